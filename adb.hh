@@ -33,11 +33,12 @@
 
 
 #include "timer.hh"
-#include "pins.h"
+#include "pins.hh"
 #include "helpers.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/delay.h>
 
 #include <stdlib.h>
 #include <inttypes.h>
@@ -46,11 +47,17 @@
 
 
 //============================================================================
-//    ADB class
+//    ADBBase class
 //============================================================================
 
 
-struct ADB {
+/**
+	\brief ADB base class
+
+	Contains the scan codes and keyboard state, which are independent of the
+	pin to which the ADB bus is connected.
+*/
+struct ADBBase {
 
 	enum {
 		KEY_A = 0x00,
@@ -167,21 +174,18 @@ struct ADB {
 	};
 
 
-	ADB( char const* const adbString );
-	~ADB();
-
-
-	bool const UpdateKeyboard();
-
 	bool const GetPressed( uint8_t const key ) const;
 
-	void SetLEDs( uint8_t const leds );
-
+	/**
+		\brief Finds the keys which have changed
 
-	void Reset();
+		\param index  which 16 scan codes to check ( 0 to 7 )
+		\result  bit i is set if scan code 16 * index + i has changed since the last call for this index
+	*/
+	uint16_t const PollChanged( uint8_t const index );
 
 
-private:
+protected:
 
 	enum ResultCode {
 		RESULT_FAILURE = 0,
@@ -195,6 +199,65 @@ private:
 	};
 
 
+	ADBBase();
+
+
+	/**
+		\brief Updates the keyboard state from the contents of register 2
+		\param data  register contents
+	*/
+	void HandleKeys( uint8_t const data[ 2 ] );
+
+	/// \brief Marks all keys as released
+	void ClearKeys();
+
+
+	uint8_t m_leds;
+
+
+private:
+
+	uint16_t m_keys[ 8 ];          ///< ADB supports 128 keyboard scan codes
+	uint16_t m_polledKeys[ 8 ];    ///< m_keys as of the last poll \sa PollChanged()
+
+
+	inline ADBBase( ADBBase const& );                     ///< \brief Private and unimplemented copy constructor
+	inline ADBBase const& operator=( ADBBase const& );    ///< Private and unimplemented assignment operator
+};
+
+
+
+
+//============================================================================
+//    ADB class
+//============================================================================
+
+
+/**
+	\brief ADB keyboard class
+
+	Bit-bangs the ADB protocol on a single open-collector pin. Since the pin is
+	known at compile time, every bus access is a single instruction, which
+	keeps the bit timing tight.
+
+	\param t_Pin  Pin to which the ADB data line is connected
+*/
+template< typename t_Pin >
+struct ADB : public ADBBase {
+
+	ADB();
+
+
+	bool const UpdateKeyboard();
+
+	void SetLEDs( uint8_t const leds );
+
+
+	void Reset();
+
+
+private:
+
 	inline void WriteBit( Timer const* const pTimer, uint16_t const lowTicks, uint16_t const highTicks ) const;
 	inline void WriteByte( uint8_t const byte, Timer const* const pTimer, uint16_t const shortTicks, uint16_t const longTicks ) const;
 
@@ -211,14 +274,8 @@ private:
 	ResultCode const SendCommand( uint8_t const address, CommandCode const command ) const;
 
 
-	char m_adbPinName;
-	uint8_t m_adbPinBit;
-	uint8_t volatile* m_adbPin;
-	uint8_t volatile* m_adbDDR;
-	uint8_t volatile* m_adbPort;
-
-	uint16_t m_keys[ 8 ];    ///< ADB supports 128 keyboard scan codes
-	uint8_t m_leds;
+	inline ADB( ADB const& );                     ///< \brief Private and unimplemented copy constructor
+	inline ADB const& operator=( ADB const& );    ///< Private and unimplemented assignment operator
 };
 
 
@@ -229,21 +286,23 @@ private:
 //============================================================================
 
 
-void ADB::WriteBit( Timer const* const pTimer, uint16_t const lowTicks, uint16_t const highTicks ) const {
+template< typename t_Pin >
+void ADB< t_Pin >::WriteBit( Timer const* const pTimer, uint16_t const lowTicks, uint16_t const highTicks ) const {
 
-	*m_adbDDR  |=  ( 1u << m_adbPinBit );    // direction = output
-	*m_adbPort &= ~( 1u << m_adbPinBit );    // value = low
+	t_Pin::SetOutput();    // direction = output
+	t_Pin::SetLow();       // value = low
 
 	pTimer->DelayTicks( lowTicks );
 
-	*m_adbPort |=  ( 1u << m_adbPinBit );    // value = high
-	*m_adbDDR  &= ~( 1u << m_adbPinBit );    // direction = input
+	t_Pin::SetHigh();     // value = high
+	t_Pin::SetInput();    // direction = input
 
 	pTimer->DelayTicks( highTicks );
 }
 
 
-void ADB::WriteByte( uint8_t const byte, Timer const* const pTimer, uint16_t const shortTicks, uint16_t const longTicks ) const {
+template< typename t_Pin >
+void ADB< t_Pin >::WriteByte( uint8_t const byte, Timer const* const pTimer, uint16_t const shortTicks, uint16_t const longTicks ) const {
 
 	for ( int ii = 7; ii >= 0; --ii ) {
 
@@ -255,13 +314,14 @@ void ADB::WriteByte( uint8_t const byte, Timer const* const pTimer, uint16_t con
 }
 
 
-bool const ADB::WaitLow( Timer const* const pTimer, uint16_t const ticks ) const {
+template< typename t_Pin >
+bool const ADB< t_Pin >::WaitLow( Timer const* const pTimer, uint16_t const ticks ) const {
 
 	bool success = false;
 
 	for ( uint16_t const startTicks = pTimer->GetTicks(); ( pTimer->GetTicks() - startTicks ) < ticks; ) {
 
-		if ( ( *m_adbPin & ( 1u << m_adbPinBit ) ) == 0 ) {
+		if ( ! t_Pin::Read() ) {
 
 			success = true;
 			break;
@@ -272,13 +332,14 @@ bool const ADB::WaitLow( Timer const* const pTimer, uint16_t const ticks ) const
 }
 
 
-bool const ADB::WaitHigh( Timer const* const pTimer, uint16_t const ticks ) const {
+template< typename t_Pin >
+bool const ADB< t_Pin >::WaitHigh( Timer const* const pTimer, uint16_t const ticks ) const {
 
 	bool success = false;
 
 	for ( uint16_t const startTicks = pTimer->GetTicks(); ( pTimer->GetTicks() - startTicks ) < ticks; ) {
 
-		if ( ( *m_adbPin & ( 1u << m_adbPinBit ) ) != 0 ) {
+		if ( t_Pin::Read() ) {
 
 			success = true;
 			break;
@@ -289,39 +350,40 @@ bool const ADB::WaitHigh( Timer const* const pTimer, uint16_t const ticks ) cons
 }
 
 
-bool const ADB::ReadBit( bool* const bit, Timer const* const pTimer, uint16_t const bitTicks ) const {
+template< typename t_Pin >
+bool const ADB< t_Pin >::ReadBit( bool* const bit, Timer const* const pTimer, uint16_t const bitTicks ) const {
 
 	bool success = false;
 
-	if ( ( *m_adbPin & ( 1u << m_adbPinBit ) ) == 0 ) {
+	if ( ! t_Pin::Read() ) {
 
 		uint16_t const startTicks = pTimer->GetTicks();
 
 		uint16_t lowTicks = startTicks;
 		do {
 
-			if ( ( *m_adbPin & ( 1u << m_adbPinBit ) ) != 0 )
+			if ( t_Pin::Read() )
 				break;
 
 			lowTicks = pTimer->GetTicks();
 
 		} while ( ( lowTicks - startTicks ) < bitTicks );
 
-		if ( ( *m_adbPin & ( 1u << m_adbPinBit ) ) != 0 ) {
+		if ( t_Pin::Read() ) {
 
 			success = false;
 
 			uint16_t highTicks = lowTicks;
 			do {
 
-				if ( ( *m_adbPin & ( 1u << m_adbPinBit ) ) == 0 )
+				if ( ! t_Pin::Read() )
 					break;
 
 				highTicks = pTimer->GetTicks();
 
 			} while ( ( highTicks - startTicks ) < bitTicks );
 
-			if ( ( *m_adbPin & ( 1u << m_adbPinBit ) ) == 0 ) {
+			if ( ! t_Pin::Read() ) {
 
 				if ( ( lowTicks - startTicks ) >= ( highTicks - lowTicks ) )
 					*bit = false;
@@ -337,7 +399,8 @@ bool const ADB::ReadBit( bool* const bit, Timer const* const pTimer, uint16_t co
 }
 
 
-bool const ADB::ReadByte( uint8_t* const byte, Timer const* const pTimer, uint16_t const bitTicks ) const {
+template< typename t_Pin >
+bool const ADB< t_Pin >::ReadByte( uint8_t* const byte, Timer const* const pTimer, uint16_t const bitTicks ) const {
 
 	bool success = true;
 
@@ -358,6 +421,232 @@ bool const ADB::ReadByte( uint8_t* const byte, Timer const* const pTimer, uint16
 
 
 
+//============================================================================
+//    ADB methods
+//============================================================================
+
+
+template< typename t_Pin >
+ADB< t_Pin >::ADB() {
+
+	t_Pin::SetHigh();     // value = high
+	t_Pin::SetInput();    // direction = input
+
+	Reset();
+}
+
+
+template< typename t_Pin >
+bool const ADB< t_Pin >::UpdateKeyboard() {
+
+	bool changed = false;
+
+	uint8_t data[] = { 0x7f, 0xff };
+	while ( ReadRegister( 2, 0, data, sizeof( data ) ) == RESULT_SUCCESS ) {
+
+		HandleKeys( data );
+		changed = true;
+	}
+
+	return changed;
+}
+
+
+template< typename t_Pin >
+void ADB< t_Pin >::SetLEDs( uint8_t const leds ) {
+
+	uint8_t const newLEDs = ( leds & 0x07 );
+	if ( newLEDs != m_leds ) {
+
+		uint8_t const data[] = { 0, ( newLEDs ^ 0x07 ) };
+		if ( WriteRegister( 2, 2, data, sizeof( data ) ) == RESULT_SUCCESS )
+			m_leds = newLEDs;
+	}
+}
+
+
+template< typename t_Pin >
+void ADB< t_Pin >::Reset() {
+
+	SendCommand( 2, COMMAND_RESET );
+
+	ClearKeys();
+	m_leds = 0xff;
+
+	// give the device time to reset
+	_delay_ms( 100 );
+}
+
+
+template< typename t_Pin >
+typename ADB< t_Pin >::ResultCode const ADB< t_Pin >::WriteRegister( uint8_t const address, uint8_t const index, uint8_t const* const data, uint8_t const size ) const {
+
+	ResultCode result = RESULT_FAILURE;
+
+	Timer const* const pTimer = Timer::Instance();
+
+	uint16_t const shortTicks     = Timer::MicrosecondsToTicks( 30  );    // 35
+	uint16_t const longTicks      = Timer::MicrosecondsToTicks( 60  );    // 65
+	uint16_t const attentionTicks = Timer::MicrosecondsToTicks( 800 );    // 720
+	uint16_t const stopStartTicks = Timer::MicrosecondsToTicks( 200 );    // 128
+
+	uint16_t const maximumStopStartTicks = Timer::MicrosecondsToTicks( 260 );
+
+	// save and clear the interrupt flag
+	uint8_t const sreg = SREG;
+	cli();
+
+	// wait until bus is clear (**FIXME **TODO **HACK: potential infinite loop)
+	while ( WaitLow( pTimer, maximumStopStartTicks ) );
+
+	// attention & sync
+	WriteBit( pTimer, attentionTicks, longTicks );
+
+	// listen
+	WriteByte( ( ( address << 4 ) | ( index & 0x03 ) | 0x08 ), pTimer, shortTicks, longTicks );
+
+	// stop bit
+	WriteBit( pTimer, longTicks, shortTicks );
+
+	// bus low = service request
+	if ( ! t_Pin::Read() )
+		result = RESULT_SERVICE;
+	else {
+
+		// stop-to-start time
+		pTimer->DelayTicks( stopStartTicks );
+
+		// start bit
+		WriteBit( pTimer, shortTicks, longTicks );
+
+		// data
+		for ( unsigned int ii = 0; ii < size; ++ii )
+			WriteByte( data[ ii ], pTimer, shortTicks, longTicks );
+
+		// stop bit
+		WriteBit( pTimer, longTicks, shortTicks );
+
+		result = RESULT_SUCCESS;
+	}
+
+	// restore the interrupt flag
+	SREG = sreg;
+
+	return result;
+}
+
+
+template< typename t_Pin >
+typename ADB< t_Pin >::ResultCode const ADB< t_Pin >::ReadRegister( uint8_t const address, uint8_t const index, uint8_t* const data, uint8_t const size ) const {
+
+	ResultCode result = RESULT_FAILURE;
+
+	Timer const* const pTimer = Timer::Instance();
+
+	uint16_t const shortTicks     = Timer::MicrosecondsToTicks( 30  );    // 35
+	uint16_t const longTicks      = Timer::MicrosecondsToTicks( 60  );    // 65
+	uint16_t const attentionTicks = Timer::MicrosecondsToTicks( 800 );    // 720
+
+	uint16_t const maximumStopStartTicks = Timer::MicrosecondsToTicks( 260 );
+	uint16_t const maximumBitTicks       = Timer::MicrosecondsToTicks( 130 );
+	uint16_t const maximumHalfBitTicks   = Timer::MicrosecondsToTicks( 91  );
+
+	// save and clear the interrupt flag
+	uint8_t const sreg = SREG;
+	cli();
+
+	// wait until bus is clear (**FIXME **TODO **HACK: potential infinite loop)
+	while ( WaitLow( pTimer, maximumStopStartTicks ) );
+
+	// attention & sync
+	WriteBit( pTimer, attentionTicks, longTicks );
+
+	// talk
+	WriteByte( ( ( address << 4 ) | ( index & 0x03 ) | 0x0c ), pTimer, shortTicks, longTicks );
+
+	// stop bit
+	WriteBit( pTimer, longTicks, shortTicks );
+
+	// bus low = service request
+	if ( ! t_Pin::Read() )
+		result = RESULT_SERVICE;
+	else {
+
+		// stop-to-start time
+		bool success = WaitLow( pTimer, maximumStopStartTicks );
+		if ( success ) {
+
+			// start bit
+			bool bit = false;
+			success = ReadBit( &bit, pTimer, maximumBitTicks );
+			success &= bit;
+			if ( success ) {
+
+				// data
+				for ( unsigned int ii = 0; success && ( ii < size ); ++ii )
+					success = ReadByte( data + ii, pTimer, maximumBitTicks );
+
+				if ( success ) {
+
+					// stop bit
+					if ( WaitHigh( pTimer, maximumHalfBitTicks ) )
+						result = RESULT_SUCCESS;
+				}
+			}
+		}
+	}
+
+	// restore the interrupt flag
+	SREG = sreg;
+
+	return result;
+}
+
+
+template< typename t_Pin >
+typename ADB< t_Pin >::ResultCode const ADB< t_Pin >::SendCommand( uint8_t const address, CommandCode const command ) const {
+
+	ResultCode result = RESULT_FAILURE;
+
+	Timer const* const pTimer = Timer::Instance();
+
+	uint16_t const shortTicks     = Timer::MicrosecondsToTicks( 30  );    // 35
+	uint16_t const longTicks      = Timer::MicrosecondsToTicks( 60  );    // 65
+	uint16_t const attentionTicks = Timer::MicrosecondsToTicks( 800 );    // 720
+
+	uint16_t const maximumStopStartTicks = Timer::MicrosecondsToTicks( 260 );
+
+	// save and clear the interrupt flag
+	uint8_t const sreg = SREG;
+	cli();
+
+	// wait until bus is clear (**FIXME **TODO **HACK: potential infinite loop)
+	while ( WaitLow( pTimer, maximumStopStartTicks ) );
+
+	// attention & sync
+	WriteBit( pTimer, attentionTicks, longTicks );
+
+	// reset
+	WriteByte( ( ( address << 4 ) | command ), pTimer, shortTicks, longTicks );
+
+	// stop bit
+	WriteBit( pTimer, longTicks, shortTicks );
+
+	// bus low = service request
+	if ( ! t_Pin::Read() )
+		result = RESULT_SERVICE;
+	else
+		result = RESULT_SUCCESS;
+
+	// restore the interrupt flag
+	SREG = sreg;
+
+	return result;
+}
+
+
+
+
 #endif    /* __cplusplus */
 
 #endif    /* __ADB_HH__ */
@@ -32,11 +32,12 @@
 
 
 
-#include "pins.h"
+#include "pins.hh"
 #include "helpers.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/delay.h>
 
 #include <assert.h>
 #include <stdlib.h>
@@ -50,6 +51,17 @@
 //============================================================================
 
 
+/**
+	\brief Buttons class
+
+	Reads a set of buttons, each of which is connected directly to a pin. The
+	pins are given as a PinList, e.g. PinList< Pin< 'B', 6 >, Pin< 'B', 7 > >,
+	so all pin accesses are resolved at compile time.
+
+	\param t_Pins        PinList of button pins
+	\param t_ActiveHigh  true if the buttons are active-high, false otherwise
+*/
+template< typename t_Pins, bool t_ActiveHigh = false >
 struct Buttons {
 
 	typedef uint32_t StateType;
@@ -57,8 +69,13 @@ struct Buttons {
 	enum { MAXIMUM_BUTTONS = sizeof( StateType ) * 8 };
 
 
-	Buttons( char const* const buttonString, bool const activeHigh );
-	~Buttons();
+	/// \cond false
+	static_assert( ( static_cast< unsigned int >( t_Pins::SIZE ) <= MAXIMUM_BUTTONS ), "too many buttons" );
+	static_assert( t_Pins::UNIQUE, "button pins must be distinct" );
+	/// \endcond
+
+
+	inline Buttons();
 
 
 	inline uint8_t const GetButtons() const;
@@ -70,22 +87,23 @@ struct Buttons {
 
 	inline bool const GetPressed( uint8_t const index ) const;
 
+	/// \brief Returns the buttons whose state has changed since the last call ( bit i is button i )
+	inline StateType const PollChanged();
 
-	bool const Update();
 
+	inline bool const Update();
 
-private:
 
-	uint8_t m_buttons;
-	char m_buttonPinNames[          MAXIMUM_BUTTONS ];
-	uint8_t m_buttonPinBits[        MAXIMUM_BUTTONS ];
-	uint8_t volatile* m_buttonPins[ MAXIMUM_BUTTONS ];
-
-	bool m_activeHigh;
+private:
 
 	unsigned int m_debouncingIterations;
 
 	StateType m_state;
+	StateType m_polledState;
+
+
+	inline Buttons( Buttons const& );                     ///< \brief Private and unimplemented copy constructor
+	inline Buttons const& operator=( Buttons const& );    ///< Private and unimplemented assignment operator
 };
 
 
@@ -96,13 +114,26 @@ private:
 //============================================================================
 
 
-unsigned int const Buttons::GetDebouncing() const {
+template< typename t_Pins, bool t_ActiveHigh >
+Buttons< t_Pins, t_ActiveHigh >::Buttons() :
+	m_debouncingIterations( 1 ),
+	m_state( 0 ),
+	m_polledState( 0 )
+{
+	// direction = input, value = high (pull-up resistor)
+	t_Pins::SetInputs( true );
+}
+
+
+template< typename t_Pins, bool t_ActiveHigh >
+unsigned int const Buttons< t_Pins, t_ActiveHigh >::GetDebouncing() const {
 
 	return m_debouncingIterations;
 }
 
 
-void Buttons::SetDebouncing( unsigned int const debouncingIterations ) {
+template< typename t_Pins, bool t_ActiveHigh >
+void Buttons< t_Pins, t_ActiveHigh >::SetDebouncing( unsigned int const debouncingIterations ) {
 
 	assert( debouncingIterations > 0 );
 
@@ -117,18 +148,49 @@ void Buttons::SetDebouncing( unsigned int const debouncingIterations ) {
 }
 
 
-uint8_t const Buttons::GetButtons() const {
+template< typename t_Pins, bool t_ActiveHigh >
+uint8_t const Buttons< t_Pins, t_ActiveHigh >::GetButtons() const {
 
-	return m_buttons;
+	return t_Pins::SIZE;
 }
 
 
-bool const Buttons::GetPressed( uint8_t const index ) const {
+template< typename t_Pins, bool t_ActiveHigh >
+bool const Buttons< t_Pins, t_ActiveHigh >::GetPressed( uint8_t const index ) const {
 
 	return( ( m_state & ( static_cast< StateType >( 1 ) << index ) ) != 0 );
 }
 
 
+template< typename t_Pins, bool t_ActiveHigh >
+typename Buttons< t_Pins, t_ActiveHigh >::StateType const Buttons< t_Pins, t_ActiveHigh >::PollChanged() {
+
+	StateType const changed = ( m_state ^ m_polledState );
+	m_polledState = m_state;
+	return changed;
+}
+
+
+template< typename t_Pins, bool t_ActiveHigh >
+bool const Buttons< t_Pins, t_ActiveHigh >::Update() {
+
+	StateType const oldState = m_state;
+
+	// a button is pressed iff it is active on every debouncing iteration
+	m_state = ( ~static_cast< StateType >( 0 ) >> ( MAXIMUM_BUTTONS - t_Pins::SIZE ) );
+	for ( unsigned int ii = 0; ii < m_debouncingIterations; ++ii ) {
+
+		_delay_us( 10 );
+
+		StateType state = 0;
+		t_Pins::Read( state );
+		m_state &= ( t_ActiveHigh ? state : ~state );
+	}
+
+	return( m_state != oldState );
+}
+
+
 
 
 #endif    /* __cplusplus */
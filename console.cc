@@ -0,0 +1,164 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file console.cc
+	\brief Console implementation
+*/
+
+
+
+
+#include "console.hh"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <avr/pgmspace.h>
+
+
+
+
+//============================================================================
+//    Console methods
+//============================================================================
+
+
+Console::Console( USB::CDC::Serial* const pSerial ) :
+	m_pSerial( pSerial ),
+	m_length( 0 ),
+	m_prompt( true ),
+	m_argumentCount( 0 )
+{
+	memset( m_line,      0, sizeof( m_line      ) );
+	memset( m_arguments, 0, sizeof( m_arguments ) );
+}
+
+
+bool const Console::Update() {
+
+	bool complete = false;
+	for ( uint8_t byte; ( ! complete ) && m_pSerial->Read( &byte ); ) {
+
+		if ( m_prompt ) {
+
+			m_pSerial->PrintProgmem( PSTR( "> " ) );
+			m_prompt = false;
+		}
+
+		if ( ( byte == '\r' ) || ( byte == '\n' ) ) {
+
+			m_pSerial->PrintProgmem( PSTR( "\r\n" ) );
+			if ( m_length > 0 ) {
+
+				m_line[ m_length ] = '\0';
+				m_length = 0;
+
+				complete = Parse();
+				if ( ! complete )
+					m_pSerial->PrintProgmem( PSTR( "bad arguments\r\n" ) );
+			}
+			m_prompt = true;
+		}
+		else if ( ( byte == '\b' ) || ( byte == 0x7f ) ) {
+
+			if ( m_length > 0 ) {
+
+				--m_length;
+				m_pSerial->PrintProgmem( PSTR( "\b \b" ) );
+			}
+		}
+		else if ( ( byte >= ' ' ) && ( byte < 0x7f ) && ( m_length < MAXIMUM_LINE_LENGTH ) ) {
+
+			m_line[ m_length++ ] = byte;
+			m_pSerial->Write( byte );
+		}
+	}
+	return complete;
+}
+
+
+bool const Console::IsCommandProgmem( char const* const name ) const {
+
+	return( strcmp_P( m_line, name ) == 0 );
+}
+
+
+bool const Console::Parse() {
+
+	bool success = true;
+
+	// the command name is NULL-terminated in place, and the arguments follow it
+	char* pCharacter = m_line;
+	while ( *pCharacter == ' ' )
+		++pCharacter;
+	memmove( m_line, pCharacter, strlen( pCharacter ) + 1 );
+	for ( pCharacter = m_line; ( *pCharacter != ' ' ) && ( *pCharacter != '\0' ); ++pCharacter );
+	bool const more = ( *pCharacter != '\0' );
+	*pCharacter = '\0';
+	if ( more )
+		++pCharacter;
+
+	m_argumentCount = 0;
+	while ( success ) {
+
+		while ( *pCharacter == ' ' )
+			++pCharacter;
+		if ( *pCharacter == '\0' )
+			break;
+
+		bool const negative = ( *pCharacter == '-' );
+		if ( negative )
+			++pCharacter;
+
+		uint8_t base = 10;
+		if ( ( pCharacter[ 0 ] == '0' ) && ( pCharacter[ 1 ] == 'x' ) ) {
+
+			base = 16;
+			pCharacter += 2;
+		}
+
+		int32_t value = 0;
+		uint8_t digits = 0;
+		for ( ; ( *pCharacter != ' ' ) && ( *pCharacter != '\0' ); ++pCharacter, ++digits ) {
+
+			char const character = *pCharacter;
+			uint8_t digit = 0xff;
+			if ( ( character >= '0' ) && ( character <= '9' ) )
+				digit = character - '0';
+			else if ( ( character >= 'a' ) && ( character <= 'f' ) )
+				digit = character - 'a' + 10;
+			else if ( ( character >= 'A' ) && ( character <= 'F' ) )
+				digit = character - 'A' + 10;
+
+			if ( digit >= base ) {
+
+				success = false;
+				break;
+			}
+			value = value * base + digit;
+		}
+
+		if ( ( digits == 0 ) || ( m_argumentCount >= MAXIMUM_ARGUMENTS ) )
+			success = false;
+		else
+			m_arguments[ m_argumentCount++ ] = ( negative ? -value : value );
+	}
+
+	return success;
+}
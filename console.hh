@@ -0,0 +1,139 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file console.hh
+	\brief Console implementation
+*/
+
+
+
+
+#ifndef __CONSOLE_HH__
+#define __CONSOLE_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include "usb.hh"
+
+#include <inttypes.h>
+
+
+
+
+//============================================================================
+//    Console class
+//============================================================================
+
+
+/**
+	\brief Line-oriented command parser on a USB::CDC::Serial port
+
+	Input is echoed as it's typed (with backspace for corrections), and once a
+	line is complete, it's split into a command name and up to
+	MAXIMUM_ARGUMENTS integer arguments (decimal, or hexadecimal with a "0x"
+	prefix). Update() never waits for input, so it can be called once per
+	iteration of the main loop, which then looks at the command with
+	IsCommandProgmem() and GetArgument(), and replies through the serial
+	port.
+*/
+struct Console {
+
+	enum { MAXIMUM_LINE_LENGTH = 31 };
+	enum { MAXIMUM_ARGUMENTS = 2 };
+
+
+	/**
+		\brief Constructor
+
+		\param pSerial  serial port to read commands from, and write replies to
+	*/
+	Console( USB::CDC::Serial* const pSerial );
+
+
+	/**
+		\brief Reads pending input
+
+		\result  true if a command has been received, false otherwise
+	*/
+	bool const Update();
+
+
+	/**
+		\brief Checks the name of the command just received
+
+		\param name  command name (in program memory)
+		\result  true if it matches, false otherwise
+	*/
+	bool const IsCommandProgmem( char const* const name ) const;
+
+	/// \brief Number of arguments of the command just received
+	inline uint8_t const GetArgumentCount() const;
+
+	/// \brief Argument of the command just received
+	inline int32_t const GetArgument( uint8_t const index ) const;
+
+
+private:
+
+	/// \brief Splits the line into a command name and arguments
+	bool const Parse();
+
+
+	USB::CDC::Serial* const m_pSerial;
+
+	char m_line[ MAXIMUM_LINE_LENGTH + 1 ];
+	uint8_t m_length;
+	bool m_prompt;    ///< a prompt should be printed before any more input is echoed
+
+	uint8_t m_argumentCount;
+	int32_t m_arguments[ MAXIMUM_ARGUMENTS ];
+
+
+	inline Console( Console const& other );
+	inline Console const& operator=( Console const& other );
+};
+
+
+
+
+//============================================================================
+//    Console inline methods
+//============================================================================
+
+
+uint8_t const Console::GetArgumentCount() const {
+
+	return m_argumentCount;
+}
+
+
+int32_t const Console::GetArgument( uint8_t const index ) const {
+
+	return( ( index < m_argumentCount ) ? m_arguments[ index ] : 0 );
+}
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __CONSOLE_HH__ */
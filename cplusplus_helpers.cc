@@ -40,6 +40,9 @@
 //============================================================================
 
 
+#ifndef NO_HEAP
+
+
 void* operator new( size_t size ) {
 
 	return malloc( size );
@@ -64,6 +67,18 @@ void operator delete[]( void* pp ) {
 }
 
 
+#else    /* NO_HEAP */
+
+
+void operator delete( void* pp ) {
+
+	// nothing is ever allocated on the heap, so there's nothing to free
+}
+
+
+#endif    /* NO_HEAP */
+
+
 
 
 #if 0    // I use "-fno-threadsafe-statics" instead
@@ -40,6 +40,9 @@
 //============================================================================
 
 
+#ifndef NO_HEAP
+
+
 void* operator new( size_t );
 void* operator new[]( size_t );
 
@@ -47,6 +50,20 @@ void operator delete( void* );
 void operator delete[]( void* );
 
 
+#else    /* NO_HEAP */
+
+
+/*
+	In a heap-free build, new and new[] are left undefined, so that any use
+	of them fails to link. The deleting destructors of classes with virtual
+	destructors still refer to operator delete, though, so it must exist.
+*/
+void operator delete( void* );
+
+
+#endif    /* NO_HEAP */
+
+
 
 
 #if 0    // I use "-fno-threadsafe-statics" instead
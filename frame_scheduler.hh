@@ -0,0 +1,158 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file frame_scheduler.hh
+	\brief Start-of-frame phase locked scheduling
+*/
+
+
+
+
+#ifndef __FRAME_SCHEDULER_HH__
+#define __FRAME_SCHEDULER_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include "usb.hh"
+#include "timer.hh"
+
+#include <inttypes.h>
+
+
+
+
+//============================================================================
+//    FrameScheduler class
+//============================================================================
+
+
+/**
+	\brief Times the main loop so that its work finishes just before a SOF
+
+	Reports are written to the endpoints on the start-of-frame interrupt, so
+	a keypress sampled just after a SOF waits almost a full frame before it
+	is sent, while one sampled just before a SOF goes out immediately. This
+	class keeps track of how long the work done by each iteration of the main
+	loop takes (sampling the inputs and updating the keymap), and delays the
+	start of the next iteration so that it completes MARGIN_MICROSECONDS
+	before the next SOF.
+
+	Wait() should be called at the start of each iteration, and Finish() at
+	the end. The duration estimate is a decaying maximum, so that the
+	occasional slow iteration pushes subsequent ones earlier straight away,
+	and the schedule only creeps back later once they have been fast for a
+	while. If the work takes longer than a frame (e.g. an ADB transaction),
+	it's scheduled to finish just before some later SOF.
+
+	The CPU sleeps in idle mode while waiting, so that, when nothing is
+	happening, it spends most of each frame asleep. If the device isn't
+	receiving SOFs (e.g. it hasn't been configured yet), then Wait() returns
+	immediately.
+*/
+struct FrameScheduler {
+
+	enum { FRAME_MICROSECONDS = 1000 };
+	enum { MARGIN_MICROSECONDS = 50 };
+
+
+	inline FrameScheduler();
+
+
+	/// \brief Waits until the work should be started
+	inline void Wait();
+
+	/// \brief Updates the duration estimate from the work just finished
+	inline void Finish();
+
+
+	/// \brief Current estimate of how long the work takes (Timer ticks)
+	inline uint16_t const GetDurationTicks() const;
+
+
+private:
+
+	uint16_t m_startTicks;
+	uint16_t m_durationTicks;
+
+
+	inline FrameScheduler( FrameScheduler const& other );
+	inline FrameScheduler const& operator=( FrameScheduler const& other );
+};
+
+
+
+
+//============================================================================
+//    FrameScheduler inline methods
+//============================================================================
+
+
+FrameScheduler::FrameScheduler() :
+	m_startTicks( 0 ),
+	m_durationTicks( 0 )
+{
+}
+
+
+void FrameScheduler::Wait() {
+
+	Timer const* const pTimer = Timer::Instance();
+
+	uint16_t frameTicks;
+	if ( USB::Device::Instance()->GetFrameTicks( &frameTicks ) ) {
+
+		uint16_t const periodTicks = Timer::MicrosecondsToTicks( FRAME_MICROSECONDS );
+		uint16_t const marginTicks = Timer::MicrosecondsToTicks( MARGIN_MICROSECONDS );
+
+		// offset into a frame at which the work must start to finish marginTicks before the end of a frame
+		uint16_t const startTicks = periodTicks - ( ( m_durationTicks + marginTicks ) % periodTicks );
+
+		uint16_t const elapsedTicks = ( pTimer->GetTicks() - frameTicks );
+		if ( elapsedTicks < periodTicks )    // otherwise we've missed a SOF, so the timestamp isn't trustworthy
+			pTimer->SleepTicks( ( startTicks + periodTicks - elapsedTicks ) % periodTicks );
+	}
+
+	m_startTicks = pTimer->GetTicks();
+}
+
+
+void FrameScheduler::Finish() {
+
+	uint16_t const durationTicks = ( Timer::Instance()->GetTicks() - m_startTicks );
+	if ( durationTicks > m_durationTicks )
+		m_durationTicks = durationTicks;
+	else
+		m_durationTicks -= ( ( m_durationTicks - durationTicks ) >> 4 );
+}
+
+
+uint16_t const FrameScheduler::GetDurationTicks() const {
+
+	return m_durationTicks;
+}
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __FRAME_SCHEDULER_HH__ */
@@ -27,94 +27,36 @@
 #include "keyboard_matrix.hh"
 
 #include <string.h>
-#include <util/delay.h>
 
 
 
 
 //============================================================================
-//    KeyboardMatrix methods
+//    KeyboardMatrixBase methods
 //============================================================================
 
 
-KeyboardMatrix::KeyboardMatrix( char const* const rowString, char const* const columnString, bool const activeHigh ) :
-	m_rows( 0 ),
-	m_logColumns( 0 ),
-	m_columns( 1 ),
-	m_activeHigh( activeHigh ),
+KeyboardMatrixBase::KeyboardMatrixBase( uint8_t const rows, uint8_t const logColumns ) :
+	m_rows( rows ),
+	m_columns( 1u << logColumns ),
 	m_antiGhosting( false ),
 	m_debouncingIterations( 1 )
 {
-	for ( unsigned int ii = 0; ( rowString[ ii * 2 ] != '\0' ) && ( rowString[ ii * 2 + 1 ] != '\0' ) && ( m_rows < MAXIMUM_ROWS ); ++ii ) {
-
-		char const name = rowString[ ii * 2     ];
-		char const bit  = rowString[ ii * 2 + 1 ] - '0';
-
-		uint8_t volatile* ddr  = NULL;
-		uint8_t volatile* port = NULL;
-		uint8_t volatile* pin  = NULL;
-		if ( PinAllocate( &pin, &ddr, &port, name, bit ) ) {    /// \todo handle errors
-
-			*ddr  &= ~( 1u << bit );    // direction = input
-			*port |=  ( 1u << bit );    // value = high (pull-up resistor)
-
-			m_rowPinNames[ m_rows ] = name;
-			m_rowPinBits[  m_rows ] = bit;
-			m_rowPins[     m_rows ] = pin;
-
-			++m_rows;
-		}
-	}
-
-	for ( unsigned int ii = 0; ( columnString[ ii * 2 ] != '\0' ) && ( columnString[ ii * 2 + 1 ] != '\0' ) && ( m_columns < MAXIMUM_COLUMNS ); ++ii ) {
-
-		char const name = columnString[ ii * 2     ];
-		char const bit  = columnString[ ii * 2 + 1 ] - '0';
-
-		uint8_t volatile* ddr  = NULL;
-		uint8_t volatile* port = NULL;
-		uint8_t volatile* pin  = NULL;
-		if ( PinAllocate( &pin, &ddr, &port, name, bit ) ) {    /// \todo handle errors
-
-			*ddr  |=  ( 1u << bit );    // direction = output
-			*port &= ~( 1u << bit );    // value = low
-
-			m_columnPinNames[ m_logColumns ] = name;
-			m_columnPinBits[  m_logColumns ] = bit;
-			m_columnPorts[    m_logColumns ] = port;
-
-			++m_logColumns;
-			m_columns += m_columns;
-		}
-	}
-
 	for ( uint8_t ii = 0; ii < m_rows; ++ii ) {
 
 		m_switchMask[      ii ] = 0;
 		m_rawPressedState[ ii ] = 0;
 		m_pressedState[    ii ] = 0;
+		m_polledState[     ii ] = 0;
 	}
 }
 
 
-KeyboardMatrix::~KeyboardMatrix() {
-
-	for ( unsigned int ii = 0; ii < m_rows; ++ii )
-		PinFree( m_rowPinNames[ ii ], m_rowPinBits[ ii ] );
-
-	for ( unsigned int ii = 0; ii < m_logColumns; ++ii )
-		PinFree( m_columnPinNames[ ii ], m_columnPinBits[ ii ] );
-}
-
-
-bool const KeyboardMatrix::Update() {
+bool const KeyboardMatrixBase::UpdateState( ColumnType workPressedState[] ) {
 
 	bool changed = false;
 	if ( m_antiGhosting ) {
 
-		ColumnType workPressedState[ MAXIMUM_ROWS ];
-		ReadKeyboardMatrix( workPressedState );
-
 		// cluster all connected rows together
 		Clustering clustering( workPressedState, m_rows );
 
@@ -169,15 +111,13 @@ bool const KeyboardMatrix::Update() {
 	}
 	else {
 
-		ReadKeyboardMatrix( m_rawPressedState );
-
 		// save and clear the interrupt flag
 		uint8_t const sreg = SREG;
 		cli();
 
 		for ( uint8_t ii = 0; ii < m_rows; ++ii ) {
 
-			m_rawPressedState[ ii ] &= m_switchMask[ ii ];
+			m_rawPressedState[ ii ] = ( workPressedState[ ii ] & m_switchMask[ ii ] );
 			changed |= ( m_pressedState[ ii ] != m_rawPressedState[ ii ] );
 			m_pressedState[ ii ] = m_rawPressedState[ ii ];
 		}
@@ -190,31 +130,7 @@ bool const KeyboardMatrix::Update() {
 }
 
 
-void KeyboardMatrix::ReadKeyboardMatrix( ColumnType workPressedState[] ) const {
-
-	memcpy( workPressedState, m_switchMask, m_rows * sizeof( ColumnType ) );
-	for ( unsigned int ii = 0; ii < m_debouncingIterations; ++ii ) {
-
-		for ( uint8_t jj = 0; jj < m_columns; ++jj ) {
-
-			for ( uint8_t kk = 0, mask = 1; kk < m_logColumns; ++kk, mask += mask ) {
-
-				if ( jj & mask )
-					*m_columnPorts[ kk ] |= ( 1u << m_columnPinBits[ kk ] );
-				else
-					*m_columnPorts[ kk ] &= ~( 1u << m_columnPinBits[ kk ] );
-			}
-			_delay_us( 10 );
-
-			for ( uint8_t kk = 0; kk < m_rows; ++kk )
-				if ( ( ( *m_rowPins[ kk ] & ( 1u << m_rowPinBits[ kk ] ) ) != 0 ) != m_activeHigh )    // is this row pin active?
-					workPressedState[ kk ] &= ~( static_cast< ColumnType >( 1 ) << jj );
-		}
-	}
-}
-
-
-void KeyboardMatrix::DFS( ColumnType ghostedState[], Clustering const& clustering ) {
+void KeyboardMatrixBase::DFS( ColumnType ghostedState[], Clustering const& clustering ) {
 
 	// we follow the convention that nodes with indices less than m_rows are rows, and are otherwise columns
 
@@ -290,7 +206,7 @@ void KeyboardMatrix::DFS( ColumnType ghostedState[], Clustering const& clusterin
 }
 
 
-void KeyboardMatrix::DFSMarkCycle( ColumnType ghostedState[], uint8_t parents[], uint8_t depths[], uint8_t node1, uint8_t node2 ) {
+void KeyboardMatrixBase::DFSMarkCycle( ColumnType ghostedState[], uint8_t parents[], uint8_t depths[], uint8_t node1, uint8_t node2 ) {
 
 	// we follow the convention that nodes with indices less than m_rows are rows, and are otherwise columns
 
@@ -331,7 +247,7 @@ void KeyboardMatrix::DFSMarkCycle( ColumnType ghostedState[], uint8_t parents[],
 }
 
 
-void KeyboardMatrix::DFSMoveUp( ColumnType ghostedState[], uint8_t parents[], uint8_t depths[], uint8_t& node, uint8_t& depth ) {
+void KeyboardMatrixBase::DFSMoveUp( ColumnType ghostedState[], uint8_t parents[], uint8_t depths[], uint8_t& node, uint8_t& depth ) {
 
 	// we follow the convention that nodes with indices less than m_rows are rows, and are otherwise columns
 
@@ -361,11 +277,11 @@ void KeyboardMatrix::DFSMoveUp( ColumnType ghostedState[], uint8_t parents[], ui
 
 
 //============================================================================
-//    KeyboardMatrix::Clustering methods
+//    KeyboardMatrixBase::Clustering methods
 //============================================================================
 
 
-KeyboardMatrix::Clustering::Clustering( ColumnType const pressedState[], uint8_t const rows ) {
+KeyboardMatrixBase::Clustering::Clustering( ColumnType const pressedState[], uint8_t const rows ) {
 
 	// cluster two rows together if they are connected along a column (union-find algorithm)
 	for ( uint8_t ii = 0; ii < rows; ++ii )
@@ -399,7 +315,7 @@ KeyboardMatrix::Clustering::Clustering( ColumnType const pressedState[], uint8_t
 }
 
 
-uint8_t const KeyboardMatrix::Clustering::FindRoot( uint8_t const node ) const {
+uint8_t const KeyboardMatrixBase::Clustering::FindRoot( uint8_t const node ) const {
 
 	// find the root of the cluster containing node
 	uint8_t root = 0xff;
@@ -409,7 +325,7 @@ uint8_t const KeyboardMatrix::Clustering::FindRoot( uint8_t const node ) const {
 }
 
 
-void KeyboardMatrix::Clustering::Reparent( uint8_t node, uint8_t const root ) {
+void KeyboardMatrixBase::Clustering::Reparent( uint8_t node, uint8_t const root ) {
 
 	// walk up node's tree, pointing all elements to the root
 	for ( ; ; ) {
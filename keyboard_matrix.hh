@@ -32,13 +32,15 @@
 
 
 
-#include "pins.h"
+#include "pins.hh"
 #include "helpers.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/delay.h>
 
 #include <assert.h>
+#include <string.h>
 #include <stdlib.h>
 #include <inttypes.h>
 
@@ -46,22 +48,20 @@
 
 
 //============================================================================
-//    KeyboardMatrix class
+//    KeyboardMatrixBase class
 //============================================================================
 
 
 /**
-	\brief Keyboard matrix class
+	\brief Keyboard matrix base class
 
-	Class which reads from a standard keyboard matrix, optionally corrects for
-	ghosting, and stores the state of each key. The matrix is active-low, and
-	current is taken to be flowing <em>from</em> the column pins <em>to</em>
-	the row pins.
+	Class which optionally corrects a keyboard matrix for ghosting, and stores
+	the state of each key. It contains everything except for the pin accesses,
+	which are performed by the KeyboardMatrix template, so that the
+	(comparatively large) anti-ghosting code is only instantiated once.
 
-	A key property of this class is that it is runtime configurable--one may
-	construct an empty keyboard matrix, and then specify the pins corresponding
-	to the rows and columns, and the row/column intersections which are
-	occupied by switches.
+	The row/column intersections which are occupied by switches are runtime
+	configurable, using SetSwitch().
 
 	This class is a bit more heavyweight than one might at first assume, mostly
 	because the anti-ghosting algorithm is "correct", in the sense that a
@@ -75,7 +75,7 @@
 	inside an interrupt. Non-const methods should only be called from "normal"
 	code.
 */
-struct KeyboardMatrix {
+struct KeyboardMatrixBase {
 
 	typedef uint32_t ColumnType;    ///< unsigned integer type in which the column bitfields for each row are stored
 
@@ -89,38 +89,6 @@ struct KeyboardMatrix {
 	/// \endcond
 
 
-	/**
-		\brief Constructor
-
-		This function will also set the number of rows and columns in the
-		keyboard matrix (accessed using GetRows() and GetColumns(),
-		respectively), and clears all switch flags (see SetSwitch() and
-		GetSwitch()).
-
-		The two parameters are strings of the form "XDXDXD", where the number
-		of "XD" blocks is the number of pins, "X" is a character in the range
-		'a'-'f' or 'A'-'F', and "D" is in the range '0'-'9'.
-
-		The matrix is active-low (see ReadKeyboardMatrix()), so we have pull-up
-		resistors on the columns, and set the rows to low (when active).
-
-		\todo create general classes wrapping raw pins, multiplexers,
-		demultiplexers, encoders and decoders, both for active-high and
-		active-low. then make this thunk to instances of these classes. this
-		should probably be done by extending the functions in pins.h and pins.c
-		to be way more general, and making string parsers to construct the
-		various classes.
-
-		\param rowString    configuration string for row pins
-		\param columnString configuration string for column pins
-		\param activeHigh   true if matrix is active-high, false otherwise
-	*/
-	KeyboardMatrix( char const* const rowString, char const* const columnString, bool activeHigh );
-
-	/// \brief Destructor
-	~KeyboardMatrix();
-
-
 	/**
 		\brief Checks if anti-ghosting is enabled
 		\result  anti-ghosting flag
@@ -158,13 +126,6 @@ struct KeyboardMatrix {
 	*/
 	inline uint8_t const GetColumns() const;
 
-	/**
-		\brief Gets whether the matrix is active high
-		\result  active-high flag
-	*/
-	inline bool const GetActiveHigh() const;
-
-
 	/**
 		\brief Checks if a switch exists
 
@@ -206,16 +167,46 @@ struct KeyboardMatrix {
 	*/
 	inline bool const GetPressed( uint8_t const row, uint8_t const column ) const;
 
+	/**
+		\brief Finds the keys in a row which have changed
+
+		\param row  key row
+		\result  columns whose keypress flags have changed since the last call for this row
+	*/
+	inline ColumnType const PollChanged( uint8_t const row );
+
+
+protected:
+
+	/**
+		\brief Constructor
+
+		Sets the number of rows and columns in the keyboard matrix (accessed
+		using GetRows() and GetColumns(), respectively), and clears all switch
+		flags (see SetSwitch() and GetSwitch()).
+
+		\param rows        number of row pins
+		\param logColumns  number of column pins
+	*/
+	KeyboardMatrixBase( uint8_t const rows, uint8_t const logColumns );
+
+
+	/**
+		\brief Gets the switch flags
+		\result  switch flags, one element per row \sa SetSwitch()
+	*/
+	inline ColumnType const* GetSwitchMask() const;
+
 
 	/**
 		\brief Updates the keypress flags
 
-		This function reads the keyboard matrix from the pins/switches
-		specified by KeyboardMatrix() and SetSwitch(), performs anti-ghosting
-		if it has been enabled with SetAntiGhosting(), and updates the keypress
-		flags accessed by GetPressed(). If the state of the keyboard matrix has
-		changed since the last call to Update(), then this function will return
-		true.
+		This function takes the raw state of the keyboard matrix, as read by
+		KeyboardMatrix::Update(), removes the switches not specified by
+		SetSwitch(), performs anti-ghosting if it has been enabled with
+		SetAntiGhosting(), and updates the keypress flags accessed by
+		GetPressed(). If the state of the keyboard matrix has changed since the
+		last call, then this function will return true.
 
 		There are several phases to the anti-ghosting procedure:
 		<ul>
@@ -237,9 +228,10 @@ struct KeyboardMatrix {
 		is)--is there any way that the DFS forest could be kept around, and
 		only updated in response to changed keypresses?
 
+		\param workPressedState  raw keypress flags (overwritten)
 		\result  changed flag
 	*/
-	bool const Update();
+	bool const UpdateState( ColumnType workPressedState[] );
 
 
 private:
@@ -318,19 +310,6 @@ private:
 	};
 
 
-	/**
-		\brief Helper function for Update()
-
-		Reads the current (raw) state of the keyboard matrix into
-		workPressedState. The matrix is active-low (see KeyboardMatrix()), so
-		we have pull-up resistors on the columns, and set the rows to low (when
-		active).
-
-		\param workPressedState  destination
-	*/
-	void ReadKeyboardMatrix( ColumnType workPressedState[] ) const;
-
-
 	/**
 		\brief Finds all ghosted keypresses
 
@@ -379,18 +358,8 @@ private:
 	void DFSMoveUp( ColumnType ghostedState[], uint8_t parents[], uint8_t depths[], uint8_t& node, uint8_t& depth );
 
 
-	uint8_t m_rows;    ///< rows in use \sa GetRows(), KeyboardMatrix()
-	char m_rowPinNames[          MAXIMUM_ROWS ];    ///< row pin names \sa KeyboardMatrix()
-	uint8_t m_rowPinBits[        MAXIMUM_ROWS ];    ///< row pin numbers \sa KeyboardMatrix()
-	uint8_t volatile* m_rowPins[ MAXIMUM_ROWS ];    ///< row input registers \sa KeyboardMatrix()
-
-	uint8_t m_logColumns;    ///< log of columns in use \sa GetColumns(), KeyboardMatrix()
-	uint8_t m_columns;       ///< columns in use \sa GetColumns(), KeyboardMatrix()
-	char m_columnPinNames[           MAXIMUM_COLUMNS ];    ///< column pin names \sa KeyboardMatrix()
-	uint8_t m_columnPinBits[         MAXIMUM_COLUMNS ];    ///< column pin numbers \sa KeyboardMatrix()
-	uint8_t volatile* m_columnPorts[ MAXIMUM_COLUMNS ];    ///< column output registers \sa KeyboardMatrix()
-
-	bool m_activeHigh;    ///< active-high flag \sa GetActiveHigh(), KeyboardMatrix()
+	uint8_t m_rows;       ///< rows in use \sa GetRows(), KeyboardMatrixBase()
+	uint8_t m_columns;    ///< columns in use \sa GetColumns(), KeyboardMatrixBase()
 
 	bool m_antiGhosting;                    ///< anti-ghosting flag \sa GetAntiGhosting(), SetAntiGhosting()
 	unsigned int m_debouncingIterations;    ///< number of debouncing iterations to perform \sa GetDebouncing(), SetDebouncing()
@@ -399,6 +368,82 @@ private:
 
 	ColumnType m_rawPressedState[ MAXIMUM_ROWS ];    ///< raw keypress flags \sa Update()
 	ColumnType m_pressedState[    MAXIMUM_ROWS ];    ///< anti-ghosted keypress flags \sa GetPressed(), Update()
+	ColumnType m_polledState[     MAXIMUM_ROWS ];    ///< keypress flags as of the last poll \sa PollChanged()
+
+
+	inline KeyboardMatrixBase( KeyboardMatrixBase const& );                     ///< \brief Private and unimplemented copy constructor
+	inline KeyboardMatrixBase const& operator=( KeyboardMatrixBase const& );    ///< Private and unimplemented assignment operator
+};
+
+
+
+
+//============================================================================
+//    KeyboardMatrix class
+//============================================================================
+
+
+/**
+	\brief Keyboard matrix class
+
+	Class which reads from a standard keyboard matrix, using compile-time pin
+	lists. Current is taken to be flowing <em>from</em> the column pins
+	<em>to</em> the row pins. The column pins drive a demultiplexer: the index
+	of the active column is written to them in binary, so there are
+	2^t_ColumnPins::SIZE columns.
+
+	\param t_RowPins     PinList of row pins
+	\param t_ColumnPins  PinList of (binary-encoded) column pins
+	\param t_ActiveHigh  true if matrix is active-high, false otherwise
+*/
+template< typename t_RowPins, typename t_ColumnPins, bool t_ActiveHigh = false >
+struct KeyboardMatrix : public KeyboardMatrixBase {
+
+	/// \cond false
+	static_assert( ( static_cast< unsigned int >( t_RowPins::SIZE ) <= MAXIMUM_ROWS ), "too many rows" );
+	static_assert( ( ( 1u << t_ColumnPins::SIZE ) <= MAXIMUM_COLUMNS ), "too many columns" );
+	static_assert( PinsDisjoint< t_RowPins, t_ColumnPins >::VALUE, "keyboard matrix pins must be distinct" );
+	/// \endcond
+
+
+	/**
+		\brief Constructor
+
+		If the matrix is active-low, then we have pull-up resistors on the
+		rows, and set the columns to low (when active).
+	*/
+	inline KeyboardMatrix();
+
+
+	/**
+		\brief Gets whether the matrix is active high
+		\result  active-high flag
+	*/
+	inline bool const GetActiveHigh() const;
+
+
+	/**
+		\brief Updates the keypress flags
+
+		Reads the keyboard matrix, and passes the result to UpdateState().
+
+		\result  changed flag
+	*/
+	inline bool const Update();
+
+
+private:
+
+	/**
+		\brief Helper function for Update()
+
+		Reads the current (raw) state of the keyboard matrix into
+		workPressedState. Each row is read with a single instruction per pin,
+		and each column index is written with a single instruction per pin.
+
+		\param workPressedState  destination
+	*/
+	inline void ReadKeyboardMatrix( ColumnType workPressedState[] ) const;
 
 
 	inline KeyboardMatrix( KeyboardMatrix const& );                     ///< \brief Private and unimplemented copy constructor
@@ -409,23 +454,23 @@ private:
 
 
 //============================================================================
-//    KeyboardMatrix inline methods
+//    KeyboardMatrixBase inline methods
 //============================================================================
 
 
-bool const KeyboardMatrix::GetAntiGhosting() const {
+bool const KeyboardMatrixBase::GetAntiGhosting() const {
 
 	return m_antiGhosting;
 }
 
 
-unsigned int const KeyboardMatrix::GetDebouncing() const {
+unsigned int const KeyboardMatrixBase::GetDebouncing() const {
 
 	return m_debouncingIterations;
 }
 
 
-void KeyboardMatrix::SetAntiGhosting( bool const antiGhosting ) {
+void KeyboardMatrixBase::SetAntiGhosting( bool const antiGhosting ) {
 
 	// save and clear the interrupt flag
 	uint8_t const sreg = SREG;
@@ -438,7 +483,7 @@ void KeyboardMatrix::SetAntiGhosting( bool const antiGhosting ) {
 }
 
 
-void KeyboardMatrix::SetDebouncing( unsigned int const debouncingIterations ) {
+void KeyboardMatrixBase::SetDebouncing( unsigned int const debouncingIterations ) {
 
 	assert( debouncingIterations > 0 );
 
@@ -453,31 +498,25 @@ void KeyboardMatrix::SetDebouncing( unsigned int const debouncingIterations ) {
 }
 
 
-uint8_t const KeyboardMatrix::GetRows() const {
+uint8_t const KeyboardMatrixBase::GetRows() const {
 
 	return m_rows;
 }
 
 
-uint8_t const KeyboardMatrix::GetColumns() const {
+uint8_t const KeyboardMatrixBase::GetColumns() const {
 
 	return m_columns;
 }
 
 
-bool const KeyboardMatrix::GetActiveHigh() const {
-
-	return m_activeHigh;
-}
-
-
-bool const KeyboardMatrix::GetSwitch( uint8_t const row, uint8_t const column ) const {
+bool const KeyboardMatrixBase::GetSwitch( uint8_t const row, uint8_t const column ) const {
 
 	return( ( m_switchMask[ row ] & ( static_cast< ColumnType >( 1 ) << column ) ) != 0 );
 }
 
 
-void KeyboardMatrix::SetSwitch( uint8_t const row, uint8_t const column, bool const value ) {
+void KeyboardMatrixBase::SetSwitch( uint8_t const row, uint8_t const column, bool const value ) {
 
 	// save and clear the interrupt flag
 	uint8_t const sreg = SREG;
@@ -493,26 +532,103 @@ void KeyboardMatrix::SetSwitch( uint8_t const row, uint8_t const column, bool co
 }
 
 
-bool const KeyboardMatrix::GetPressed( uint8_t const row, uint8_t const column ) const {
+bool const KeyboardMatrixBase::GetPressed( uint8_t const row, uint8_t const column ) const {
 
 	return( ( m_pressedState[ row ] & ( static_cast< ColumnType >( 1 ) << column ) ) != 0 );
 }
 
 
+KeyboardMatrixBase::ColumnType const KeyboardMatrixBase::PollChanged( uint8_t const row ) {
+
+	ColumnType const changed = ( m_pressedState[ row ] ^ m_polledState[ row ] );
+	m_polledState[ row ] = m_pressedState[ row ];
+	return changed;
+}
+
+
+KeyboardMatrixBase::ColumnType const* KeyboardMatrixBase::GetSwitchMask() const {
+
+	return m_switchMask;
+}
+
+
+
+
+//============================================================================
+//    KeyboardMatrix inline methods
+//============================================================================
+
+
+template< typename t_RowPins, typename t_ColumnPins, bool t_ActiveHigh >
+KeyboardMatrix< t_RowPins, t_ColumnPins, t_ActiveHigh >::KeyboardMatrix() :
+	KeyboardMatrixBase( t_RowPins::SIZE, t_ColumnPins::SIZE )
+{
+	// direction = input, value = high (pull-up resistor)
+	t_RowPins::SetInputs( true );
+
+	// direction = output, value = low
+	t_ColumnPins::SetOutputs( false );
+}
+
+
+template< typename t_RowPins, typename t_ColumnPins, bool t_ActiveHigh >
+bool const KeyboardMatrix< t_RowPins, t_ColumnPins, t_ActiveHigh >::GetActiveHigh() const {
+
+	return t_ActiveHigh;
+}
+
+
+template< typename t_RowPins, typename t_ColumnPins, bool t_ActiveHigh >
+bool const KeyboardMatrix< t_RowPins, t_ColumnPins, t_ActiveHigh >::Update() {
+
+	ColumnType workPressedState[ MAXIMUM_ROWS ];
+	ReadKeyboardMatrix( workPressedState );
+
+	return UpdateState( workPressedState );
+}
+
+
+template< typename t_RowPins, typename t_ColumnPins, bool t_ActiveHigh >
+void KeyboardMatrix< t_RowPins, t_ColumnPins, t_ActiveHigh >::ReadKeyboardMatrix( ColumnType workPressedState[] ) const {
+
+	uint8_t const rows    = t_RowPins::SIZE;
+	uint8_t const columns = ( 1u << t_ColumnPins::SIZE );
+
+	memcpy( workPressedState, GetSwitchMask(), rows * sizeof( ColumnType ) );
+	for ( unsigned int ii = 0; ii < GetDebouncing(); ++ii ) {
+
+		for ( uint8_t jj = 0; jj < columns; ++jj ) {
+
+			t_ColumnPins::Write( jj );
+			_delay_us( 10 );
+
+			uint16_t state = 0;
+			t_RowPins::Read( state );
+			if ( ! t_ActiveHigh )
+				state = ~state;
+
+			for ( uint8_t kk = 0; kk < rows; ++kk )
+				if ( ! ( state & ( 1u << kk ) ) )    // is this row pin inactive?
+					workPressedState[ kk ] &= ~( static_cast< ColumnType >( 1 ) << jj );
+		}
+	}
+}
+
+
 
 
 //============================================================================
-//    KeyboardMatrix::Clustering inline methods
+//    KeyboardMatrixBase::Clustering inline methods
 //============================================================================
 
 
-uint8_t const KeyboardMatrix::Clustering::GetCluster( uint8_t const row ) const {
+uint8_t const KeyboardMatrixBase::Clustering::GetCluster( uint8_t const row ) const {
 
 	return m_clusters[ row ];
 }
 
 
-uint8_t const KeyboardMatrix::Clustering::GetClusterSize( uint8_t const cluster ) const {
+uint8_t const KeyboardMatrixBase::Clustering::GetClusterSize( uint8_t const cluster ) const {
 
 	return m_clusterSizes[ cluster ];
 }
@@ -27,8 +27,6 @@
 #include "keymap.hh"
 #include "timer.hh"
 
-#include <math.h>
-
 #include <avr/pgmspace.h>
 
 
@@ -172,19 +170,61 @@ static_assert( ARRAYLENGTH( g_baseKeymap ) == KEYMAP_BASE_END, "g_baseKeymap mus
 //============================================================================
 
 
-extern float const g_mouseMoveDirection[] __attribute__(( __progmem__ ));
-float const g_mouseMoveDirection[] = {
-	 0,         -1,          0,    // N
-	 0.7071068, -0.7071068,  0,    // NE
-	 1,          0,          0,    // E
-	 0.7071068,  0.7071068,  0,    // SE
-	 0,          1,          0,    // S
-	-0.7071068,  0.7071068,  0,    // SW
-	-1,          0,          0,    // W
-	-0.7071068, -0.7071068,  0,    // NW
-	 0,          0,          1,    // Wheel+
-	 0,          0,         -1     // Wheel-
+// Q8.8, with 181 / 256 approximating 1 / sqrt( 2 )
+extern int16_t const g_mouseMoveDirection[] __attribute__(( __progmem__ ));
+int16_t const g_mouseMoveDirection[] = {
+	    0, -256,    0,    // N
+	  181, -181,    0,    // NE
+	  256,    0,    0,    // E
+	  181,  181,    0,    // SE
+	    0,  256,    0,    // S
+	 -181,  181,    0,    // SW
+	 -256,    0,    0,    // W
+	 -181, -181,    0,    // NW
+	    0,    0,  256,    // Wheel+
+	    0,    0, -256     // Wheel-
+};
+
+
+
+
+//============================================================================
+//    Virtual actions
+//============================================================================
+
+
+// indexed by virtual code, starting from Keymap::VIRTUAL_ACTIONS_BEGIN
+extern Keymap::VirtualAction const g_virtualActions[] __attribute__(( __progmem__ ));
+Keymap::VirtualAction const g_virtualActions[] = {
+	{ Keymap::ACTION_LOCKING,                      KEYMAP_KEYBOARD_CAPS_LOCK,            USB::HID::LED_CAPS_LOCK   },    // VIRTUAL_LOCKING_CAPS_LOCK
+	{ Keymap::ACTION_LOCKING,                      KEYMAP_KEYBOARD_NUM_LOCK,             USB::HID::LED_NUM_LOCK    },    // VIRTUAL_LOCKING_NUM_LOCK
+	{ Keymap::ACTION_LOCKING,                      KEYMAP_KEYBOARD_SCROLL_LOCK,          USB::HID::LED_SCROLL_LOCK },    // VIRTUAL_LOCKING_SCROLL_LOCK
+	{ Keymap::ACTION_HOLD | Keymap::ACTION_STICKY, Keymap::TARGET_STICKY_MODIFIERS,      0                         },    // VIRTUAL_STICKY_LEFT_CONTROL
+	{ Keymap::ACTION_HOLD | Keymap::ACTION_STICKY, Keymap::TARGET_STICKY_MODIFIERS,      1                         },    // VIRTUAL_STICKY_LEFT_SHIFT
+	{ Keymap::ACTION_HOLD | Keymap::ACTION_STICKY, Keymap::TARGET_STICKY_MODIFIERS,      2                         },    // VIRTUAL_STICKY_LEFT_ALT
+	{ Keymap::ACTION_HOLD | Keymap::ACTION_STICKY, Keymap::TARGET_STICKY_MODIFIERS,      3                         },    // VIRTUAL_STICKY_LEFT_GUI
+	{ Keymap::ACTION_HOLD | Keymap::ACTION_STICKY, Keymap::TARGET_STICKY_MODIFIERS,      4                         },    // VIRTUAL_STICKY_RIGHT_CONTROL
+	{ Keymap::ACTION_HOLD | Keymap::ACTION_STICKY, Keymap::TARGET_STICKY_MODIFIERS,      5                         },    // VIRTUAL_STICKY_RIGHT_SHIFT
+	{ Keymap::ACTION_HOLD | Keymap::ACTION_STICKY, Keymap::TARGET_STICKY_MODIFIERS,      6                         },    // VIRTUAL_STICKY_RIGHT_ALT
+	{ Keymap::ACTION_HOLD | Keymap::ACTION_STICKY, Keymap::TARGET_STICKY_MODIFIERS,      7                         },    // VIRTUAL_STICKY_RIGHT_GUI
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      0                         },    // VIRTUAL_MOUSE_N
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      1                         },    // VIRTUAL_MOUSE_NE
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      2                         },    // VIRTUAL_MOUSE_E
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      3                         },    // VIRTUAL_MOUSE_SE
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      4                         },    // VIRTUAL_MOUSE_S
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      5                         },    // VIRTUAL_MOUSE_SW
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      6                         },    // VIRTUAL_MOUSE_W
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      7                         },    // VIRTUAL_MOUSE_NW
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      8                         },    // VIRTUAL_MOUSE_WHEEL_UP
+	{ Keymap::ACTION_MOUSE,                        Keymap::TARGET_MOUSE_DIRECTIONS,      9                         },    // VIRTUAL_MOUSE_WHEEL_DOWN
+	{ Keymap::ACTION_HOLD,                         Keymap::TARGET_MOUSE_BUTTONS,         0                         },    // VIRTUAL_MOUSE_BUTTON_1_PRESS
+	{ Keymap::ACTION_HOLD,                         Keymap::TARGET_MOUSE_BUTTONS,         1                         },    // VIRTUAL_MOUSE_BUTTON_2_PRESS
+	{ Keymap::ACTION_HOLD,                         Keymap::TARGET_MOUSE_BUTTONS,         2                         },    // VIRTUAL_MOUSE_BUTTON_3_PRESS
+	{ Keymap::ACTION_TOGGLE,                       Keymap::TARGET_TOGGLED_MOUSE_BUTTONS, 0                         },    // VIRTUAL_MOUSE_BUTTON_1_TOGGLE
+	{ Keymap::ACTION_TOGGLE,                       Keymap::TARGET_TOGGLED_MOUSE_BUTTONS, 1                         },    // VIRTUAL_MOUSE_BUTTON_2_TOGGLE
+	{ Keymap::ACTION_TOGGLE,                       Keymap::TARGET_TOGGLED_MOUSE_BUTTONS, 2                         }     // VIRTUAL_MOUSE_BUTTON_3_TOGGLE
 };
+static_assert( ARRAYLENGTH( g_virtualActions ) == Keymap::VIRTUAL_END - Keymap::VIRTUAL_ACTIONS_BEGIN, "g_virtualActions must have an entry for every virtual action code" );
 
 
 
@@ -195,91 +235,103 @@ float const g_mouseMoveDirection[] = {
 
 
 Keymap::Keymap(
-	USB::HID::Mouse* const pMouse,
-	USB::HID::Keyboard* const pKeyboard,
-	USB::HID::KeyboardExtension* const pKeyboardExtension,
-	float const mouseMoveMinimumTime,
-	float const mouseMoveMaximumTime,
-	float const mouseMoveMinimumVelocity,
-	float const mouseMoveMaximumVelocity,
-	float const mouseWheelMinimumTime,
-	float const mouseWheelMaximumTime,
-	float const mouseWheelMinimumVelocity,
-	float const mouseWheelMaximumVelocity,
-	uint16_t const* const extendedKeymap
+	MouseCurve const* const mouseMoveCurve,
+	MouseCurve const* const mouseWheelCurve,
+	uint16_t const* const extendedKeymap,
+	uint8_t const extendedKeymapLength
 ) :
-	m_pMouse( pMouse ),
-	m_pKeyboard( pKeyboard ),
-	m_pKeyboardExtension( pKeyboardExtension ),
-	m_extendedKeymap( extendedKeymap ),
+	m_outputCount( 0 ),
+	m_outputPressed( 0 ),
+	m_modifiers( 0 ),
+	m_mouseButtons( 0 ),
+	m_selectedLayerCached( 0xff ),
+	m_lockedLayerCached( 0xff ),
+	m_queueHead( 0 ),
+	m_queueTail( 0 ),
+	m_newCode( 0 ),
+	m_lastCode( 0 ),
+	m_lastAssignment( 0 ),
 	m_layerSelected( 0xff ),
 	m_layerLocked( 0 ),
 	m_normalKeypresses( 0 ),
 	m_pressedModifiers( 0 ),
-	m_pressedStickyModifiers( 0 ),
 	m_stickyModifiers( 0 ),
 	m_unstickyModifiers( 0 ),
-	m_modifiers( 0 ),
-	m_oldModifiers( 0 ),
-	m_mouseMoveMinimumTime( mouseMoveMinimumTime ),
-	m_mouseMoveMaximumTime( mouseMoveMaximumTime ),
-	m_mouseMoveMinimumVelocity( mouseMoveMinimumVelocity ),
-	m_mouseMoveMaximumVelocity( mouseMoveMaximumVelocity ),
-	m_mouseWheelMinimumTime( mouseWheelMinimumTime ),
-	m_mouseWheelMaximumTime( mouseWheelMaximumTime ),
-	m_mouseWheelMinimumVelocity( mouseWheelMinimumVelocity ),
-	m_mouseWheelMaximumVelocity( mouseWheelMaximumVelocity ),
-	m_mouseMovement( 0 ),
-	m_pressedMouseDirections( 0 ),
-	m_pressedMouseButtons( 0 ),
-	m_toggledMouseButtons( 0 ),
-	m_mouseButtons( 0 ),
-	m_oldMouseButtons( 0 )
+	m_leds( 0 ),
+	m_mouseMoveCurve( mouseMoveCurve ),
+	m_mouseWheelCurve( mouseWheelCurve ),
+	m_mouseOverflows( 0 ),
+	m_mouseMovement( 0 )
 {
+	memset( m_mouseCounts, 0, sizeof( m_mouseCounts ) );
+
 	memset( m_layers, 0, sizeof( m_layers ) );
+	m_sparseLayers = 0;
 
-	memset( m_oldPressed, 0, sizeof( m_oldPressed ) );
-	memset( m_pressed, 0, sizeof( m_pressed ) );
+	memset( m_macros, 0, sizeof( m_macros ) );
+	m_macro = NULL;
+	m_macroKey = 0;
+	m_macroModifiers = 0;
+
+	for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_keycodes ); ++ii ) {
+
+		uint16_t keycode = 0;
+		if ( ii < KEYMAP_BASE_END )
+			keycode = pgm_read_word( g_baseKeymap + ii );
+		else if ( ( extendedKeymap != NULL ) && ( ii - KEYMAP_BASE_END < extendedKeymapLength ) )
+			keycode = pgm_read_word( extendedKeymap + ii - KEYMAP_BASE_END );
+		m_keycodes[ ii ] = keycode;
+	}
 
 	memset( m_assignments, 0, sizeof( m_assignments ) );
-	memset( m_active, 0, sizeof( m_active ) );
+	memset( m_counts, 0, sizeof( m_counts ) );
+
+	memset( m_pressed, 0, sizeof( m_pressed ) );
+	memset( m_pulsed, 0, sizeof( m_pulsed ) );
+	memset( m_queued, 0, sizeof( m_queued ) );
 
 	memset( m_mouseMoveTime, 0, sizeof( m_mouseMoveTime ) );
 	memset( m_mouseCoordinates, 0, sizeof( m_mouseCoordinates ) );
+
+	memset( m_targets, 0, sizeof( m_targets ) );
 }
 
 
 void Keymap::Press( uint8_t const code ) {
 
-	if ( m_assignments[ code ] == 0 ) {
+	LatencyTrace::Press( code );
 
-		uint8_t assignment = 0;
+	if ( ( m_assignments[ code ] == 0 ) && ( code < KEYMAP_BASE_END ) ) {
+
+		uint8_t assignment;
 		if ( m_layerSelected < MAXIMUM_LAYERS ) {
 
-			uint8_t const* const layer = m_layers[ m_layerSelected ];
-			if ( layer != NULL ) {
+			if ( m_selectedLayerCached != m_layerSelected ) {
 
-				assignment = pgm_read_byte( layer + code );
-				uint16_t const mapped = ( ( assignment < KEYMAP_BASE_END ) ? pgm_read_word( g_baseKeymap + assignment ) : ( ( m_extendedKeymap != NULL ) ? pgm_read_word( m_extendedKeymap + assignment - KEYMAP_BASE_END ) : 0 ) );
-				if ( ( mapped & KEYCODE_TYPE_MASK ) == KEYCODE_TYPE_VIRTUAL ) {
-
-					uint16_t const mappedCode = ( mapped & KEYCODE_CODE_MASK );
-					if ( ( mappedCode >= VIRTUAL_LAYER_SELECT ) && ( mappedCode < VIRTUAL_LAYER_SELECT + MAXIMUM_LAYERS ) )    // ignore new layer selection keypresses
-						assignment = 0;
-				}
+				CacheLayer( m_selectedLayerAssignments, m_layerSelected, true );
+				m_selectedLayerCached = m_layerSelected;
 			}
+			assignment = m_selectedLayerAssignments[ code ];
 		}
 		else {
 
-			uint8_t const* const layer = m_layers[ m_layerLocked ];
-			if ( layer != NULL )
-				assignment = pgm_read_byte( layer + code );
+			if ( m_lockedLayerCached != m_layerLocked ) {
+
+				CacheLayer( m_lockedLayerAssignments, m_layerLocked, false );
+				m_lockedLayerCached = m_layerLocked;
+			}
+			assignment = m_lockedLayerAssignments[ code ];
 		}
 
 		if ( assignment != 0 ) {
 
 			m_assignments[ code ] = assignment;
-			m_active[ code >> 4 ] |= ( 1u << ( code & 15 ) );
+			if ( m_counts[ assignment ]++ == 0 )
+				Enqueue( assignment );
+
+			// candidate for a tap, if it's still held at the next update
+			if ( ! ( m_pressed[ assignment >> 4 ] & ( 1u << ( assignment & 15 ) ) ) )
+				m_newCode = code;
 		}
 	}
 }
@@ -287,351 +339,342 @@ void Keymap::Press( uint8_t const code ) {
 
 void Keymap::Release( uint8_t const code ) {
 
+	LatencyTrace::Press( code );
+
 	uint8_t const assignment = m_assignments[ code ];
+	if ( assignment != 0 ) {
 
-	uint8_t const index = ( assignment >> 4 );
-	uint16_t const mask = ( 1u << ( assignment & 15 ) );
-	if ( ! ( m_oldPressed[ index ] & mask ) )
-		m_pressed[ index ] |= mask;
+		// a press and release between updates must still be reported
+		if ( ! ( m_pressed[ assignment >> 4 ] & ( 1u << ( assignment & 15 ) ) ) )
+			Pulse( assignment );
+		if ( --m_counts[ assignment ] == 0 )
+			Enqueue( assignment );
 
-	m_assignments[ code ] = 0;
-	m_active[ code >> 4 ] &= ~( 1u << ( code & 15 ) );
+		m_assignments[ code ] = 0;
+	}
 }
 
 
-void Keymap::Update() {
-
-	static uint8_t lastCode = 0;
-	static uint8_t lastAssignment = 0;
-	static uint16_t oldOverflows = 0;
+void Keymap::Process( uint8_t const leds ) {
 
-	if ( ! ( ( ( m_pMouse != NULL ) && m_pMouse->IsChanged() ) || ( ( m_pKeyboard != NULL ) && m_pKeyboard->IsChanged() ) || ( ( m_pKeyboardExtension != NULL ) && m_pKeyboardExtension->IsChanged() ) ) ) {
+	m_leds = leds;
+	m_outputCount = 0;
+	m_outputPressed = 0;
 
-		uint16_t const overflows = Timer::Instance()->GetOverflows();
-		float const duration = ( ( overflows - oldOverflows ) / 256.0 );
+	// a tap is a release of the most recently pressed code, with no other press in between
+	if ( ( m_lastCode != 0 ) && ( m_assignments[ m_lastCode ] == 0 ) ) {
 
-		if ( lastCode != 0 ) {
+		uint16_t const mapped = m_keycodes[ m_lastAssignment ];
+		if ( ( mapped & KEYCODE_TYPE_MASK ) == KEYCODE_TYPE_VIRTUAL )
+			VirtualTap( mapped & KEYCODE_CODE_MASK, m_lastCode );
+		m_lastCode = 0;
+		m_lastAssignment = 0;
+	}
+	if ( m_newCode != 0 ) {
 
-			if ( ! ( m_active[ lastCode >> 4 ] & ( 1u << ( lastCode & 15 ) ) ) ) {
+		if ( m_assignments[ m_newCode ] != 0 ) {
 
-				uint16_t const mapped = ( ( lastAssignment < KEYMAP_BASE_END ) ? pgm_read_word( g_baseKeymap + lastAssignment ) : ( ( m_extendedKeymap != NULL ) ? pgm_read_word( m_extendedKeymap + lastAssignment - KEYMAP_BASE_END ) : 0 ) );
-				if ( ( mapped & KEYCODE_TYPE_MASK ) == KEYCODE_TYPE_VIRTUAL )
-					VirtualTap( mapped & KEYCODE_CODE_MASK, lastCode );
-				lastCode = 0;
-				lastAssignment = 0;
-			}
+			m_lastCode = m_newCode;
+			m_lastAssignment = m_assignments[ m_newCode ];
 		}
+		m_newCode = 0;
+	}
 
-		for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_active ); ++ii ) {
+	/*
+		Virtual assignments are handled first, since they may pulse other
+		assignments (e.g. the locking keys), which are appended to the queue
+		and handled below during this same update.
+	*/
+	for ( uint8_t ii = m_queueHead; ii != m_queueTail; ++ii ) {
 
-			if ( m_active[ ii ] != 0 ) {
+		uint8_t const assignment = m_queue[ ii ];
+		uint16_t const mapped = m_keycodes[ assignment ];
+		if ( ( mapped & KEYCODE_TYPE_MASK ) == KEYCODE_TYPE_VIRTUAL ) {
 
-				uint8_t code = ii * 16;
-				for ( unsigned int jj = 0; jj < 16; ++jj ) {
+			uint8_t const index = ( assignment >> 4 );
+			uint16_t const mask = ( 1u << ( assignment & 15 ) );
+			bool const pressed = ( ( m_counts[ assignment ] != 0 ) || ( m_pulsed[ index ] & mask ) );
+			if ( pressed != ( ( m_pressed[ index ] & mask ) != 0 ) ) {
 
-					if ( m_active[ ii ] & ( 1u << jj ) ) {
+				m_pressed[ index ] ^= mask;
+				VirtualTransition( mapped & KEYCODE_CODE_MASK, pressed );
+			}
+		}
+	}
 
-						uint8_t const assignment = m_assignments[ code ];
-						if ( assignment != 0 ) {
+	/*
+		Pulsed assignments are queued again for release, which happens on the
+		next update. If the output buffer fills up, the rest of the queue is
+		left for the next update, and since the virtual pass above only acts
+		on differences, seeing those entries again there is harmless.
+	*/
+	for ( uint8_t const tail = m_queueTail; ( m_queueHead != tail ) && ( m_outputCount < OUTPUT_BUFFER_LENGTH ); ) {
+
+		uint8_t const assignment = m_queue[ m_queueHead++ ];
+		uint8_t const index = ( assignment >> 4 );
+		uint16_t const mask = ( 1u << ( assignment & 15 ) );
+		m_queued[ index ] &= ~mask;
+
+		bool pressed = ( m_counts[ assignment ] != 0 );
+		if ( m_pulsed[ index ] & mask ) {
+
+			m_pulsed[ index ] &= ~mask;
+			Enqueue( assignment );
+			pressed = true;
+		}
 
-							uint8_t const index = ( assignment >> 4 );
-							uint16_t const mask = ( 1u << ( assignment & 15 ) );
-							if ( ! ( m_oldPressed[ index ] & mask ) ) {
+		uint16_t const mapped = m_keycodes[ assignment ];
+		if ( ( mapped & KEYCODE_TYPE_MASK ) != KEYCODE_TYPE_VIRTUAL ) {
 
-								lastCode = code;
-								lastAssignment = assignment;
-							}
-							m_pressed[ index ] |= mask;
-						}
-					}
+			if ( pressed != ( ( m_pressed[ index ] & mask ) != 0 ) ) {
 
-					++code;
-				}
+				m_pressed[ index ] ^= mask;
+				OutputTransition( mapped, pressed );
 			}
 		}
+	}
 
-		for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_pressed ); ++ii ) {
-
-			if ( m_oldPressed[ ii ] != m_pressed[ ii ] ) {
+	if ( m_normalKeypresses > 0 )
+		m_unstickyModifiers |= m_stickyModifiers;
+	else {
 
-				uint8_t assignment = ii * 16;
-				for ( unsigned int jj = 0; jj < 16; ++jj ) {
+		m_stickyModifiers &= ~m_unstickyModifiers;
+		m_unstickyModifiers = 0;
+	}
+	m_modifiers = ( m_pressedModifiers | m_targets[ TARGET_STICKY_MODIFIERS ] | m_stickyModifiers );
 
-					uint16_t const mask = ( 1u << jj );
-					bool const oldPressed = ( ( m_oldPressed[ ii ] & mask ) != 0 );
-					bool const pressed = ( ( m_pressed[ ii ] & mask ) != 0 );
-					if ( oldPressed != pressed ) {
+	if ( m_targets[ TARGET_MOUSE_DIRECTIONS ] != 0 ) {
 
-						uint16_t const mapped = ( ( assignment < KEYMAP_BASE_END ) ? pgm_read_word( g_baseKeymap + assignment ) : ( ( m_extendedKeymap != NULL ) ? pgm_read_word( m_extendedKeymap + assignment - KEYMAP_BASE_END ) : 0 ) );
-						if ( ( mapped & KEYCODE_TYPE_MASK ) == KEYCODE_TYPE_VIRTUAL ) {
+		uint16_t const overflows = Timer::Instance()->GetOverflows();
+		uint16_t const elapsed = ( overflows - m_mouseOverflows );
+		uint8_t const duration = ( ( elapsed < MOUSE_MAXIMUM_DURATION ) ? elapsed : MOUSE_MAXIMUM_DURATION );
+		m_mouseOverflows = overflows;
+
+		for ( unsigned int ii = 0; ii < 8; ++ii )
+			if ( m_targets[ TARGET_MOUSE_DIRECTIONS ] & ( 1u << ii ) )
+				VirtualMouseMove( ii, duration, m_mouseMoveCurve );
+		for ( unsigned int ii = 8; ii < 10; ++ii )
+			if ( m_targets[ TARGET_MOUSE_DIRECTIONS ] & ( 1u << ii ) )
+				VirtualMouseMove( ii, duration, m_mouseWheelCurve );
+	}
 
-							uint16_t const mappedCode = ( mapped & KEYCODE_CODE_MASK );
-							if ( pressed )
-								VirtualPress( mappedCode );
-							else
-								VirtualRelease( mappedCode );
-						}
-					}
+	m_mouseButtons = ( m_targets[ TARGET_MOUSE_BUTTONS ] | m_targets[ TARGET_TOGGLED_MOUSE_BUTTONS ] );
 
-					++assignment;
-				}
-			}
-		}
+	// truncate towards zero, keeping the fractional part for the next update
+	for ( unsigned int ii = 0; ii < 3; ++ii ) {
 
-		for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_pressed ); ++ii ) {
+		if ( ! ( m_mouseMovement & ( 1u << ii ) ) )
+			m_mouseCoordinates[ ii ] = 0;
+		int16_t const counts = ( ( m_mouseCoordinates[ ii ] >= 0 ) ? static_cast< int16_t >( m_mouseCoordinates[ ii ] >> 16 ) : -static_cast< int16_t >( ( -m_mouseCoordinates[ ii ] ) >> 16 ) );
+		m_mouseCoordinates[ ii ] -= ( static_cast< int32_t >( counts ) << 16 );
+		m_mouseCounts[ ii ] = counts;
+	}
+	m_mouseMovement = 0;
+}
 
-			if ( m_oldPressed[ ii ] != m_pressed[ ii ] ) {
 
-				uint8_t assignment = ii * 16;
-				for ( unsigned int jj = 0; jj < 16; ++jj ) {
+void Keymap::PlayMacro() {
 
-					uint16_t const mask = ( 1u << jj );
-					bool const oldPressed = ( ( m_oldPressed[ ii ] & mask ) != 0 );
-					bool const pressed = ( ( m_pressed[ ii ] & mask ) != 0 );
-					if ( oldPressed != pressed ) {
+	m_outputCount = 0;
+	m_outputPressed = 0;
 
-						uint16_t const mapped = ( ( assignment < KEYMAP_BASE_END ) ? pgm_read_word( g_baseKeymap + assignment ) : ( ( m_extendedKeymap != NULL ) ? pgm_read_word( m_extendedKeymap + assignment - KEYMAP_BASE_END ) : 0 ) );
-						switch( mapped & KEYCODE_TYPE_MASK ) {
+	// the previous report pressed a key, so this one releases it
+	if ( m_macroKey != 0 ) {
 
-							case KEYCODE_TYPE_KEYBOARD: {
+		m_outputs[ m_outputCount++ ] = KEYCODE_KEYBOARD( m_macroKey );
+		m_macroKey = 0;
+		return;
+	}
 
-								USB::HID::Key const mappedCode = static_cast< USB::HID::Key >( mapped & KEYCODE_CODE_MASK );
-								if ( pressed ) {
+	/*
+		Each pass adds at most one output, and the end of the macro may add
+		eight more (the modifier releases), so stop while there's still room
+		for them. Any toggles left over go out in the next report.
+	*/
+	static_assert( OUTPUT_BUFFER_LENGTH > 8, "output buffer must have room for the macro's modifier releases" );
+	while ( m_outputCount < OUTPUT_BUFFER_LENGTH - 8 ) {
 
-									switch( mappedCode ) {
+		uint8_t const key = pgm_read_byte( m_macro );
+		if ( key == 0 ) {
 
-										case USB::HID::KEY_LEFT_CONTROL:  { m_pressedModifiers |= ( 1u << 0 ); break; }
-										case USB::HID::KEY_LEFT_SHIFT:    { m_pressedModifiers |= ( 1u << 1 ); break; }
-										case USB::HID::KEY_LEFT_ALT:      { m_pressedModifiers |= ( 1u << 2 ); break; }
-										case USB::HID::KEY_LEFT_GUI:      { m_pressedModifiers |= ( 1u << 3 ); break; }
-										case USB::HID::KEY_RIGHT_CONTROL: { m_pressedModifiers |= ( 1u << 4 ); break; }
-										case USB::HID::KEY_RIGHT_SHIFT:   { m_pressedModifiers |= ( 1u << 5 ); break; }
-										case USB::HID::KEY_RIGHT_ALT:     { m_pressedModifiers |= ( 1u << 6 ); break; }
-										case USB::HID::KEY_RIGHT_GUI:     { m_pressedModifiers |= ( 1u << 7 ); break; }
+			// release the modifiers pressed by the macro, unless they're also held down
+			for ( unsigned int ii = 0; ii < 8; ++ii )
+				if ( ( m_macroModifiers & ~m_modifiers ) & ( 1u << ii ) )
+					m_outputs[ m_outputCount++ ] = KEYCODE_KEYBOARD( USB::HID::KEY_LEFT_CONTROL + ii );
+			m_macroModifiers = 0;
+			m_macro = NULL;
+			break;
+		}
+		++m_macro;
 
-										default: {
+		if ( ( key >= USB::HID::KEY_LEFT_CONTROL ) && ( key <= USB::HID::KEY_RIGHT_GUI ) ) {
 
-											if ( ! ( ( m_pKeyboard != NULL ) && m_pKeyboard->PressKey( mappedCode ) ) )
-												if ( m_pKeyboardExtension != NULL )
-													m_pKeyboardExtension->PressKey( mappedCode );
-											++m_normalKeypresses;
+			uint8_t const mask = ( 1u << ( key - USB::HID::KEY_LEFT_CONTROL ) );
+			m_macroModifiers ^= mask;
+			if ( m_macroModifiers & mask )
+				m_outputPressed |= ( 1u << m_outputCount );
+			else if ( m_modifiers & mask )
+				continue;
+			m_outputs[ m_outputCount++ ] = KEYCODE_KEYBOARD( key );
+		}
+		else {
 
-											break;
-										}
-									}
-								}
-								else {
+			m_outputPressed |= ( 1u << m_outputCount );
+			m_outputs[ m_outputCount++ ] = KEYCODE_KEYBOARD( key );
+			m_macroKey = key;
+			break;
+		}
+	}
+}
 
-									switch( mappedCode ) {
 
-										case USB::HID::KEY_LEFT_CONTROL:  { m_pressedModifiers &= ~( 1u << 0 ); break; }
-										case USB::HID::KEY_LEFT_SHIFT:    { m_pressedModifiers &= ~( 1u << 1 ); break; }
-										case USB::HID::KEY_LEFT_ALT:      { m_pressedModifiers &= ~( 1u << 2 ); break; }
-										case USB::HID::KEY_LEFT_GUI:      { m_pressedModifiers &= ~( 1u << 3 ); break; }
-										case USB::HID::KEY_RIGHT_CONTROL: { m_pressedModifiers &= ~( 1u << 4 ); break; }
-										case USB::HID::KEY_RIGHT_SHIFT:   { m_pressedModifiers &= ~( 1u << 5 ); break; }
-										case USB::HID::KEY_RIGHT_ALT:     { m_pressedModifiers &= ~( 1u << 6 ); break; }
-										case USB::HID::KEY_RIGHT_GUI:     { m_pressedModifiers &= ~( 1u << 7 ); break; }
+void Keymap::OutputTransition( uint16_t const mapped, bool const pressed ) {
 
-										default: {
+	if ( ( mapped & KEYCODE_TYPE_MASK ) == KEYCODE_TYPE_MACRO ) {
 
-											if ( m_pKeyboard != NULL )
-												m_pKeyboard->ReleaseKey( mappedCode );
-											if ( m_pKeyboardExtension != NULL )
-												m_pKeyboardExtension->ReleaseKey( mappedCode );
-											--m_normalKeypresses;
+		uint16_t const mappedCode = ( mapped & KEYCODE_CODE_MASK );
+		if ( pressed && ( m_macro == NULL ) && ( mappedCode < MAXIMUM_MACROS ) && ( m_macros[ mappedCode ] != NULL ) )
+			m_macro = m_macros[ mappedCode ];
+		return;
+	}
 
-											break;
-										}
-									}
-								}
+	if ( ( mapped & KEYCODE_TYPE_MASK ) == KEYCODE_TYPE_KEYBOARD ) {
 
-								break;
-							}
+		uint16_t const mappedCode = ( mapped & KEYCODE_CODE_MASK );
+		if ( ( mappedCode >= USB::HID::KEY_LEFT_CONTROL ) && ( mappedCode <= USB::HID::KEY_RIGHT_GUI ) ) {
 
-							case KEYCODE_TYPE_CONSUMER: {
+			uint8_t const mask = ( 1u << ( mappedCode - USB::HID::KEY_LEFT_CONTROL ) );
+			if ( pressed )
+				m_pressedModifiers |= mask;
+			else
+				m_pressedModifiers &= ~mask;
+			return;
+		}
+	}
 
-								USB::HID::Consumer const mappedCode = static_cast< USB::HID::Consumer >( mapped & KEYCODE_CODE_MASK );
-								if ( pressed ) {
+	if ( pressed ) {
 
-									if ( m_pKeyboardExtension != NULL )
-										m_pKeyboardExtension->PressConsumer( mappedCode );
-									++m_normalKeypresses;
-								}
-								else {
+		m_outputPressed |= ( 1u << m_outputCount );
+		++m_normalKeypresses;
+	}
+	else
+		--m_normalKeypresses;
+	m_outputs[ m_outputCount++ ] = mapped;
+}
 
-									if ( m_pKeyboardExtension != NULL )
-										m_pKeyboardExtension->ReleaseConsumer( mappedCode );
-									--m_normalKeypresses;
-								}
 
-								break;
-							}
-						}
-					}
+uint8_t const Keymap::LayerAssignment( uint8_t const index, uint8_t const code ) const {
 
-					++assignment;
-				}
-			}
-		}
+	uint8_t const* layer = m_layers[ index ];
+	if ( m_sparseLayers & ( 1u << index ) ) {
 
-		if ( m_normalKeypresses > 0 )
-			m_unstickyModifiers |= m_stickyModifiers;
-		else {
+		uint8_t const present = pgm_read_byte( layer + ( code >> 3 ) );
+		uint8_t const mask = ( 1u << ( code & 7 ) );
+		if ( present & mask ) {
 
-			m_stickyModifiers &= ~m_unstickyModifiers;
-			m_unstickyModifiers = 0;
+			// rank of this code among the overrides: the count for its byte, plus the lower bits of the byte
+			uint8_t rank = pgm_read_byte( layer + LAYER_BITMAP_LENGTH + ( code >> 3 ) );
+			for ( uint8_t bits = ( present & ( mask - 1 ) ); bits != 0; bits &= ( bits - 1 ) )
+				++rank;
+			return pgm_read_byte( layer + 2 * LAYER_BITMAP_LENGTH + rank );
 		}
-		m_modifiers = ( m_pressedModifiers | m_pressedStickyModifiers | m_stickyModifiers );
-		if ( m_oldModifiers != m_modifiers ) {
-
-			for ( unsigned int ii = 0; ii < 8; ++ii ) {
-
-				uint8_t const mask = ( 1u << ii );
-				bool const oldPressed = ( ( m_oldModifiers & mask ) != 0 );
-				bool const pressed = ( ( m_modifiers & mask ) != 0 );
-				if ( oldPressed != pressed ) {
-
-					USB::HID::Key const mappedCode = static_cast< USB::HID::Key >( USB::HID::KEY_LEFT_CONTROL + ii );
-					if ( pressed ) {
-
-						if ( ! ( ( m_pKeyboard != NULL ) && m_pKeyboard->PressKey( mappedCode ) ) )
-							if ( m_pKeyboardExtension != NULL )
-								m_pKeyboardExtension->PressKey( mappedCode );
-					}
-					else {
-
-						if ( m_pKeyboard != NULL )
-							m_pKeyboard->ReleaseKey( mappedCode );
-						if ( m_pKeyboardExtension != NULL )
-							m_pKeyboardExtension->ReleaseKey( mappedCode );
-					}
-				}
-			}
-			m_oldModifiers = m_modifiers;
-		}
-
-		memcpy( m_oldPressed, m_pressed, sizeof( m_oldPressed ) );
-		memset( m_pressed, 0, sizeof( m_pressed ) );
 
-		if ( m_pressedMouseDirections != 0 ) {
+		layer = m_layers[ 0 ];
+		if ( layer == NULL )
+			return 0;
+	}
+	return pgm_read_byte( layer + code );
+}
 
-			for ( unsigned int ii = 0; ii < 8; ++ii )
-				if ( m_pressedMouseDirections & ( 1u << ii ) )
-					VirtualMouseMove( ii, duration, m_mouseMoveMinimumTime, m_mouseMoveMaximumTime, m_mouseMoveMinimumVelocity, m_mouseMoveMaximumVelocity );
-			for ( unsigned int ii = 8; ii < 10; ++ii )
-				if ( m_pressedMouseDirections & ( 1u << ii ) )
-					VirtualMouseMove( ii, duration, m_mouseWheelMinimumTime, m_mouseWheelMaximumTime, m_mouseWheelMinimumVelocity, m_mouseWheelMaximumVelocity );
-		}
 
-		m_mouseButtons = ( m_pressedMouseButtons | m_toggledMouseButtons );
-		if ( m_pMouse != NULL ) {
+void Keymap::CacheLayer( uint8_t* const cache, uint8_t const index, bool const selected ) {
 
-			if ( m_mouseButtons != m_oldMouseButtons ) {
+	if ( m_layers[ index ] != NULL ) {
 
-				if ( ( m_mouseButtons & 1 ) != ( m_oldMouseButtons & 1 ) ) {
+		for ( unsigned int ii = 0; ii < KEYMAP_BASE_END; ++ii ) {
 
-					if ( m_mouseButtons & 1 )
-						m_pMouse->PressButton( USB::HID::BUTTON_1 );
-					else
-						m_pMouse->ReleaseButton( USB::HID::BUTTON_1 );
-				}
-				if ( ( m_mouseButtons & 2 ) != ( m_oldMouseButtons & 2 ) ) {
+			uint8_t assignment = LayerAssignment( index, ii );
+			if ( selected ) {
 
-					if ( m_mouseButtons & 2 )
-						m_pMouse->PressButton( USB::HID::BUTTON_2 );
-					else
-						m_pMouse->ReleaseButton( USB::HID::BUTTON_2 );
-				}
-				if ( ( m_mouseButtons & 4 ) != ( m_oldMouseButtons & 4 ) ) {
+				uint16_t const mapped = m_keycodes[ assignment ];
+				if ( ( mapped & KEYCODE_TYPE_MASK ) == KEYCODE_TYPE_VIRTUAL ) {
 
-					if ( m_mouseButtons & 4 )
-						m_pMouse->PressButton( USB::HID::BUTTON_3 );
-					else
-						m_pMouse->ReleaseButton( USB::HID::BUTTON_3 );
+					uint16_t const mappedCode = ( mapped & KEYCODE_CODE_MASK );
+					if ( ( mappedCode >= VIRTUAL_LAYER_SELECT ) && ( mappedCode < VIRTUAL_LAYER_SELECT + MAXIMUM_LAYERS ) )    // ignore new layer selection keypresses
+						assignment = 0;
 				}
-				m_oldMouseButtons = m_mouseButtons;
 			}
+			cache[ ii ] = assignment;
 		}
-
-		if ( m_pMouse != NULL ) {
-
-			for ( unsigned int ii = 0; ii < 3; ++ii ) {
-
-				if ( ! ( m_mouseMovement & ( 1u << ii ) ) )
-					m_mouseCoordinates[ ii ] = 0;
-			}
-			int16_t const mouseXX    = trunc( m_mouseCoordinates[ 0 ] );
-			int16_t const mouseYY    = trunc( m_mouseCoordinates[ 1 ] );
-			int16_t const mouseWheel = trunc( m_mouseCoordinates[ 2 ] );
-			if ( ( mouseXX != 0 ) || ( mouseYY != 0 ) || ( mouseWheel != 0 ) ) {
-
-				m_pMouse->Move( mouseXX, mouseYY, mouseWheel );
-				m_mouseCoordinates[ 0 ] -= mouseXX;
-				m_mouseCoordinates[ 1 ] -= mouseYY;
-				m_mouseCoordinates[ 2 ] -= mouseWheel;
-			}
-			m_mouseMovement = 0;
-		}
-
-		oldOverflows = overflows;
 	}
+	else
+		memset( cache, 0, KEYMAP_BASE_END );
 }
 
 
 void Keymap::VirtualMouseMoveStart( uint8_t const index ) {
 
+	if ( m_targets[ TARGET_MOUSE_DIRECTIONS ] == 0 )
+		m_mouseOverflows = Timer::Instance()->GetOverflows();
+
 	m_mouseMoveTime[ index ] = 0;
 	for ( unsigned int ii = 0; ii < 3; ++ii ) {
 
-		float const direction = pgm_read_float( g_mouseMoveDirection + index * 3 + ii );
+		int16_t const direction = pgm_read_word( g_mouseMoveDirection + index * 3 + ii );
 		if ( direction != 0 ) {
 
 			if ( direction > 0 )
-				++m_mouseCoordinates[ ii ];
+				m_mouseCoordinates[ ii ] += ( 1l << 16 );
 			else
-				--m_mouseCoordinates[ ii ];
+				m_mouseCoordinates[ ii ] -= ( 1l << 16 );
 			m_mouseMovement |= ( 1u << ii );
 		}
 	}
 }
 
 
-void Keymap::VirtualMouseMove(
-	uint8_t const index,
-	float const duration,
-	float const minimumTime,
-	float const maximumTime,
-	float const minimumVelocity,
-	float const maximumVelocity
-)
-{
-	float oldMouseTime = m_mouseMoveTime[ index ];
-	float newMouseTime = oldMouseTime + duration;
+void Keymap::VirtualMouseMove( uint8_t const index, uint8_t const duration, MouseCurve const* const curve ) {
 
-	float delta = 0;
-	if ( oldMouseTime < minimumTime )
-		delta += ( Min( newMouseTime, minimumTime ) - oldMouseTime ) * minimumVelocity;
-	if ( ( newMouseTime > minimumTime ) && ( oldMouseTime < maximumTime ) ) {
+	uint8_t const timeShift = pgm_read_byte( &curve->timeShift );
+	uint8_t const velocityShift = pgm_read_byte( &curve->velocityShift );
 
-		float const lowerTime = Max( oldMouseTime, minimumTime );
-		float const upperTime = Min( newMouseTime, maximumTime );
-		delta += ( upperTime - lowerTime ) * ( minimumVelocity + ( 0.5 * ( lowerTime + upperTime ) - minimumTime ) * ( maximumVelocity - minimumVelocity ) / ( maximumTime - minimumTime ) );
+	/*
+		Integrate with the midpoint rule, which is exact when the step doesn't
+		cross a knot of the curve. The midpoint is measured in half-overflows.
+	*/
+	uint16_t const oldTime = m_mouseMoveTime[ index ];
+	uint16_t const midpoint = ( ( oldTime << 1 ) + duration );
+	uint8_t const segment = ( midpoint >> ( timeShift + 1 ) );
+	uint16_t velocity;
+	if ( segment < MOUSE_CURVE_SEGMENTS ) {
+
+		uint16_t const lower = pgm_read_word( curve->velocity + segment );
+		uint16_t const upper = pgm_read_word( curve->velocity + segment + 1 );
+		uint16_t const fraction = ( midpoint & ( ( 2u << timeShift ) - 1 ) );
+		velocity = lower + ( ( ( static_cast< int32_t >( upper ) - lower ) * fraction ) >> ( timeShift + 1 ) );
 	}
-	if ( newMouseTime > maximumTime )
-		delta += ( newMouseTime - Max( oldMouseTime, maximumTime ) ) * maximumVelocity;
+	else
+		velocity = pgm_read_word( curve->velocity + MOUSE_CURVE_SEGMENTS );
 
 	for ( unsigned int ii = 0; ii < 3; ++ii ) {
 
-		float const direction = pgm_read_float( g_mouseMoveDirection + index * 3 + ii );
+		int16_t const direction = pgm_read_word( g_mouseMoveDirection + index * 3 + ii );
 		if ( direction != 0 ) {
 
-			m_mouseCoordinates[ ii ] += direction * delta;
+			// duration <= MOUSE_MAXIMUM_DURATION and velocityShift >= 8, so this fits in 31 bits
+			uint16_t const magnitude = ( ( direction > 0 ) ? direction : -direction );
+			int32_t const delta = ( ( ( ( static_cast< uint32_t >( velocity ) * magnitude ) >> 8 ) * duration ) << ( 16 - velocityShift ) );
+			if ( direction > 0 )
+				m_mouseCoordinates[ ii ] += delta;
+			else
+				m_mouseCoordinates[ ii ] -= delta;
 			m_mouseMovement |= ( 1u << ii );
 		}
 	}
 
-	m_mouseMoveTime[ index ] = Min( newMouseTime, maximumTime );
+	uint16_t const maximumTime = ( static_cast< uint16_t >( MOUSE_CURVE_SEGMENTS ) << timeShift );
+	uint16_t const newTime = oldTime + duration;
+	m_mouseMoveTime[ index ] = ( ( newTime < maximumTime ) ? newTime : maximumTime );
 }
 
 
@@ -639,154 +682,78 @@ void Keymap::VirtualTap( uint16_t const mappedCode, uint8_t const code ) {
 
 	if ( ( mappedCode >= VIRTUAL_LAYER_SELECT ) && ( mappedCode < VIRTUAL_LAYER_SELECT + MAXIMUM_LAYERS ) ) {
 
-		uint8_t const* const layer = m_layers[ mappedCode - VIRTUAL_LAYER_SELECT ];
-		if ( layer != NULL ) {
+		uint8_t const index = ( mappedCode - VIRTUAL_LAYER_SELECT );
+		if ( m_layers[ index ] != NULL ) {
 
-			uint8_t const assignment = pgm_read_byte( layer + code );
+			uint8_t const assignment = LayerAssignment( index, code );
 			if ( assignment != 0 ) {
 
-				uint16_t const layerMapped = ( ( assignment < KEYMAP_BASE_END ) ? pgm_read_word( g_baseKeymap + assignment ) : ( ( m_extendedKeymap != NULL ) ? pgm_read_word( m_extendedKeymap + assignment - KEYMAP_BASE_END ) : 0 ) );
-				if ( ( layerMapped & KEYCODE_TYPE_MASK ) != KEYCODE_TYPE_VIRTUAL ) {
-
-					uint8_t const index = ( assignment >> 4 );
-					uint16_t const mask = ( 1u << ( assignment & 15 ) );
-					m_pressed[ index ] |= mask;
-				}
+				uint16_t const layerMapped = m_keycodes[ assignment ];
+				if ( ( layerMapped & KEYCODE_TYPE_MASK ) != KEYCODE_TYPE_VIRTUAL )
+					Pulse( assignment );
 			}
 		}
 	}
-	else {
+	else if ( ( mappedCode >= VIRTUAL_ACTIONS_BEGIN ) && ( mappedCode < VIRTUAL_END ) ) {
 
-		switch( mappedCode ) {
+		VirtualAction const* const action = g_virtualActions + ( mappedCode - VIRTUAL_ACTIONS_BEGIN );
+		if ( pgm_read_byte( &action->operation ) & ACTION_STICKY ) {
 
-			case VIRTUAL_STICKY_LEFT_CONTROL:  { m_stickyModifiers ^= ( 1u << 0 ); m_unstickyModifiers &= ~( 1u << 0 ); break; }
-			case VIRTUAL_STICKY_LEFT_SHIFT:    { m_stickyModifiers ^= ( 1u << 1 ); m_unstickyModifiers &= ~( 1u << 1 ); break; }
-			case VIRTUAL_STICKY_LEFT_ALT:      { m_stickyModifiers ^= ( 1u << 2 ); m_unstickyModifiers &= ~( 1u << 2 ); break; }
-			case VIRTUAL_STICKY_LEFT_GUI:      { m_stickyModifiers ^= ( 1u << 3 ); m_unstickyModifiers &= ~( 1u << 3 ); break; }
-			case VIRTUAL_STICKY_RIGHT_CONTROL: { m_stickyModifiers ^= ( 1u << 4 ); m_unstickyModifiers &= ~( 1u << 4 ); break; }
-			case VIRTUAL_STICKY_RIGHT_SHIFT:   { m_stickyModifiers ^= ( 1u << 5 ); m_unstickyModifiers &= ~( 1u << 5 ); break; }
-			case VIRTUAL_STICKY_RIGHT_ALT:     { m_stickyModifiers ^= ( 1u << 6 ); m_unstickyModifiers &= ~( 1u << 6 ); break; }
-			case VIRTUAL_STICKY_RIGHT_GUI:     { m_stickyModifiers ^= ( 1u << 7 ); m_unstickyModifiers &= ~( 1u << 7 ); break; }
+			uint8_t const mask = ( 1u << pgm_read_byte( &action->bit ) );
+			m_stickyModifiers ^= mask;
+			m_unstickyModifiers &= ~mask;
 		}
 	}
 }
 
 
-void Keymap::VirtualPress( uint16_t const mappedCode ) {
+void Keymap::VirtualTransition( uint16_t const mappedCode, bool const pressed ) {
 
 	if ( ( mappedCode >= VIRTUAL_LAYER_SELECT ) && ( mappedCode < VIRTUAL_LAYER_SELECT + MAXIMUM_LAYERS ) )
-		m_layerSelected = mappedCode - VIRTUAL_LAYER_SELECT;
-	else if ( ( mappedCode >= VIRTUAL_LAYER_LOCK ) && ( mappedCode < VIRTUAL_LAYER_LOCK + MAXIMUM_LAYERS ) )
-		m_layerLocked = mappedCode - VIRTUAL_LAYER_LOCK;
-	else {
-
-		switch( mappedCode ) {
-
-			case VIRTUAL_LOCKING_CAPS_LOCK: {
-
-				if ( ( m_pKeyboard != NULL ) && ( ! m_pKeyboard->GetLED( USB::HID::LED_CAPS_LOCK ) ) )
-					m_pressed[ KEYMAP_KEYBOARD_CAPS_LOCK >> 4 ] |= ( 1u << ( KEYMAP_KEYBOARD_CAPS_LOCK & 15 ) );
-				break;
-			}
-
-			case VIRTUAL_LOCKING_NUM_LOCK: {
-
-				if ( ( m_pKeyboard != NULL ) && ( ! m_pKeyboard->GetLED( USB::HID::LED_NUM_LOCK ) ) )
-					m_pressed[ KEYMAP_KEYBOARD_NUM_LOCK >> 4 ] |= ( 1u << ( KEYMAP_KEYBOARD_NUM_LOCK & 15 ) );
-				break;
-			}
-
-			case VIRTUAL_LOCKING_SCROLL_LOCK: {
+		m_layerSelected = ( pressed ? ( mappedCode - VIRTUAL_LAYER_SELECT ) : 0xff );
+	else if ( ( mappedCode >= VIRTUAL_LAYER_LOCK ) && ( mappedCode < VIRTUAL_LAYER_LOCK + MAXIMUM_LAYERS ) ) {
 
-				if ( ( m_pKeyboard != NULL ) && ( ! m_pKeyboard->GetLED( USB::HID::LED_SCROLL_LOCK ) ) )
-					m_pressed[ KEYMAP_KEYBOARD_SCROLL_LOCK >> 4 ] |= ( 1u << ( KEYMAP_KEYBOARD_SCROLL_LOCK & 15 ) );
-				break;
-			}
-
-			case VIRTUAL_STICKY_LEFT_CONTROL:  { m_pressedStickyModifiers |= ( 1u << 0 ); break; }
-			case VIRTUAL_STICKY_LEFT_SHIFT:    { m_pressedStickyModifiers |= ( 1u << 1 ); break; }
-			case VIRTUAL_STICKY_LEFT_ALT:      { m_pressedStickyModifiers |= ( 1u << 2 ); break; }
-			case VIRTUAL_STICKY_LEFT_GUI:      { m_pressedStickyModifiers |= ( 1u << 3 ); break; }
-			case VIRTUAL_STICKY_RIGHT_CONTROL: { m_pressedStickyModifiers |= ( 1u << 4 ); break; }
-			case VIRTUAL_STICKY_RIGHT_SHIFT:   { m_pressedStickyModifiers |= ( 1u << 5 ); break; }
-			case VIRTUAL_STICKY_RIGHT_ALT:     { m_pressedStickyModifiers |= ( 1u << 6 ); break; }
-			case VIRTUAL_STICKY_RIGHT_GUI:     { m_pressedStickyModifiers |= ( 1u << 7 ); break; }
-
-			case VIRTUAL_MOUSE_N:          { VirtualMouseMoveStart( 0 ); m_pressedMouseDirections |= ( 1u << 0 ); break; }
-			case VIRTUAL_MOUSE_NE:         { VirtualMouseMoveStart( 1 ); m_pressedMouseDirections |= ( 1u << 1 ); break; }
-			case VIRTUAL_MOUSE_E:          { VirtualMouseMoveStart( 2 ); m_pressedMouseDirections |= ( 1u << 2 ); break; }
-			case VIRTUAL_MOUSE_SE:         { VirtualMouseMoveStart( 3 ); m_pressedMouseDirections |= ( 1u << 3 ); break; }
-			case VIRTUAL_MOUSE_S:          { VirtualMouseMoveStart( 4 ); m_pressedMouseDirections |= ( 1u << 4 ); break; }
-			case VIRTUAL_MOUSE_SW:         { VirtualMouseMoveStart( 5 ); m_pressedMouseDirections |= ( 1u << 5 ); break; }
-			case VIRTUAL_MOUSE_W:          { VirtualMouseMoveStart( 6 ); m_pressedMouseDirections |= ( 1u << 6 ); break; }
-			case VIRTUAL_MOUSE_NW:         { VirtualMouseMoveStart( 7 ); m_pressedMouseDirections |= ( 1u << 7 ); break; }
-			case VIRTUAL_MOUSE_WHEEL_UP:   { VirtualMouseMoveStart( 8 ); m_pressedMouseDirections |= ( 1u << 8 ); break; }
-			case VIRTUAL_MOUSE_WHEEL_DOWN: { VirtualMouseMoveStart( 9 ); m_pressedMouseDirections |= ( 1u << 9 ); break; }
-
-			case VIRTUAL_MOUSE_BUTTON_1_PRESS: { m_pressedMouseButtons |= ( 1u << 0 ); break; }
-			case VIRTUAL_MOUSE_BUTTON_2_PRESS: { m_pressedMouseButtons |= ( 1u << 1 ); break; }
-			case VIRTUAL_MOUSE_BUTTON_3_PRESS: { m_pressedMouseButtons |= ( 1u << 2 ); break; }
-
-			case VIRTUAL_MOUSE_BUTTON_1_TOGGLE: { m_toggledMouseButtons ^= ( 1u << 0 ); break; }
-			case VIRTUAL_MOUSE_BUTTON_2_TOGGLE: { m_toggledMouseButtons ^= ( 1u << 1 ); break; }
-			case VIRTUAL_MOUSE_BUTTON_3_TOGGLE: { m_toggledMouseButtons ^= ( 1u << 2 ); break; }
-		}
+		if ( pressed )
+			m_layerLocked = mappedCode - VIRTUAL_LAYER_LOCK;
 	}
-}
+	else if ( ( mappedCode >= VIRTUAL_ACTIONS_BEGIN ) && ( mappedCode < VIRTUAL_END ) ) {
 
+		VirtualAction const* const action = g_virtualActions + ( mappedCode - VIRTUAL_ACTIONS_BEGIN );
+		uint8_t const operation = ( pgm_read_byte( &action->operation ) & ACTION_OPERATION_MASK );
+		uint8_t const target = pgm_read_byte( &action->target );
+		uint8_t const bit = pgm_read_byte( &action->bit );
 
-void Keymap::VirtualRelease( uint16_t const mappedCode ) {
+		switch( operation ) {
 
-	if ( ( mappedCode >= VIRTUAL_LAYER_SELECT ) && ( mappedCode < VIRTUAL_LAYER_SELECT + MAXIMUM_LAYERS ) )
-		m_layerSelected = 0xff;
-	else {
+			case ACTION_MOUSE: {
 
-		switch( mappedCode ) {
+				if ( pressed )
+					VirtualMouseMoveStart( bit );
+				// fall through
+			}
 
-			case VIRTUAL_LOCKING_CAPS_LOCK: {
+			case ACTION_HOLD: {
 
-				if ( ( m_pKeyboard != NULL ) && m_pKeyboard->GetLED( USB::HID::LED_CAPS_LOCK ) )
-					m_pressed[ KEYMAP_KEYBOARD_CAPS_LOCK >> 4 ] |= ( 1u << ( KEYMAP_KEYBOARD_CAPS_LOCK & 15 ) );
+				if ( pressed )
+					m_targets[ target ] |= ( 1u << bit );
+				else
+					m_targets[ target ] &= ~( 1u << bit );
 				break;
 			}
 
-			case VIRTUAL_LOCKING_NUM_LOCK: {
+			case ACTION_TOGGLE: {
 
-				if ( ( m_pKeyboard != NULL ) && m_pKeyboard->GetLED( USB::HID::LED_NUM_LOCK ) )
-					m_pressed[ KEYMAP_KEYBOARD_NUM_LOCK >> 4 ] |= ( 1u << ( KEYMAP_KEYBOARD_NUM_LOCK & 15 ) );
+				if ( pressed )
+					m_targets[ target ] ^= ( 1u << bit );
 				break;
 			}
 
-			case VIRTUAL_LOCKING_SCROLL_LOCK: {
+			case ACTION_LOCKING: {
 
-				if ( ( m_pKeyboard != NULL ) && m_pKeyboard->GetLED( USB::HID::LED_SCROLL_LOCK ) )
-					m_pressed[ KEYMAP_KEYBOARD_SCROLL_LOCK >> 4 ] |= ( 1u << ( KEYMAP_KEYBOARD_SCROLL_LOCK & 15 ) );
+				if ( ( ( m_leds & ( 1u << bit ) ) != 0 ) != pressed )
+					Pulse( target );
 				break;
 			}
-
-			case VIRTUAL_STICKY_LEFT_CONTROL:  { m_pressedStickyModifiers &= ~( 1u << 0 ); break; }
-			case VIRTUAL_STICKY_LEFT_SHIFT:    { m_pressedStickyModifiers &= ~( 1u << 1 ); break; }
-			case VIRTUAL_STICKY_LEFT_ALT:      { m_pressedStickyModifiers &= ~( 1u << 2 ); break; }
-			case VIRTUAL_STICKY_LEFT_GUI:      { m_pressedStickyModifiers &= ~( 1u << 3 ); break; }
-			case VIRTUAL_STICKY_RIGHT_CONTROL: { m_pressedStickyModifiers &= ~( 1u << 4 ); break; }
-			case VIRTUAL_STICKY_RIGHT_SHIFT:   { m_pressedStickyModifiers &= ~( 1u << 5 ); break; }
-			case VIRTUAL_STICKY_RIGHT_ALT:     { m_pressedStickyModifiers &= ~( 1u << 6 ); break; }
-			case VIRTUAL_STICKY_RIGHT_GUI:     { m_pressedStickyModifiers &= ~( 1u << 7 ); break; }
-
-			case VIRTUAL_MOUSE_N:          { m_pressedMouseDirections &= ~( 1u << 0 ); break; }
-			case VIRTUAL_MOUSE_NE:         { m_pressedMouseDirections &= ~( 1u << 1 ); break; }
-			case VIRTUAL_MOUSE_E:          { m_pressedMouseDirections &= ~( 1u << 2 ); break; }
-			case VIRTUAL_MOUSE_SE:         { m_pressedMouseDirections &= ~( 1u << 3 ); break; }
-			case VIRTUAL_MOUSE_S:          { m_pressedMouseDirections &= ~( 1u << 4 ); break; }
-			case VIRTUAL_MOUSE_SW:         { m_pressedMouseDirections &= ~( 1u << 5 ); break; }
-			case VIRTUAL_MOUSE_W:          { m_pressedMouseDirections &= ~( 1u << 6 ); break; }
-			case VIRTUAL_MOUSE_NW:         { m_pressedMouseDirections &= ~( 1u << 7 ); break; }
-			case VIRTUAL_MOUSE_WHEEL_UP:   { m_pressedMouseDirections &= ~( 1u << 8 ); break; }
-			case VIRTUAL_MOUSE_WHEEL_DOWN: { m_pressedMouseDirections &= ~( 1u << 9 ); break; }
-
-			case VIRTUAL_MOUSE_BUTTON_1_PRESS: { m_pressedMouseButtons &= ~( 1u << 0 ); break; }
-			case VIRTUAL_MOUSE_BUTTON_2_PRESS: { m_pressedMouseButtons &= ~( 1u << 1 ); break; }
-			case VIRTUAL_MOUSE_BUTTON_3_PRESS: { m_pressedMouseButtons &= ~( 1u << 2 ); break; }
 		}
 	}
 }
@@ -33,6 +33,7 @@
 
 
 #include "usb.hh"
+#include "latency_trace.hh"
 #include "helpers.h"
 
 #include <inttypes.h>
@@ -179,6 +180,80 @@ enum {
 
 
 
+namespace _Private {
+
+
+
+
+//============================================================================
+//    KeymapSink structure
+//============================================================================
+
+
+/**
+	\brief Forwards the output of a HIDKeymap to a USB HID interface
+
+	The void specialization stands in for an interface which doesn't exist.
+*/
+template< typename t_Interface >
+struct KeymapSink {
+
+	static inline bool const Snapshot( t_Interface* const pInterface ) { return pInterface->Snapshot(); }
+	static inline bool const Flush( t_Interface* const pInterface ) { return pInterface->Flush(); }
+	static inline bool const GetImmediate( t_Interface* const pInterface ) { return pInterface->GetImmediate(); }
+
+	static inline uint8_t const GetLEDs( t_Interface* const pInterface ) {
+
+		uint8_t leds = 0;
+		if ( pInterface->GetLED( USB::HID::LED_NUM_LOCK ) )
+			leds |= ( 1u << USB::HID::LED_NUM_LOCK );
+		if ( pInterface->GetLED( USB::HID::LED_CAPS_LOCK ) )
+			leds |= ( 1u << USB::HID::LED_CAPS_LOCK );
+		if ( pInterface->GetLED( USB::HID::LED_SCROLL_LOCK ) )
+			leds |= ( 1u << USB::HID::LED_SCROLL_LOCK );
+		return leds;
+	}
+
+	static inline bool const PressKey( t_Interface* const pInterface, USB::HID::Key const key ) { return pInterface->PressKey( key ); }
+	static inline void ReleaseKey( t_Interface* const pInterface, USB::HID::Key const key ) { pInterface->ReleaseKey( key ); }
+
+	static inline void PressConsumer( t_Interface* const pInterface, USB::HID::Consumer const consumer ) { pInterface->PressConsumer( consumer ); }
+	static inline void ReleaseConsumer( t_Interface* const pInterface, USB::HID::Consumer const consumer ) { pInterface->ReleaseConsumer( consumer ); }
+
+	static inline void PressButton( t_Interface* const pInterface, USB::HID::Button const button ) { pInterface->PressButton( button ); }
+	static inline void ReleaseButton( t_Interface* const pInterface, USB::HID::Button const button ) { pInterface->ReleaseButton( button ); }
+	static inline void Move( t_Interface* const pInterface, int const xx, int const yy, int const wheel ) { pInterface->Move( xx, yy, wheel ); }
+};
+
+
+template<>
+struct KeymapSink< void > {
+
+	static inline bool const Snapshot( void* const ) { return true; }
+	static inline bool const Flush( void* const ) { return true; }
+	static inline bool const GetImmediate( void* const ) { return false; }
+
+	static inline uint8_t const GetLEDs( void* const ) { return 0; }
+
+	static inline bool const PressKey( void* const, USB::HID::Key const ) { return false; }
+	static inline void ReleaseKey( void* const, USB::HID::Key const ) { }
+
+	static inline void PressConsumer( void* const, USB::HID::Consumer const ) { }
+	static inline void ReleaseConsumer( void* const, USB::HID::Consumer const ) { }
+
+	static inline void PressButton( void* const, USB::HID::Button const ) { }
+	static inline void ReleaseButton( void* const, USB::HID::Button const ) { }
+	static inline void Move( void* const, int const, int const, int const ) { }
+};
+
+
+
+
+}    // namespace _Private
+
+
+
+
 //============================================================================
 //    Keymap class
 //============================================================================
@@ -188,6 +263,24 @@ struct Keymap {
 
 	enum { MAXIMUM_LAYERS = 16 };
 
+	/**
+		\brief Length of the presence bitmap of a sparse layer
+
+		A sparse layer ( as written by tools/keymapc ) consists of a bitmap
+		with one bit for each code, followed by one byte for each byte of the
+		bitmap holding the number of bits set in the preceding bytes, followed
+		by the assignments of the codes whose bits are set, in code order.
+		Codes whose bits are clear are transparent, and take their assignments
+		from layer 0, which must be a full layer.
+	*/
+	enum { LAYER_BITMAP_LENGTH = ( KEYMAP_BASE_END + 7 ) / 8 };
+
+	enum { MAXIMUM_MACROS = 16 };
+
+	enum { MOUSE_CURVE_SEGMENTS = 32 };
+	enum { MOUSE_CURVE_MAXIMUM_TIME_SHIFT = 9 };
+	enum { MOUSE_MAXIMUM_DURATION = 64 };
+
 	enum {
 
 		KEYCODE_CODE_MASK = 0x0fff,
@@ -195,6 +288,7 @@ struct Keymap {
 
 		KEYCODE_TYPE_KEYBOARD = 0x0000,
 		KEYCODE_TYPE_CONSUMER = 0x1000,
+		KEYCODE_TYPE_MACRO    = 0x2000,
 		KEYCODE_TYPE_VIRTUAL  = 0xf000
 
 	};
@@ -234,98 +328,358 @@ struct Keymap {
 		VIRTUAL_MOUSE_BUTTON_2_TOGGLE,
 		VIRTUAL_MOUSE_BUTTON_3_TOGGLE,
 
+		VIRTUAL_END
+
 	};
 
+	/// virtual codes from here on are handled by the action table
+	enum { VIRTUAL_ACTIONS_BEGIN = VIRTUAL_LOCKING_CAPS_LOCK };
 
-	Keymap(
-		USB::HID::Mouse* const pMouse,
-		USB::HID::Keyboard* const pKeyboard,
-		USB::HID::KeyboardExtension* const pKeyboardExtension,
-		float const mouseMoveMinimumTime,
-		float const mouseMoveMaximumTime,
-		float const mouseMoveMinimumVelocity,
-		float const mouseMoveMaximumVelocity,
-		float const mouseWheelMinimumTime,
-		float const mouseWheelMaximumTime,
-		float const mouseWheelMinimumVelocity,
-		float const mouseWheelMaximumVelocity,
-		uint16_t const* const extendedKeymap = NULL
-	);
+
+	/// virtual action operations
+	enum {
+
+		ACTION_HOLD,       // set the target bit on press, and clear it on release
+		ACTION_TOGGLE,     // toggle the target bit on press
+		ACTION_MOUSE,      // as ACTION_HOLD, and also start moving in mouse direction bit
+		ACTION_LOCKING,    // pulse the target assignment if LED bit doesn't match the key state
+
+		ACTION_OPERATION_MASK = 0x7f,
+		ACTION_STICKY         = 0x80    // a tap toggles sticky modifier bit
+
+	};
+
+	/// state words which virtual actions operate on
+	enum {
+
+		TARGET_STICKY_MODIFIERS,
+		TARGET_MOUSE_DIRECTIONS,
+		TARGET_MOUSE_BUTTONS,
+		TARGET_TOGGLED_MOUSE_BUTTONS,
+
+		TARGET_END
+
+	};
+
+	/// virtual action table entry
+	struct VirtualAction {
+
+		uint8_t operation;
+		uint8_t target;
+		uint8_t bit;
+	};
+
+
+	/**
+		\brief Mouse key acceleration curve
+
+		Lives in PROGMEM, and should be built with the KEYMAP_MOUSE_CURVE macro.
+		Entry i of velocity is the speed ( in units of 2^-velocityShift counts
+		per timer overflow ) after the key has been held for ( i << timeShift )
+		timer overflows, with linear interpolation in between, and the last
+		entry holding forever after.
+	*/
+	struct MouseCurve {
+
+		uint8_t timeShift;
+		uint8_t velocityShift;
+		uint16_t velocity[ MOUSE_CURVE_SEGMENTS + 1 ];
+	};
+
+
+	/**
+		\brief Sets ( or clears, if layer is NULL ) a layer
+
+		\param layer   PROGMEM layer table
+		\param sparse  true if layer is in the sparse format, instead of
+		               holding one assignment for each code
+	*/
+	inline void SetLayer( uint8_t const index, uint8_t const* const layer = NULL, bool const sparse = false );
 
 
-	inline void SetLayer( uint8_t const index, uint8_t const* const layer = NULL );
+	/**
+		\brief Sets ( or clears, if macro is NULL ) a macro
+
+		A macro is a PROGMEM sequence of USB::HID::Key usages, terminated by
+		zero. Each ordinary key is tapped, i.e. pressed in one report and
+		released in the next. A modifier ( KEY_LEFT_CONTROL to KEY_RIGHT_GUI )
+		is toggled instead, and changes along with the next key press, so for
+		example "KEY_LEFT_SHIFT, KEY_H, KEY_LEFT_SHIFT, KEY_I" types "Hi".
+		Modifiers left pressed are released at the end.
+
+		Pressing an assignment with keycode KEYCODE_MACRO( index ) plays the
+		macro, unless one is already playing. Keymap processing is suspended
+		until it finishes.
+	*/
+	inline void SetMacro( uint8_t const index, uint8_t const* const macro = NULL );
 
 
 	void Press( uint8_t const code );
 	void Release( uint8_t const code );
 
 
-	void Update();
+protected:
+
+	enum { OUTPUT_BUFFER_LENGTH = 16 };
+
+
+	Keymap(
+		MouseCurve const* const mouseMoveCurve,
+		MouseCurve const* const mouseWheelCurve,
+		uint16_t const* const extendedKeymap = NULL,
+		uint8_t const extendedKeymapLength = 0
+	);
+
+
+	/// \brief True if Process() would do nothing
+	inline bool const IsIdle() const;
+
+	/// \brief True if PlayMacro() should be called instead of Process()
+	inline bool const IsPlayingMacro() const;
+
+	/**
+		\brief Handles all pending presses and releases
+
+		Afterwards, m_outputs holds the keyboard and consumer keycodes which
+		changed state, and m_modifiers, m_mouseButtons and m_mouseCounts hold
+		the rest of the output.
+
+		\param leds  bitmask of the keyboard LEDs ( bit i is USB::HID::LED i )
+	*/
+	void Process( uint8_t const leds );
+
+	/**
+		\brief Advances the playing macro by one report
+
+		Like Process(), leaves the transitions in m_outputs, except that
+		modifiers are included there as keys, and m_modifiers is untouched.
+	*/
+	void PlayMacro();
+
+
+	uint16_t m_outputs[ OUTPUT_BUFFER_LENGTH ];
+	uint8_t m_outputCount;
+	uint16_t m_outputPressed;    // bit i is set if m_outputs[ i ] was pressed
+
+	uint8_t m_modifiers;
+	uint8_t m_mouseButtons;
+	int16_t m_mouseCounts[ 3 ];
 
 
 private:
 
+	uint8_t const LayerAssignment( uint8_t const index, uint8_t const code ) const;
+	void CacheLayer( uint8_t* const cache, uint8_t const index, bool const selected );
+
+	inline void Enqueue( uint8_t const assignment );
+	inline void Pulse( uint8_t const assignment );
+
+	void OutputTransition( uint16_t const mapped, bool const pressed );
+
 	void VirtualMouseMoveStart( uint8_t const index );
-	void VirtualMouseMove(
-		uint8_t const index,
-		float const duration,
-		float const minimumTime,
-		float const maximumTime,
-		float const minimumVelocity,
-		float const maximumVelocity
-	);
+	void VirtualMouseMove( uint8_t const index, uint8_t const duration, MouseCurve const* const curve );
 
 	void VirtualTap( uint16_t const mappedCode, uint8_t const code );
-	void VirtualPress( uint16_t const mappedCode );
-	void VirtualRelease( uint16_t const mappedCode );
-
+	void VirtualTransition( uint16_t const mappedCode, bool const pressed );
 
-	USB::HID::Mouse* m_pMouse;
-	USB::HID::Keyboard* m_pKeyboard;
-	USB::HID::KeyboardExtension* m_pKeyboardExtension;
 
-	uint16_t const* m_extendedKeymap;
 	uint8_t const* m_layers[ MAXIMUM_LAYERS ];
+	uint16_t m_sparseLayers;    // bit i is set if layer i is sparse
+
+	uint8_t const* m_macros[ MAXIMUM_MACROS ];
+	uint8_t const* m_macro;        // next usage of the playing macro, or NULL
+	uint8_t m_macroKey;            // key to release in the next report, or zero
+	uint8_t m_macroModifiers;      // modifiers pressed by the macro
+
+	// resolved keycode of every assignment, from g_baseKeymap or the extended keymap
+	uint16_t m_keycodes[ 256 ];
+
+	// code -> assignment tables for the selected and locked layers, rebuilt on layer change
+	uint8_t m_selectedLayerAssignments[ KEYMAP_BASE_END ];
+	uint8_t m_lockedLayerAssignments[ KEYMAP_BASE_END ];
+	uint8_t m_selectedLayerCached;
+	uint8_t m_lockedLayerCached;
+
+	uint8_t m_assignments[ 256 ];    // code -> assignment, for held codes
+	uint8_t m_counts[ 256 ];         // number of held codes on each assignment
+
+	uint16_t m_pressed[ 16 ];    // assignments which have been reported as pressed
+	uint16_t m_pulsed[ 16 ];     // assignments to report as pressed for a single update
 
-	uint16_t m_oldPressed[ 16 ];
-	uint16_t m_pressed[ 16 ];
+	// queue of assignments which might need to change state, with a bitmap to avoid duplicates
+	uint8_t m_queue[ 256 ];
+	uint16_t m_queued[ 16 ];
+	uint8_t m_queueHead;
+	uint8_t m_queueTail;
 
-	uint8_t m_assignments[ 256 ];
-	uint16_t m_active[ 16 ];
+	uint8_t m_newCode;
+	uint8_t m_lastCode;
+	uint8_t m_lastAssignment;
 
 	uint8_t m_layerSelected;
 	uint8_t m_layerLocked;
 
 	uint16_t m_normalKeypresses;
 	uint8_t m_pressedModifiers;
-	uint8_t m_pressedStickyModifiers;
 	uint8_t m_stickyModifiers;
 	uint8_t m_unstickyModifiers;
-	uint8_t m_modifiers;
-	uint8_t m_oldModifiers;
 
-	float m_mouseMoveMinimumTime;
-	float m_mouseMoveMaximumTime;
-	float m_mouseMoveMinimumVelocity;
-	float m_mouseMoveMaximumVelocity;
+	uint8_t m_leds;
 
-	float m_mouseWheelMinimumTime;
-	float m_mouseWheelMaximumTime;
-	float m_mouseWheelMinimumVelocity;
-	float m_mouseWheelMaximumVelocity;
+	MouseCurve const* m_mouseMoveCurve;
+	MouseCurve const* m_mouseWheelCurve;
 
-	float m_mouseMoveTime[ 10 ];
-	float m_mouseCoordinates[ 3 ];
+	uint16_t m_mouseOverflows;
+	uint16_t m_mouseMoveTime[ 10 ];
+	int32_t m_mouseCoordinates[ 3 ];    // Q16.16
 	uint8_t m_mouseMovement;
 
-	uint16_t m_pressedMouseDirections;
-	uint8_t m_pressedMouseButtons;
-	uint8_t m_toggledMouseButtons;
-	uint8_t m_mouseButtons;
+	uint16_t m_targets[ TARGET_END ];
+};
+
+
+
+
+//============================================================================
+//    HIDKeymap class
+//============================================================================
+
+
+/**
+	\brief Keymap which sends its output to USB HID interfaces
+
+	Any of the interface types may be void, in which case that interface
+	doesn't exist, and the code which would have used it isn't compiled.
+	Calls to the interfaces are direct, and can be inlined.
+
+	Key presses go to the keyboard if possible, and otherwise to the keyboard
+	extension.
+*/
+template< typename t_Mouse, typename t_Keyboard, typename t_KeyboardExtension >
+struct HIDKeymap : public Keymap {
+
+	inline HIDKeymap(
+		t_Mouse* const pMouse,
+		t_Keyboard* const pKeyboard,
+		t_KeyboardExtension* const pKeyboardExtension,
+		MouseCurve const* const mouseMoveCurve,
+		MouseCurve const* const mouseWheelCurve,
+		uint16_t const* const extendedKeymap = NULL,
+		uint8_t const extendedKeymapLength = 0
+	);
+
+
+	inline void Update();
+
+
+private:
+
+	typedef _Private::KeymapSink< t_Mouse > MouseSink;
+	typedef _Private::KeymapSink< t_Keyboard > KeyboardSink;
+	typedef _Private::KeymapSink< t_KeyboardExtension > KeyboardExtensionSink;
+
+
+	inline void Output();
+
+	inline void PressKey( USB::HID::Key const key );
+	inline void ReleaseKey( USB::HID::Key const key );
+
+
+	t_Mouse* m_pMouse;
+	t_Keyboard* m_pKeyboard;
+	t_KeyboardExtension* m_pKeyboardExtension;
+
+	uint8_t m_oldModifiers;
 	uint8_t m_oldMouseButtons;
+
+
+	inline HIDKeymap( HIDKeymap const& other );
+	inline HIDKeymap const& operator=( HIDKeymap const& other );
+};
+
+
+
+
+namespace _Private {
+
+
+
+
+//============================================================================
+//    Mouse curve helpers
+//============================================================================
+
+
+template< unsigned int... t_Indices >
+struct MouseCurveIndices { };
+
+
+template< unsigned int t_Count, unsigned int... t_Indices >
+struct MakeMouseCurveIndices : public MakeMouseCurveIndices< t_Count - 1, t_Count - 1, t_Indices... > { };
+
+
+template< unsigned int... t_Indices >
+struct MakeMouseCurveIndices< 0, t_Indices... > {
+
+	typedef MouseCurveIndices< t_Indices... > Type;
 };
 
 
+/// timer 1 is unprescaled, so it overflows every 65536 cycles
+constexpr double MouseCurveOverflowRate() {
+
+	return( F_CPU / 65536.0 );
+}
+
+
+constexpr uint8_t MouseCurveTimeShift( double const maximumTime, uint8_t const shift = 0 ) {
+
+	return( ( ( ( static_cast< unsigned long >( Keymap::MOUSE_CURVE_SEGMENTS ) << shift ) >= maximumTime * MouseCurveOverflowRate() ) || ( shift >= Keymap::MOUSE_CURVE_MAXIMUM_TIME_SHIFT ) ) ? shift : MouseCurveTimeShift( maximumTime, shift + 1 ) );
+}
+
+
+/// largest shift ( at most 16, at least 8 ) for which the fastest speed fits in 16 bits
+constexpr uint8_t MouseCurveVelocityShift( double const minimumVelocity, double const maximumVelocity, uint8_t const shift = 16 ) {
+
+	return( ( ( ( ( ( minimumVelocity > maximumVelocity ) ? minimumVelocity : maximumVelocity ) / MouseCurveOverflowRate() ) * ( 1ul << shift ) < 65535 ) || ( shift <= 8 ) ) ? shift : MouseCurveVelocityShift( minimumVelocity, maximumVelocity, shift - 1 ) );
+}
+
+
+constexpr uint16_t MouseCurveVelocity(
+	double const time,
+	double const minimumTime,
+	double const maximumTime,
+	double const minimumVelocity,
+	double const maximumVelocity,
+	uint8_t const velocityShift
+)
+{
+	return( ( ( ( time <= minimumTime ) ? minimumVelocity : ( ( time >= maximumTime ) ? maximumVelocity : ( minimumVelocity + ( time - minimumTime ) * ( maximumVelocity - minimumVelocity ) / ( maximumTime - minimumTime ) ) ) ) / MouseCurveOverflowRate() ) * ( 1ul << velocityShift ) + 0.5 );
+}
+
+
+template< unsigned int... t_Indices >
+constexpr Keymap::MouseCurve MakeMouseCurve(
+	MouseCurveIndices< t_Indices... > const,
+	double const minimumTime,
+	double const maximumTime,
+	double const minimumVelocity,
+	double const maximumVelocity
+)
+{
+	return Keymap::MouseCurve{
+		MouseCurveTimeShift( maximumTime ),
+		MouseCurveVelocityShift( minimumVelocity, maximumVelocity ),
+		{ MouseCurveVelocity( ( static_cast< unsigned long >( t_Indices ) << MouseCurveTimeShift( maximumTime ) ) / MouseCurveOverflowRate(), minimumTime, maximumTime, minimumVelocity, maximumVelocity, MouseCurveVelocityShift( minimumVelocity, maximumVelocity ) )... }
+	};
+}
+
+
+
+
+}    // namespace _Private
+
+
 
 
 //============================================================================
@@ -333,10 +687,222 @@ private:
 //============================================================================
 
 
-void Keymap::SetLayer( uint8_t const index, uint8_t const* const layer ) {
+void Keymap::SetLayer( uint8_t const index, uint8_t const* const layer, bool const sparse ) {
+
+	if ( index < MAXIMUM_LAYERS ) {
 
-	if ( index < MAXIMUM_LAYERS )
 		m_layers[ index ] = layer;
+		if ( sparse && ( index != 0 ) )
+			m_sparseLayers |= ( 1u << index );
+		else
+			m_sparseLayers &= ~( 1u << index );
+		if ( index == 0 ) {    // every sparse layer falls through to layer 0
+
+			m_selectedLayerCached = 0xff;
+			m_lockedLayerCached = 0xff;
+		}
+		if ( m_selectedLayerCached == index )
+			m_selectedLayerCached = 0xff;
+		if ( m_lockedLayerCached == index )
+			m_lockedLayerCached = 0xff;
+	}
+}
+
+
+void Keymap::SetMacro( uint8_t const index, uint8_t const* const macro ) {
+
+	if ( index < MAXIMUM_MACROS )
+		m_macros[ index ] = macro;
+}
+
+
+bool const Keymap::IsIdle() const {
+
+	return( ( m_queueHead == m_queueTail ) && ( m_targets[ TARGET_MOUSE_DIRECTIONS ] == 0 ) && ( m_macro == NULL ) );
+}
+
+
+bool const Keymap::IsPlayingMacro() const {
+
+	return( m_macro != NULL );
+}
+
+
+void Keymap::Enqueue( uint8_t const assignment ) {
+
+	uint8_t const index = ( assignment >> 4 );
+	uint16_t const mask = ( 1u << ( assignment & 15 ) );
+	if ( ! ( m_queued[ index ] & mask ) ) {
+
+		m_queued[ index ] |= mask;
+		m_queue[ m_queueTail++ ] = assignment;
+	}
+}
+
+
+void Keymap::Pulse( uint8_t const assignment ) {
+
+	m_pulsed[ assignment >> 4 ] |= ( 1u << ( assignment & 15 ) );
+	Enqueue( assignment );
+}
+
+
+
+
+//============================================================================
+//    HIDKeymap inline methods
+//============================================================================
+
+
+template< typename t_Mouse, typename t_Keyboard, typename t_KeyboardExtension >
+HIDKeymap< t_Mouse, t_Keyboard, t_KeyboardExtension >::HIDKeymap(
+	t_Mouse* const pMouse,
+	t_Keyboard* const pKeyboard,
+	t_KeyboardExtension* const pKeyboardExtension,
+	MouseCurve const* const mouseMoveCurve,
+	MouseCurve const* const mouseWheelCurve,
+	uint16_t const* const extendedKeymap,
+	uint8_t const extendedKeymapLength
+) :
+	Keymap( mouseMoveCurve, mouseWheelCurve, extendedKeymap, extendedKeymapLength ),
+	m_pMouse( pMouse ),
+	m_pKeyboard( pKeyboard ),
+	m_pKeyboardExtension( pKeyboardExtension ),
+	m_oldModifiers( 0 ),
+	m_oldMouseButtons( 0 )
+{
+}
+
+
+template< typename t_Mouse, typename t_Keyboard, typename t_KeyboardExtension >
+void HIDKeymap< t_Mouse, t_Keyboard, t_KeyboardExtension >::Update() {
+
+	if ( IsIdle() )
+		return;
+
+	/*
+		A macro is streamed as fast as the host takes reports: each report is
+		written as soon as an endpoint bank is free, rather than waiting for
+		the next SOF, so both banks of the keyboard endpoint stay full.
+	*/
+	if ( IsPlayingMacro() ) {
+
+		if ( KeyboardSink::Flush( m_pKeyboard ) && KeyboardExtensionSink::Flush( m_pKeyboardExtension ) ) {
+
+			PlayMacro();
+			Output();
+			KeyboardSink::Flush( m_pKeyboard );
+			KeyboardExtensionSink::Flush( m_pKeyboardExtension );
+		}
+		return;
+	}
+
+	/*
+		Queue whatever the last update changed. Only if an interface's queue
+		is full do we wait (and try again on the next call), so a key which
+		is pressed and released between two SOFs still produces both reports.
+	*/
+	bool const mouseQueued = MouseSink::Snapshot( m_pMouse );
+	bool const keyboardQueued = KeyboardSink::Snapshot( m_pKeyboard );
+	bool const keyboardExtensionQueued = KeyboardExtensionSink::Snapshot( m_pKeyboardExtension );
+	if ( ! ( mouseQueued && keyboardQueued && keyboardExtensionQueued ) )
+		return;
+
+	Process( KeyboardSink::GetLEDs( m_pKeyboard ) );
+	LatencyTrace::Output( ( m_outputCount != 0 ) || ( m_modifiers != m_oldModifiers ) || ( m_mouseButtons != m_oldMouseButtons ) );
+	Output();
+
+	if ( m_modifiers != m_oldModifiers ) {
+
+		for ( unsigned int ii = 0; ii < 8; ++ii ) {
+
+			uint8_t const mask = ( 1u << ii );
+			if ( ( m_modifiers ^ m_oldModifiers ) & mask ) {
+
+				USB::HID::Key const key = static_cast< USB::HID::Key >( USB::HID::KEY_LEFT_CONTROL + ii );
+				if ( m_modifiers & mask )
+					PressKey( key );
+				else
+					ReleaseKey( key );
+			}
+		}
+		m_oldModifiers = m_modifiers;
+	}
+
+	if ( m_mouseButtons != m_oldMouseButtons ) {
+
+		for ( unsigned int ii = 0; ii < 3; ++ii ) {
+
+			uint8_t const mask = ( 1u << ii );
+			if ( ( m_mouseButtons ^ m_oldMouseButtons ) & mask ) {
+
+				USB::HID::Button const button = static_cast< USB::HID::Button >( USB::HID::BUTTON_1 + ii );
+				if ( m_mouseButtons & mask )
+					MouseSink::PressButton( m_pMouse, button );
+				else
+					MouseSink::ReleaseButton( m_pMouse, button );
+			}
+		}
+		m_oldMouseButtons = m_mouseButtons;
+	}
+
+	if ( ( m_mouseCounts[ 0 ] != 0 ) || ( m_mouseCounts[ 1 ] != 0 ) || ( m_mouseCounts[ 2 ] != 0 ) )
+		MouseSink::Move( m_pMouse, m_mouseCounts[ 0 ], m_mouseCounts[ 1 ], m_mouseCounts[ 2 ] );
+
+	MouseSink::Snapshot( m_pMouse );
+	KeyboardSink::Snapshot( m_pKeyboard );
+	KeyboardExtensionSink::Snapshot( m_pKeyboardExtension );
+
+	// interfaces in immediate mode get the new reports now, rather than at the next SOF
+	if ( MouseSink::GetImmediate( m_pMouse ) )
+		MouseSink::Flush( m_pMouse );
+	if ( KeyboardSink::GetImmediate( m_pKeyboard ) )
+		KeyboardSink::Flush( m_pKeyboard );
+	if ( KeyboardExtensionSink::GetImmediate( m_pKeyboardExtension ) )
+		KeyboardExtensionSink::Flush( m_pKeyboardExtension );
+}
+
+
+template< typename t_Mouse, typename t_Keyboard, typename t_KeyboardExtension >
+void HIDKeymap< t_Mouse, t_Keyboard, t_KeyboardExtension >::Output() {
+
+	for ( uint8_t ii = 0; ii < m_outputCount; ++ii ) {
+
+		uint16_t const mapped = m_outputs[ ii ];
+		bool const pressed = ( ( m_outputPressed & ( 1u << ii ) ) != 0 );
+		if ( ( mapped & KEYCODE_TYPE_MASK ) == KEYCODE_TYPE_CONSUMER ) {
+
+			USB::HID::Consumer const consumer = static_cast< USB::HID::Consumer >( mapped & KEYCODE_CODE_MASK );
+			if ( pressed )
+				KeyboardExtensionSink::PressConsumer( m_pKeyboardExtension, consumer );
+			else
+				KeyboardExtensionSink::ReleaseConsumer( m_pKeyboardExtension, consumer );
+		}
+		else {
+
+			USB::HID::Key const key = static_cast< USB::HID::Key >( mapped & KEYCODE_CODE_MASK );
+			if ( pressed )
+				PressKey( key );
+			else
+				ReleaseKey( key );
+		}
+	}
+}
+
+
+template< typename t_Mouse, typename t_Keyboard, typename t_KeyboardExtension >
+void HIDKeymap< t_Mouse, t_Keyboard, t_KeyboardExtension >::PressKey( USB::HID::Key const key ) {
+
+	if ( ! KeyboardSink::PressKey( m_pKeyboard, key ) )
+		KeyboardExtensionSink::PressKey( m_pKeyboardExtension, key );
+}
+
+
+template< typename t_Mouse, typename t_Keyboard, typename t_KeyboardExtension >
+void HIDKeymap< t_Mouse, t_Keyboard, t_KeyboardExtension >::ReleaseKey( USB::HID::Key const key ) {
+
+	KeyboardSink::ReleaseKey( m_pKeyboard, key );
+	KeyboardExtensionSink::ReleaseKey( m_pKeyboardExtension, key );
 }
 
 
@@ -349,9 +915,21 @@ void Keymap::SetLayer( uint8_t const index, uint8_t const* const layer ) {
 
 #define KEYCODE_KEYBOARD( nn ) ( ( nn ) | Keymap::KEYCODE_TYPE_KEYBOARD )
 #define KEYCODE_CONSUMER( nn ) ( ( nn ) | Keymap::KEYCODE_TYPE_CONSUMER )
+#define KEYCODE_MACRO(    nn ) ( ( nn ) | Keymap::KEYCODE_TYPE_MACRO    )
 #define KEYCODE_VIRTUAL(  nn ) ( ( nn ) | Keymap::KEYCODE_TYPE_VIRTUAL  )
 
 
+/**
+	\brief Builds a Keymap::MouseCurve at compile time
+
+	The velocity ramps linearly from minimumVelocity to maximumVelocity
+	between minimumTime and maximumTime. Times are in seconds, and velocities
+	( which must be nonnegative ) in counts per second.
+*/
+#define KEYMAP_MOUSE_CURVE( minimumTime, maximumTime, minimumVelocity, maximumVelocity ) \
+	_Private::MakeMouseCurve( _Private::MakeMouseCurveIndices< Keymap::MOUSE_CURVE_SEGMENTS + 1 >::Type(), ( minimumTime ), ( maximumTime ), ( minimumVelocity ), ( maximumVelocity ) )
+
+
 
 
 #endif    /* __cplusplus */
@@ -0,0 +1,341 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file latency_trace.hh
+	\brief Keystroke latency tracing
+*/
+
+
+
+
+#ifndef __LATENCY_TRACE_HH__
+#define __LATENCY_TRACE_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include "timer.hh"
+
+#include <inttypes.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+
+
+
+//============================================================================
+//    LatencyTrace class
+//============================================================================
+
+
+/**
+	\brief Measures how long key transitions take to reach the USB endpoint
+
+	One key transition at a time is followed through the firmware, and
+	timestamped when its source is sampled ( Scan() and Detect() ), when it
+	reaches the keymap ( Press() ), when the keymap passes the result to the
+	HID interfaces ( Output() ), and when the next report is written to an
+	endpoint bank ( Send() ). The delays between these points are accumulated
+	in histograms with logarithmic buckets: bucket 0 counts delays shorter
+	than one time unit ( 16us ), and bucket i > 0 counts delays of at least
+	2^(i-1) units, but shorter than 2^i, with the last bucket holding
+	everything longer.
+
+	Tracing is only compiled in if LATENCY_TRACE is defined ( see the
+	Makefile ). Otherwise, every method does nothing.
+*/
+struct LatencyTrace {
+
+	enum {
+
+		STAGE_SCAN_TO_KEYMAP,
+		STAGE_KEYMAP_TO_INTERFACE,
+		STAGE_INTERFACE_TO_ENDPOINT,
+		STAGE_TOTAL,
+
+		STAGES
+
+	};
+
+	enum { BUCKETS = 14 };
+
+
+	/// \brief Current time, in units of 256 cycles ( 16us at 16MHz )
+	static inline uint16_t const Now();
+
+
+	/// \brief Called immediately before an input source is sampled
+	static inline void Scan();
+
+	/// \brief Called when the sampled source changes the state of a code
+	static inline void Detect( uint8_t const code );
+
+	/// \brief Called when the keymap receives a press or release of a code
+	static inline void Press( uint8_t const code );
+
+	/**
+		\brief Called when the keymap has processed its pending keypresses
+
+		\param changed  true if the keymap changed the state of the HID interfaces
+	*/
+	static inline void Output( bool const changed );
+
+	/// \brief Called when an input report has been written to an endpoint bank
+	static inline void Send();
+
+
+	/// \brief Returns the number of delays in a histogram bucket
+	static inline uint16_t const GetCount( uint8_t const stage, uint8_t const bucket );
+
+	/// \brief Clears the histograms
+	static inline void Clear();
+
+
+private:
+
+	enum {
+
+		STATE_IDLE,
+		STATE_DETECTED,
+		STATE_PRESSED,
+		STATE_OUTPUT
+
+	};
+
+
+	static inline LatencyTrace* const Instance();
+
+	inline LatencyTrace();
+
+	inline void Add( uint8_t const stage, uint16_t const duration );
+
+
+	uint16_t m_scanTime;
+	uint16_t m_times[ STAGES ];
+	uint8_t m_code;
+	uint8_t volatile m_state;
+
+	uint16_t m_histograms[ STAGES ][ BUCKETS ];
+
+
+	inline LatencyTrace( LatencyTrace const& other );
+	inline LatencyTrace const& operator=( LatencyTrace const& other );
+};
+
+
+
+
+//============================================================================
+//    LatencyTrace inline methods
+//============================================================================
+
+
+uint16_t const LatencyTrace::Now() {
+
+	uint16_t result = 0;
+
+#ifdef LATENCY_TRACE
+
+	// save and clear the interrupt flag
+	uint8_t const sreg = SREG;
+	cli();
+
+	Timer const* const pTimer = Timer::Instance();
+	uint16_t overflows = pTimer->GetOverflows();
+	uint16_t const ticks = pTimer->GetTicks();
+	if ( ( TIFR1 & ( 1 << TOV1 ) ) && ( ticks < 0x8000 ) )    // overflow interrupt is still pending
+		++overflows;
+	result = ( ( overflows << 8 ) | ( ticks >> 8 ) );
+
+	// restore the interrupt flag
+	SREG = sreg;
+
+#endif    /* LATENCY_TRACE */
+
+	return result;
+}
+
+
+void LatencyTrace::Scan() {
+
+#ifdef LATENCY_TRACE
+
+	LatencyTrace* const pTrace = Instance();
+	if ( pTrace->m_state == STATE_IDLE )
+		pTrace->m_scanTime = Now();
+
+#endif    /* LATENCY_TRACE */
+}
+
+
+void LatencyTrace::Detect( uint8_t const code ) {
+
+#ifdef LATENCY_TRACE
+
+	LatencyTrace* const pTrace = Instance();
+	if ( pTrace->m_state == STATE_IDLE ) {
+
+		pTrace->m_times[ 0 ] = pTrace->m_scanTime;
+		pTrace->m_code = code;
+		pTrace->m_state = STATE_DETECTED;
+	}
+
+#endif    /* LATENCY_TRACE */
+}
+
+
+void LatencyTrace::Press( uint8_t const code ) {
+
+#ifdef LATENCY_TRACE
+
+	LatencyTrace* const pTrace = Instance();
+	if ( ( pTrace->m_state == STATE_DETECTED ) && ( pTrace->m_code == code ) ) {
+
+		pTrace->m_times[ 1 ] = Now();
+		pTrace->m_state = STATE_PRESSED;
+	}
+
+#endif    /* LATENCY_TRACE */
+}
+
+
+void LatencyTrace::Output( bool const changed ) {
+
+#ifdef LATENCY_TRACE
+
+	LatencyTrace* const pTrace = Instance();
+	if ( pTrace->m_state == STATE_PRESSED ) {
+
+		// a keypress which changes nothing ( e.g. a layer selection ) can't be followed any further
+		if ( changed ) {
+
+			pTrace->m_times[ 2 ] = Now();
+			pTrace->m_state = STATE_OUTPUT;
+		}
+		else
+			pTrace->m_state = STATE_IDLE;
+	}
+
+#endif    /* LATENCY_TRACE */
+}
+
+
+void LatencyTrace::Send() {
+
+#ifdef LATENCY_TRACE
+
+	LatencyTrace* const pTrace = Instance();
+	if ( pTrace->m_state == STATE_OUTPUT ) {
+
+		uint16_t const time = Now();
+		pTrace->Add( STAGE_SCAN_TO_KEYMAP,        pTrace->m_times[ 1 ] - pTrace->m_times[ 0 ] );
+		pTrace->Add( STAGE_KEYMAP_TO_INTERFACE,   pTrace->m_times[ 2 ] - pTrace->m_times[ 1 ] );
+		pTrace->Add( STAGE_INTERFACE_TO_ENDPOINT, time                 - pTrace->m_times[ 2 ] );
+		pTrace->Add( STAGE_TOTAL,                 time                 - pTrace->m_times[ 0 ] );
+		pTrace->m_state = STATE_IDLE;
+	}
+
+#endif    /* LATENCY_TRACE */
+}
+
+
+uint16_t const LatencyTrace::GetCount( uint8_t const stage, uint8_t const bucket ) {
+
+	uint16_t result = 0;
+
+#ifdef LATENCY_TRACE
+
+	if ( ( stage < STAGES ) && ( bucket < BUCKETS ) ) {
+
+		// save and clear the interrupt flag
+		uint8_t const sreg = SREG;
+		cli();
+
+		result = Instance()->m_histograms[ stage ][ bucket ];
+
+		// restore the interrupt flag
+		SREG = sreg;
+	}
+
+#endif    /* LATENCY_TRACE */
+
+	return result;
+}
+
+
+void LatencyTrace::Clear() {
+
+#ifdef LATENCY_TRACE
+
+	// save and clear the interrupt flag
+	uint8_t const sreg = SREG;
+	cli();
+
+	LatencyTrace* const pTrace = Instance();
+	for ( unsigned int ii = 0; ii < STAGES; ++ii )
+		for ( unsigned int jj = 0; jj < BUCKETS; ++jj )
+			pTrace->m_histograms[ ii ][ jj ] = 0;
+
+	// restore the interrupt flag
+	SREG = sreg;
+
+#endif    /* LATENCY_TRACE */
+}
+
+
+LatencyTrace* const LatencyTrace::Instance() {
+
+	static LatencyTrace trace;
+	return &trace;
+}
+
+
+LatencyTrace::LatencyTrace() :
+	m_scanTime( 0 ),
+	m_code( 0 ),
+	m_state( STATE_IDLE )
+{
+	for ( unsigned int ii = 0; ii < STAGES; ++ii ) {
+
+		m_times[ ii ] = 0;
+		for ( unsigned int jj = 0; jj < BUCKETS; ++jj )
+			m_histograms[ ii ][ jj ] = 0;
+	}
+}
+
+
+void LatencyTrace::Add( uint8_t const stage, uint16_t const duration ) {
+
+	uint8_t bucket = 0;
+	for ( uint16_t remaining = duration; ( remaining != 0 ) && ( bucket < BUCKETS - 1 ); remaining >>= 1 )
+		++bucket;
+
+	if ( m_histograms[ stage ][ bucket ] < 0xffff )
+		++m_histograms[ stage ][ bucket ];
+}
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __LATENCY_TRACE_HH__ */
@@ -93,6 +93,11 @@
 #include "buttons.hh"
 #include "adb.hh"
 #include "timer.hh"
+#include "latency_trace.hh"
+#include "frame_scheduler.hh"
+#include "power.hh"
+#include "console.hh"
+#include "pins.hh"
 #include "helpers.h"
 
 #include <math.h>
@@ -117,6 +122,42 @@
 
 
 
+//============================================================================
+//    Pin assignments
+//============================================================================
+
+
+typedef PinList<
+	Pin< 'B', 6 >, Pin< 'B', 7 >, Pin< 'D', 0 >, Pin< 'D', 1 >, Pin< 'D', 2 >,
+	Pin< 'D', 3 >, Pin< 'D', 4 >, Pin< 'D', 5 >, Pin< 'B', 4 >, Pin< 'D', 7 >
+> ButtonPins;
+
+typedef PinList<
+	Pin< 'C', 0 >, Pin< 'C', 1 >, Pin< 'C', 2 >, Pin< 'C', 3 >,
+	Pin< 'C', 4 >, Pin< 'C', 5 >, Pin< 'C', 6 >, Pin< 'C', 7 >
+> MatrixRowPins;
+
+typedef PinList<
+	Pin< 'E', 7 >, Pin< 'E', 6 >, Pin< 'E', 0 >, Pin< 'E', 1 >
+> MatrixColumnPins;
+
+typedef Pin< 'B', 5 > ADBPin;
+
+typedef PinList<
+	Pin< 'B', 0 >,    // num lock
+	Pin< 'B', 1 >,    // caps lock
+	Pin< 'B', 2 >     // scroll lock
+> LEDPins;
+
+
+static_assert( ( ButtonPins::SIZE == BUTTONS ), "BUTTONS doesn't match the button pins" );
+static_assert( ( MatrixRowPins::SIZE == ROWS ), "ROWS doesn't match the keyboard matrix row pins" );
+static_assert( ( ( 1u << MatrixColumnPins::SIZE ) == COLUMNS ), "COLUMNS doesn't match the keyboard matrix column pins" );
+static_assert( PinsDisjoint< ButtonPins, MatrixRowPins, MatrixColumnPins, ADBPin, LEDPins >::VALUE, "conflicting pin assignments" );
+
+
+
+
 //============================================================================
 //    global variables
 //============================================================================
@@ -141,6 +182,11 @@ wchar_t const g_keyboardString[] = L"Boot Keyboard Interface";
 extern wchar_t const g_keyboardExtensionString[] __attribute__(( __progmem__ ));
 wchar_t const g_keyboardExtensionString[] = L"Keyboard Extension Interface";
 
+#ifdef USB_CONSOLE
+extern wchar_t const g_consoleString[] __attribute__(( __progmem__ ));
+wchar_t const g_consoleString[] = L"Console";
+#endif    /* USB_CONSOLE */
+
 
 
 
@@ -343,7 +389,9 @@ enum {
 	KEYMAP_VIRTUAL_MOUSE_BUTTON_3_PRESS,
 	KEYMAP_VIRTUAL_MOUSE_BUTTON_1_TOGGLE,
 	KEYMAP_VIRTUAL_MOUSE_BUTTON_2_TOGGLE,
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_3_TOGGLE
+	KEYMAP_VIRTUAL_MOUSE_BUTTON_3_TOGGLE,
+
+	KEYMAP_MACRO_0
 
 };
 
@@ -481,7 +529,9 @@ uint16_t const g_extendedKeymap[] = {
 	KEYCODE_VIRTUAL( Keymap::VIRTUAL_MOUSE_BUTTON_3_PRESS ),
 	KEYCODE_VIRTUAL( Keymap::VIRTUAL_MOUSE_BUTTON_1_TOGGLE ),
 	KEYCODE_VIRTUAL( Keymap::VIRTUAL_MOUSE_BUTTON_2_TOGGLE ),
-	KEYCODE_VIRTUAL( Keymap::VIRTUAL_MOUSE_BUTTON_3_TOGGLE )
+	KEYCODE_VIRTUAL( Keymap::VIRTUAL_MOUSE_BUTTON_3_TOGGLE ),
+
+	KEYCODE_MACRO( 0 )
 
 };
 static_assert( KEYMAP_BASE_END + ARRAYLENGTH( g_extendedKeymap ) <= 256, "g_baseKeymap and g_extendedKeymap must have total length no greater than 256" );
@@ -495,773 +545,197 @@ static_assert( KEYMAP_BASE_END + ARRAYLENGTH( g_extendedKeymap ) <= 256, "g_base
 
 
 /*
-	Default layer
-	-------------
-
-	left alt = select media layer
-	left gui = left alt
-	right alt = right gui
-	right gui = right alt
+	The layer tables are compiled from layers.keymap by tools/keymapc. The
+	first layer is full, and the others are sparse.
 */
-extern uint8_t const g_layer0[] __attribute__(( __progmem__ ));
-uint8_t const g_layer0[] = {
-
-	KEYMAP_NONE,
-
-	KEYMAP_KEYBOARD_A,
-	KEYMAP_KEYBOARD_B,
-	KEYMAP_KEYBOARD_C,
-	KEYMAP_KEYBOARD_D,
-	KEYMAP_KEYBOARD_E,
-	KEYMAP_KEYBOARD_F,
-	KEYMAP_KEYBOARD_G,
-	KEYMAP_KEYBOARD_H,
-	KEYMAP_KEYBOARD_I,
-	KEYMAP_KEYBOARD_J,
-	KEYMAP_KEYBOARD_K,
-	KEYMAP_KEYBOARD_L,
-	KEYMAP_KEYBOARD_M,
-	KEYMAP_KEYBOARD_N,
-	KEYMAP_KEYBOARD_O,
-	KEYMAP_KEYBOARD_P,
-	KEYMAP_KEYBOARD_Q,
-	KEYMAP_KEYBOARD_R,
-	KEYMAP_KEYBOARD_S,
-	KEYMAP_KEYBOARD_T,
-	KEYMAP_KEYBOARD_U,
-	KEYMAP_KEYBOARD_V,
-	KEYMAP_KEYBOARD_W,
-	KEYMAP_KEYBOARD_X,
-	KEYMAP_KEYBOARD_Y,
-	KEYMAP_KEYBOARD_Z,
-	KEYMAP_KEYBOARD_1,
-	KEYMAP_KEYBOARD_2,
-	KEYMAP_KEYBOARD_3,
-	KEYMAP_KEYBOARD_4,
-	KEYMAP_KEYBOARD_5,
-	KEYMAP_KEYBOARD_6,
-	KEYMAP_KEYBOARD_7,
-	KEYMAP_KEYBOARD_8,
-	KEYMAP_KEYBOARD_9,
-	KEYMAP_KEYBOARD_0,
-	KEYMAP_KEYBOARD_ENTER,
-	KEYMAP_KEYBOARD_ESCAPE,
-	KEYMAP_KEYBOARD_BACKSPACE,
-	KEYMAP_KEYBOARD_TAB,
-	KEYMAP_KEYBOARD_SPACEBAR,
-	KEYMAP_KEYBOARD_DASH,
-	KEYMAP_KEYBOARD_EQUALS,
-	KEYMAP_KEYBOARD_LEFT_BRACKET,
-	KEYMAP_KEYBOARD_RIGHT_BRACKET,
-	KEYMAP_KEYBOARD_BACKSLASH,
-	KEYMAP_KEYBOARD_NON_US_HASH,
-	KEYMAP_KEYBOARD_SEMICOLON,
-	KEYMAP_KEYBOARD_QUOTE,
-	KEYMAP_KEYBOARD_BACKQUOTE,
-	KEYMAP_KEYBOARD_COMMA,
-	KEYMAP_KEYBOARD_PERIOD,
-	KEYMAP_KEYBOARD_SLASH,
-	KEYMAP_KEYBOARD_CAPS_LOCK,
-	KEYMAP_KEYBOARD_F1,
-	KEYMAP_KEYBOARD_F2,
-	KEYMAP_KEYBOARD_F3,
-	KEYMAP_KEYBOARD_F4,
-	KEYMAP_KEYBOARD_F5,
-	KEYMAP_KEYBOARD_F6,
-	KEYMAP_KEYBOARD_F7,
-	KEYMAP_KEYBOARD_F8,
-	KEYMAP_KEYBOARD_F9,
-	KEYMAP_KEYBOARD_F10,
-	KEYMAP_KEYBOARD_F11,
-	KEYMAP_KEYBOARD_F12,
-	KEYMAP_KEYBOARD_PRINT_SCREEN,
-	KEYMAP_KEYBOARD_SCROLL_LOCK,
-	KEYMAP_KEYBOARD_PAUSE,
-	KEYMAP_KEYBOARD_INSERT,
-	KEYMAP_KEYBOARD_HOME,
-	KEYMAP_KEYBOARD_PAGE_UP,
-	KEYMAP_KEYBOARD_DELETE,
-	KEYMAP_KEYBOARD_END,
-	KEYMAP_KEYBOARD_PAGE_DOWN,
-	KEYMAP_KEYBOARD_RIGHT_ARROW,
-	KEYMAP_KEYBOARD_LEFT_ARROW,
-	KEYMAP_KEYBOARD_DOWN_ARROW,
-	KEYMAP_KEYBOARD_UP_ARROW,
-	KEYMAP_KEYBOARD_NUM_LOCK,
-	KEYMAP_KEYBOARD_KEYPAD_SLASH,
-	KEYMAP_KEYBOARD_KEYPAD_STAR,
-	KEYMAP_KEYBOARD_KEYPAD_DASH,
-	KEYMAP_KEYBOARD_KEYPAD_PLUS,
-	KEYMAP_KEYBOARD_KEYPAD_ENTER,
-	KEYMAP_KEYBOARD_KEYPAD_1,
-	KEYMAP_KEYBOARD_KEYPAD_2,
-	KEYMAP_KEYBOARD_KEYPAD_3,
-	KEYMAP_KEYBOARD_KEYPAD_4,
-	KEYMAP_KEYBOARD_KEYPAD_5,
-	KEYMAP_KEYBOARD_KEYPAD_6,
-	KEYMAP_KEYBOARD_KEYPAD_7,
-	KEYMAP_KEYBOARD_KEYPAD_8,
-	KEYMAP_KEYBOARD_KEYPAD_9,
-	KEYMAP_KEYBOARD_KEYPAD_0,
-	KEYMAP_KEYBOARD_KEYPAD_PERIOD,
-	KEYMAP_KEYBOARD_NON_US_BACKSLASH,
-	KEYMAP_KEYBOARD_APPLICATION,
-	KEYMAP_KEYBOARD_POWER,
-	KEYMAP_KEYBOARD_KEYPAD_EQUALS,
-	KEYMAP_KEYBOARD_F13,
-	KEYMAP_KEYBOARD_F14,
-	KEYMAP_KEYBOARD_F15,
+#include "layers.hh"
 
-	KEYMAP_KEYBOARD_LEFT_CONTROL,
-	KEYMAP_KEYBOARD_LEFT_SHIFT,
-	KEYMAP_KEYBOARD_LEFT_GUI,    // KEYMAP_KEYBOARD_LEFT_ALT
-	KEYMAP_KEYBOARD_LEFT_ALT,    // KEYMAP_KEYBOARD_LEFT_GUI
-	KEYMAP_KEYBOARD_RIGHT_CONTROL,
-	KEYMAP_KEYBOARD_RIGHT_SHIFT,
-	KEYMAP_KEYBOARD_RIGHT_ALT,
-	KEYMAP_VIRTUAL_LAYER_1_SELECT,
 
-	KEYMAP_VIRTUAL_LOCKING_CAPS_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_NUM_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_SCROLL_LOCK
 
-};
-static_assert( ARRAYLENGTH( g_layer0 ) == KEYMAP_BASE_END, "g_layer0 must have same length as the base keymap" );
 
+//============================================================================
+//    Mouse acceleration curves
+//============================================================================
 
-/*
-	Media layer
-	-----------
-
-	space = lock Matias half-QWERTY layer
-
-	num lock = clear
-	print screen = F13
-	scroll lock = F14
-	pause = F15
-	insert = help
-	delete = backspace
-	backspace = delete
-
-	left arrow = home
-	right arrow = end
-	up arrow = page up
-	down arrow = page down
-
-	 ______ ______ ______ ______
-	|      |      |      |      |
-	|      | PnLt | PnRt | Btn3 |
-	|______|______|______|______|
-	|      |      |      |      |
-	|  NW  |  N   |  NE  | ScUp |
-	|______|______|______|______|
-	|      |      |      |      |
-	|   W  | Btn1 |  E   | ScDn |
-	|______|______|______|______|
-	|      |      |      |      |
-	|  SW  |  S   |  SE  |      |
-	|______|______|______| Btn2 |
-	|             |      |      |
-	|    Tgl1     | Tgl2 |      |
-	|_____________|______|______|
-
-	keypad 8 = mouse N
-	keypad 9 = mouse NE
-	keypad 6 = mouse E
-	keypad 3 = mouse SE
-	keypad 2 = mouse S
-	keypad 1 = mouse SW
-	keypad 4 = mouse W
-	keypad 7 = mouse NW
-	keypad minus = mouse wheel up
-	keypad plus = mouse wheel down
-	keypad equals = pan left
-	keypad slash = pan right
-	keypad 5 = left button
-	keypad 0 = left button toggle
-	keypad enter = right button
-	keypad period = right button toggle
-	keypad star = middle button
-
-	 ______ ______ ______ ______     ______ ______ ______ ______     ______ ______ ______ ______
-	|      |      |      |      |   |      |      |      |      |   |      |      |      |      |
-	| Calc | Home | Mail | Web  |   | Stop | Prev | Paus | Next |   | Msc  | VlDn | VlUp | Mute |
-	|______|______|______|______|   |______|______|______|______|   |______|______|______|______|
-
-	F1 = calculator
-	F2 = my computer
-	F3 = email
-	F4 = web browser
-	F5 = stop
-	F6 = previous track
-	F7 = play/pause
-	F8 = next track
-	F9 = music player
-	F10 = volume down
-	F11 = volume up
-	F12 = mute
-
-	 ______ ______
-	|      |      |
-	| Mute | VlUp |
-	|______|______|______
-	|      |      |      |
-	| Rwd  | VlDn |  FF  |
-	|______|______|______|
-
-	Q = mute
-	W = volume up
-	A = rewind
-	S = volume down
-	D = fast forward
-*/
-extern uint8_t const g_layer1[] __attribute__(( __progmem__ ));
-uint8_t const g_layer1[] = {
-
-	KEYMAP_NONE,
-
-	KEYMAP_CONSUMER_REWIND,              // KEYMAP_KEYBOARD_A
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_B
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_C
-	KEYMAP_CONSUMER_FAST_FORWARD,        // KEYMAP_KEYBOARD_D
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_E
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_F
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_G
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_H
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_I
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_J
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_K
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_L
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_M
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_N
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_O
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_P
-	KEYMAP_CONSUMER_MUTE,                // KEYMAP_KEYBOARD_Q
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_R
-	KEYMAP_CONSUMER_VOLUME_DECREMENT,    // KEYMAP_KEYBOARD_S
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_T
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_U
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_V
-	KEYMAP_CONSUMER_VOLUME_INCREMENT,    // KEYMAP_KEYBOARD_W
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_X
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_Y
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_Z
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_1
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_2
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_3
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_4
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_5
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_6
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_7
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_8
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_9
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_0
-	KEYMAP_KEYBOARD_ENTER,
-	KEYMAP_KEYBOARD_ESCAPE,
-	KEYMAP_KEYBOARD_DELETE,    // KEYMAP_KEYBOARD_BACKSPACE
-	KEYMAP_KEYBOARD_TAB,
-	KEYMAP_VIRTUAL_LAYER_2_LOCK,    // KEYMAP_KEYBOARD_SPACEBAR
-	KEYMAP_KEYBOARD_DASH,
-	KEYMAP_KEYBOARD_EQUALS,
-	KEYMAP_KEYBOARD_LEFT_BRACKET,
-	KEYMAP_KEYBOARD_RIGHT_BRACKET,
-	KEYMAP_KEYBOARD_BACKSLASH,
-	KEYMAP_KEYBOARD_NON_US_HASH,
-	KEYMAP_KEYBOARD_SEMICOLON,
-	KEYMAP_KEYBOARD_QUOTE,
-	KEYMAP_KEYBOARD_BACKQUOTE,
-	KEYMAP_KEYBOARD_COMMA,
-	KEYMAP_KEYBOARD_PERIOD,
-	KEYMAP_KEYBOARD_SLASH,
-	KEYMAP_KEYBOARD_CAPS_LOCK,
-	KEYMAP_CONSUMER_AL_CALCULATOR,                // KEYMAP_KEYBOARD_F1
-	KEYMAP_CONSUMER_AL_LOCAL_MACHINE_BROWSER,     // KEYMAP_KEYBOARD_F2
-	KEYMAP_CONSUMER_AL_EMAIL_READER,              // KEYMAP_KEYBOARD_F3
-	KEYMAP_CONSUMER_AL_INTERNET_BROWSER,          // KEYMAP_KEYBOARD_F4
-	KEYMAP_CONSUMER_STOP,                         // KEYMAP_KEYBOARD_F5
-	KEYMAP_CONSUMER_SCAN_PREVIOUS_TRACK,          // KEYMAP_KEYBOARD_F6
-	KEYMAP_CONSUMER_PLAY_PAUSE,                   // KEYMAP_KEYBOARD_F7
-	KEYMAP_CONSUMER_SCAN_NEXT_TRACK,              // KEYMAP_KEYBOARD_F8
-	KEYMAP_CONSUMER_AL_AUDIO_PLAYER,              // KEYMAP_KEYBOARD_F9
-	KEYMAP_CONSUMER_VOLUME_DECREMENT,             // KEYMAP_KEYBOARD_F10
-	KEYMAP_CONSUMER_VOLUME_INCREMENT,             // KEYMAP_KEYBOARD_F11
-	KEYMAP_CONSUMER_MUTE,                         // KEYMAP_KEYBOARD_F12
-	KEYMAP_KEYBOARD_F13,                          // KEYMAP_KEYBOARD_PRINT_SCREEN
-	KEYMAP_KEYBOARD_F14,                          // KEYMAP_KEYBOARD_SCROLL_LOCK
-	KEYMAP_KEYBOARD_F15,                          // KEYMAP_KEYBOARD_PAUSE
-	KEYMAP_CONSUMER_AL_INTEGRATED_HELP_CENTER,    // KEYMAP_KEYBOARD_INSERT
-	KEYMAP_KEYBOARD_HOME,
-	KEYMAP_KEYBOARD_PAGE_UP,
-	KEYMAP_KEYBOARD_BACKSPACE,    // KEYMAP_KEYBOARD_DELETE
-	KEYMAP_KEYBOARD_END,
-	KEYMAP_KEYBOARD_PAGE_DOWN,
-	KEYMAP_KEYBOARD_END,                     // KEYMAP_KEYBOARD_RIGHT_ARROW
-	KEYMAP_KEYBOARD_HOME,                    // KEYMAP_KEYBOARD_LEFT_ARROW
-	KEYMAP_KEYBOARD_PAGE_DOWN,               // KEYMAP_KEYBOARD_DOWN_ARROW
-	KEYMAP_KEYBOARD_PAGE_UP,                 // KEYMAP_KEYBOARD_UP_ARROW
-	KEYMAP_KEYBOARD_KEYPAD_CLEAR,            // KEYMAP_KEYBOARD_NUM_LOCK
-	KEYMAP_CONSUMER_AC_PAN_RIGHT,            // KEYMAP_KEYBOARD_KEYPAD_SLASH
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_3_PRESS,     // KEYMAP_KEYBOARD_KEYPAD_STAR
-	KEYMAP_VIRTUAL_MOUSE_WHEEL_UP,           // KEYMAP_KEYBOARD_KEYPAD_DASH
-	KEYMAP_VIRTUAL_MOUSE_WHEEL_DOWN,         // KEYMAP_KEYBOARD_KEYPAD_PLUS
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_2_PRESS,     // KEYMAP_KEYBOARD_KEYPAD_ENTER
-	KEYMAP_VIRTUAL_MOUSE_SW,                 // KEYMAP_KEYBOARD_KEYPAD_1
-	KEYMAP_VIRTUAL_MOUSE_S,                  // KEYMAP_KEYBOARD_KEYPAD_2
-	KEYMAP_VIRTUAL_MOUSE_SE,                 // KEYMAP_KEYBOARD_KEYPAD_3
-	KEYMAP_VIRTUAL_MOUSE_W,                  // KEYMAP_KEYBOARD_KEYPAD_4
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_1_PRESS,     // KEYMAP_KEYBOARD_KEYPAD_5
-	KEYMAP_VIRTUAL_MOUSE_E,                  // KEYMAP_KEYBOARD_KEYPAD_6
-	KEYMAP_VIRTUAL_MOUSE_NW,                 // KEYMAP_KEYBOARD_KEYPAD_7
-	KEYMAP_VIRTUAL_MOUSE_N,                  // KEYMAP_KEYBOARD_KEYPAD_8
-	KEYMAP_VIRTUAL_MOUSE_NE,                 // KEYMAP_KEYBOARD_KEYPAD_9
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_1_TOGGLE,    // KEYMAP_KEYBOARD_KEYPAD_0
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_2_TOGGLE,    // KEYMAP_KEYBOARD_KEYPAD_PERIOD
-	KEYMAP_KEYBOARD_NON_US_BACKSLASH,
-	KEYMAP_KEYBOARD_APPLICATION,
-	KEYMAP_KEYBOARD_POWER,
-	KEYMAP_CONSUMER_AC_PAN_LEFT,    // KEYMAP_KEYBOARD_KEYPAD_EQUALS
-	KEYMAP_KEYBOARD_F13,
-	KEYMAP_KEYBOARD_F14,
-	KEYMAP_KEYBOARD_F15,
 
-	KEYMAP_KEYBOARD_LEFT_CONTROL,
-	KEYMAP_KEYBOARD_LEFT_SHIFT,
-	KEYMAP_KEYBOARD_LEFT_ALT,
-	KEYMAP_KEYBOARD_LEFT_GUI,
-	KEYMAP_KEYBOARD_RIGHT_CONTROL,
-	KEYMAP_KEYBOARD_RIGHT_SHIFT,
-	KEYMAP_KEYBOARD_RIGHT_ALT,
-	KEYMAP_KEYBOARD_RIGHT_GUI,
+// ramps from 100 to 2000 counts per second between 0.1 and 2 seconds
+extern Keymap::MouseCurve const g_mouseMoveCurve __attribute__(( __progmem__ ));
+Keymap::MouseCurve const g_mouseMoveCurve = KEYMAP_MOUSE_CURVE( 0.1, 2, 100, 2000 );
 
-	KEYMAP_VIRTUAL_LOCKING_CAPS_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_NUM_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_SCROLL_LOCK
 
-};
-static_assert( ARRAYLENGTH( g_layer1 ) == KEYMAP_BASE_END, "g_layer1 must have same length as the base keymap" );
+// ramps from 5 to 100 counts per second between 0 and 4 seconds
+extern Keymap::MouseCurve const g_mouseWheelCurve __attribute__(( __progmem__ ));
+Keymap::MouseCurve const g_mouseWheelCurve = KEYMAP_MOUSE_CURVE( 0, 4, 5, 100 );
+
 
 
-/*
-	Matias half-QWERTY base layer
-	-----------------------------
 
-	all modifiers are sticky
+//============================================================================
+//    Macros
+//============================================================================
 
-	space = select flipped layer
 
-	left alt = select media layer
-	left gui = left alt
-	right alt = right gui
-	right gui = right alt
+/*
+	Macro i is played by an assignment with keycode KEYCODE_MACRO( i ) in
+	g_extendedKeymap ( see Keymap::SetMacro for the format ).
 */
-extern uint8_t const g_layer2[] __attribute__(( __progmem__ ));
-uint8_t const g_layer2[] = {
-
-	KEYMAP_NONE,
-
-	KEYMAP_KEYBOARD_A,
-	KEYMAP_KEYBOARD_B,
-	KEYMAP_KEYBOARD_C,
-	KEYMAP_KEYBOARD_D,
-	KEYMAP_KEYBOARD_E,
-	KEYMAP_KEYBOARD_F,
-	KEYMAP_KEYBOARD_G,
-	KEYMAP_KEYBOARD_H,
-	KEYMAP_KEYBOARD_I,
-	KEYMAP_KEYBOARD_J,
-	KEYMAP_KEYBOARD_K,
-	KEYMAP_KEYBOARD_L,
-	KEYMAP_KEYBOARD_M,
-	KEYMAP_KEYBOARD_N,
-	KEYMAP_KEYBOARD_O,
-	KEYMAP_KEYBOARD_P,
-	KEYMAP_KEYBOARD_Q,
-	KEYMAP_KEYBOARD_R,
-	KEYMAP_KEYBOARD_S,
-	KEYMAP_KEYBOARD_T,
-	KEYMAP_KEYBOARD_U,
-	KEYMAP_KEYBOARD_V,
-	KEYMAP_KEYBOARD_W,
-	KEYMAP_KEYBOARD_X,
-	KEYMAP_KEYBOARD_Y,
-	KEYMAP_KEYBOARD_Z,
-	KEYMAP_KEYBOARD_1,
-	KEYMAP_KEYBOARD_2,
-	KEYMAP_KEYBOARD_3,
-	KEYMAP_KEYBOARD_4,
-	KEYMAP_KEYBOARD_5,
-	KEYMAP_KEYBOARD_6,
-	KEYMAP_KEYBOARD_7,
-	KEYMAP_KEYBOARD_8,
-	KEYMAP_KEYBOARD_9,
-	KEYMAP_KEYBOARD_0,
-	KEYMAP_KEYBOARD_ENTER,
-	KEYMAP_KEYBOARD_ESCAPE,
-	KEYMAP_KEYBOARD_BACKSPACE,
-	KEYMAP_KEYBOARD_TAB,
-	KEYMAP_VIRTUAL_LAYER_3_SELECT,    // KEYMAP_KEYBOARD_SPACEBAR
-	KEYMAP_KEYBOARD_DASH,
-	KEYMAP_KEYBOARD_EQUALS,
-	KEYMAP_KEYBOARD_LEFT_BRACKET,
-	KEYMAP_KEYBOARD_RIGHT_BRACKET,
-	KEYMAP_KEYBOARD_BACKSLASH,
-	KEYMAP_KEYBOARD_NON_US_HASH,
-	KEYMAP_KEYBOARD_SEMICOLON,
-	KEYMAP_KEYBOARD_QUOTE,
-	KEYMAP_KEYBOARD_BACKQUOTE,
-	KEYMAP_KEYBOARD_COMMA,
-	KEYMAP_KEYBOARD_PERIOD,
-	KEYMAP_KEYBOARD_SLASH,
-	KEYMAP_KEYBOARD_CAPS_LOCK,
-	KEYMAP_KEYBOARD_F1,
-	KEYMAP_KEYBOARD_F2,
-	KEYMAP_KEYBOARD_F3,
-	KEYMAP_KEYBOARD_F4,
-	KEYMAP_KEYBOARD_F5,
-	KEYMAP_KEYBOARD_F6,
-	KEYMAP_KEYBOARD_F7,
-	KEYMAP_KEYBOARD_F8,
-	KEYMAP_KEYBOARD_F9,
-	KEYMAP_KEYBOARD_F10,
-	KEYMAP_KEYBOARD_F11,
-	KEYMAP_KEYBOARD_F12,
-	KEYMAP_KEYBOARD_PRINT_SCREEN,
-	KEYMAP_KEYBOARD_SCROLL_LOCK,
-	KEYMAP_KEYBOARD_PAUSE,
-	KEYMAP_KEYBOARD_INSERT,
-	KEYMAP_KEYBOARD_HOME,
-	KEYMAP_KEYBOARD_PAGE_UP,
-	KEYMAP_KEYBOARD_DELETE,
-	KEYMAP_KEYBOARD_END,
-	KEYMAP_KEYBOARD_PAGE_DOWN,
-	KEYMAP_KEYBOARD_RIGHT_ARROW,
-	KEYMAP_KEYBOARD_LEFT_ARROW,
-	KEYMAP_KEYBOARD_DOWN_ARROW,
-	KEYMAP_KEYBOARD_UP_ARROW,
-	KEYMAP_KEYBOARD_NUM_LOCK,
-	KEYMAP_KEYBOARD_KEYPAD_SLASH,
-	KEYMAP_KEYBOARD_KEYPAD_STAR,
-	KEYMAP_KEYBOARD_KEYPAD_DASH,
-	KEYMAP_KEYBOARD_KEYPAD_PLUS,
-	KEYMAP_KEYBOARD_KEYPAD_ENTER,
-	KEYMAP_KEYBOARD_KEYPAD_1,
-	KEYMAP_KEYBOARD_KEYPAD_2,
-	KEYMAP_KEYBOARD_KEYPAD_3,
-	KEYMAP_KEYBOARD_KEYPAD_4,
-	KEYMAP_KEYBOARD_KEYPAD_5,
-	KEYMAP_KEYBOARD_KEYPAD_6,
-	KEYMAP_KEYBOARD_KEYPAD_7,
-	KEYMAP_KEYBOARD_KEYPAD_8,
-	KEYMAP_KEYBOARD_KEYPAD_9,
-	KEYMAP_KEYBOARD_KEYPAD_0,
-	KEYMAP_KEYBOARD_KEYPAD_PERIOD,
-	KEYMAP_KEYBOARD_NON_US_BACKSLASH,
-	KEYMAP_KEYBOARD_APPLICATION,
-	KEYMAP_KEYBOARD_POWER,
-	KEYMAP_KEYBOARD_KEYPAD_EQUALS,
-	KEYMAP_KEYBOARD_F13,
-	KEYMAP_KEYBOARD_F14,
-	KEYMAP_KEYBOARD_F15,
-
-	KEYMAP_VIRTUAL_STICKY_LEFT_CONTROL,     // KEYMAP_KEYBOARD_LEFT_CONTROL,
-	KEYMAP_VIRTUAL_STICKY_LEFT_SHIFT,       // KEYMAP_KEYBOARD_LEFT_SHIFT,
-	KEYMAP_VIRTUAL_STICKY_LEFT_GUI,         // KEYMAP_KEYBOARD_LEFT_ALT
-	KEYMAP_VIRTUAL_STICKY_LEFT_ALT,         // KEYMAP_KEYBOARD_LEFT_GUI
-	KEYMAP_VIRTUAL_STICKY_RIGHT_CONTROL,    // KEYMAP_KEYBOARD_RIGHT_CONTROL,
-	KEYMAP_VIRTUAL_STICKY_RIGHT_SHIFT,      // KEYMAP_KEYBOARD_RIGHT_SHIFT,
-	KEYMAP_VIRTUAL_LAYER_4_SELECT,          // KEYMAP_KEYBOARD_RIGHT_ALT
-	KEYMAP_VIRTUAL_STICKY_RIGHT_ALT,        // KEYMAP_KEYBOARD_RIGHT_GUI
-
-	KEYMAP_VIRTUAL_LOCKING_CAPS_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_NUM_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_SCROLL_LOCK
+// types "AEK2"
+extern uint8_t const g_macro0[] __attribute__(( __progmem__ ));
+uint8_t const g_macro0[] = {
+	USB::HID::KEY_LEFT_SHIFT,
+	USB::HID::KEY_A,
+	USB::HID::KEY_E,
+	USB::HID::KEY_K,
+	USB::HID::KEY_LEFT_SHIFT,
+	USB::HID::KEY_2,
+	0
+};
 
+
+extern uint8_t const* const g_macros[] __attribute__(( __progmem__ ));
+uint8_t const* const g_macros[] = {
+	g_macro0,
+	NULL
 };
-static_assert( ARRAYLENGTH( g_layer2 ) == KEYMAP_BASE_END, "g_layer2 must have same length as the base keymap" );
 
 
-/*
-	Matias half-QWERTY flipped layer
-	--------------------------------
 
-	all modifiers are sticky
-	keys are flipped (see http://half-qwerty.com/)
 
-	left alt = select media layer
-	left gui = left alt
-	right alt = right gui
-	right gui = right alt
+//============================================================================
+//    Input merging
+//============================================================================
+
+
+/**
+	\brief Passes a change in the state of a source key on to the keymap
+
+	Several source keys may map to the same code ( e.g. the same key on the
+	matrix and on an ADB keyboard ), so a code is pressed when the first of
+	its source keys goes down, and released when the last one goes up.
+
+	\param counts   number of source keys currently pressing each code
+	\param code     code to which the source key maps
+	\param pressed  new state of the source key
 */
-extern uint8_t const g_layer3[] __attribute__(( __progmem__ ));
-uint8_t const g_layer3[] = {
-
-	KEYMAP_NONE,
-
-	KEYMAP_KEYBOARD_SEMICOLON,    // KEYMAP_KEYBOARD_A
-	KEYMAP_KEYBOARD_N,            // KEYMAP_KEYBOARD_B
-	KEYMAP_KEYBOARD_COMMA,        // KEYMAP_KEYBOARD_C
-	KEYMAP_KEYBOARD_K,            // KEYMAP_KEYBOARD_D
-	KEYMAP_KEYBOARD_I,            // KEYMAP_KEYBOARD_E
-	KEYMAP_KEYBOARD_J,            // KEYMAP_KEYBOARD_F
-	KEYMAP_KEYBOARD_H,            // KEYMAP_KEYBOARD_G
-	KEYMAP_KEYBOARD_G,            // KEYMAP_KEYBOARD_H
-	KEYMAP_KEYBOARD_E,            // KEYMAP_KEYBOARD_I
-	KEYMAP_KEYBOARD_F,            // KEYMAP_KEYBOARD_J
-	KEYMAP_KEYBOARD_D,            // KEYMAP_KEYBOARD_K
-	KEYMAP_KEYBOARD_S,            // KEYMAP_KEYBOARD_L
-	KEYMAP_KEYBOARD_V,            // KEYMAP_KEYBOARD_M
-	KEYMAP_KEYBOARD_B,            // KEYMAP_KEYBOARD_N
-	KEYMAP_KEYBOARD_W,            // KEYMAP_KEYBOARD_O
-	KEYMAP_KEYBOARD_Q,            // KEYMAP_KEYBOARD_P
-	KEYMAP_KEYBOARD_P,            // KEYMAP_KEYBOARD_Q
-	KEYMAP_KEYBOARD_U,            // KEYMAP_KEYBOARD_R
-	KEYMAP_KEYBOARD_L,            // KEYMAP_KEYBOARD_S
-	KEYMAP_KEYBOARD_Y,            // KEYMAP_KEYBOARD_T
-	KEYMAP_KEYBOARD_R,            // KEYMAP_KEYBOARD_U
-	KEYMAP_KEYBOARD_M,            // KEYMAP_KEYBOARD_V
-	KEYMAP_KEYBOARD_O,            // KEYMAP_KEYBOARD_W
-	KEYMAP_KEYBOARD_PERIOD,       // KEYMAP_KEYBOARD_X
-	KEYMAP_KEYBOARD_T,            // KEYMAP_KEYBOARD_Y
-	KEYMAP_KEYBOARD_SLASH,        // KEYMAP_KEYBOARD_Z
-	KEYMAP_KEYBOARD_0,            // KEYMAP_KEYBOARD_1
-	KEYMAP_KEYBOARD_9,            // KEYMAP_KEYBOARD_2
-	KEYMAP_KEYBOARD_8,            // KEYMAP_KEYBOARD_3
-	KEYMAP_KEYBOARD_7,            // KEYMAP_KEYBOARD_4
-	KEYMAP_KEYBOARD_6,            // KEYMAP_KEYBOARD_5
-	KEYMAP_KEYBOARD_5,            // KEYMAP_KEYBOARD_6
-	KEYMAP_KEYBOARD_4,            // KEYMAP_KEYBOARD_7
-	KEYMAP_KEYBOARD_3,            // KEYMAP_KEYBOARD_8
-	KEYMAP_KEYBOARD_2,            // KEYMAP_KEYBOARD_9
-	KEYMAP_KEYBOARD_1,            // KEYMAP_KEYBOARD_0
-	KEYMAP_KEYBOARD_ENTER,
-	KEYMAP_KEYBOARD_ESCAPE,
-	KEYMAP_KEYBOARD_BACKSPACE,
-	KEYMAP_KEYBOARD_BACKSPACE,    // KEYMAP_KEYBOARD_TAB
-	KEYMAP_KEYBOARD_SPACEBAR,
-	KEYMAP_KEYBOARD_DASH,
-	KEYMAP_KEYBOARD_EQUALS,
-	KEYMAP_KEYBOARD_TAB,    // KEYMAP_KEYBOARD_LEFT_BRACKET
-	KEYMAP_KEYBOARD_TAB,    // KEYMAP_KEYBOARD_RIGHT_BRACKET
-	KEYMAP_KEYBOARD_TAB,    // KEYMAP_KEYBOARD_BACKSLASH
-	KEYMAP_KEYBOARD_NON_US_HASH,
-	KEYMAP_KEYBOARD_A,    // KEYMAP_KEYBOARD_SEMICOLON
-	KEYMAP_KEYBOARD_QUOTE,
-	KEYMAP_KEYBOARD_BACKQUOTE,
-	KEYMAP_KEYBOARD_C,    // KEYMAP_KEYBOARD_COMMA
-	KEYMAP_KEYBOARD_X,    // KEYMAP_KEYBOARD_PERIOD
-	KEYMAP_KEYBOARD_Z,    // KEYMAP_KEYBOARD_SLASH
-	KEYMAP_KEYBOARD_CAPS_LOCK,
-	KEYMAP_KEYBOARD_F1,
-	KEYMAP_KEYBOARD_F2,
-	KEYMAP_KEYBOARD_F3,
-	KEYMAP_KEYBOARD_F4,
-	KEYMAP_KEYBOARD_F5,
-	KEYMAP_KEYBOARD_F6,
-	KEYMAP_KEYBOARD_F7,
-	KEYMAP_KEYBOARD_F8,
-	KEYMAP_KEYBOARD_F9,
-	KEYMAP_KEYBOARD_F10,
-	KEYMAP_KEYBOARD_F11,
-	KEYMAP_KEYBOARD_F12,
-	KEYMAP_KEYBOARD_PRINT_SCREEN,
-	KEYMAP_KEYBOARD_SCROLL_LOCK,
-	KEYMAP_KEYBOARD_PAUSE,
-	KEYMAP_KEYBOARD_INSERT,
-	KEYMAP_KEYBOARD_HOME,
-	KEYMAP_KEYBOARD_PAGE_UP,
-	KEYMAP_KEYBOARD_DELETE,
-	KEYMAP_KEYBOARD_END,
-	KEYMAP_KEYBOARD_PAGE_DOWN,
-	KEYMAP_KEYBOARD_RIGHT_ARROW,
-	KEYMAP_KEYBOARD_LEFT_ARROW,
-	KEYMAP_KEYBOARD_DOWN_ARROW,
-	KEYMAP_KEYBOARD_UP_ARROW,
-	KEYMAP_KEYBOARD_NUM_LOCK,
-	KEYMAP_KEYBOARD_KEYPAD_SLASH,
-	KEYMAP_KEYBOARD_KEYPAD_STAR,
-	KEYMAP_KEYBOARD_KEYPAD_DASH,
-	KEYMAP_KEYBOARD_KEYPAD_PLUS,
-	KEYMAP_KEYBOARD_KEYPAD_ENTER,
-	KEYMAP_KEYBOARD_KEYPAD_1,
-	KEYMAP_KEYBOARD_KEYPAD_2,
-	KEYMAP_KEYBOARD_KEYPAD_3,
-	KEYMAP_KEYBOARD_KEYPAD_4,
-	KEYMAP_KEYBOARD_KEYPAD_5,
-	KEYMAP_KEYBOARD_KEYPAD_6,
-	KEYMAP_KEYBOARD_KEYPAD_7,
-	KEYMAP_KEYBOARD_KEYPAD_8,
-	KEYMAP_KEYBOARD_KEYPAD_9,
-	KEYMAP_KEYBOARD_KEYPAD_0,
-	KEYMAP_KEYBOARD_KEYPAD_PERIOD,
-	KEYMAP_KEYBOARD_NON_US_BACKSLASH,
-	KEYMAP_KEYBOARD_APPLICATION,
-	KEYMAP_KEYBOARD_POWER,
-	KEYMAP_KEYBOARD_KEYPAD_EQUALS,
-	KEYMAP_KEYBOARD_F13,
-	KEYMAP_KEYBOARD_F14,
-	KEYMAP_KEYBOARD_F15,
-
-	KEYMAP_VIRTUAL_STICKY_LEFT_CONTROL,     // KEYMAP_KEYBOARD_LEFT_CONTROL,
-	KEYMAP_KEYBOARD_ENTER,                  // KEYMAP_KEYBOARD_LEFT_SHIFT
-	KEYMAP_VIRTUAL_STICKY_LEFT_GUI,         // KEYMAP_KEYBOARD_LEFT_ALT
-	KEYMAP_VIRTUAL_STICKY_LEFT_ALT,         // KEYMAP_KEYBOARD_LEFT_GUI
-	KEYMAP_VIRTUAL_STICKY_RIGHT_CONTROL,    // KEYMAP_KEYBOARD_RIGHT_CONTROL,
-	KEYMAP_VIRTUAL_STICKY_RIGHT_SHIFT,      // KEYMAP_KEYBOARD_RIGHT_SHIFT,
-	KEYMAP_VIRTUAL_STICKY_RIGHT_GUI,        // KEYMAP_KEYBOARD_RIGHT_ALT
-	KEYMAP_VIRTUAL_STICKY_RIGHT_ALT,        // KEYMAP_KEYBOARD_RIGHT_GUI
-
-	KEYMAP_VIRTUAL_LOCKING_CAPS_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_NUM_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_SCROLL_LOCK
+template< typename t_Keymap >
+inline void MergeKey( t_Keymap* const pKeymap, uint8_t counts[ 256 ], uint8_t const code, bool const pressed ) {
 
-};
-static_assert( ARRAYLENGTH( g_layer3 ) == KEYMAP_BASE_END, "g_layer3 must have same length as the base keymap" );
+	if ( pressed ) {
 
+		if ( counts[ code ]++ == 0 ) {
 
-/*
-	Matias half-QWERTY media layer
-	------------------------------
+			LatencyTrace::Detect( code );
+			pKeymap->Press( code );
+		}
+	}
+	else if ( counts[ code ] > 0 ) {
 
-	mostly the same as the default media layer
-	all modifiers are sticky
+		if ( --counts[ code ] == 0 ) {
 
-	space = lock default layer
+			LatencyTrace::Detect( code );
+			pKeymap->Release( code );
+		}
+	}
+}
+
+
+
+
+#ifdef USB_CONSOLE
+
+
+
+
+//============================================================================
+//    Console commands
+//============================================================================
+
+
+/// largest number of debouncing iterations which may be set from the console
+enum { MAXIMUM_DEBOUNCING = 8 };
+
+
+/**
+	\brief Runs the command just received by the console
+
+	Counters are dumped and parameters tuned through the console. Commands
+	which set a parameter print its value if given no argument.
+
+	\param iterations  number of iterations of the main loop so far
 */
-extern uint8_t const g_layer4[] __attribute__(( __progmem__ ));
-uint8_t const g_layer4[] = {
-
-	KEYMAP_NONE,
-
-	KEYMAP_CONSUMER_REWIND,              // KEYMAP_KEYBOARD_A
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_B
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_C
-	KEYMAP_CONSUMER_FAST_FORWARD,        // KEYMAP_KEYBOARD_D
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_E
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_F
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_G
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_H
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_I
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_J
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_K
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_L
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_M
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_N
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_O
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_P
-	KEYMAP_CONSUMER_MUTE,                // KEYMAP_KEYBOARD_Q
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_R
-	KEYMAP_CONSUMER_VOLUME_DECREMENT,    // KEYMAP_KEYBOARD_S
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_T
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_U
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_V
-	KEYMAP_CONSUMER_VOLUME_INCREMENT,    // KEYMAP_KEYBOARD_W
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_X
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_Y
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_Z
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_1
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_2
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_3
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_4
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_5
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_6
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_7
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_8
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_9
-	KEYMAP_NONE,                         // KEYMAP_KEYBOARD_0
-	KEYMAP_KEYBOARD_ENTER,
-	KEYMAP_KEYBOARD_ESCAPE,
-	KEYMAP_KEYBOARD_DELETE,    // KEYMAP_KEYBOARD_BACKSPACE
-	KEYMAP_KEYBOARD_TAB,
-	KEYMAP_VIRTUAL_LAYER_0_LOCK,    // KEYMAP_KEYBOARD_SPACEBAR
-	KEYMAP_KEYBOARD_DASH,
-	KEYMAP_KEYBOARD_EQUALS,
-	KEYMAP_KEYBOARD_LEFT_BRACKET,
-	KEYMAP_KEYBOARD_RIGHT_BRACKET,
-	KEYMAP_KEYBOARD_BACKSLASH,
-	KEYMAP_KEYBOARD_NON_US_HASH,
-	KEYMAP_KEYBOARD_SEMICOLON,
-	KEYMAP_KEYBOARD_QUOTE,
-	KEYMAP_KEYBOARD_BACKQUOTE,
-	KEYMAP_KEYBOARD_COMMA,
-	KEYMAP_KEYBOARD_PERIOD,
-	KEYMAP_KEYBOARD_SLASH,
-	KEYMAP_KEYBOARD_CAPS_LOCK,
-	KEYMAP_CONSUMER_AL_CALCULATOR,                // KEYMAP_KEYBOARD_F1
-	KEYMAP_CONSUMER_AL_LOCAL_MACHINE_BROWSER,     // KEYMAP_KEYBOARD_F2
-	KEYMAP_CONSUMER_AL_EMAIL_READER,              // KEYMAP_KEYBOARD_F3
-	KEYMAP_CONSUMER_AL_INTERNET_BROWSER,          // KEYMAP_KEYBOARD_F4
-	KEYMAP_CONSUMER_STOP,                         // KEYMAP_KEYBOARD_F5
-	KEYMAP_CONSUMER_SCAN_PREVIOUS_TRACK,          // KEYMAP_KEYBOARD_F6
-	KEYMAP_CONSUMER_PLAY_PAUSE,                   // KEYMAP_KEYBOARD_F7
-	KEYMAP_CONSUMER_SCAN_NEXT_TRACK,              // KEYMAP_KEYBOARD_F8
-	KEYMAP_CONSUMER_AL_AUDIO_PLAYER,              // KEYMAP_KEYBOARD_F9
-	KEYMAP_CONSUMER_VOLUME_DECREMENT,             // KEYMAP_KEYBOARD_F10
-	KEYMAP_CONSUMER_VOLUME_INCREMENT,             // KEYMAP_KEYBOARD_F11
-	KEYMAP_CONSUMER_MUTE,                         // KEYMAP_KEYBOARD_F12
-	KEYMAP_KEYBOARD_F13,                          // KEYMAP_KEYBOARD_PRINT_SCREEN
-	KEYMAP_KEYBOARD_F14,                          // KEYMAP_KEYBOARD_SCROLL_LOCK
-	KEYMAP_KEYBOARD_F15,                          // KEYMAP_KEYBOARD_PAUSE
-	KEYMAP_CONSUMER_AL_INTEGRATED_HELP_CENTER,    // KEYMAP_KEYBOARD_INSERT
-	KEYMAP_KEYBOARD_HOME,
-	KEYMAP_KEYBOARD_PAGE_UP,
-	KEYMAP_KEYBOARD_BACKSPACE,    // KEYMAP_KEYBOARD_DELETE
-	KEYMAP_KEYBOARD_END,
-	KEYMAP_KEYBOARD_PAGE_DOWN,
-	KEYMAP_KEYBOARD_END,                     // KEYMAP_KEYBOARD_RIGHT_ARROW
-	KEYMAP_KEYBOARD_HOME,                    // KEYMAP_KEYBOARD_LEFT_ARROW
-	KEYMAP_KEYBOARD_PAGE_DOWN,               // KEYMAP_KEYBOARD_DOWN_ARROW
-	KEYMAP_KEYBOARD_PAGE_UP,                 // KEYMAP_KEYBOARD_UP_ARROW
-	KEYMAP_KEYBOARD_KEYPAD_CLEAR,            // KEYMAP_KEYBOARD_NUM_LOCK
-	KEYMAP_CONSUMER_AC_PAN_RIGHT,            // KEYMAP_KEYBOARD_KEYPAD_SLASH
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_3_PRESS,     // KEYMAP_KEYBOARD_KEYPAD_STAR
-	KEYMAP_VIRTUAL_MOUSE_WHEEL_UP,           // KEYMAP_KEYBOARD_KEYPAD_DASH
-	KEYMAP_VIRTUAL_MOUSE_WHEEL_DOWN,         // KEYMAP_KEYBOARD_KEYPAD_PLUS
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_2_PRESS,     // KEYMAP_KEYBOARD_KEYPAD_ENTER
-	KEYMAP_VIRTUAL_MOUSE_SW,                 // KEYMAP_KEYBOARD_KEYPAD_1
-	KEYMAP_VIRTUAL_MOUSE_S,                  // KEYMAP_KEYBOARD_KEYPAD_2
-	KEYMAP_VIRTUAL_MOUSE_SE,                 // KEYMAP_KEYBOARD_KEYPAD_3
-	KEYMAP_VIRTUAL_MOUSE_W,                  // KEYMAP_KEYBOARD_KEYPAD_4
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_1_PRESS,     // KEYMAP_KEYBOARD_KEYPAD_5
-	KEYMAP_VIRTUAL_MOUSE_E,                  // KEYMAP_KEYBOARD_KEYPAD_6
-	KEYMAP_VIRTUAL_MOUSE_NW,                 // KEYMAP_KEYBOARD_KEYPAD_7
-	KEYMAP_VIRTUAL_MOUSE_N,                  // KEYMAP_KEYBOARD_KEYPAD_8
-	KEYMAP_VIRTUAL_MOUSE_NE,                 // KEYMAP_KEYBOARD_KEYPAD_9
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_1_TOGGLE,    // KEYMAP_KEYBOARD_KEYPAD_0
-	KEYMAP_VIRTUAL_MOUSE_BUTTON_2_TOGGLE,    // KEYMAP_KEYBOARD_KEYPAD_PERIOD
-	KEYMAP_KEYBOARD_NON_US_BACKSLASH,
-	KEYMAP_KEYBOARD_APPLICATION,
-	KEYMAP_KEYBOARD_POWER,
-	KEYMAP_CONSUMER_AC_PAN_LEFT,    // KEYMAP_KEYBOARD_KEYPAD_EQUALS
-	KEYMAP_KEYBOARD_F13,
-	KEYMAP_KEYBOARD_F14,
-	KEYMAP_KEYBOARD_F15,
-
-	KEYMAP_VIRTUAL_STICKY_LEFT_CONTROL,     // KEYMAP_KEYBOARD_LEFT_CONTROL
-	KEYMAP_VIRTUAL_STICKY_LEFT_SHIFT,       // KEYMAP_KEYBOARD_LEFT_SHIFT
-	KEYMAP_VIRTUAL_STICKY_LEFT_ALT,         // KEYMAP_KEYBOARD_LEFT_ALT
-	KEYMAP_VIRTUAL_STICKY_LEFT_GUI,         // KEYMAP_KEYBOARD_LEFT_GUI
-	KEYMAP_VIRTUAL_STICKY_RIGHT_CONTROL,    // KEYMAP_KEYBOARD_RIGHT_CONTROL
-	KEYMAP_VIRTUAL_STICKY_RIGHT_SHIFT,      // KEYMAP_KEYBOARD_RIGHT_SHIFT
-	KEYMAP_VIRTUAL_STICKY_RIGHT_ALT,        // KEYMAP_KEYBOARD_RIGHT_ALT
-	KEYMAP_VIRTUAL_STICKY_RIGHT_GUI,        // KEYMAP_KEYBOARD_RIGHT_GUI
-
-	KEYMAP_VIRTUAL_LOCKING_CAPS_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_NUM_LOCK,
-	KEYMAP_VIRTUAL_LOCKING_SCROLL_LOCK
+template< typename t_Buttons, typename t_Matrix >
+void RunCommand(
+	Console const* const pConsole,
+	USB::CDC::Serial* const pSerial,
+	t_Buttons* const pButtons,
+	t_Matrix* const pMatrix,
+	USB::HID::Interface* const* const ppInterfaces,
+	uint8_t const interfaces,
+	FrameScheduler const* const pScheduler,
+	uint32_t const iterations
+)
+{
+	bool const set = ( pConsole->GetArgumentCount() > 0 );
+	int32_t const argument = pConsole->GetArgument( 0 );
+
+	if ( pConsole->IsCommandProgmem( PSTR( "help" ) ) )
+		pSerial->PrintProgmem( PSTR( "stats, latency, debounce [1-8], ghost [0|1], immediate [0|1]\r\n" ) );
+	else if ( pConsole->IsCommandProgmem( PSTR( "stats" ) ) ) {
+
+		pSerial->PrintProgmem(
+			PSTR( "iterations %lu\r\nwork %u us\r\ndropped %u\r\n" ),
+			iterations,
+			static_cast< unsigned int >( pScheduler->GetDurationTicks() / ( F_CPU / 1000000 ) ),
+			pSerial->GetDropped()
+		);
+	}
+	else if ( pConsole->IsCommandProgmem( PSTR( "latency" ) ) ) {
 
-};
-static_assert( ARRAYLENGTH( g_layer4 ) == KEYMAP_BASE_END, "g_layer4 must have same length as the base keymap" );
+		// all zero unless built with LATENCY_TRACE
+		for ( uint8_t ii = 0; ii < LatencyTrace::STAGES; ++ii ) {
+
+			pSerial->PrintProgmem( PSTR( "%u:" ), ii );
+			for ( uint8_t jj = 0; jj < LatencyTrace::BUCKETS; ++jj )
+				pSerial->PrintProgmem( PSTR( " %u" ), LatencyTrace::GetCount( ii, jj ) );
+			pSerial->PrintProgmem( PSTR( "\r\n" ) );
+		}
+	}
+	else if ( pConsole->IsCommandProgmem( PSTR( "debounce" ) ) ) {
 
+		// each iteration re-reads every column, so a large count would stall the scan
+		if ( set && ( ( argument < 1 ) || ( argument > MAXIMUM_DEBOUNCING ) ) )
+			pSerial->PrintProgmem( PSTR( "bad arguments\r\n" ) );
+		else {
 
-extern uint8_t const* const g_layers[] __attribute__(( __progmem__ ));
-uint8_t const* const g_layers[] = {
-	g_layer0,
-	g_layer1,
-	g_layer2,
-	g_layer3,
-	g_layer4,
-	NULL
-};
+			if ( set ) {
+
+				pButtons->SetDebouncing( argument );
+				pMatrix->SetDebouncing( argument );
+			}
+			pSerial->PrintProgmem( PSTR( "debounce %u\r\n" ), pMatrix->GetDebouncing() );
+		}
+	}
+	else if ( pConsole->IsCommandProgmem( PSTR( "ghost" ) ) ) {
+
+		if ( set )
+			pMatrix->SetAntiGhosting( argument != 0 );
+		pSerial->PrintProgmem( PSTR( "ghost %u\r\n" ), ( pMatrix->GetAntiGhosting() ? 1 : 0 ) );
+	}
+	else if ( pConsole->IsCommandProgmem( PSTR( "immediate" ) ) ) {
+
+		if ( set )
+			for ( uint8_t ii = 0; ii < interfaces; ++ii )
+				ppInterfaces[ ii ]->SetImmediate( argument != 0 );
+		pSerial->PrintProgmem( PSTR( "immediate %u\r\n" ), ( ppInterfaces[ 0 ]->GetImmediate() ? 1 : 0 ) );
+	}
+	else
+		pSerial->PrintProgmem( PSTR( "unknown command\r\n" ) );
+}
+
+
+
+
+#endif    /* USB_CONSOLE */
 
 
 
@@ -1280,22 +754,21 @@ int main() {
 	CLKPR = 0;
 
 	// enable the LEDs, and light them up
-	DDRB  = 0x07;
-	PORTB = 0x07;
+	LEDPins::SetOutputs( true );
 
 	USB::Device* pDevice = USB::Device::Instance();
 
 	sei();
 
 
-	Buttons buttons( "b6b7d0d1d2d3d4d5b4d7", false );
+	Buttons< ButtonPins > buttons;
 	buttons.SetDebouncing( 3 );
 
-	KeyboardMatrix matrix( "c0c1c2c3c4c5c6c7", "e7e6e0e1", false );
+	KeyboardMatrix< MatrixRowPins, MatrixColumnPins > matrix;
 	matrix.SetAntiGhosting( true );
 	matrix.SetDebouncing( 3 );
 
-	ADB adb( "b5" );
+	ADB< ADBPin > adb;
 	adb.SetLEDs( 7 );
 
 
@@ -1322,18 +795,45 @@ int main() {
 	uint8_t const mouseString             = pDevice->RegisterStringProgmem( g_mouseString,             ( ARRAYLENGTH( g_mouseString             ) - 1 ) );
 	uint8_t const keyboardString          = pDevice->RegisterStringProgmem( g_keyboardString,          ( ARRAYLENGTH( g_keyboardString          ) - 1 ) );
 	uint8_t const keyboardExtensionString = pDevice->RegisterStringProgmem( g_keyboardExtensionString, ( ARRAYLENGTH( g_keyboardExtensionString ) - 1 ) );
+#ifdef USB_CONSOLE
+	uint8_t const consoleString           = pDevice->RegisterStringProgmem( g_consoleString,           ( ARRAYLENGTH( g_consoleString           ) - 1 ) );
+#endif    /* USB_CONSOLE */
 
 	USB::HID::Mouse             mouse(             ( mouseString             == 0xff ) ? 0 : mouseString             );
 	USB::HID::Keyboard          keyboard(          ( keyboardString          == 0xff ) ? 0 : keyboardString          );
 	USB::HID::KeyboardExtension keyboardExtension( ( keyboardExtensionString == 0xff ) ? 0 : keyboardExtensionString );
 
-	Keymap keymap(
+#ifdef IMMEDIATE_REPORTS
+	// write reports as soon as the keymap produces them, instead of at the next SOF
+	mouse.SetImmediate( true );
+	keyboard.SetImmediate( true );
+	keyboardExtension.SetImmediate( true );
+#endif    /* IMMEDIATE_REPORTS */
+
+#ifdef USB_CONSOLE
+	USB::CDC::Serial serial( ( consoleString == 0xff ) ? 0 : consoleString );
+	Console console( &serial );
+
+	USB::HID::Interface* const interfaces[] = { &mouse, &keyboard, &keyboardExtension };
+	uint32_t iterations = 0;
+#endif    /* USB_CONSOLE */
+
+	// have the device call the interfaces directly, instead of through their vtables
+#ifdef USB_CONSOLE
+	// the serial port registers two interfaces, so it's listed twice
+	USB::Dispatch< USB::HID::Mouse, USB::HID::Keyboard, USB::HID::KeyboardExtension, USB::CDC::Serial, USB::CDC::Serial > dispatch( &mouse, &keyboard, &keyboardExtension, &serial, &serial );
+#else    /* USB_CONSOLE */
+	USB::Dispatch< USB::HID::Mouse, USB::HID::Keyboard, USB::HID::KeyboardExtension > dispatch( &mouse, &keyboard, &keyboardExtension );
+#endif    /* USB_CONSOLE */
+
+	HIDKeymap< USB::HID::Mouse, USB::HID::Keyboard, USB::HID::KeyboardExtension > keymap(
 		&mouse,
 		&keyboard,
 		&keyboardExtension,
-		0.1, 2, 100, 2000,
-		0,   4,   5,  100,
-		g_extendedKeymap
+		&g_mouseMoveCurve,
+		&g_mouseWheelCurve,
+		g_extendedKeymap,
+		ARRAYLENGTH( g_extendedKeymap )
 	);
 	for ( unsigned int ii = 0; ; ++ii ) {
 
@@ -1341,7 +841,14 @@ int main() {
 		uint8_t const* const layer = reinterpret_cast< uint8_t const* >( pgm_read_word( g_layers + ii ) );
 		if ( layer == NULL )
 			break;
-		keymap.SetLayer( ii, layer );
+		keymap.SetLayer( ii, layer, ( ii != 0 ) );
+	}
+	for ( unsigned int ii = 0; ; ++ii ) {
+
+		uint8_t const* const macro = reinterpret_cast< uint8_t const* >( pgm_read_word( g_macros + ii ) );
+		if ( macro == NULL )
+			break;
+		keymap.SetMacro( ii, macro );
 	}
 
 	pDevice->Start(
@@ -1356,98 +863,137 @@ int main() {
 	while ( ! pDevice->GetConfiguration() );
 
 
-	uint16_t pressed[    16 ];
-	uint16_t oldPressed[ 16 ];
-	memset( pressed,    0, sizeof( pressed    ) );
-	memset( oldPressed, 0, sizeof( oldPressed ) );
+	// number of sources currently pressing each code
+	uint8_t counts[ 256 ];
+	memset( counts, 0, sizeof( counts ) );
+
+	// sample the inputs once per frame, just in time for the next SOF
+	FrameScheduler scheduler;
+
+	// set once a key is pressed while suspended, until the host has been woken up
+	bool wakeup = false;
 
 	for ( ; ; ) {
 
-		bool const numLock    = keyboard.GetLED( USB::HID::LED_NUM_LOCK    );
-		bool const capsLock   = keyboard.GetLED( USB::HID::LED_CAPS_LOCK   );
-		bool const scrollLock = keyboard.GetLED( USB::HID::LED_SCROLL_LOCK );
-		PORTB = ( ( PORTB & ~0x07 ) | (
+		/*
+			While the bus is suspended, we sleep between scans, and are woken
+			up either by the watchdog, to scan again, or by the host resuming
+			the bus. Interrupts are disabled while checking, so that a resume
+			can't slip in between the check and the sleep. We stay awake while
+			waking up the host, since the timer, which times the resume, stops
+			in standby.
+		*/
+		cli();
+		if ( pDevice->IsSuspended() && ( ! wakeup ) )
+			Power::Standby();
+		else
+			sei();
+
+		scheduler.Wait();
+
+		// the LEDs are turned off while suspended
+		bool const suspended  = pDevice->IsSuspended();
+		bool const numLock    = ( ( ! suspended ) && keyboard.GetLED( USB::HID::LED_NUM_LOCK    ) );
+		bool const capsLock   = ( ( ! suspended ) && keyboard.GetLED( USB::HID::LED_CAPS_LOCK   ) );
+		bool const scrollLock = ( ( ! suspended ) && keyboard.GetLED( USB::HID::LED_SCROLL_LOCK ) );
+		LEDPins::Write( static_cast< uint8_t >(
 			( numLock    ? 1 : 0 ) |
 			( capsLock   ? 2 : 0 ) |
 			( scrollLock ? 4 : 0 )
 		) );
 		adb.SetLEDs(
-			( numLock    ? ADB::LED_NUM_LOCK    : 0 ) |
-			( capsLock   ? ADB::LED_CAPS_LOCK   : 0 ) |
-			( scrollLock ? ADB::LED_SCROLL_LOCK : 0 )
+			( numLock    ? ADBBase::LED_NUM_LOCK    : 0 ) |
+			( capsLock   ? ADBBase::LED_CAPS_LOCK   : 0 ) |
+			( scrollLock ? ADBBase::LED_SCROLL_LOCK : 0 )
 		);
 
-		bool const buttonsChanged = buttons.Update();
-		bool const matrixChanged  = matrix.Update();
-		bool const adbChanged     = adb.UpdateKeyboard();
-		if ( buttonsChanged || matrixChanged || adbChanged ) {
+		/*
+			Each source reports which of its keys changed since the last
+			poll, so only those are looked up in the source keymaps and
+			passed on, instead of rebuilding the state of every code.
+		*/
 
-			memset( pressed, 0, sizeof( pressed ) );
+		// set if any source reports a newly pressed key, so that we can wake up the host
+		bool pressed = false;
 
-			// get keypresses from buttons list
-			for ( unsigned int ii = 0; ii < BUTTONS; ++ii ) {
+		// get keypresses from buttons list
+		LatencyTrace::Scan();
+		if ( buttons.Update() ) {
 
-				if ( buttons.GetPressed( ii ) ) {
+			Buttons< ButtonPins >::StateType changed = buttons.PollChanged();
+			for ( uint8_t ii = 0; changed != 0; ++ii, changed >>= 1 ) {
 
-					if (ii == 0)
+				if ( changed & 1 ) {
+
+					bool const down = buttons.GetPressed( ii );
+					if ( down && ( ii == 0 ) )
 						_reboot_Teensyduino_();
 
-					uint8_t const code = pgm_read_byte( g_buttonsKeymap + ii );
-					pressed[ code >> 4 ] |= ( 1 << ( code & 15 ) );
+					MergeKey( &keymap, counts, pgm_read_byte( g_buttonsKeymap + ii ), down );
+					pressed |= down;
 				}
 			}
+		}
 
-			// get keypresses from keyboard matrix
-			unsigned int index = 0;
-			for ( unsigned int ii = 0; ii < ROWS; ++ii ) {
-
-				for ( unsigned int jj = 0; jj < COLUMNS; ++jj ) {
-
-					if ( matrix.GetPressed( ii, jj ) ) {
-
-						uint8_t const code = pgm_read_byte( g_matrixKeymap + index );
-						pressed[ code >> 4 ] |= ( 1 << ( code & 15 ) );
-					}
+		// get keypresses from keyboard matrix
+		LatencyTrace::Scan();
+		if ( matrix.Update() ) {
 
-					++index;
-				}
-			}
+			for ( uint8_t ii = 0; ii < ROWS; ++ii ) {
 
-			// get keypresses from ADB
-			for ( unsigned int ii = 0; ii < ARRAYLENGTH( g_adbKeymap ); ++ii ) {
+				KeyboardMatrixBase::ColumnType changed = matrix.PollChanged( ii );
+				for ( uint8_t jj = 0; changed != 0; ++jj, changed >>= 1 ) {
 
-				if ( adb.GetPressed( ii ) ) {
+					if ( changed & 1 ) {
 
-					uint8_t const code = pgm_read_byte( g_adbKeymap + ii );
-					pressed[ code >> 4 ] |= ( 1 << ( code & 15 ) );
+						bool const down = matrix.GetPressed( ii, jj );
+						MergeKey( &keymap, counts, pgm_read_byte( g_matrixKeymap + ii * COLUMNS + jj ), down );
+						pressed |= down;
+					}
 				}
 			}
+		}
 
-			// tell the keymap class about the new keypresses
-			for ( unsigned int ii = 0; ii < ARRAYLENGTH( pressed ); ++ii ) {
-
-				if ( pressed[ ii ] != oldPressed[ ii ] ) {
+		// get keypresses from ADB
+		LatencyTrace::Scan();
+		if ( adb.UpdateKeyboard() ) {
 
-					uint8_t code = ii * 16;
-					for ( unsigned int jj = 0; jj < 16; ++jj ) {
+			for ( uint8_t ii = 0; ii < ARRAYLENGTH( g_adbKeymap ) / 16; ++ii ) {
 
-						uint16_t const mask = ( 1 << jj );
-						if ( ( pressed[ ii ] & mask ) != ( oldPressed[ ii ] & mask ) ) {
+				uint16_t changed = adb.PollChanged( ii );
+				for ( uint8_t jj = ii * 16; changed != 0; ++jj, changed >>= 1 ) {
 
-							if ( pressed[ ii ] & mask )
-								keymap.Press( code );
-							else
-								keymap.Release( code );
-						}
+					if ( changed & 1 ) {
 
-						++code;
+						bool const down = adb.GetPressed( jj );
+						MergeKey( &keymap, counts, pgm_read_byte( g_adbKeymap + jj ), down );
+						pressed |= down;
 					}
 				}
 			}
-
-			memcpy( oldPressed, pressed, sizeof( oldPressed ) );
 		}
+
 		keymap.Update();
+
+		/*
+			Only a press wakes up the host, so that releasing the key which
+			put it to sleep doesn't wake it straight back up. The wakeup may
+			have to wait until the bus has been idle for long enough, so we
+			keep asking until it's been sent, or the host resumes by itself.
+		*/
+		if ( ! suspended )
+			wakeup = false;
+		else if ( pressed || wakeup )
+			wakeup = pDevice->RemoteWakeup();
+
+		scheduler.Finish();
+
+#ifdef USB_CONSOLE
+		// the console only uses the time left over before the next frame, after the work has been timed
+		++iterations;
+		if ( console.Update() )
+			RunCommand( &console, &serial, &buttons, &matrix, interfaces, ARRAYLENGTH( interfaces ), &scheduler, iterations );
+#endif    /* USB_CONSOLE */
 	}
 
 	return 0;
@@ -0,0 +1,469 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file pins.hh
+	\brief Compile-time pin descriptors
+*/
+
+
+
+
+#ifndef __PINS_HH__
+#define __PINS_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include <avr/io.h>
+
+#include <inttypes.h>
+
+
+
+
+namespace _Private {
+
+
+
+
+//============================================================================
+//    Port structures
+//============================================================================
+
+
+/**
+	\brief I/O port register lookup
+
+	Specialized for every port which exists on the target processor. Naming a
+	port which does not exist will fail to compile, since the primary template
+	is left undefined. Since the register addresses are compile-time
+	constants, single-bit accesses through these functions compile to
+	sbi/cbi/sbic/sbis instructions.
+*/
+template< char t_Name >
+struct Port;
+
+
+#if ( defined( PINA ) && defined( DDRA ) && defined( PORTA ) )
+template<>
+struct Port< 'A' > {
+
+	static inline uint8_t volatile& Input()     { return PINA;  }
+	static inline uint8_t volatile& Direction() { return DDRA;  }
+	static inline uint8_t volatile& Output()    { return PORTA; }
+};
+#endif    /* PINA */
+
+
+#if ( defined( PINB ) && defined( DDRB ) && defined( PORTB ) )
+template<>
+struct Port< 'B' > {
+
+	static inline uint8_t volatile& Input()     { return PINB;  }
+	static inline uint8_t volatile& Direction() { return DDRB;  }
+	static inline uint8_t volatile& Output()    { return PORTB; }
+};
+#endif    /* PINB */
+
+
+#if ( defined( PINC ) && defined( DDRC ) && defined( PORTC ) )
+template<>
+struct Port< 'C' > {
+
+	static inline uint8_t volatile& Input()     { return PINC;  }
+	static inline uint8_t volatile& Direction() { return DDRC;  }
+	static inline uint8_t volatile& Output()    { return PORTC; }
+};
+#endif    /* PINC */
+
+
+#if ( defined( PIND ) && defined( DDRD ) && defined( PORTD ) )
+template<>
+struct Port< 'D' > {
+
+	static inline uint8_t volatile& Input()     { return PIND;  }
+	static inline uint8_t volatile& Direction() { return DDRD;  }
+	static inline uint8_t volatile& Output()    { return PORTD; }
+};
+#endif    /* PIND */
+
+
+#if ( defined( PINE ) && defined( DDRE ) && defined( PORTE ) )
+template<>
+struct Port< 'E' > {
+
+	static inline uint8_t volatile& Input()     { return PINE;  }
+	static inline uint8_t volatile& Direction() { return DDRE;  }
+	static inline uint8_t volatile& Output()    { return PORTE; }
+};
+#endif    /* PINE */
+
+
+#if ( defined( PINF ) && defined( DDRF ) && defined( PORTF ) )
+template<>
+struct Port< 'F' > {
+
+	static inline uint8_t volatile& Input()     { return PINF;  }
+	static inline uint8_t volatile& Direction() { return DDRF;  }
+	static inline uint8_t volatile& Output()    { return PORTF; }
+};
+#endif    /* PINF */
+
+
+#if ( defined( PING ) && defined( DDRG ) && defined( PORTG ) )
+template<>
+struct Port< 'G' > {
+
+	static inline uint8_t volatile& Input()     { return PING;  }
+	static inline uint8_t volatile& Direction() { return DDRG;  }
+	static inline uint8_t volatile& Output()    { return PORTG; }
+};
+#endif    /* PING */
+
+
+#if ( defined( PINH ) && defined( DDRH ) && defined( PORTH ) )
+template<>
+struct Port< 'H' > {
+
+	static inline uint8_t volatile& Input()     { return PINH;  }
+	static inline uint8_t volatile& Direction() { return DDRH;  }
+	static inline uint8_t volatile& Output()    { return PORTH; }
+};
+#endif    /* PINH */
+
+
+
+
+//============================================================================
+//    PinListImplementation structure
+//============================================================================
+
+
+/**
+	\brief Helper for PinList
+
+	Each level of the recursion handles one pin, which is stored in bit
+	t_Index of the values passed to Read() and Write(). Since the recursion is
+	unrolled by the compiler, these functions are straight-line sequences of
+	single-bit instructions.
+*/
+template< uint8_t t_Index, typename... t_Pins >
+struct PinListImplementation;
+
+
+template< uint8_t t_Index >
+struct PinListImplementation< t_Index > {
+
+	enum { SIZE = 0 };
+	enum { UNIQUE = true };
+
+	template< uint8_t t_PinIndex >
+	struct Contains {
+
+		enum { VALUE = false };
+	};
+
+
+	template< typename t_Type >
+	static inline void Read( t_Type& value ) { }
+
+	template< typename t_Type >
+	static inline void Write( t_Type const value ) { }
+
+	static inline void SetInputs( bool const pullUp ) { }
+	static inline void SetOutputs( bool const high ) { }
+};
+
+
+template< uint8_t t_Index, typename t_Pin, typename... t_Pins >
+struct PinListImplementation< t_Index, t_Pin, t_Pins... > {
+
+	typedef PinListImplementation< t_Index + 1, t_Pins... > Next;
+
+	enum { SIZE = Next::SIZE + 1 };
+
+	template< uint8_t t_PinIndex >
+	struct Contains {
+
+		enum { VALUE = ( ( t_Pin::INDEX == t_PinIndex ) || Next::template Contains< t_PinIndex >::VALUE ) };
+	};
+
+	enum { UNIQUE = ( ( ! Next::template Contains< t_Pin::INDEX >::VALUE ) && Next::UNIQUE ) };
+
+
+	template< typename t_Type >
+	static inline void Read( t_Type& value ) {
+
+		if ( t_Pin::Read() )
+			value |= ( static_cast< t_Type >( 1 ) << t_Index );
+		Next::Read( value );
+	}
+
+	template< typename t_Type >
+	static inline void Write( t_Type const value ) {
+
+		t_Pin::Write( ( value & ( static_cast< t_Type >( 1 ) << t_Index ) ) != 0 );
+		Next::Write( value );
+	}
+
+	static inline void SetInputs( bool const pullUp ) {
+
+		t_Pin::SetInput();
+		t_Pin::Write( pullUp );
+		Next::SetInputs( pullUp );
+	}
+
+	static inline void SetOutputs( bool const high ) {
+
+		t_Pin::SetOutput();
+		t_Pin::Write( high );
+		Next::SetOutputs( high );
+	}
+};
+
+
+
+
+}    // namespace _Private
+
+
+
+
+//============================================================================
+//    Pin structure
+//============================================================================
+
+
+/**
+	\brief Compile-time pin descriptor
+
+	Names a single pin, e.g. Pin< 'B', 5 >. The port name may be given in
+	either case. All methods are static, and access the pin through
+	compile-time constant register addresses, so each of them compiles to a
+	single instruction.
+
+	\param t_Name  port name ('a'-'h', 'A'-'H')
+	\param t_Bit   bit index (0-7)
+*/
+template< char t_Name, uint8_t t_Bit >
+struct Pin {
+
+	enum { NAME = ( ( ( t_Name >= 'a' ) && ( t_Name <= 'z' ) ) ? ( t_Name - 'a' + 'A' ) : t_Name ) };
+	enum { BIT  = t_Bit };
+	enum { MASK = ( 1u << t_Bit ) };
+
+	/// unique index of this pin, used to detect conflicting assignments
+	enum { INDEX = ( ( NAME - 'A' ) * 8 + BIT ) };
+
+
+	/// \cond false
+	static_assert( ( ( NAME >= 'A' ) && ( NAME <= 'H' ) ), "invalid port name" );
+	static_assert( ( t_Bit < 8 ), "invalid bit index" );
+	/// \endcond
+
+
+	/**
+		\brief Reads the input register
+		\result  true if the pin is high
+	*/
+	static inline bool const Read();
+
+	/**
+		\brief Writes the output register
+
+		For an output pin, this sets the value, and for an input pin, this
+		enables or disables the pull-up resistor.
+
+		\param high  new value
+	*/
+	static inline void Write( bool const high );
+
+	/// \brief Sets the output register
+	static inline void SetHigh();
+
+	/// \brief Clears the output register
+	static inline void SetLow();
+
+	/// \brief Sets the direction to input
+	static inline void SetInput();
+
+	/// \brief Sets the direction to output
+	static inline void SetOutput();
+
+
+private:
+
+	typedef _Private::Port< NAME > PortType;
+};
+
+
+
+
+//============================================================================
+//    PinList structure
+//============================================================================
+
+
+/**
+	\brief Compile-time list of pins
+
+	Pin i of the list corresponds to bit i of the values passed to Read() and
+	Write(). Its UNIQUE member is true iff no pin occurs in the list more than
+	once.
+*/
+template< typename... t_Pins >
+struct PinList : public _Private::PinListImplementation< 0, t_Pins... > { };
+
+
+
+
+namespace _Private {
+
+
+
+
+//============================================================================
+//    PinsDisjoint helpers
+//============================================================================
+
+
+template< typename t_Type >
+struct ToPinList {
+
+	typedef t_Type Type;
+};
+
+
+template< char t_Name, uint8_t t_Bit >
+struct ToPinList< Pin< t_Name, t_Bit > > {
+
+	typedef PinList< Pin< t_Name, t_Bit > > Type;
+};
+
+
+template< typename... t_Lists >
+struct ConcatenatePinLists;
+
+
+template<>
+struct ConcatenatePinLists<> {
+
+	typedef PinList<> Type;
+};
+
+
+template< typename... t_Pins >
+struct ConcatenatePinLists< PinList< t_Pins... > > {
+
+	typedef PinList< t_Pins... > Type;
+};
+
+
+template< typename... t_Pins1, typename... t_Pins2, typename... t_Lists >
+struct ConcatenatePinLists< PinList< t_Pins1... >, PinList< t_Pins2... >, t_Lists... > {
+
+	typedef typename ConcatenatePinLists< PinList< t_Pins1..., t_Pins2... >, t_Lists... >::Type Type;
+};
+
+
+
+
+}    // namespace _Private
+
+
+
+
+//============================================================================
+//    PinsDisjoint structure
+//============================================================================
+
+
+/**
+	\brief Checks for conflicting pin assignments
+
+	Each parameter is either a Pin or a PinList. VALUE is true iff no pin is
+	used more than once, so that the pin assignment for an entire board can
+	be checked with a single static_assert.
+*/
+template< typename... t_Lists >
+struct PinsDisjoint {
+
+	enum { VALUE = _Private::ConcatenatePinLists< typename _Private::ToPinList< t_Lists >::Type... >::Type::UNIQUE };
+};
+
+
+
+
+//============================================================================
+//    Pin inline methods
+//============================================================================
+
+
+template< char t_Name, uint8_t t_Bit >
+bool const Pin< t_Name, t_Bit >::Read() {
+
+	return( ( PortType::Input() & MASK ) != 0 );
+}
+
+
+template< char t_Name, uint8_t t_Bit >
+void Pin< t_Name, t_Bit >::Write( bool const high ) {
+
+	if ( high )
+		SetHigh();
+	else
+		SetLow();
+}
+
+
+template< char t_Name, uint8_t t_Bit >
+void Pin< t_Name, t_Bit >::SetHigh() {
+
+	PortType::Output() |= MASK;
+}
+
+
+template< char t_Name, uint8_t t_Bit >
+void Pin< t_Name, t_Bit >::SetLow() {
+
+	PortType::Output() &= ~MASK;
+}
+
+
+template< char t_Name, uint8_t t_Bit >
+void Pin< t_Name, t_Bit >::SetInput() {
+
+	PortType::Direction() &= ~MASK;
+}
+
+
+template< char t_Name, uint8_t t_Bit >
+void Pin< t_Name, t_Bit >::SetOutput() {
+
+	PortType::Direction() |= MASK;
+}
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __PINS_HH__ */
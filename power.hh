@@ -0,0 +1,143 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file power.hh
+	\brief Power management
+*/
+
+
+
+
+#ifndef __POWER_HH__
+#define __POWER_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include <inttypes.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+
+
+
+//============================================================================
+//    Power class
+//============================================================================
+
+
+/**
+	\brief Puts the CPU to sleep
+
+	All of the methods must be called with interrupts disabled, so that the
+	caller can check whether it should sleep (e.g. whether the USB bus is
+	still suspended) without racing the interrupt which would change its
+	mind. They return, with interrupts enabled, once an interrupt has woken
+	the CPU, and after it has been serviced.
+*/
+struct Power {
+
+	/**
+		\brief Sleeps in idle mode until the next interrupt
+
+		The CPU clock is stopped, but every other clock keeps running, so
+		anything can wake us up (e.g. the USB start-of-frame, or a Timer
+		compare match), and we wake up immediately. This is used to wait
+		between iterations of the main loop.
+	*/
+	static inline void Idle();
+
+	/**
+		\brief Sleeps in standby mode for at most one watchdog period
+
+		Only the oscillator and the asynchronous interrupts (USB wakeup, pin
+		change, external and watchdog) keep running, so this is what we use
+		while the USB bus is suspended. The oscillator is left running so that
+		waking up only takes a few cycles, which lets us wake on the watchdog
+		to scan the inputs (not all of the input pins are capable of pin
+		change interrupts).
+	*/
+	static inline void Standby();
+
+
+private:
+
+	/// \brief Sleeps in the given mode until an interrupt arrives
+	static inline void Sleep( uint8_t const mode );
+
+
+	inline Power();
+	inline Power( Power const& other );
+	inline Power const& operator=( Power const& other );
+};
+
+
+
+
+//============================================================================
+//    Power inline methods
+//============================================================================
+
+
+void Power::Idle() {
+
+	Sleep( SLEEP_MODE_IDLE );
+}
+
+
+void Power::Standby() {
+
+	// run the watchdog in interrupt mode, with a 16ms timeout
+	wdt_reset();
+	WDTCSR = ( ( 1 << WDCE ) | ( 1 << WDE ) );
+	WDTCSR = ( 1 << WDIE );
+
+	Sleep( SLEEP_MODE_STANDBY );
+
+	// stop the watchdog
+	cli();
+	wdt_reset();
+	MCUSR &= ~( 1 << WDRF );
+	WDTCSR = ( ( 1 << WDCE ) | ( 1 << WDE ) );
+	WDTCSR = 0;
+	sei();
+}
+
+
+void Power::Sleep( uint8_t const mode ) {
+
+	set_sleep_mode( mode );
+	sleep_enable();
+	// the instruction following sei() is executed before any interrupt, so none can sneak in before we're asleep
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __POWER_HH__ */
@@ -0,0 +1,178 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file ring_buffer.hh
+	\brief RingBuffer implementation
+*/
+
+
+
+
+#ifndef __RING_BUFFER_HH__
+#define __RING_BUFFER_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include <inttypes.h>
+
+
+
+
+//============================================================================
+//    RingBuffer class
+//============================================================================
+
+
+/**
+	\brief Single-producer single-consumer byte queue
+
+	One side (e.g. the main loop) may call Push() while the other (e.g. an
+	interrupt) calls Pop(), without either having to disable interrupts: the
+	producer only ever writes the head index, and the consumer the tail, and
+	both are single bytes, so they're read and written atomically. The
+	indices run freely from 0 to 255, and are reduced modulo t_Size only when
+	indexing, so a full buffer can be told apart from an empty one.
+
+	\param t_Size  capacity (bytes), a power of two no larger than 128
+*/
+template< uint8_t t_Size >
+struct RingBuffer {
+
+	static_assert( ( ( t_Size & ( t_Size - 1 ) ) == 0 ) && ( t_Size > 0 ) && ( t_Size <= 128 ), "RingBuffer size must be a power of two no larger than 128" );
+
+
+	inline RingBuffer();
+
+
+	/// \brief Number of bytes queued
+	inline uint8_t const GetCount() const;
+
+	inline bool const IsEmpty() const;
+	inline bool const IsFull() const;
+
+
+	/**
+		\brief Appends a byte (producer only)
+		\param byte  byte to append
+		\result  true on success, false if the buffer was full
+	*/
+	inline bool const Push( uint8_t const byte );
+
+	/**
+		\brief Removes the oldest byte (consumer only)
+		\param pByte  receives the byte
+		\result  true on success, false if the buffer was empty
+	*/
+	inline bool const Pop( uint8_t* const pByte );
+
+
+private:
+
+	enum { MASK = t_Size - 1 };
+
+
+	// the data is volatile too, so that it's written before the head index is advanced
+	uint8_t volatile m_data[ t_Size ];
+	uint8_t volatile m_head;    ///< written by the producer
+	uint8_t volatile m_tail;    ///< written by the consumer
+
+
+	inline RingBuffer( RingBuffer const& other );
+	inline RingBuffer const& operator=( RingBuffer const& other );
+};
+
+
+
+
+//============================================================================
+//    RingBuffer inline methods
+//============================================================================
+
+
+template< uint8_t t_Size >
+RingBuffer< t_Size >::RingBuffer() :
+	m_head( 0 ),
+	m_tail( 0 )
+{
+}
+
+
+template< uint8_t t_Size >
+uint8_t const RingBuffer< t_Size >::GetCount() const {
+
+	return( static_cast< uint8_t >( m_head - m_tail ) );
+}
+
+
+template< uint8_t t_Size >
+bool const RingBuffer< t_Size >::IsEmpty() const {
+
+	return( m_head == m_tail );
+}
+
+
+template< uint8_t t_Size >
+bool const RingBuffer< t_Size >::IsFull() const {
+
+	return( GetCount() >= t_Size );
+}
+
+
+template< uint8_t t_Size >
+bool const RingBuffer< t_Size >::Push( uint8_t const byte ) {
+
+	bool success = false;
+
+	uint8_t const head = m_head;
+	if ( static_cast< uint8_t >( head - m_tail ) < t_Size ) {
+
+		m_data[ head & MASK ] = byte;
+		m_head = head + 1;
+
+		success = true;
+	}
+	return success;
+}
+
+
+template< uint8_t t_Size >
+bool const RingBuffer< t_Size >::Pop( uint8_t* const pByte ) {
+
+	bool success = false;
+
+	uint8_t const tail = m_tail;
+	if ( m_head != tail ) {
+
+		*pByte = m_data[ tail & MASK ];
+		m_tail = tail + 1;
+
+		success = true;
+	}
+	return success;
+}
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __RING_BUFFER_HH__ */
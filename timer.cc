@@ -30,7 +30,7 @@
 
 
 //============================================================================
-//    Timer overflow interrupt
+//    Timer interrupts
 //============================================================================
 
 
@@ -38,3 +38,7 @@ ISR( TIMER1_OVF_vect ) {
 
 	_Private::OverflowInterrupt();
 }
+
+
+// the compare match only wakes us up from Timer::SleepTicks(), so there's nothing to do
+EMPTY_INTERRUPT( TIMER1_COMPA_vect );
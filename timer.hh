@@ -32,6 +32,7 @@
 
 
 
+#include "power.hh"
 #include "helpers.h"
 
 #include <inttypes.h>
@@ -82,6 +83,15 @@ struct Timer {
 
 	inline void const DelayTicks( uint16_t const ticks ) const;
 
+	/**
+		\brief Like DelayTicks(), but sleeps instead of spinning
+
+		The CPU sleeps in idle mode, and is woken by a compare match interrupt
+		when the time is up (or earlier by any other interrupt, after which it
+		goes back to sleep). Must be called with interrupts enabled.
+	*/
+	inline void const SleepTicks( uint16_t const ticks ) const;
+
 
 private:
 
@@ -153,6 +163,27 @@ void const Timer::DelayTicks( uint16_t const ticks ) const {
 }
 
 
+void const Timer::SleepTicks( uint16_t const ticks ) const {
+
+	// the 16-bit registers share a temporary byte with the interrupts' reads of TCNT1
+	cli();
+	uint16_t const startTime = GetTicks();
+	OCR1A = startTime + ticks;
+	TIFR1 = ( 1 << OCF1A );
+	TIMSK1 |= ( 1 << OCIE1A );
+
+	// if the compare match arrives before we're asleep, its interrupt will wake us straight away
+	while ( ( GetTicks() - startTime ) < ticks ) {
+
+		Power::Idle();
+		cli();
+	}
+
+	TIMSK1 &= ~( 1 << OCIE1A );
+	sei();
+}
+
+
 Timer::Timer() {
 
 	// save and clear the interrupt flag
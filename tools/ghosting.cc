@@ -0,0 +1,530 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file ghosting.cc
+	\brief Host-side verifier and benchmark for the anti-ghosting code
+
+	Compiles KeyboardMatrixBase natively, and enumerates every combination of
+	up to N pressed keys on a switch map, using all cores. For each
+	combination, we compute what a diode-less matrix would read, and check
+	the keys reported by KeyboardMatrixBase::UpdateState() against a
+	brute-force reference. Each combination is checked twice: once with all
+	keys pressed at the same time, and once with the keys pressed one after
+	the other.
+
+	Usage: ghosting [-k keys] [-j threads] [switch map]
+
+	The switch map is a text file with one line per row, containing 'x' where
+	a switch exists and '.' otherwise. Lines starting with '#' are ignored.
+	The default is aek2.switches.
+*/
+
+
+
+
+#include "../keyboard_matrix.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+
+thread_local uint8_t volatile g_hostSREG = 0x80;
+
+
+
+
+namespace {
+
+
+
+
+//============================================================================
+//    Constants
+//============================================================================
+
+
+typedef KeyboardMatrixBase::ColumnType ColumnType;
+
+enum { MAXIMUM_ROWS    = KeyboardMatrixBase::MAXIMUM_ROWS    };
+enum { MAXIMUM_COLUMNS = KeyboardMatrixBase::MAXIMUM_COLUMNS };
+enum { MAXIMUM_KEYS    = 16 };
+
+enum { BUCKET_NANOSECONDS = 16   };    ///< width of timing histogram buckets
+enum { BUCKETS            = 4096 };    ///< the last bucket collects all longer timings
+enum { MAXIMUM_FAILURES   = 8    };    ///< number of failures which will be printed in full
+
+
+
+
+//============================================================================
+//    TestMatrix class
+//============================================================================
+
+
+/**
+	\brief Exposes the protected interface of KeyboardMatrixBase
+
+	The pins are replaced by passing each simulated scan directly to
+	UpdateState().
+*/
+struct TestMatrix : public KeyboardMatrixBase {
+
+	TestMatrix( uint8_t const rows, uint8_t const logColumns ) : KeyboardMatrixBase( rows, logColumns ) { }
+
+	using KeyboardMatrixBase::UpdateState;
+};
+
+
+
+
+//============================================================================
+//    SwitchMap structure
+//============================================================================
+
+
+struct SwitchMap {
+
+	uint8_t rows;
+	uint8_t columns;
+	uint8_t logColumns;
+	ColumnType mask[ MAXIMUM_ROWS ];
+
+	std::vector< uint8_t > keyRows;       ///< row of each switch
+	std::vector< uint8_t > keyColumns;    ///< column of each switch
+};
+
+
+
+
+//============================================================================
+//    Statistics structure
+//============================================================================
+
+
+/// \brief Per-thread counters, indexed by the number of pressed keys
+struct Statistics {
+
+	Statistics() {
+
+		memset( combinations, 0, sizeof( combinations ) );
+		memset( failures,     0, sizeof( failures     ) );
+		buckets.assign( ( MAXIMUM_KEYS + 1 ) * BUCKETS, 0 );
+	}
+
+	uint64_t combinations[ MAXIMUM_KEYS + 1 ];
+	uint64_t failures[     MAXIMUM_KEYS + 1 ];
+	std::vector< uint64_t > buckets;
+};
+
+
+
+
+//============================================================================
+//    Helper functions
+//============================================================================
+
+
+bool LoadSwitchMap( SwitchMap* const pSwitchMap, char const* const path ) {
+
+	std::ifstream file( path );
+	if ( ! file ) {
+
+		fprintf( stderr, "unable to open \"%s\"\n", path );
+		return false;
+	}
+
+	pSwitchMap->rows    = 0;
+	pSwitchMap->columns = 0;
+	for ( std::string line; std::getline( file, line ); ) {
+
+		if ( line.empty() || ( line[ 0 ] == '#' ) )
+			continue;
+		if ( ( pSwitchMap->rows >= MAXIMUM_ROWS ) || ( line.size() > MAXIMUM_COLUMNS ) ) {
+
+			fprintf( stderr, "switch map is larger than %ux%u\n", MAXIMUM_ROWS, MAXIMUM_COLUMNS );
+			return false;
+		}
+
+		ColumnType mask = 0;
+		for ( unsigned int ii = 0; ii < line.size(); ++ii ) {
+
+			if ( ( line[ ii ] == 'x' ) || ( line[ ii ] == 'X' ) ) {
+
+				mask |= ( static_cast< ColumnType >( 1 ) << ii );
+				pSwitchMap->keyRows.push_back( pSwitchMap->rows );
+				pSwitchMap->keyColumns.push_back( ii );
+			}
+		}
+		pSwitchMap->mask[ pSwitchMap->rows++ ] = mask;
+		pSwitchMap->columns = std::max< uint8_t >( pSwitchMap->columns, line.size() );
+	}
+
+	// the column pins drive a demultiplexer, so the number of columns is a power of two
+	for ( pSwitchMap->logColumns = 0; ( 1u << pSwitchMap->logColumns ) < pSwitchMap->columns; ++pSwitchMap->logColumns );
+
+	return( pSwitchMap->rows > 0 );
+}
+
+
+/**
+	\brief Computes what a diode-less matrix reads
+
+	Current flows between a row and a column iff they are connected by a path
+	of pressed keys, so a switch reads as pressed iff its row and column are
+	connected. This is computed by repeatedly merging rows which share a
+	column, until nothing changes.
+
+	\param observed   filled in with the observed state
+	\param pressed    keys which are physically pressed
+	\param switchMap  switch map
+*/
+void Observe( ColumnType observed[], ColumnType const pressed[], SwitchMap const& switchMap ) {
+
+	ColumnType reach[ MAXIMUM_ROWS ];
+	memcpy( reach, pressed, switchMap.rows * sizeof( ColumnType ) );
+
+	for ( bool changed = true; changed; ) {
+
+		changed = false;
+		for ( uint8_t ii = 0; ii < switchMap.rows; ++ii ) {
+
+			for ( uint8_t jj = 0; jj < switchMap.rows; ++jj ) {
+
+				if ( ( ( reach[ ii ] & reach[ jj ] ) != 0 ) && ( reach[ ii ] != reach[ jj ] ) ) {
+
+					reach[ ii ] |= reach[ jj ];
+					reach[ jj ]  = reach[ ii ];
+					changed = true;
+				}
+			}
+		}
+	}
+
+	for ( uint8_t ii = 0; ii < switchMap.rows; ++ii )
+		observed[ ii ] = ( reach[ ii ] & switchMap.mask[ ii ] );
+}
+
+
+/**
+	\brief Brute-force reference for ghosted keys
+
+	A key in the observed state is ghosted iff there is some set of pressed
+	keys which does not contain it, but produces the same observation. Since
+	Observe() is monotone, and every candidate set must be a subset of the
+	observation, it suffices to check the largest candidate: the observation
+	with the key removed.
+
+	\param ghosted   filled in with the ghosted flags
+	\param observed  observed state
+	\param switchMap  switch map
+*/
+void FindGhosted( ColumnType ghosted[], ColumnType const observed[], SwitchMap const& switchMap ) {
+
+	for ( uint8_t ii = 0; ii < switchMap.rows; ++ii ) {
+
+		ghosted[ ii ] = 0;
+		for ( uint8_t jj = 0; jj < switchMap.columns; ++jj ) {
+
+			ColumnType const mask = ( static_cast< ColumnType >( 1 ) << jj );
+			if ( observed[ ii ] & mask ) {
+
+				ColumnType candidate[ MAXIMUM_ROWS ];
+				memcpy( candidate, observed, switchMap.rows * sizeof( ColumnType ) );
+				candidate[ ii ] &= ~mask;
+
+				ColumnType result[ MAXIMUM_ROWS ];
+				Observe( result, candidate, switchMap );
+				if ( memcmp( result, observed, switchMap.rows * sizeof( ColumnType ) ) == 0 )
+					ghosted[ ii ] |= mask;
+			}
+		}
+	}
+}
+
+
+/**
+	\brief Passes a scan to the matrix, returning the reported keys and elapsed time
+	\result  nanoseconds spent in UpdateState()
+*/
+uint64_t const Scan( TestMatrix& matrix, ColumnType reported[], ColumnType const observed[], SwitchMap const& switchMap ) {
+
+	ColumnType work[ MAXIMUM_ROWS ];
+	memcpy( work, observed, switchMap.rows * sizeof( ColumnType ) );
+
+	auto const start = std::chrono::steady_clock::now();
+	matrix.UpdateState( work );
+	auto const stop = std::chrono::steady_clock::now();
+
+	for ( uint8_t ii = 0; ii < switchMap.rows; ++ii ) {
+
+		reported[ ii ] = 0;
+		for ( uint8_t jj = 0; jj < switchMap.columns; ++jj )
+			if ( matrix.GetPressed( ii, jj ) )
+				reported[ ii ] |= ( static_cast< ColumnType >( 1 ) << jj );
+	}
+
+	return std::chrono::duration_cast< std::chrono::nanoseconds >( stop - start ).count();
+}
+
+
+void PrintFailure( std::mutex& outputMutex, SwitchMap const& switchMap, std::vector< unsigned int > const& combination, char const* const message ) {
+
+	std::lock_guard< std::mutex > lock( outputMutex );
+
+	fprintf( stderr, "FAILURE (%s):", message );
+	for ( unsigned int ii = 0; ii < combination.size(); ++ii )
+		fprintf( stderr, " r%uc%u", switchMap.keyRows[ combination[ ii ] ], switchMap.keyColumns[ combination[ ii ] ] );
+	fprintf( stderr, "\n" );
+}
+
+
+/**
+	\brief Checks a single combination of pressed keys
+	\result  true on success
+*/
+bool const Check( TestMatrix& matrix, Statistics& statistics, std::mutex& outputMutex, SwitchMap const& switchMap, std::vector< unsigned int > const& combination ) {
+
+	ColumnType const empty[ MAXIMUM_ROWS ] = { 0 };
+	ColumnType reported[ MAXIMUM_ROWS ];
+
+	ColumnType pressed[ MAXIMUM_ROWS ];
+	memset( pressed, 0, sizeof( pressed ) );
+
+	bool success = true;
+
+	// all keys pressed simultaneously: exactly the non-ghosted keys are reported
+	{	for ( unsigned int ii = 0; ii < combination.size(); ++ii )
+			pressed[ switchMap.keyRows[ combination[ ii ] ] ] |= ( static_cast< ColumnType >( 1 ) << switchMap.keyColumns[ combination[ ii ] ] );
+
+		ColumnType observed[ MAXIMUM_ROWS ];
+		Observe( observed, pressed, switchMap );
+		ColumnType ghosted[ MAXIMUM_ROWS ];
+		FindGhosted( ghosted, observed, switchMap );
+
+		Scan( matrix, reported, empty, switchMap );
+		uint64_t const nanoseconds = Scan( matrix, reported, observed, switchMap );
+		statistics.buckets[ combination.size() * BUCKETS + std::min< uint64_t >( nanoseconds / BUCKET_NANOSECONDS, BUCKETS - 1 ) ] += 1;
+
+		for ( uint8_t ii = 0; ii < switchMap.rows; ++ii )
+			if ( reported[ ii ] != ( observed[ ii ] & ~ghosted[ ii ] ) )
+				success = false;
+		if ( ! success && ( statistics.failures[ combination.size() ] < MAXIMUM_FAILURES ) )
+			PrintFailure( outputMutex, switchMap, combination, "simultaneous" );
+	}
+
+	// keys pressed one at a time: every non-ghosted key is reported, and every reported key is pressed
+	if ( success ) {
+
+		Scan( matrix, reported, empty, switchMap );
+		memset( pressed, 0, sizeof( pressed ) );
+
+		for ( unsigned int ii = 0; success && ( ii < combination.size() ); ++ii ) {
+
+			pressed[ switchMap.keyRows[ combination[ ii ] ] ] |= ( static_cast< ColumnType >( 1 ) << switchMap.keyColumns[ combination[ ii ] ] );
+
+			ColumnType observed[ MAXIMUM_ROWS ];
+			Observe( observed, pressed, switchMap );
+			ColumnType ghosted[ MAXIMUM_ROWS ];
+			FindGhosted( ghosted, observed, switchMap );
+
+			Scan( matrix, reported, observed, switchMap );
+			for ( uint8_t jj = 0; jj < switchMap.rows; ++jj ) {
+
+				if ( ( reported[ jj ] & ~pressed[ jj ] ) != 0 )
+					success = false;
+				if ( ( observed[ jj ] & ~ghosted[ jj ] & ~reported[ jj ] ) != 0 )
+					success = false;
+			}
+		}
+		if ( ! success && ( statistics.failures[ combination.size() ] < MAXIMUM_FAILURES ) )
+			PrintFailure( outputMutex, switchMap, combination, "sequential" );
+	}
+
+	++statistics.combinations[ combination.size() ];
+	if ( ! success )
+		++statistics.failures[ combination.size() ];
+
+	return success;
+}
+
+
+/**
+	\brief Enumerates all combinations which extend the given one
+	\param combination  combination so far (its elements are increasing)
+*/
+void Enumerate( TestMatrix& matrix, Statistics& statistics, std::mutex& outputMutex, SwitchMap const& switchMap, unsigned int const maximumKeys, std::vector< unsigned int >& combination ) {
+
+	Check( matrix, statistics, outputMutex, switchMap, combination );
+
+	if ( combination.size() < maximumKeys ) {
+
+		for ( unsigned int ii = combination.back() + 1; ii < switchMap.keyRows.size(); ++ii ) {
+
+			combination.push_back( ii );
+			Enumerate( matrix, statistics, outputMutex, switchMap, maximumKeys, combination );
+			combination.pop_back();
+		}
+	}
+}
+
+
+/// \brief Finds the smallest time t such that at least the given fraction of timings are <= t
+uint64_t const Percentile( uint64_t const* const buckets, uint64_t const total, double const fraction ) {
+
+	uint64_t const target = static_cast< uint64_t >( fraction * total );
+	uint64_t sum = 0;
+	unsigned int ii = 0;
+	for ( ; ii < BUCKETS - 1; ++ii ) {
+
+		sum += buckets[ ii ];
+		if ( sum > target )
+			break;
+	}
+
+	return( ( ii + 1 ) * BUCKET_NANOSECONDS );
+}
+
+
+
+
+}    // anonymous namespace
+
+
+
+
+//============================================================================
+//    main function
+//============================================================================
+
+
+int main( int argc, char* argv[] ) {
+
+	unsigned int maximumKeys = 4;
+	unsigned int threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+	for ( int option; ( option = getopt( argc, argv, "k:j:h" ) ) != -1; ) {
+
+		switch( option ) {
+			case 'k': maximumKeys = std::min< unsigned int >( atoi( optarg ), MAXIMUM_KEYS ); break;
+			case 'j': threads     = std::max< int >( atoi( optarg ), 1 ); break;
+			default: {
+
+				fprintf( stderr, "usage: %s [-k keys] [-j threads] [switch map]\n", argv[ 0 ] );
+				return 2;
+			}
+		}
+	}
+
+	SwitchMap switchMap;
+	if ( ! LoadSwitchMap( &switchMap, ( ( optind < argc ) ? argv[ optind ] : "aek2.switches" ) ) )
+		return 2;
+	printf(
+		"%u rows, %u columns, %u switches, up to %u keys, %u threads\n",
+		switchMap.rows,
+		( 1u << switchMap.logColumns ),
+		static_cast< unsigned int >( switchMap.keyRows.size() ),
+		maximumKeys,
+		threads
+	);
+
+	// work is handed out by the index of the first (smallest) key of each combination
+	std::atomic< unsigned int > next( 0 );
+	std::mutex outputMutex;
+	std::vector< Statistics > statistics( threads );
+
+	auto const start = std::chrono::steady_clock::now();
+	{	std::vector< std::thread > workers;
+		for ( unsigned int ii = 0; ii < threads; ++ii ) {
+
+			workers.push_back( std::thread( [ &, ii ]() {
+
+				TestMatrix matrix( switchMap.rows, switchMap.logColumns );
+				matrix.SetAntiGhosting( true );
+				for ( unsigned int jj = 0; jj < switchMap.keyRows.size(); ++jj )
+					matrix.SetSwitch( switchMap.keyRows[ jj ], switchMap.keyColumns[ jj ], true );
+
+				std::vector< unsigned int > combination;
+				for ( unsigned int first; ( first = next++ ) < switchMap.keyRows.size(); ) {
+
+					combination.assign( 1, first );
+					Enumerate( matrix, statistics[ ii ], outputMutex, switchMap, maximumKeys, combination );
+				}
+			} ) );
+		}
+		for ( unsigned int ii = 0; ii < threads; ++ii )
+			workers[ ii ].join();
+	}
+	auto const stop = std::chrono::steady_clock::now();
+
+	// merge the per-thread statistics
+	Statistics total;
+	for ( unsigned int ii = 0; ii < threads; ++ii ) {
+
+		for ( unsigned int jj = 0; jj <= MAXIMUM_KEYS; ++jj ) {
+
+			total.combinations[ jj ] += statistics[ ii ].combinations[ jj ];
+			total.failures[     jj ] += statistics[ ii ].failures[     jj ];
+		}
+		for ( unsigned int jj = 0; jj < total.buckets.size(); ++jj )
+			total.buckets[ jj ] += statistics[ ii ].buckets[ jj ];
+	}
+
+	printf( "\nkeys  combinations  failures   min ns   p50 ns   p90 ns   p99 ns   max ns\n" );
+	uint64_t failures = 0;
+	for ( unsigned int ii = 1; ii <= maximumKeys; ++ii ) {
+
+		uint64_t const* const buckets = &total.buckets[ ii * BUCKETS ];
+
+		unsigned int minimum = 0;
+		while ( ( minimum < BUCKETS - 1 ) && ( buckets[ minimum ] == 0 ) )
+			++minimum;
+		unsigned int maximum = BUCKETS - 1;
+		while ( ( maximum > 0 ) && ( buckets[ maximum ] == 0 ) )
+			--maximum;
+
+		printf(
+			"%4u  %12llu  %8llu  %7u  %7llu  %7llu  %7llu  %6u%s\n",
+			ii,
+			static_cast< unsigned long long >( total.combinations[ ii ] ),
+			static_cast< unsigned long long >( total.failures[ ii ] ),
+			minimum * BUCKET_NANOSECONDS,
+			static_cast< unsigned long long >( Percentile( buckets, total.combinations[ ii ], 0.50 ) ),
+			static_cast< unsigned long long >( Percentile( buckets, total.combinations[ ii ], 0.90 ) ),
+			static_cast< unsigned long long >( Percentile( buckets, total.combinations[ ii ], 0.99 ) ),
+			( maximum + 1 ) * BUCKET_NANOSECONDS,
+			( ( maximum == BUCKETS - 1 ) ? "+" : "" )
+		);
+		failures += total.failures[ ii ];
+	}
+	printf( "\n%.1f seconds\n", std::chrono::duration< double >( stop - start ).count() );
+
+	return( ( failures == 0 ) ? 0 : 1 );
+}
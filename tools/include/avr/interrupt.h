@@ -0,0 +1,49 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file interrupt.h
+	\brief Host replacement for avr-libc's avr/interrupt.h
+*/
+
+
+
+
+#ifndef __HOST_AVR_INTERRUPT_H__
+#define __HOST_AVR_INTERRUPT_H__
+
+
+
+
+#include <avr/io.h>
+
+
+
+
+#define cli() ( SREG &= 0x7f )
+#define sei() ( SREG |= 0x80 )
+
+
+// interrupt handlers become ordinary functions, which the host tools call directly
+#define ISR( vector ) extern "C" void vector()
+#define EMPTY_INTERRUPT( vector ) extern "C" void vector() { }
+
+
+
+
+#endif    /* __HOST_AVR_INTERRUPT_H__ */
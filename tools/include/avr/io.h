@@ -0,0 +1,61 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file io.h
+	\brief Host replacement for avr-libc's avr/io.h
+
+	Only the status register is provided, so firmware sources which don't
+	touch I/O registers (e.g. the anti-ghosting code) can be compiled
+	natively. Each thread has its own copy, since the host tools run the
+	firmware code on several threads at once.
+
+	If HOST_USB_MODEL is defined, the USB controller and timer registers
+	are provided as well, backed by the register-level model in
+	../../usb_model.hh.
+*/
+
+
+
+
+#ifndef __HOST_AVR_IO_H__
+#define __HOST_AVR_IO_H__
+
+
+
+
+#include <inttypes.h>
+
+
+
+
+extern thread_local uint8_t volatile g_hostSREG;
+
+#define SREG g_hostSREG
+
+
+
+
+#ifdef HOST_USB_MODEL
+#include "../../usb_model.hh"
+#endif    /* HOST_USB_MODEL */
+
+
+
+
+#endif    /* __HOST_AVR_IO_H__ */
@@ -0,0 +1,53 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file pgmspace.h
+	\brief Host replacement for avr-libc's avr/pgmspace.h
+*/
+
+
+
+
+#ifndef __HOST_AVR_PGMSPACE_H__
+#define __HOST_AVR_PGMSPACE_H__
+
+
+
+
+#include <inttypes.h>
+#include <string.h>
+
+
+
+
+// the host has a single address space, so program memory is ordinary memory
+#define PROGMEM
+#define PSTR( string ) ( string )
+
+#define pgm_read_byte( address ) ( *reinterpret_cast< uint8_t const* >( address ) )
+#define pgm_read_word( address ) ( *reinterpret_cast< uint16_t const* >( address ) )
+
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+#define strlen_P strlen
+
+
+
+
+#endif    /* __HOST_AVR_PGMSPACE_H__ */
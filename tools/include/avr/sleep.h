@@ -0,0 +1,45 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file sleep.h
+	\brief Host replacement for avr-libc's avr/sleep.h
+*/
+
+
+
+
+#ifndef __HOST_AVR_SLEEP_H__
+#define __HOST_AVR_SLEEP_H__
+
+
+
+
+#define SLEEP_MODE_IDLE    0
+#define SLEEP_MODE_STANDBY 1
+
+// the host tools never wait for interrupts, so sleeping does nothing
+inline void set_sleep_mode( int const ) { }
+inline void sleep_enable() { }
+inline void sleep_disable() { }
+inline void sleep_cpu() { }
+
+
+
+
+#endif    /* __HOST_AVR_SLEEP_H__ */
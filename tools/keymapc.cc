@@ -0,0 +1,293 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file keymapc.cc
+	\brief Compiles a textual keymap into layer tables
+
+	Usage: keymapc keymap.hh layers.keymap > layers.hh
+
+	The code numbering is taken from the base keymap enumeration in
+	keymap.hh, so that the output matches the firmware it's compiled into.
+
+	The input consists of "layer <name>" lines, each followed by mappings of
+	the form "<code> = <assignment>", where both sides are names from the
+	keymap enumerations with the "KEYMAP_" prefix left off. Everything after
+	a '#' is a comment.
+
+	The first layer is the base layer, in which codes which aren't mentioned
+	map to themselves. It is written out in full. In every other layer, codes
+	which aren't mentioned are transparent, i.e. fall through to the base
+	layer. These are written out in the sparse format described in keymap.hh:
+	a presence bitmap, the number of overrides before each byte of the
+	bitmap, and then the overrides in code order.
+*/
+
+
+
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+
+
+
+namespace {
+
+
+
+
+//============================================================================
+//    Layer structure
+//============================================================================
+
+
+struct Layer {
+
+	std::string name;
+	std::map< unsigned int, std::string > assignments;    // code -> assignment name
+};
+
+
+
+
+//============================================================================
+//    Helper functions
+//============================================================================
+
+
+bool LoadCodes( std::vector< std::string >* const pCodes, char const* const path ) {
+
+	std::ifstream file( path );
+	if ( ! file ) {
+
+		fprintf( stderr, "unable to open \"%s\"\n", path );
+		return false;
+	}
+	std::stringstream stream;
+	stream << file.rdbuf();
+	std::string const text = stream.str();
+
+	std::string::size_type const begin = text.find( "KEYMAP_BASE_BEGIN = 0," );
+	std::string::size_type const end = text.find( "KEYMAP_BASE_END", begin );
+	if ( ( begin == std::string::npos ) || ( end == std::string::npos ) ) {
+
+		fprintf( stderr, "unable to find the base keymap enumeration in \"%s\"\n", path );
+		return false;
+	}
+
+	// every identifier which starts a line is an enumerator
+	std::istringstream body( text.substr( begin, end - begin ) );
+	std::string line;
+	std::getline( body, line );
+	while ( std::getline( body, line ) ) {
+
+		std::string::size_type const first = line.find_first_not_of( " \t" );
+		if ( ( first == std::string::npos ) || ( line.compare( first, 7, "KEYMAP_" ) != 0 ) )
+			continue;
+		std::string::size_type const last = line.find_first_not_of( "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", first );
+		pCodes->push_back( line.substr( first + 7, ( ( last == std::string::npos ) ? line.size() : last ) - first - 7 ) );
+	}
+
+	if ( pCodes->empty() || ( pCodes->size() > 256 ) ) {
+
+		fprintf( stderr, "base keymap in \"%s\" has %u codes\n", path, static_cast< unsigned int >( pCodes->size() ) );
+		return false;
+	}
+	return true;
+}
+
+
+bool LoadLayers( std::vector< Layer >* const pLayers, std::vector< std::string > const& codes, char const* const path ) {
+
+	std::map< std::string, unsigned int > codeIndices;
+	for ( unsigned int ii = 0; ii < codes.size(); ++ii )
+		codeIndices[ codes[ ii ] ] = ii;
+
+	std::ifstream file( path );
+	if ( ! file ) {
+
+		fprintf( stderr, "unable to open \"%s\"\n", path );
+		return false;
+	}
+
+	std::string line;
+	for ( unsigned int lineNumber = 1; std::getline( file, line ); ++lineNumber ) {
+
+		std::string::size_type const comment = line.find( '#' );
+		if ( comment != std::string::npos )
+			line.erase( comment );
+		for ( std::string::iterator ii = line.begin(); ii != line.end(); ++ii )
+			if ( *ii == '=' )
+				*ii = ' ';
+
+		std::istringstream words( line );
+		std::string first, second, rest;
+		if ( ! ( words >> first ) )
+			continue;
+		words >> second >> rest;
+
+		if ( first == "layer" ) {
+
+			if ( second.empty() || ! rest.empty() ) {
+
+				fprintf( stderr, "%s:%u: expected \"layer <name>\"\n", path, lineNumber );
+				return false;
+			}
+			pLayers->push_back( Layer() );
+			pLayers->back().name = second;
+		}
+		else {
+
+			if ( second.empty() || ! rest.empty() ) {
+
+				fprintf( stderr, "%s:%u: expected \"<code> = <assignment>\"\n", path, lineNumber );
+				return false;
+			}
+			if ( pLayers->empty() ) {
+
+				fprintf( stderr, "%s:%u: mapping outside of a layer\n", path, lineNumber );
+				return false;
+			}
+			std::map< std::string, unsigned int >::const_iterator const code = codeIndices.find( first );
+			if ( code == codeIndices.end() ) {
+
+				fprintf( stderr, "%s:%u: unknown code \"%s\"\n", path, lineNumber, first.c_str() );
+				return false;
+			}
+			if ( ! pLayers->back().assignments.insert( std::make_pair( code->second, second ) ).second ) {
+
+				fprintf( stderr, "%s:%u: code \"%s\" is mapped twice\n", path, lineNumber, first.c_str() );
+				return false;
+			}
+		}
+	}
+
+	if ( pLayers->empty() ) {
+
+		fprintf( stderr, "%s: no layers\n", path );
+		return false;
+	}
+	if ( pLayers->size() > 16 ) {
+
+		fprintf( stderr, "%s: more than 16 layers\n", path );
+		return false;
+	}
+	return true;
+}
+
+
+void WriteBaseLayer( Layer const& layer, unsigned int const index, std::vector< std::string > const& codes ) {
+
+	printf( "// %s ( base layer )\n", layer.name.c_str() );
+	printf( "extern uint8_t const g_layer%u[] __attribute__(( __progmem__ ));\n", index );
+	printf( "uint8_t const g_layer%u[] = {\n\n", index );
+	for ( unsigned int ii = 0; ii < codes.size(); ++ii ) {
+
+		std::map< unsigned int, std::string >::const_iterator const assignment = layer.assignments.find( ii );
+		printf( "\tKEYMAP_%s%s\n", ( ( assignment == layer.assignments.end() ) ? codes[ ii ] : assignment->second ).c_str(), ( ( ii + 1 < codes.size() ) ? "," : "" ) );
+	}
+	printf( "\n};\n" );
+	printf( "static_assert( ARRAYLENGTH( g_layer%u ) == KEYMAP_BASE_END, \"g_layer%u must have same length as the base keymap\" );\n", index, index );
+}
+
+
+void WriteSparseLayer( Layer const& layer, unsigned int const index, std::vector< std::string > const& codes ) {
+
+	unsigned int const bitmapLength = ( ( codes.size() + 7 ) / 8 );
+
+	std::vector< unsigned int > bitmap( bitmapLength, 0 );
+	std::vector< unsigned int > ranks( bitmapLength, 0 );
+	for ( std::map< unsigned int, std::string >::const_iterator ii = layer.assignments.begin(); ii != layer.assignments.end(); ++ii )
+		bitmap[ ii->first >> 3 ] |= ( 1u << ( ii->first & 7 ) );
+	for ( unsigned int ii = 1; ii < bitmapLength; ++ii )
+		ranks[ ii ] = ranks[ ii - 1 ] + __builtin_popcount( bitmap[ ii - 1 ] );
+
+	printf( "// %s ( %u overrides )\n", layer.name.c_str(), static_cast< unsigned int >( layer.assignments.size() ) );
+	printf( "extern uint8_t const g_layer%u[] __attribute__(( __progmem__ ));\n", index );
+	printf( "uint8_t const g_layer%u[] = {\n\n", index );
+
+	printf( "\t// presence bitmap\n" );
+	for ( unsigned int ii = 0; ii < bitmapLength; ++ii )
+		printf( "%s0x%02x,%s", ( ( ii % 8 == 0 ) ? "\t" : " " ), bitmap[ ii ], ( ( ( ii % 8 == 7 ) || ( ii + 1 == bitmapLength ) ) ? "\n" : "" ) );
+	printf( "\n\t// number of overrides before each bitmap byte\n" );
+	for ( unsigned int ii = 0; ii < bitmapLength; ++ii )
+		printf( "%s%u%s%s", ( ( ii % 8 == 0 ) ? "\t" : " " ), ranks[ ii ], ( ( ( ii + 1 < bitmapLength ) || ! layer.assignments.empty() ) ? "," : "" ), ( ( ( ii % 8 == 7 ) || ( ii + 1 == bitmapLength ) ) ? "\n" : "" ) );
+	printf( "\n\t// overrides\n" );
+	unsigned int remaining = layer.assignments.size();
+	for ( std::map< unsigned int, std::string >::const_iterator ii = layer.assignments.begin(); ii != layer.assignments.end(); ++ii )
+		printf( "\tKEYMAP_%s%s    // %s\n", ii->second.c_str(), ( ( --remaining > 0 ) ? "," : "" ), codes[ ii->first ].c_str() );
+
+	printf( "\n};\n" );
+	printf( "static_assert( ARRAYLENGTH( g_layer%u ) == 2 * Keymap::LAYER_BITMAP_LENGTH + %u, \"g_layer%u has the wrong length\" );\n", index, static_cast< unsigned int >( layer.assignments.size() ), index );
+}
+
+
+
+
+}    // anonymous namespace
+
+
+
+
+//============================================================================
+//    main function
+//============================================================================
+
+
+int main( int argc, char* argv[] ) {
+
+	if ( argc != 3 ) {
+
+		fprintf( stderr, "usage: %s keymap.hh layers.keymap > layers.hh\n", argv[ 0 ] );
+		return 2;
+	}
+
+	std::vector< std::string > codes;
+	if ( ! LoadCodes( &codes, argv[ 1 ] ) )
+		return 1;
+	std::vector< Layer > layers;
+	if ( ! LoadLayers( &layers, codes, argv[ 2 ] ) )
+		return 1;
+
+	printf( "/*\n\tGenerated by tools/keymapc from %s. Do not edit.\n*/\n\n\n", argv[ 2 ] );
+	printf( "static_assert( KEYMAP_BASE_END == %u, \"layer tables were compiled against a different keymap.hh\" );\n\n\n", static_cast< unsigned int >( codes.size() ) );
+
+	for ( unsigned int ii = 0; ii < layers.size(); ++ii ) {
+
+		if ( ii == 0 )
+			WriteBaseLayer( layers[ ii ], ii, codes );
+		else
+			WriteSparseLayer( layers[ ii ], ii, codes );
+		printf( "\n\n" );
+	}
+
+	printf( "// the first layer is full, and the rest are sparse\n" );
+	printf( "extern uint8_t const* const g_layers[] __attribute__(( __progmem__ ));\n" );
+	printf( "uint8_t const* const g_layers[] = {\n" );
+	for ( unsigned int ii = 0; ii < layers.size(); ++ii )
+		printf( "\tg_layer%u,\n", ii );
+	printf( "\tNULL\n};\n" );
+
+	return 0;
+}
@@ -0,0 +1,267 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file latency.cc
+	\brief Reads the keystroke latency histograms from the keyboard
+
+	The firmware must be built with LATENCY_TRACE defined. The histograms
+	are read from the vendor feature report on the keyboard extension
+	interface, through its hidraw device. The report ID depends on how many
+	input reports come before it (fewer with NKRO_BITMAP), so it's found in
+	the report descriptor.
+
+	Usage: latency [-c] /dev/hidrawN
+
+	With -c, the histograms are cleared after they have been read.
+*/
+
+
+
+
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+
+
+
+namespace {
+
+
+
+
+//============================================================================
+//    Constants
+//============================================================================
+
+
+enum { VENDOR_USAGE_PAGE = 0xff00 };
+enum { STAGES = 4 };
+enum { BUCKETS = 14 };
+enum { REPORT_LENGTH = 1 + 1 + 2 * BUCKETS };    ///< report ID, stage, bucket counts
+
+enum { UNIT_MICROSECONDS = 16 };    ///< width of a firmware time unit
+
+char const* const g_stageNames[ STAGES ] = {
+	"scan to keymap",
+	"keymap to interface",
+	"interface to endpoint",
+	"total"
+};
+
+
+
+
+//============================================================================
+//    Helper functions
+//============================================================================
+
+
+/**
+	\brief Finds the ID of the vendor feature report in the report descriptor
+	\result  report ID, or 0 if there's no such report
+*/
+uint8_t FindReportID( int const file ) {
+
+	int size = 0;
+	hidraw_report_descriptor descriptor;
+	if ( ( ioctl( file, HIDIOCGRDESCSIZE, &size ) < 0 ) || ( size <= 0 ) || ( size > HID_MAX_DESCRIPTOR_SIZE ) ) {
+
+		perror( "unable to read the report descriptor size" );
+		return 0;
+	}
+	descriptor.size = size;
+	if ( ioctl( file, HIDIOCGRDESC, &descriptor ) < 0 ) {
+
+		perror( "unable to read the report descriptor" );
+		return 0;
+	}
+
+	// walk the short items, keeping track of the usage page and report ID globals
+	uint32_t usagePage = 0;
+	uint8_t reportID = 0;
+	for ( unsigned int ii = 0; ii < descriptor.size; ) {
+
+		uint8_t const prefix = descriptor.value[ ii ];
+		if ( prefix == 0xfe ) {    // long item
+
+			if ( ii + 1 >= descriptor.size )
+				break;
+			ii += 3 + descriptor.value[ ii + 1 ];
+			continue;
+		}
+
+		unsigned int const length = ( ( ( prefix & 0x03 ) == 3 ) ? 4 : ( prefix & 0x03 ) );
+		if ( ii + 1 + length > descriptor.size )
+			break;
+		uint32_t data = 0;
+		for ( unsigned int jj = 0; jj < length; ++jj )
+			data |= ( static_cast< uint32_t >( descriptor.value[ ii + 1 + jj ] ) << ( 8 * jj ) );
+
+		switch( prefix & 0xfc ) {
+			case 0x04: usagePage = data; break;    // usage page
+			case 0x84: reportID  = data; break;    // report ID
+			case 0xb0: {                           // feature
+
+				if ( usagePage == VENDOR_USAGE_PAGE )
+					return reportID;
+				break;
+			}
+		}
+		ii += 1 + length;
+	}
+
+	fprintf( stderr, "there's no latency report (was the firmware built with LATENCY_TRACE?)\n" );
+	return 0;
+}
+
+
+bool ReadHistograms( unsigned int histograms[ STAGES ][ BUCKETS ], int const file, uint8_t const reportID ) {
+
+	// each read returns the next stage, so after STAGES reads we've seen them all
+	bool seen[ STAGES ] = { false };
+	for ( unsigned int ii = 0; ii < STAGES; ++ii ) {
+
+		uint8_t report[ REPORT_LENGTH ];
+		memset( report, 0, sizeof( report ) );
+		report[ 0 ] = reportID;
+		if ( ioctl( file, HIDIOCGFEATURE( sizeof( report ) ), report ) < static_cast< int >( sizeof( report ) ) ) {
+
+			perror( "unable to read the latency report" );
+			return false;
+		}
+
+		unsigned int const stage = report[ 1 ];
+		if ( stage >= STAGES ) {
+
+			fprintf( stderr, "latency report has unknown stage %u\n", stage );
+			return false;
+		}
+		for ( unsigned int jj = 0; jj < BUCKETS; ++jj )
+			histograms[ stage ][ jj ] = ( report[ 2 + 2 * jj ] | ( report[ 3 + 2 * jj ] << 8 ) );
+		seen[ stage ] = true;
+	}
+
+	for ( unsigned int ii = 0; ii < STAGES; ++ii ) {
+
+		if ( ! seen[ ii ] ) {
+
+			fprintf( stderr, "latency report for stage \"%s\" is missing\n", g_stageNames[ ii ] );
+			return false;
+		}
+	}
+	return true;
+}
+
+
+bool ClearHistograms( int const file, uint8_t const reportID ) {
+
+	uint8_t report[ REPORT_LENGTH ];
+	memset( report, 0, sizeof( report ) );
+	report[ 0 ] = reportID;
+	if ( ioctl( file, HIDIOCSFEATURE( sizeof( report ) ), report ) < 0 ) {
+
+		perror( "unable to clear the latency histograms" );
+		return false;
+	}
+	return true;
+}
+
+
+void PrintHistogram( char const* const name, unsigned int const histogram[ BUCKETS ] ) {
+
+	unsigned int total = 0;
+	for ( unsigned int ii = 0; ii < BUCKETS; ++ii )
+		total += histogram[ ii ];
+
+	printf( "%s ( %u samples )\n", name, total );
+	for ( unsigned int ii = 0; ii < BUCKETS; ++ii ) {
+
+		if ( histogram[ ii ] == 0 )
+			continue;
+
+		// bucket 0 holds delays shorter than one unit, and bucket i > 0 those in [ 2^(i-1), 2^i ) units
+		unsigned int const low  = ( ( ii == 0 ) ? 0 : ( UNIT_MICROSECONDS << ( ii - 1 ) ) );
+		unsigned int const high = ( UNIT_MICROSECONDS << ii );
+		if ( ii + 1 < BUCKETS )
+			printf( "\t%6u - %6u us  %6u  ( %5.1f%% )\n", low, high, histogram[ ii ], 100.0 * histogram[ ii ] / total );
+		else
+			printf( "\t%6u +        us  %6u  ( %5.1f%% )\n", low, histogram[ ii ], 100.0 * histogram[ ii ] / total );
+	}
+}
+
+
+
+
+}    // anonymous namespace
+
+
+
+
+//============================================================================
+//    main function
+//============================================================================
+
+
+int main( int argc, char* argv[] ) {
+
+	bool clear = false;
+	for ( int option; ( option = getopt( argc, argv, "ch" ) ) != -1; ) {
+
+		switch( option ) {
+
+			case 'c': clear = true; break;
+			default: {
+
+				fprintf( stderr, "usage: %s [-c] /dev/hidrawN\n", argv[ 0 ] );
+				return 2;
+			}
+		}
+	}
+	if ( optind + 1 != argc ) {
+
+		fprintf( stderr, "usage: %s [-c] /dev/hidrawN\n", argv[ 0 ] );
+		return 2;
+	}
+
+	int const file = open( argv[ optind ], O_RDWR );
+	if ( file < 0 ) {
+
+		perror( argv[ optind ] );
+		return 1;
+	}
+
+	unsigned int histograms[ STAGES ][ BUCKETS ];
+	uint8_t const reportID = FindReportID( file );
+	bool success = ( ( reportID != 0 ) && ReadHistograms( histograms, file, reportID ) );
+	if ( success ) {
+
+		for ( unsigned int ii = 0; ii < STAGES; ++ii )
+			PrintHistogram( g_stageNames[ ii ], histograms[ ii ] );
+		if ( clear )
+			success = ClearHistograms( file, reportID );
+	}
+
+	close( file );
+	return( success ? 0 : 1 );
+}
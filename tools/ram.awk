@@ -0,0 +1,53 @@
+# Static RAM report, run by "make ram" on the output of "avr-nm -C -S -t d".
+#
+# Every .data and .bss symbol is charged to the class or namespace which
+# owns it: for a function-local static (e.g. the singletons returned by the
+# Instance() methods), that's the scope of the function, and for anything
+# else, the scope of the symbol itself. Symbols at global scope (mostly
+# avr-libc's) are charged to "(global)". If main.su exists (see the
+# heap-free build in the Makefile), the size of main()'s stack frame, which
+# holds the keymap, the HID interfaces and the input sources, is reported
+# as well.
+
+
+$3 ~ /^[bBdD]$/ {
+
+	name = $4
+	for ( ii = 5; ii <= NF; ++ii )
+		name = name " " $ii
+	local = ( name ~ /\)::/ )
+
+	# drop argument lists and template arguments, which may contain "::"
+	while ( gsub( /\([^()]*\)/, "", name ) > 0 );
+	while ( gsub( /<[^<>]*>/, "", name ) > 0 );
+	gsub( /\(anonymous namespace\)::/, "", name )
+
+	count = split( name, parts, "::" )
+	count -= ( local ? 2 : 1 )
+	scope = "(global)"
+	if ( count > 0 ) {
+
+		scope = parts[ 1 ]
+		for ( ii = 2; ii <= count; ++ii )
+			scope = scope "::" parts[ ii ]
+	}
+
+	sizes[ scope ] += $2
+	total += $2
+}
+
+
+END {
+
+	for ( scope in sizes )
+		printf( "%6u  %s\n", sizes[ scope ], scope ) | "sort -rn"
+	close( "sort -rn" )
+	printf( "%6u  total static\n", total )
+
+	while ( ( getline line < "main.su" ) > 0 ) {
+
+		split( line, fields, "\t" )
+		if ( fields[ 1 ] ~ /main\(\)$/ )
+			printf( "%6u  main() stack frame\n", fields[ 2 ] )
+	}
+}
@@ -0,0 +1,624 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file usb_model.cc
+	\brief HostUSB::Model implementation
+*/
+
+
+
+
+#include "usb_model.hh"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+
+uint16_t g_hostOCR1A = 0;
+
+
+
+
+namespace HostUSB {
+
+
+
+
+Model g_model;
+
+
+
+
+namespace {
+
+
+
+
+//============================================================================
+//    Constants
+//============================================================================
+
+
+enum { MAXIMUM_SPINS = 1000000 };    ///< polling UEINTX this many times without progress is a hang
+
+enum { INTERRUPT_FLAGS = 0x5f };     ///< UEINTX flags with a matching enable bit in UEIENX
+enum { CLEARABLE_FLAGS = 0x5f };     ///< UEINTX flags which the firmware clears by writing zero
+
+
+
+
+}    // anonymous namespace
+
+
+
+
+//============================================================================
+//    HostUSB::Model methods
+//============================================================================
+
+
+Model::Model() :
+	m_frameNumber( 0 ),
+	m_remoteWakeups( 0 ),
+	m_accesses( 0 ),
+	m_spins( 0 )
+{
+	memset( m_registers, 0, sizeof( m_registers ) );
+	for ( unsigned int ii = 0; ii < ENDPOINTS; ++ii ) {
+
+		m_endpoints[ ii ].ueconx  = 0;
+		m_endpoints[ ii ].uecfg0x = 0;
+		m_endpoints[ ii ].uecfg1x = 0;
+		m_endpoints[ ii ].uesta0x = 0;
+		m_endpoints[ ii ].ueienx  = 0;
+		ResetEndpoint( ii );
+	}
+}
+
+
+uint8_t const Model::Read( RegisterName const name ) {
+
+	++m_accesses;
+
+	uint8_t const endpoint = ( m_registers[ REGISTER_UENUM ] % ENDPOINTS );
+	Endpoint& current = m_endpoints[ endpoint ];
+
+	uint8_t result = m_registers[ name ];
+	switch( name ) {
+
+		case REGISTER_UDFNUML: result = ( m_frameNumber & 0xff ); break;
+		case REGISTER_UDFNUMH: result = ( m_frameNumber >> 8 );   break;
+
+		case REGISTER_UECONX:  result = ( current.ueconx & ~( ( 1 << STALLRQC ) | ( 1 << RSTDT ) ) ); break;
+		case REGISTER_UECFG0X: result = current.uecfg0x; break;
+		case REGISTER_UECFG1X: result = current.uecfg1x; break;
+		case REGISTER_UESTA0X: result = current.uesta0x; break;
+		case REGISTER_UEIENX:  result = current.ueienx;  break;
+		case REGISTER_UEINTX:  result = ReadEndpointInterrupt(); break;
+		case REGISTER_UEDATX:  result = ReadData(); break;
+
+		case REGISTER_UEBCLX: {
+
+			if ( endpoint == 0 )
+				result = ( current.fill.size() - current.offset );
+			else if ( IsIn( endpoint ) )
+				result = current.fill.size();
+			else
+				result = ( current.banks.empty() ? 0 : ( current.banks.front().size() - current.offset ) );
+			break;
+		}
+
+		case REGISTER_UEINT: {
+
+			result = 0;
+			for ( unsigned int ii = 0; ii < ENDPOINTS; ++ii )
+				if ( m_endpoints[ ii ].ueintx & m_endpoints[ ii ].ueienx & INTERRUPT_FLAGS )
+					result |= ( 1 << ii );
+			break;
+		}
+
+		default: break;
+	}
+	return result;
+}
+
+
+void Model::Write( RegisterName const name, uint8_t const value ) {
+
+	++m_accesses;
+	m_spins = 0;
+
+	uint8_t const endpoint = ( m_registers[ REGISTER_UENUM ] % ENDPOINTS );
+	Endpoint& current = m_endpoints[ endpoint ];
+
+	switch( name ) {
+
+		case REGISTER_PLLCSR: {
+
+			// the PLL locks as soon as it's enabled
+			m_registers[ name ] = ( ( value & ~( 1 << PLOCK ) ) | ( ( value & ( 1 << PLLE ) ) ? ( 1 << PLOCK ) : 0 ) );
+			break;
+		}
+
+		case REGISTER_UDCON: {
+
+			// resume signalling is sent at once, the bit clears when it's done, and the host answers straight away
+			if ( value & ( 1 << RMWKUP ) ) {
+
+				if ( m_registers[ REGISTER_USBCON ] & ( 1 << FRZCLK ) )
+					Error( "remote wakeup requested with the USB clock frozen" );
+				++m_remoteWakeups;
+				m_registers[ REGISTER_UDINT ] |= ( ( 1 << UPRSMI ) | ( 1 << EORSMI ) );
+			}
+			m_registers[ name ] = ( value & ~( 1 << RMWKUP ) );
+			break;
+		}
+
+		case REGISTER_UDINT: {
+
+			// flags can only be cleared
+			m_registers[ name ] &= value;
+			break;
+		}
+
+		case REGISTER_UENUM: {
+
+			if ( value >= ENDPOINTS )
+				Error( "UENUM = %u selects a nonexistent endpoint", value );
+			m_registers[ name ] = value;
+			break;
+		}
+
+		case REGISTER_UERST: {
+
+			for ( unsigned int ii = 1; ii < ENDPOINTS; ++ii )
+				if ( value & ( 1 << ii ) )
+					ResetEndpoint( ii );
+			m_registers[ name ] = value;
+			break;
+		}
+
+		case REGISTER_UECONX: {
+
+			if ( value & ( 1 << STALLRQ ) )
+				current.stalled = true;
+			if ( value & ( 1 << STALLRQC ) )
+				current.stalled = false;
+			bool const enabled = ( ( value ^ current.ueconx ) & ( 1 << EPEN ) );
+			current.ueconx = ( value & ( ( 1 << STALLRQ ) | ( 1 << EPEN ) ) );
+			if ( enabled )
+				Allocate( endpoint );
+			break;
+		}
+
+		case REGISTER_UECFG0X: current.uecfg0x = value; break;
+
+		case REGISTER_UECFG1X: {
+
+			current.uecfg1x = value;
+			ResetEndpoint( endpoint );
+			Allocate( endpoint );
+			break;
+		}
+
+		case REGISTER_UEIENX:  current.ueienx = value; break;
+		case REGISTER_UEINTX:  WriteEndpointInterrupt( value ); break;
+		case REGISTER_UEDATX:  WriteData( value ); break;
+
+		case REGISTER_UDFNUML:
+		case REGISTER_UDFNUMH:
+		case REGISTER_UESTA0X:
+		case REGISTER_UEBCLX:
+		case REGISTER_UEINT: {
+
+			Error( "write to a read-only register" );
+			break;
+		}
+
+		default: m_registers[ name ] = value; break;
+	}
+}
+
+
+void Model::Reset() {
+
+	m_registers[ REGISTER_UDADDR ] = 0;
+	for ( unsigned int ii = 1; ii < ENDPOINTS; ++ii ) {
+
+		m_endpoints[ ii ].ueconx  = 0;
+		m_endpoints[ ii ].uecfg1x = 0;
+		m_endpoints[ ii ].uesta0x = 0;
+		m_endpoints[ ii ].ueienx  = 0;
+		ResetEndpoint( ii );
+	}
+	ResetEndpoint( 0 );
+	m_registers[ REGISTER_UDINT ] |= ( 1 << EORSTI );
+	m_spins = 0;
+}
+
+
+void Model::StartOfFrame() {
+
+	m_frameNumber = ( ( m_frameNumber + 1 ) & 0x7ff );
+	m_registers[ REGISTER_UDINT ] |= ( 1 << SOFI );
+	m_spins = 0;
+}
+
+
+void Model::Suspend() {
+
+	m_registers[ REGISTER_UDINT ] |= ( 1 << SUSPI );
+	m_spins = 0;
+}
+
+
+void Model::Resume() {
+
+	m_registers[ REGISTER_UDINT ] |= ( ( 1 << WAKEUPI ) | ( 1 << EORSMI ) );
+	m_spins = 0;
+}
+
+
+Model::Handshake const Model::Setup( uint8_t const* const packet ) {
+
+	m_spins = 0;
+
+	// SETUP packets are always accepted, and clear a stall
+	Endpoint& control = m_endpoints[ 0 ];
+	control.stalled  = false;
+	control.ueconx  &= ~( 1 << STALLRQ );
+	control.transmit = false;
+	control.fill.assign( packet, packet + 8 );
+	control.offset = 0;
+	control.ueintx |= ( ( 1 << RXSTPI ) | ( 1 << TXINI ) );
+	return HANDSHAKE_ACK;
+}
+
+
+Model::Handshake const Model::In( uint8_t const endpoint, std::vector< uint8_t >* const pData ) {
+
+	m_spins = 0;
+	pData->clear();
+
+	Handshake result = HANDSHAKE_NAK;
+	if ( ( endpoint < ENDPOINTS ) && IsConfigured( endpoint ) && ( ( endpoint == 0 ) || IsIn( endpoint ) ) ) {
+
+		Endpoint& target = m_endpoints[ endpoint ];
+		if ( target.stalled )
+			result = HANDSHAKE_STALL;
+		else if ( endpoint == 0 ) {
+
+			if ( target.transmit ) {
+
+				*pData = target.fill;
+				target.fill.clear();
+				target.transmit = false;
+				target.ueintx |= ( 1 << TXINI );
+				result = HANDSHAKE_ACK;
+			}
+		}
+		else if ( ! target.banks.empty() ) {
+
+			*pData = target.banks.front();
+			target.banks.pop_front();
+			target.ueintx |= ( 1 << TXINI );
+			result = HANDSHAKE_ACK;
+		}
+
+		if ( result == HANDSHAKE_NAK )
+			target.ueintx |= ( 1 << NAKINI );
+	}
+	return result;
+}
+
+
+Model::Handshake const Model::Out( uint8_t const endpoint, std::vector< uint8_t > const& data ) {
+
+	m_spins = 0;
+
+	Handshake result = HANDSHAKE_NAK;
+	if ( ( endpoint < ENDPOINTS ) && IsConfigured( endpoint ) && ( ( endpoint == 0 ) || ! IsIn( endpoint ) ) ) {
+
+		Endpoint& target = m_endpoints[ endpoint ];
+		if ( data.size() > GetSize( endpoint ) )
+			Error( "host sent %u bytes to endpoint %u, which holds %u", static_cast< unsigned int >( data.size() ), endpoint, GetSize( endpoint ) );
+
+		if ( target.stalled )
+			result = HANDSHAKE_STALL;
+		else if ( endpoint == 0 ) {
+
+			if ( ! ( target.ueintx & ( 1 << RXOUTI ) ) ) {
+
+				target.fill   = data;
+				target.offset = 0;
+				target.ueintx |= ( 1 << RXOUTI );
+				result = HANDSHAKE_ACK;
+			}
+		}
+		else if ( target.banks.size() < GetBanks( endpoint ) ) {
+
+			target.banks.push_back( data );
+			target.ueintx |= ( 1 << RXOUTI );
+			result = HANDSHAKE_ACK;
+		}
+
+		if ( result == HANDSHAKE_NAK )
+			target.ueintx |= ( 1 << NAKOUTI );
+	}
+	return result;
+}
+
+
+bool const Model::IsGeneralInterruptPending() const {
+
+	return( ( m_registers[ REGISTER_UDINT ] & m_registers[ REGISTER_UDIEN ] & 0x7d ) != 0 );
+}
+
+
+bool const Model::IsCommunicationInterruptPending() const {
+
+	bool pending = false;
+	for ( unsigned int ii = 0; ii < ENDPOINTS; ++ii )
+		pending |= ( ( m_endpoints[ ii ].ueintx & m_endpoints[ ii ].ueienx & INTERRUPT_FLAGS ) != 0 );
+	return pending;
+}
+
+
+uint8_t const Model::GetAddress() const {
+
+	uint8_t const udaddr = m_registers[ REGISTER_UDADDR ];
+	return( ( udaddr & ( 1 << ADDEN ) ) ? ( udaddr & 0x7f ) : 0 );
+}
+
+
+std::vector< std::string > Model::TakeErrors() {
+
+	std::vector< std::string > errors;
+	errors.swap( m_errors );
+	return errors;
+}
+
+
+bool const Model::IsConfigured( uint8_t const endpoint ) const {
+
+	return( ( m_endpoints[ endpoint ].ueconx & ( 1 << EPEN ) ) && ( m_endpoints[ endpoint ].uesta0x & ( 1 << CFGOK ) ) );
+}
+
+
+bool const Model::IsIn( uint8_t const endpoint ) const {
+
+	return( ( m_endpoints[ endpoint ].uecfg0x & ( 1 << EPDIR ) ) != 0 );
+}
+
+
+unsigned int const Model::GetSize( uint8_t const endpoint ) const {
+
+	return( 8u << ( ( m_endpoints[ endpoint ].uecfg1x >> 4 ) & 7 ) );
+}
+
+
+unsigned int const Model::GetBanks( uint8_t const endpoint ) const {
+
+	return( ( m_endpoints[ endpoint ].uecfg1x & 0x04 ) ? 2 : 1 );
+}
+
+
+void Model::ResetEndpoint( uint8_t const endpoint ) {
+
+	Endpoint& target = m_endpoints[ endpoint ];
+	target.stalled  = false;
+	target.transmit = false;
+	target.banks.clear();
+	target.fill.clear();
+	target.offset = 0;
+
+	// an empty IN endpoint is ready to be written
+	target.ueintx = ( ( ( endpoint != 0 ) && IsIn( endpoint ) ) ? ( 1 << TXINI ) : 0 );
+}
+
+
+/**
+	The controller allocates DPRAM to the enabled endpoints in order of
+	endpoint number, so the configuration of each is only OK if it, and all
+	the endpoints before it, fit. Only problems with the endpoint which was
+	just (re)configured are reported.
+*/
+void Model::Allocate( uint8_t const changed ) {
+
+	unsigned int used = 0;
+	for ( unsigned int ii = 0; ii < ENDPOINTS; ++ii ) {
+
+		Endpoint& target = m_endpoints[ ii ];
+		target.uesta0x = 0;
+		if ( ( target.ueconx & ( 1 << EPEN ) ) && ( target.uecfg1x & ( 1 << ALLOC ) ) ) {
+
+			unsigned int const maximum = ( ( ii == 0 ) ? 64 : ( ( ii == 1 ) ? 256 : 64 ) );
+			char const* problem = NULL;
+			if ( GetSize( ii ) > maximum )
+				problem = "is larger than the endpoint can be";
+			else if ( ( ii == 0 ) && ( GetBanks( ii ) > 1 ) )
+				problem = "is double-buffered, which the control endpoint can't be";
+			else if ( used + GetSize( ii ) * GetBanks( ii ) > DPRAM_SIZE )
+				problem = "doesn't fit in what's left of the DPRAM";
+
+			if ( problem != NULL ) {
+
+				if ( ii == changed )
+					Error( "endpoint %u (%u x %u bytes) %s", ii, GetBanks( ii ), GetSize( ii ), problem );
+			}
+			else {
+
+				used += GetSize( ii ) * GetBanks( ii );
+				target.uesta0x = ( 1 << CFGOK );
+			}
+		}
+	}
+}
+
+
+void Model::Error( char const* const format, ... ) {
+
+	char buffer[ 256 ];
+
+	va_list arguments;
+	va_start( arguments, format );
+	vsnprintf( buffer, sizeof( buffer ), format, arguments );
+	va_end( arguments );
+
+	m_errors.push_back( buffer );
+}
+
+
+uint8_t const Model::ReadEndpointInterrupt() {
+
+	// firmware which polls a flag that will never be set would hang the host, so give up on it
+	if ( ++m_spins > MAXIMUM_SPINS ) {
+
+		fprintf( stderr, "firmware is spinning on UEINTX of endpoint %u, which will never change\n", m_registers[ REGISTER_UENUM ] );
+		exit( EXIT_FAILURE );
+	}
+
+	uint8_t const endpoint = ( m_registers[ REGISTER_UENUM ] % ENDPOINTS );
+	Endpoint const& current = m_endpoints[ endpoint ];
+
+	uint8_t result = ( current.ueintx & CLEARABLE_FLAGS );
+	if ( endpoint != 0 ) {
+
+		if ( IsIn( endpoint ) ) {
+
+			bool const free = ( current.banks.size() < GetBanks( endpoint ) );
+			if ( free )
+				result |= ( 1 << FIFOCON );
+			if ( free && ( current.fill.size() < GetSize( endpoint ) ) )
+				result |= ( 1 << RWAL );
+		}
+		else if ( ! current.banks.empty() ) {
+
+			result |= ( 1 << FIFOCON );
+			if ( current.offset < current.banks.front().size() )
+				result |= ( 1 << RWAL );
+		}
+	}
+	return result;
+}
+
+
+uint8_t const Model::ReadData() {
+
+	m_spins = 0;
+
+	uint8_t const endpoint = ( m_registers[ REGISTER_UENUM ] % ENDPOINTS );
+	Endpoint& current = m_endpoints[ endpoint ];
+
+	uint8_t result = 0;
+	if ( endpoint == 0 ) {
+
+		if ( current.offset < current.fill.size() )
+			result = current.fill[ current.offset++ ];
+		else
+			Error( "read past the end of the control endpoint's bank" );
+	}
+	else if ( IsIn( endpoint ) )
+		Error( "read from IN endpoint %u", endpoint );
+	else if ( ( ! current.banks.empty() ) && ( current.offset < current.banks.front().size() ) )
+		result = current.banks.front()[ current.offset++ ];
+	else
+		Error( "read past the end of endpoint %u's bank", endpoint );
+	return result;
+}
+
+
+void Model::WriteEndpointInterrupt( uint8_t const value ) {
+
+	uint8_t const endpoint = ( m_registers[ REGISTER_UENUM ] % ENDPOINTS );
+	Endpoint& current = m_endpoints[ endpoint ];
+
+	uint8_t const cleared = ( current.ueintx & ~value & CLEARABLE_FLAGS );
+	current.ueintx &= ( value | ~CLEARABLE_FLAGS );
+
+	if ( endpoint == 0 ) {
+
+		if ( cleared & ( 1 << RXSTPI ) ) {
+
+			// acknowledging a SETUP empties the bank, and leaves it ready for the data stage
+			current.fill.clear();
+			current.offset = 0;
+			current.ueintx |= ( 1 << TXINI );
+		}
+		else if ( cleared & ( 1 << TXINI ) ) {
+
+			// clearing TXINI sends the bank, which may be a zero-length packet
+			current.transmit = true;
+			current.offset   = 0;
+		}
+		if ( cleared & ( 1 << RXOUTI ) ) {
+
+			current.fill.clear();
+			current.offset = 0;
+		}
+	}
+	else if ( ! ( value & ( 1 << FIFOCON ) ) ) {
+
+		// clearing FIFOCON hands the current bank over (IN), or frees it (OUT)
+		if ( IsIn( endpoint ) ) {
+
+			if ( current.banks.size() < GetBanks( endpoint ) ) {
+
+				current.banks.push_back( current.fill );
+				current.fill.clear();
+			}
+			else
+				Error( "FIFOCON cleared on IN endpoint %u with no free bank", endpoint );
+		}
+		else if ( ! current.banks.empty() ) {
+
+			current.banks.pop_front();
+			current.offset = 0;
+			if ( ! current.banks.empty() )
+				current.ueintx |= ( 1 << RXOUTI );
+		}
+	}
+}
+
+
+void Model::WriteData( uint8_t const value ) {
+
+	m_spins = 0;
+
+	uint8_t const endpoint = ( m_registers[ REGISTER_UENUM ] % ENDPOINTS );
+	Endpoint& current = m_endpoints[ endpoint ];
+
+	if ( ( endpoint != 0 ) && ! IsIn( endpoint ) )
+		Error( "write to OUT endpoint %u", endpoint );
+	else if ( current.transmit || ( ( endpoint != 0 ) && ( current.banks.size() >= GetBanks( endpoint ) ) ) )
+		Error( "write to endpoint %u while it has no free bank", endpoint );
+	else if ( current.fill.size() >= GetSize( endpoint ) )
+		Error( "write past the end of endpoint %u's %u-byte bank", endpoint, GetSize( endpoint ) );
+	else
+		current.fill.push_back( value );
+}
+
+
+
+
+}    // namespace HostUSB
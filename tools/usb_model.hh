@@ -0,0 +1,430 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file usb_model.hh
+	\brief Register-level model of the AT90USB/ATmega32U4 USB controller
+
+	Included by the host avr/io.h when HOST_USB_MODEL is defined. Every
+	register the USB stack touches is replaced by a Register proxy, which
+	forwards reads and writes to the global Model. The model implements
+	enough of the device controller (chapter 22 of the ATmega32U4 datasheet)
+	to enumerate: the control endpoint, banked IN and OUT endpoints, stalls,
+	DPRAM allocation, the general and endpoint interrupt flags, and the
+	frame number. The other side of the model is driven by a host (see
+	usbsim.cc), which sends bus events and tokens.
+
+	Timing and electrical details are not modelled: everything the host
+	does takes effect immediately, and remote wakeup completes as soon as
+	it is requested.
+*/
+
+
+
+
+#ifndef __USB_MODEL_HH__
+#define __USB_MODEL_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+
+
+
+
+namespace HostUSB {
+
+
+
+
+//============================================================================
+//    Register names
+//============================================================================
+
+
+enum RegisterName {
+
+	// general
+	REGISTER_UHWCON,
+	REGISTER_USBCON,
+	REGISTER_PLLCSR,
+
+	// device
+	REGISTER_UDCON,
+	REGISTER_UDINT,
+	REGISTER_UDIEN,
+	REGISTER_UDADDR,
+	REGISTER_UDFNUML,
+	REGISTER_UDFNUMH,
+
+	// endpoints
+	REGISTER_UENUM,
+	REGISTER_UERST,
+	REGISTER_UECONX,
+	REGISTER_UECFG0X,
+	REGISTER_UECFG1X,
+	REGISTER_UESTA0X,
+	REGISTER_UEINTX,
+	REGISTER_UEIENX,
+	REGISTER_UEDATX,
+	REGISTER_UEBCLX,
+	REGISTER_UEINT,
+
+	// timer and power, which are plain memory
+	REGISTER_TCCR1B,
+	REGISTER_TCNT1L,
+	REGISTER_TCNT1H,
+	REGISTER_TIMSK1,
+	REGISTER_TIFR1,
+	REGISTER_WDTCSR,
+	REGISTER_MCUSR,
+
+	REGISTERS
+};
+
+
+
+
+//============================================================================
+//    Register struct
+//============================================================================
+
+
+/**
+	\brief Stands in for one 8-bit I/O register
+
+	Converts to the register's value on reads, and forwards assignments and
+	read-modify-write operators to the model, so firmware code such as
+	"UEINTX = ~( 1 << TXINI )" compiles unchanged.
+*/
+struct Register {
+
+	explicit Register( RegisterName const name ) : m_name( name ) { }
+
+	inline operator uint8_t() const;
+
+	inline Register const& operator=( unsigned int const value ) const;
+	inline Register const& operator&=( unsigned int const value ) const;
+	inline Register const& operator|=( unsigned int const value ) const;
+
+private:
+
+	RegisterName m_name;
+};
+
+
+
+
+//============================================================================
+//    Model struct
+//============================================================================
+
+
+struct Model {
+
+	enum { ENDPOINTS = 7 };
+	enum { DPRAM_SIZE = 832 };
+
+	enum Handshake {
+		HANDSHAKE_ACK,
+		HANDSHAKE_NAK,
+		HANDSHAKE_STALL
+	};
+
+
+	Model();
+
+
+	/// \brief Firmware read of a register
+	uint8_t const Read( RegisterName const name );
+
+	/// \brief Firmware write of a register
+	void Write( RegisterName const name, uint8_t const value );
+
+
+	/// \brief Host drives a bus reset
+	void Reset();
+
+	/// \brief Host sends a start-of-frame
+	void StartOfFrame();
+
+	/// \brief Bus goes idle
+	void Suspend();
+
+	/// \brief Host drives resume signalling
+	void Resume();
+
+	/// \brief Host sends a SETUP token and its 8-byte data packet on endpoint 0
+	Handshake const Setup( uint8_t const* const packet );
+
+	/// \brief Host sends an IN token
+	Handshake const In( uint8_t const endpoint, std::vector< uint8_t >* const pData );
+
+	/// \brief Host sends an OUT token and data packet
+	Handshake const Out( uint8_t const endpoint, std::vector< uint8_t > const& data );
+
+
+	/// \brief Whether USB_GEN_vect would be taken
+	bool const IsGeneralInterruptPending() const;
+
+	/// \brief Whether USB_COM_vect would be taken
+	bool const IsCommunicationInterruptPending() const;
+
+	/// \brief Device address, or 0 if not yet enabled
+	uint8_t const GetAddress() const;
+
+	/// \brief Number of remote wakeups the firmware has signalled
+	unsigned long const GetRemoteWakeups() const { return m_remoteWakeups; }
+
+	/// \brief Number of register reads and writes by the firmware so far
+	unsigned long const GetAccesses() const { return m_accesses; }
+
+	/**
+		\brief Errors the firmware made in its use of the controller
+
+		e.g. writing past the end of a bank, or allocating more DPRAM than
+		there is. Each is reported once, and the list is cleared.
+	*/
+	std::vector< std::string > TakeErrors();
+
+private:
+
+	struct Endpoint {
+		uint8_t ueconx;
+		uint8_t uecfg0x;
+		uint8_t uecfg1x;
+		uint8_t uesta0x;
+		uint8_t ueintx;
+		uint8_t ueienx;
+		bool stalled;
+		bool transmit;                                    ///< control endpoint has a packet waiting for an IN token
+		std::deque< std::vector< uint8_t > > banks;       ///< packets handed over, oldest first
+		std::vector< uint8_t > fill;                      ///< bank the firmware is writing (IN), or reading (control)
+		unsigned int offset;                              ///< read position in the front bank (OUT), or in fill (control)
+	};
+
+	bool const IsConfigured( uint8_t const endpoint ) const;
+	bool const IsIn( uint8_t const endpoint ) const;
+	unsigned int const GetSize( uint8_t const endpoint ) const;
+	unsigned int const GetBanks( uint8_t const endpoint ) const;
+
+	void ResetEndpoint( uint8_t const endpoint );
+	void Allocate( uint8_t const changed );
+	void Error( char const* const format, ... );
+
+	uint8_t const ReadEndpointInterrupt();
+	uint8_t const ReadData();
+	void WriteEndpointInterrupt( uint8_t const value );
+	void WriteData( uint8_t const value );
+
+	uint8_t m_registers[ REGISTERS ];
+	Endpoint m_endpoints[ ENDPOINTS ];
+
+	uint16_t m_frameNumber;
+	unsigned long m_remoteWakeups;
+	unsigned long m_accesses;
+	unsigned long m_spins;    ///< consecutive reads of UEINTX without anything changing
+
+	std::vector< std::string > m_errors;
+};
+
+
+extern Model g_model;
+
+
+
+
+//============================================================================
+//    Register inline methods
+//============================================================================
+
+
+Register::operator uint8_t() const {
+
+	return g_model.Read( m_name );
+}
+
+
+Register const& Register::operator=( unsigned int const value ) const {
+
+	g_model.Write( m_name, value );
+	return *this;
+}
+
+
+Register const& Register::operator&=( unsigned int const value ) const {
+
+	g_model.Write( m_name, g_model.Read( m_name ) & value );
+	return *this;
+}
+
+
+Register const& Register::operator|=( unsigned int const value ) const {
+
+	g_model.Write( m_name, g_model.Read( m_name ) | value );
+	return *this;
+}
+
+
+
+
+}    // namespace HostUSB
+
+
+
+
+//============================================================================
+//    Registers
+//============================================================================
+
+
+#define UHWCON  ( HostUSB::Register( HostUSB::REGISTER_UHWCON  ) )
+#define USBCON  ( HostUSB::Register( HostUSB::REGISTER_USBCON  ) )
+#define PLLCSR  ( HostUSB::Register( HostUSB::REGISTER_PLLCSR  ) )
+#define UDCON   ( HostUSB::Register( HostUSB::REGISTER_UDCON   ) )
+#define UDINT   ( HostUSB::Register( HostUSB::REGISTER_UDINT   ) )
+#define UDIEN   ( HostUSB::Register( HostUSB::REGISTER_UDIEN   ) )
+#define UDADDR  ( HostUSB::Register( HostUSB::REGISTER_UDADDR  ) )
+#define UDFNUML ( HostUSB::Register( HostUSB::REGISTER_UDFNUML ) )
+#define UDFNUMH ( HostUSB::Register( HostUSB::REGISTER_UDFNUMH ) )
+#define UENUM   ( HostUSB::Register( HostUSB::REGISTER_UENUM   ) )
+#define UERST   ( HostUSB::Register( HostUSB::REGISTER_UERST   ) )
+#define UECONX  ( HostUSB::Register( HostUSB::REGISTER_UECONX  ) )
+#define UECFG0X ( HostUSB::Register( HostUSB::REGISTER_UECFG0X ) )
+#define UECFG1X ( HostUSB::Register( HostUSB::REGISTER_UECFG1X ) )
+#define UESTA0X ( HostUSB::Register( HostUSB::REGISTER_UESTA0X ) )
+#define UEINTX  ( HostUSB::Register( HostUSB::REGISTER_UEINTX  ) )
+#define UEIENX  ( HostUSB::Register( HostUSB::REGISTER_UEIENX  ) )
+#define UEDATX  ( HostUSB::Register( HostUSB::REGISTER_UEDATX  ) )
+#define UEBCLX  ( HostUSB::Register( HostUSB::REGISTER_UEBCLX  ) )
+#define UEINT   ( HostUSB::Register( HostUSB::REGISTER_UEINT   ) )
+#define TCCR1B  ( HostUSB::Register( HostUSB::REGISTER_TCCR1B  ) )
+#define TCNT1L  ( HostUSB::Register( HostUSB::REGISTER_TCNT1L  ) )
+#define TCNT1H  ( HostUSB::Register( HostUSB::REGISTER_TCNT1H  ) )
+#define TIMSK1  ( HostUSB::Register( HostUSB::REGISTER_TIMSK1  ) )
+#define TIFR1   ( HostUSB::Register( HostUSB::REGISTER_TIFR1   ) )
+#define WDTCSR  ( HostUSB::Register( HostUSB::REGISTER_WDTCSR  ) )
+#define MCUSR   ( HostUSB::Register( HostUSB::REGISTER_MCUSR   ) )
+
+// 16-bit registers only written by code the host tools never run
+extern uint16_t g_hostOCR1A;
+#define OCR1A g_hostOCR1A
+
+
+
+
+//============================================================================
+//    Register bits
+//============================================================================
+
+
+// UHWCON
+#define UVREGE 0
+#define UIMOD  7
+
+// USBCON
+#define OTGPADE 4
+#define FRZCLK  5
+#define USBE    7
+
+// PLLCSR
+#define PLOCK 0
+#define PLLE  1
+#define PLLP0 2
+#define PLLP1 3
+#define PLLP2 4
+
+// UDCON
+#define DETACH 0
+#define RMWKUP 1
+
+// UDINT and UDIEN
+#define SUSPI   0
+#define SOFI    2
+#define EORSTI  3
+#define WAKEUPI 4
+#define EORSMI  5
+#define UPRSMI  6
+#define SUSPE   0
+#define SOFE    2
+#define EORSTE  3
+#define WAKEUPE 4
+#define EORSME  5
+#define UPRSME  6
+
+// UDADDR
+#define ADDEN 7
+
+// UECONX
+#define EPEN     0
+#define RSTDT    3
+#define STALLRQC 4
+#define STALLRQ  5
+
+// UECFG0X
+#define EPDIR 0
+
+// UECFG1X
+#define ALLOC 1
+
+// UESTA0X
+#define CFGOK 7
+
+// UEINTX and UEIENX
+#define TXINI    0
+#define STALLEDI 1
+#define RXOUTI   2
+#define RXSTPI   3
+#define NAKOUTI  4
+#define RWAL     5
+#define NAKINI   6
+#define FIFOCON  7
+#define TXINE    0
+#define STALLEDE 1
+#define RXOUTE   2
+#define RXSTPE   3
+#define NAKOUTE  4
+#define NAKINE   6
+#define FLERRE   7
+
+// TCCR1B, TIMSK1 and TIFR1
+#define CS10   0
+#define TOIE1  0
+#define OCIE1A 1
+#define TOV1   0
+#define OCF1A  1
+
+// WDTCSR and MCUSR
+#define WDE  3
+#define WDCE 4
+#define WDIE 6
+#define WDRF 3
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __USB_MODEL_HH__ */
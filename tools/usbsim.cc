@@ -0,0 +1,892 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file usbsim.cc
+	\brief Runs the USB stack natively against a scripted host
+
+	The firmware's USB sources are compiled for the host, against the
+	register-level controller model in usb_model.hh, and set up with the
+	same interfaces as main(). A script then plays the part of the host: it
+	sends bus events and tokens, and checks what comes back. After each bus
+	event the pending USB interrupts are run to completion, as they would be
+	on the device, and the cost of every interrupt is recorded: the number
+	of I/O register accesses (each of which is an IN, OUT, LDS or STS on the
+	AVR), and the host instructions retired, if the kernel lets us count
+	them (otherwise the time taken, in nanoseconds).
+
+	Usage: usbsim [-s] [-q] [script]
+
+	With -s, the CDC-ACM serial port is added, as in a USB_CONSOLE build.
+	With -q, only failures and the cost summary are printed. The default
+	script is enumerate.usb. The exit status is nonzero if any check failed.
+
+	Script lines (numbers are hexadecimal, '#' starts a comment):
+
+		reset                     bus reset
+		sof [count]               start-of-frame(s)
+		suspend / resume          bus suspend, and resume signalling
+		idle ms                   lets time pass without any bus activity
+		                          (as Timer1 overflows)
+		setup b0 .. b7            SETUP packet on endpoint 0
+		in ep [= bytes | nak | stall]
+		                          IN token, optionally checking the reply (a
+		                          NAK is only a failure if data was expected)
+		out ep [bytes]            OUT token and data packet
+		control bmRequestType bRequest wValue wIndex wLength [bytes]
+		        [= bytes | stall] whole control transfer, with its data and
+		                          status stages
+		descriptors               reads and checks the device, configuration,
+		                          report and string descriptors
+		press key / release key   changes a key, on the boot keyboard if it has
+		                          room, otherwise on the keyboard extension
+		                          (as HIDKeymap does)
+		snapshot [= count]        queues the changed keyboard reports, as
+		                          HIDKeymap does after each scan, optionally
+		                          checking how many were refused for lack of
+		                          room
+		leds bits                 checks the keyboard LEDs (bit 0 = num lock)
+		wakeup                    asks for a remote wakeup, as on a keypress
+		                          (which is only signalled once the bus has
+		                          been idle for long enough)
+		wakeups count             checks how many remote wakeups were signalled
+		print text                writes text to the serial port (with -s)
+		macro usages              sets macro 0 to the given key usages (see
+		                          Keymap::SetMacro), and taps the key which
+		                          plays it, through the keymap
+		update [count]            runs HIDKeymap::Update(), as the main loop
+		                          does once per scan
+*/
+
+
+
+
+#include "../usb.hh"
+#include "../keymap.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+
+thread_local uint8_t volatile g_hostSREG = 0x80;
+
+
+extern "C" void USB_GEN_vect();
+extern "C" void USB_COM_vect();
+extern "C" void TIMER1_OVF_vect();
+
+
+
+
+namespace {
+
+
+
+
+//============================================================================
+//    Constants
+//============================================================================
+
+
+enum { MAXIMUM_INTERRUPTS = 64 };    ///< more than this many in a row, for one bus event, is an interrupt storm
+
+enum { CONTROL_ENDPOINT_SIZE = USB::Device::CONTROL_ENDPOINT_SIZE };
+
+wchar_t const g_manufacturerString[] = L"Me";
+wchar_t const g_productString[]      = L"Apple Extended Keyboard II";
+wchar_t const g_keyboardString[]     = L"Keyboard Interface";
+wchar_t const g_consoleString[]      = L"Console";
+
+// the same curves as main()
+Keymap::MouseCurve const g_mouseMoveCurve  = KEYMAP_MOUSE_CURVE( 0.1, 2, 100, 2000 );
+Keymap::MouseCurve const g_mouseWheelCurve = KEYMAP_MOUSE_CURVE( 0, 4, 5, 100 );
+
+// the only extended assignment is the macro, which "B" plays, as in the media layer
+uint16_t const g_extendedKeymap[] = { KEYCODE_MACRO( 0 ) };
+uint8_t const MACRO_CODE = KEYMAP_KEYBOARD_B;
+
+
+
+
+//============================================================================
+//    CostCounter class
+//============================================================================
+
+
+/**
+	\brief Counts the host instructions retired by this thread
+
+	Falls back to the monotonic clock (in nanoseconds) if performance
+	counters aren't available, e.g. inside a container.
+*/
+struct CostCounter {
+
+	CostCounter() : m_fd( -1 ) {
+
+		perf_event_attr attributes;
+		memset( &attributes, 0, sizeof( attributes ) );
+		attributes.size           = sizeof( attributes );
+		attributes.type           = PERF_TYPE_HARDWARE;
+		attributes.config         = PERF_COUNT_HW_INSTRUCTIONS;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv     = 1;
+		m_fd = syscall( SYS_perf_event_open, &attributes, 0, -1, -1, 0 );
+	}
+
+	~CostCounter() {
+
+		if ( m_fd >= 0 )
+			close( m_fd );
+	}
+
+	bool const IsInstructions() const { return( m_fd >= 0 ); }
+
+	uint64_t const Read() const {
+
+		uint64_t result = 0;
+		if ( m_fd >= 0 ) {
+
+			if ( read( m_fd, &result, sizeof( result ) ) != sizeof( result ) )
+				result = 0;
+		}
+		else {
+
+			timespec now;
+			clock_gettime( CLOCK_MONOTONIC, &now );
+			result = static_cast< uint64_t >( now.tv_sec ) * 1000000000 + now.tv_nsec;
+		}
+		return result;
+	}
+
+private:
+
+	int m_fd;
+
+	CostCounter( CostCounter const& other );
+	CostCounter const& operator=( CostCounter const& other );
+};
+
+
+
+
+//============================================================================
+//    Statistics structure
+//============================================================================
+
+
+/// \brief Costs of the interrupts run for one kind of bus event
+struct Statistics {
+
+	Statistics() : interrupts( 0 ), accesses( 0 ), maximumAccesses( 0 ), cost( 0 ), maximumCost( 0 ) { }
+
+	uint64_t interrupts;
+	uint64_t accesses;
+	uint64_t maximumAccesses;
+	uint64_t cost;
+	uint64_t maximumCost;
+};
+
+
+
+
+//============================================================================
+//    Host class
+//============================================================================
+
+
+/// \brief Plays the part of the USB host
+struct Host {
+
+	typedef HIDKeymap< USB::HID::Mouse, USB::HID::Keyboard, USB::HID::KeyboardExtension > KeymapType;
+
+
+	Host( USB::HID::Keyboard* const pKeyboard, USB::HID::KeyboardExtension* const pKeyboardExtension, USB::CDC::Serial* const pSerial, KeymapType* const pKeymap, bool const quiet ) :
+		m_pKeyboard( pKeyboard ),
+		m_pKeyboardExtension( pKeyboardExtension ),
+		m_pSerial( pSerial ),
+		m_pKeymap( pKeymap ),
+		m_quiet( quiet ),
+		m_line( 0 ),
+		m_failures( 0 )
+	{
+	}
+
+
+	/// \brief Runs a script, and returns the number of failed checks
+	unsigned int const Run( std::istream& script );
+
+	/// \brief Prints the interrupt costs, by bus event and vector
+	void PrintCosts() const;
+
+
+private:
+
+	typedef std::vector< uint8_t > Bytes;
+
+	void Service( char const* const event );
+	HostUSB::Model::Handshake const Setup( uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength );
+	HostUSB::Model::Handshake const In( uint8_t const endpoint, Bytes* const pData );
+	HostUSB::Model::Handshake const Out( uint8_t const endpoint, Bytes const& data );
+	bool const Control( uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength, Bytes const& data, Bytes* const pReply );
+
+	bool const GetDescriptor( uint8_t const type, uint8_t const index, uint16_t const wIndex, uint16_t const wLength, Bytes* const pReply );
+	void CheckDescriptors();
+	void CheckString( uint8_t const index, char const* const what );
+
+	void Check( bool const condition, char const* const format, ... );
+	void Print( char const* const format, ... ) const;
+
+	static std::string const Format( Bytes const& data );
+
+	USB::HID::Keyboard* m_pKeyboard;
+	USB::HID::KeyboardExtension* m_pKeyboardExtension;
+	USB::CDC::Serial* m_pSerial;
+	KeymapType* m_pKeymap;
+	bool m_quiet;
+
+	std::vector< uint8_t > m_macro;    ///< zero-terminated
+
+	unsigned int m_line;
+	unsigned int m_failures;
+
+	CostCounter m_counter;
+	std::map< std::string, Statistics > m_statistics;
+};
+
+
+unsigned int const Host::Run( std::istream& script ) {
+
+	HostUSB::Model& model = HostUSB::g_model;
+
+	for ( std::string text; std::getline( script, text ); ) {
+
+		++m_line;
+		text = text.substr( 0, text.find( '#' ) );
+
+		std::istringstream line( text );
+		std::string command;
+		if ( ! ( line >> command ) )
+			continue;
+		Print( "%4u  %s", m_line, text.c_str() );
+
+		// every token after the command is a hex number, except after "print" and the "=", "nak" and "stall" markers
+		std::vector< unsigned long > arguments;
+		Bytes expected;
+		bool expectReply = false;
+		std::string expectHandshake;
+		std::string rest;
+		if ( command == "print" )
+			std::getline( line, rest );
+		else {
+
+			for ( std::string token; line >> token; ) {
+
+				if ( token == "=" )
+					expectReply = true;
+				else if ( ( token == "nak" ) || ( token == "stall" ) )
+					expectHandshake = token;
+				else if ( expectReply )
+					expected.push_back( strtoul( token.c_str(), NULL, 16 ) );
+				else
+					arguments.push_back( strtoul( token.c_str(), NULL, 16 ) );
+			}
+		}
+
+		if ( command == "reset" ) {
+
+			model.Reset();
+			Service( "reset" );
+		}
+		else if ( command == "sof" ) {
+
+			unsigned long const count = ( arguments.empty() ? 1 : arguments[ 0 ] );
+			for ( unsigned long ii = 0; ii < count; ++ii ) {
+
+				model.StartOfFrame();
+				Service( "sof" );
+			}
+		}
+		else if ( command == "suspend" ) {
+
+			model.Suspend();
+			Service( "suspend" );
+		}
+		else if ( command == "resume" ) {
+
+			model.Resume();
+			Service( "resume" );
+		}
+		else if ( ( command == "idle" ) && ( arguments.size() == 1 ) ) {
+
+			// the timer is unprescaled, so it overflows every 65536 cycles
+			unsigned long const overflows = ( arguments[ 0 ] * ( F_CPU / 1000 ) + 65535 ) / 65536;
+			for ( unsigned long ii = 0; ii < overflows; ++ii )
+				TIMER1_OVF_vect();
+		}
+		else if ( ( command == "setup" ) && ( arguments.size() == 8 ) ) {
+
+			uint8_t packet[ 8 ];
+			for ( unsigned int ii = 0; ii < 8; ++ii )
+				packet[ ii ] = arguments[ ii ];
+			model.Setup( packet );
+			Service( "setup" );
+		}
+		else if ( ( command == "in" ) && ( arguments.size() == 1 ) ) {
+
+			Bytes data;
+			HostUSB::Model::Handshake const handshake = In( arguments[ 0 ], &data );
+			if ( handshake == HostUSB::Model::HANDSHAKE_ACK ) {
+
+				Print( "      -> %s", Format( data ).c_str() );
+				Check( expectHandshake.empty(), "expected %s, but got data", expectHandshake.c_str() );
+				Check( ( ! expectReply ) || ( data == expected ), "expected %s", Format( expected ).c_str() );
+			}
+			else {
+
+				char const* const name = ( ( handshake == HostUSB::Model::HANDSHAKE_NAK ) ? "nak" : "stall" );
+				Print( "      -> %s", name );
+				bool const unchecked = ( ( handshake == HostUSB::Model::HANDSHAKE_NAK ) && ( ! expectReply ) && expectHandshake.empty() );
+				Check( unchecked || ( expectHandshake == name ), "unexpected %s", name );
+			}
+		}
+		else if ( ( command == "out" ) && ( arguments.size() >= 1 ) ) {
+
+			Bytes const data( arguments.begin() + 1, arguments.end() );
+			HostUSB::Model::Handshake const handshake = Out( arguments[ 0 ], data );
+			Check( handshake == HostUSB::Model::HANDSHAKE_ACK, "OUT was not acknowledged" );
+		}
+		else if ( ( command == "control" ) && ( arguments.size() >= 5 ) ) {
+
+			Bytes const data( arguments.begin() + 5, arguments.end() );
+			Bytes reply;
+			bool const success = Control( arguments[ 0 ], arguments[ 1 ], arguments[ 2 ], arguments[ 3 ], arguments[ 4 ], data, &reply );
+			if ( success )
+				Print( "      -> %s", Format( reply ).c_str() );
+			else
+				Print( "      -> stall" );
+
+			if ( expectHandshake == "stall" )
+				Check( ! success, "expected a stall" );
+			else {
+
+				Check( success, "unexpected stall" );
+				Check( ( ! expectReply ) || ( reply == expected ), "expected %s", Format( expected ).c_str() );
+			}
+		}
+		else if ( command == "descriptors" )
+			CheckDescriptors();
+		else if ( ( ( command == "press" ) || ( command == "release" ) ) && ( arguments.size() == 1 ) ) {
+
+			USB::HID::Key const key = static_cast< USB::HID::Key >( arguments[ 0 ] );
+			if ( command == "press" )
+				Check( m_pKeyboard->PressKey( key ) || m_pKeyboardExtension->PressKey( key ), "unable to press key %02lx", arguments[ 0 ] );
+			else {
+
+				m_pKeyboard->ReleaseKey( key );
+				m_pKeyboardExtension->ReleaseKey( key );
+			}
+		}
+		else if ( command == "snapshot" ) {
+
+			unsigned long refused = 0;
+			if ( ! m_pKeyboard->Snapshot() )
+				++refused;
+			if ( ! m_pKeyboardExtension->Snapshot() )
+				++refused;
+			if ( expectReply )
+				Check( ( expected.size() == 1 ) && ( refused == expected[ 0 ] ), "%lu snapshots were refused", refused );
+		}
+		else if ( ( command == "leds" ) && ( arguments.size() == 1 ) ) {
+
+			unsigned long leds = 0;
+			for ( unsigned int ii = 0; ii < 5; ++ii )
+				if ( m_pKeyboard->GetLED( static_cast< USB::HID::LED >( USB::HID::LED_NUM_LOCK + ii ) ) )
+					leds |= ( 1 << ii );
+			Check( leds == arguments[ 0 ], "LEDs are %02lx", leds );
+		}
+		else if ( command == "wakeup" ) {
+
+			USB::Device::Instance()->RemoteWakeup();
+			Service( "wakeup" );
+		}
+		else if ( ( command == "wakeups" ) && ( arguments.size() == 1 ) )
+			Check( model.GetRemoteWakeups() == arguments[ 0 ], "%lu remote wakeups were signalled", model.GetRemoteWakeups() );
+		else if ( command == "print" ) {
+
+			if ( m_pSerial != NULL ) {
+
+				rest.erase( 0, rest.find_first_not_of( ' ' ) );
+				m_pSerial->Print( rest.c_str() );
+			}
+			else
+				Check( false, "there's no serial port (use -s)" );
+		}
+		else if ( command == "macro" ) {
+
+			m_macro.assign( arguments.begin(), arguments.end() );
+			m_macro.push_back( 0 );
+			m_pKeymap->SetMacro( 0, m_macro.data() );
+			m_pKeymap->Press( MACRO_CODE );
+			m_pKeymap->Release( MACRO_CODE );
+		}
+		else if ( ( command == "update" ) && ( arguments.size() <= 1 ) ) {
+
+			unsigned long const count = ( arguments.empty() ? 1 : arguments[ 0 ] );
+			for ( unsigned long ii = 0; ii < count; ++ii )
+				m_pKeymap->Update();
+		}
+		else
+			Check( false, "bad command" );
+	}
+	return m_failures;
+}
+
+
+void Host::PrintCosts() const {
+
+	char const* const unit = ( m_counter.IsInstructions() ? "host instructions" : "nanoseconds" );
+	printf( "\ninterrupt costs (register accesses, and %s):\n", unit );
+	printf( "    %-16s %10s %10s %10s %12s %12s\n", "event", "interrupts", "accesses", "max", "cost", "max" );
+	for ( std::map< std::string, Statistics >::const_iterator ii = m_statistics.begin(); ii != m_statistics.end(); ++ii ) {
+
+		Statistics const& statistics = ii->second;
+		printf(
+			"    %-16s %10llu %10.1f %10llu %12.1f %12llu\n",
+			ii->first.c_str(),
+			static_cast< unsigned long long >( statistics.interrupts ),
+			static_cast< double >( statistics.accesses ) / statistics.interrupts,
+			static_cast< unsigned long long >( statistics.maximumAccesses ),
+			static_cast< double >( statistics.cost ) / statistics.interrupts,
+			static_cast< unsigned long long >( statistics.maximumCost )
+		);
+	}
+}
+
+
+/**
+	Runs the USB interrupts until none are pending, charging them to the bus
+	event which raised them. USB_GEN_vect has the higher priority, as on the
+	AVR. Controller misuse found by the model is reported as a failure.
+*/
+void Host::Service( char const* const event ) {
+
+	HostUSB::Model& model = HostUSB::g_model;
+
+	for ( unsigned int ii = 0; ; ++ii ) {
+
+		bool const general = model.IsGeneralInterruptPending();
+		if ( ! ( general || model.IsCommunicationInterruptPending() ) )
+			break;
+		if ( ii >= MAXIMUM_INTERRUPTS ) {
+
+			Check( false, "interrupt storm after %s", event );
+			break;
+		}
+
+		unsigned long const accesses = model.GetAccesses();
+		uint64_t const cost = m_counter.Read();
+
+		cli();
+		if ( general )
+			USB_GEN_vect();
+		else
+			USB_COM_vect();
+		sei();
+
+		uint64_t const spentCost = m_counter.Read() - cost;
+		unsigned long const spentAccesses = model.GetAccesses() - accesses;
+
+		Statistics& statistics = m_statistics[ std::string( event ) + ( general ? "/GEN" : "/COM" ) ];
+		++statistics.interrupts;
+		statistics.accesses        += spentAccesses;
+		statistics.maximumAccesses  = std::max< uint64_t >( statistics.maximumAccesses, spentAccesses );
+		statistics.cost            += spentCost;
+		statistics.maximumCost      = std::max< uint64_t >( statistics.maximumCost, spentCost );
+	}
+
+	std::vector< std::string > const errors = model.TakeErrors();
+	for ( unsigned int ii = 0; ii < errors.size(); ++ii )
+		Check( false, "%s", errors[ ii ].c_str() );
+}
+
+
+HostUSB::Model::Handshake const Host::Setup( uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength ) {
+
+	uint8_t const packet[] = {
+		bmRequestType,
+		bRequest,
+		static_cast< uint8_t >( wValue & 0xff ), static_cast< uint8_t >( wValue >> 8 ),
+		static_cast< uint8_t >( wIndex & 0xff ), static_cast< uint8_t >( wIndex >> 8 ),
+		static_cast< uint8_t >( wLength & 0xff ), static_cast< uint8_t >( wLength >> 8 )
+	};
+	HostUSB::Model::Handshake const handshake = HostUSB::g_model.Setup( packet );
+	Service( "setup" );
+	return handshake;
+}
+
+
+HostUSB::Model::Handshake const Host::In( uint8_t const endpoint, Bytes* const pData ) {
+
+	HostUSB::Model::Handshake const handshake = HostUSB::g_model.In( endpoint, pData );
+	Service( "in" );
+	return handshake;
+}
+
+
+HostUSB::Model::Handshake const Host::Out( uint8_t const endpoint, Bytes const& data ) {
+
+	HostUSB::Model::Handshake const handshake = HostUSB::g_model.Out( endpoint, data );
+	Service( "out" );
+	return handshake;
+}
+
+
+/**
+	Sends the SETUP packet, then the data stage (IN packets until a short
+	one, or OUT packets carrying data), then the status stage. The device
+	has answered every token by the time Service() returns, so a NAK means
+	it never will. Returns false if the device stalled, or NAKed.
+*/
+bool const Host::Control( uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength, Bytes const& data, Bytes* const pReply ) {
+
+	pReply->clear();
+	Setup( bmRequestType, bRequest, wValue, wIndex, wLength );
+
+	bool success = true;
+	if ( bmRequestType & 0x80 ) {
+
+		for ( ; ; ) {
+
+			Bytes packet;
+			if ( In( 0, &packet ) != HostUSB::Model::HANDSHAKE_ACK ) {
+
+				success = false;
+				break;
+			}
+			pReply->insert( pReply->end(), packet.begin(), packet.end() );
+			if ( ( packet.size() < CONTROL_ENDPOINT_SIZE ) || ( pReply->size() >= wLength ) )
+				break;
+		}
+		Check( pReply->size() <= wLength, "reply is longer than the %u bytes asked for", wLength );
+		if ( success )
+			success = ( Out( 0, Bytes() ) == HostUSB::Model::HANDSHAKE_ACK );
+	}
+	else {
+
+		Check( data.size() == wLength, "%u bytes of data given, for a wLength of %u", static_cast< unsigned int >( data.size() ), wLength );
+		for ( unsigned int ii = 0; success && ( ii < data.size() ); ii += CONTROL_ENDPOINT_SIZE ) {
+
+			Bytes const packet( data.begin() + ii, data.begin() + std::min< unsigned int >( data.size(), ii + CONTROL_ENDPOINT_SIZE ) );
+			success = ( Out( 0, packet ) == HostUSB::Model::HANDSHAKE_ACK );
+		}
+		if ( success ) {
+
+			Bytes status;
+			success = ( In( 0, &status ) == HostUSB::Model::HANDSHAKE_ACK );
+			Check( ( ! success ) || status.empty(), "status stage returned data" );
+		}
+	}
+	return success;
+}
+
+
+bool const Host::GetDescriptor( uint8_t const type, uint8_t const index, uint16_t const wIndex, uint16_t const wLength, Bytes* const pReply ) {
+
+	uint8_t const bmRequestType = ( ( type == 0x22 ) ? 0x81 : 0x80 );    // report descriptors belong to an interface
+	bool const success = Control( bmRequestType, 6, ( ( type << 8 ) | index ), wIndex, wLength, Bytes(), pReply );
+	Check( success, "GET_DESCRIPTOR %02x:%02x stalled", type, index );
+	return success;
+}
+
+
+/**
+	Reads the descriptors as an operating system would while enumerating
+	the device, and checks that they're consistent: each is as long as it
+	claims, the configuration descriptor's wTotalLength and bNumInterfaces
+	add up, each interface has as many endpoint descriptors as it says, no
+	endpoint address is used twice, interface associations cover existing
+	interfaces, and report and string descriptors are as long as claimed.
+*/
+void Host::CheckDescriptors() {
+
+	Bytes device;
+	if ( GetDescriptor( 1, 0, 0, 18, &device ) ) {
+
+		Check( ( device.size() == 18 ) && ( device[ 0 ] == 18 ) && ( device[ 1 ] == 1 ), "bad device descriptor %s", Format( device ).c_str() );
+		if ( device.size() == 18 ) {
+
+			uint8_t const packetSize = device[ 7 ];
+			Check( ( packetSize == 8 ) || ( packetSize == 16 ) || ( packetSize == 32 ) || ( packetSize == 64 ), "bad bMaxPacketSize0 %u", packetSize );
+			Check( device[ 17 ] == 1, "expected one configuration" );
+			Print( "      device %04x:%04x, class %02x/%02x/%02x", ( device[ 8 ] | ( device[ 9 ] << 8 ) ), ( device[ 10 ] | ( device[ 11 ] << 8 ) ), device[ 4 ], device[ 5 ], device[ 6 ] );
+			CheckString( device[ 14 ], "iManufacturer" );
+			CheckString( device[ 15 ], "iProduct" );
+			CheckString( device[ 16 ], "iSerialNumber" );
+		}
+	}
+
+	Bytes header;
+	if ( ! GetDescriptor( 2, 0, 0, 9, &header ) )
+		return;
+	Check( ( header.size() == 9 ) && ( header[ 0 ] == 9 ) && ( header[ 1 ] == 2 ), "bad configuration descriptor %s", Format( header ).c_str() );
+	if ( header.size() != 9 )
+		return;
+	uint16_t const totalLength = ( header[ 2 ] | ( header[ 3 ] << 8 ) );
+	uint8_t const interfaces = header[ 4 ];
+
+	Bytes configuration;
+	if ( ! GetDescriptor( 2, 0, 0, totalLength, &configuration ) )
+		return;
+	Check( configuration.size() == totalLength, "configuration descriptor is %u bytes, but wTotalLength is %u", static_cast< unsigned int >( configuration.size() ), totalLength );
+	CheckString( configuration[ 6 ], "iConfiguration" );
+
+	unsigned int interfaceCount = 0;
+	int interface = -1;
+	unsigned int endpointsExpected = 0;
+	unsigned int endpointsFound = 0;
+	std::vector< uint8_t > addresses;
+	unsigned int offset = configuration[ 0 ];
+	while ( offset < configuration.size() ) {
+
+		uint8_t const length = configuration[ offset ];
+		uint8_t const type   = ( ( offset + 1 < configuration.size() ) ? configuration[ offset + 1 ] : 0 );
+		if ( ( length < 2 ) || ( offset + length > configuration.size() ) ) {
+
+			Check( false, "descriptor at offset %u has a bad length %u", offset, length );
+			break;
+		}
+		uint8_t const* const descriptor = &configuration[ offset ];
+
+		if ( type == 4 ) {    // interface
+
+			Check( length == 9, "interface descriptor length %u", length );
+			if ( interface >= 0 )
+				Check( endpointsFound == endpointsExpected, "interface %d has %u endpoint descriptors, but bNumEndpoints is %u", interface, endpointsFound, endpointsExpected );
+			interface = descriptor[ 2 ];
+			Check( interface == static_cast< int >( interfaceCount ), "interface %d out of order", interface );
+			++interfaceCount;
+			endpointsExpected = descriptor[ 4 ];
+			endpointsFound = 0;
+			Print( "      interface %u: class %02x/%02x/%02x", interface, descriptor[ 5 ], descriptor[ 6 ], descriptor[ 7 ] );
+			CheckString( descriptor[ 8 ], "iInterface" );
+		}
+		else if ( type == 5 ) {    // endpoint
+
+			Check( length == 7, "endpoint descriptor length %u", length );
+			Check( std::find( addresses.begin(), addresses.end(), descriptor[ 2 ] ) == addresses.end(), "endpoint %02x described twice", descriptor[ 2 ] );
+			addresses.push_back( descriptor[ 2 ] );
+			++endpointsFound;
+
+			static char const* const s_types[] = { "control", "isochronous", "bulk", "interrupt" };
+			Print( "          endpoint %02x: %s, %u bytes, interval %u", descriptor[ 2 ], s_types[ descriptor[ 3 ] & 3 ], ( descriptor[ 4 ] | ( descriptor[ 5 ] << 8 ) ), descriptor[ 6 ] );
+		}
+		else if ( type == 11 ) {    // interface association
+
+			Check( length == 8, "interface association descriptor length %u", length );
+			Check( descriptor[ 2 ] == interfaceCount, "interface association doesn't precede its first interface" );
+			Check( descriptor[ 2 ] + descriptor[ 3 ] <= interfaces, "interface association covers nonexistent interfaces" );
+		}
+		else if ( ( type == 0x21 ) && ( interface >= 0 ) ) {    // HID
+
+			Check( length == 9, "HID descriptor length %u", length );
+			uint16_t const reportLength = ( descriptor[ 7 ] | ( descriptor[ 8 ] << 8 ) );
+			Bytes report;
+			if ( GetDescriptor( 0x22, 0, interface, reportLength, &report ) )
+				Check( report.size() == reportLength, "report descriptor of interface %d is %u bytes, but the HID descriptor says %u", interface, static_cast< unsigned int >( report.size() ), reportLength );
+		}
+		offset += length;
+	}
+	if ( interface >= 0 )
+		Check( endpointsFound == endpointsExpected, "interface %d has %u endpoint descriptors, but bNumEndpoints is %u", interface, endpointsFound, endpointsExpected );
+	Check( interfaceCount == interfaces, "%u interface descriptors, but bNumInterfaces is %u", interfaceCount, interfaces );
+}
+
+
+void Host::CheckString( uint8_t const index, char const* const what ) {
+
+	if ( index != 0 ) {
+
+		Bytes string;
+		if ( GetDescriptor( 3, index, 0x0409, 255, &string ) ) {
+
+			bool const valid = ( ( string.size() >= 2 ) && ( string[ 0 ] == string.size() ) && ( string[ 1 ] == 3 ) && ( ( string.size() & 1 ) == 0 ) );
+			Check( valid, "bad string descriptor for %s: %s", what, Format( string ).c_str() );
+			if ( valid ) {
+
+				std::string text;
+				for ( unsigned int ii = 2; ii < string.size(); ii += 2 )
+					text += ( ( string[ ii + 1 ] == 0 ) ? static_cast< char >( string[ ii ] ) : '?' );
+				Print( "      %s: \"%s\"", what, text.c_str() );
+			}
+		}
+	}
+}
+
+
+void Host::Check( bool const condition, char const* const format, ... ) {
+
+	if ( ! condition ) {
+
+		char buffer[ 256 ];
+
+		va_list arguments;
+		va_start( arguments, format );
+		vsnprintf( buffer, sizeof( buffer ), format, arguments );
+		va_end( arguments );
+
+		printf( "line %u: FAILED: %s\n", m_line, buffer );
+		++m_failures;
+	}
+}
+
+
+void Host::Print( char const* const format, ... ) const {
+
+	if ( ! m_quiet ) {
+
+		va_list arguments;
+		va_start( arguments, format );
+		vprintf( format, arguments );
+		va_end( arguments );
+		printf( "\n" );
+	}
+}
+
+
+std::string const Host::Format( Bytes const& data ) {
+
+	std::string result;
+	char buffer[ 4 ];
+	for ( unsigned int ii = 0; ii < data.size(); ++ii ) {
+
+		snprintf( buffer, sizeof( buffer ), ( ( ii == 0 ) ? "%02x" : " %02x" ), data[ ii ] );
+		result += buffer;
+	}
+	return( data.empty() ? "(empty)" : result );
+}
+
+
+
+
+}    // anonymous namespace
+
+
+
+
+//============================================================================
+//    main function
+//============================================================================
+
+
+int main( int argc, char* argv[] ) {
+
+	bool serial = false;
+	bool quiet = false;
+
+	int option;
+	while ( ( option = getopt( argc, argv, "sq" ) ) != -1 ) {
+
+		switch( option ) {
+
+			case 's': serial = true; break;
+			case 'q': quiet  = true; break;
+
+			default: {
+
+				fprintf( stderr, "usage: %s [-s] [-q] [script]\n", argv[ 0 ] );
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	char const* const path = ( ( optind < argc ) ? argv[ optind ] : "enumerate.usb" );
+
+	std::ifstream script( path );
+	if ( ! script ) {
+
+		fprintf( stderr, "unable to open \"%s\"\n", path );
+		return EXIT_FAILURE;
+	}
+
+	// the same interfaces as main(), in the same order
+	USB::Device* const pDevice = USB::Device::Instance();
+	uint8_t const manufacturerString = pDevice->RegisterStringProgmem( g_manufacturerString, ( ARRAYLENGTH( g_manufacturerString ) - 1 ) );
+	uint8_t const productString      = pDevice->RegisterStringProgmem( g_productString,      ( ARRAYLENGTH( g_productString      ) - 1 ) );
+	uint8_t const keyboardString     = pDevice->RegisterStringProgmem( g_keyboardString,     ( ARRAYLENGTH( g_keyboardString     ) - 1 ) );
+	uint8_t const consoleString      = ( serial ? pDevice->RegisterStringProgmem( g_consoleString, ( ARRAYLENGTH( g_consoleString ) - 1 ) ) : 0 );
+
+	USB::HID::Mouse mouse;
+	USB::HID::Keyboard keyboard( ( keyboardString == 0xff ) ? 0 : keyboardString );
+	USB::HID::KeyboardExtension keyboardExtension;
+
+	std::unique_ptr< USB::CDC::Serial > pSerial;
+	std::unique_ptr< USB::Dispatch< USB::HID::Mouse, USB::HID::Keyboard, USB::HID::KeyboardExtension > > pDispatch;
+	std::unique_ptr< USB::Dispatch< USB::HID::Mouse, USB::HID::Keyboard, USB::HID::KeyboardExtension, USB::CDC::Serial, USB::CDC::Serial > > pSerialDispatch;
+	if ( serial ) {
+
+		pSerial.reset( new USB::CDC::Serial( ( consoleString == 0xff ) ? 0 : consoleString ) );
+		pSerialDispatch.reset( new USB::Dispatch< USB::HID::Mouse, USB::HID::Keyboard, USB::HID::KeyboardExtension, USB::CDC::Serial, USB::CDC::Serial >( &mouse, &keyboard, &keyboardExtension, pSerial.get(), pSerial.get() ) );
+		if ( ! pSerialDispatch->IsRegistered() ) {
+
+			fprintf( stderr, "unable to register the serial port\n" );
+			return EXIT_FAILURE;
+		}
+	}
+	else
+		pDispatch.reset( new USB::Dispatch< USB::HID::Mouse, USB::HID::Keyboard, USB::HID::KeyboardExtension >( &mouse, &keyboard, &keyboardExtension ) );
+
+	pDevice->Start(
+		0xdead,
+		0xbeef,
+		0x0100,
+		( ( manufacturerString == 0xff ) ? 0 : manufacturerString ),
+		( ( productString      == 0xff ) ? 0 : productString      )
+	);
+
+	// a full first layer, mapping every code to itself, except the macro key
+	uint8_t layer[ KEYMAP_BASE_END ];
+	for ( unsigned int ii = 0; ii < KEYMAP_BASE_END; ++ii )
+		layer[ ii ] = ii;
+	layer[ MACRO_CODE ] = KEYMAP_BASE_END;
+
+	Host::KeymapType keymap( &mouse, &keyboard, &keyboardExtension, &g_mouseMoveCurve, &g_mouseWheelCurve, g_extendedKeymap, ARRAYLENGTH( g_extendedKeymap ) );
+	keymap.SetLayer( 0, layer );
+
+	Host host( &keyboard, &keyboardExtension, pSerial.get(), &keymap, quiet );
+	unsigned int const failures = host.Run( script );
+	host.PrintCosts();
+
+	printf( "\n%u failure%s\n", failures, ( ( failures == 1 ) ? "" : "s" ) );
+	return( ( failures == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE );
+}
@@ -47,8 +47,11 @@
 
 #include "usb_hid.hh"
 #include "usb_device.hh"
+#include "usb_hardware.hh"
 #include "usb_callbacks.hh"
 #include "usb_helpers.hh"
+#include "usb_cdc_serial.hh"
+#include "usb_dispatch.hh"
 
 
 
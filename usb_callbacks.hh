@@ -42,6 +42,21 @@ namespace USB {
 
 
 
+struct ControlWriter;
+
+
+namespace _Private {
+
+
+template< uint8_t t_Index, typename... t_Interfaces >
+struct DispatchImplementation;
+
+
+}    // namespace _Private
+
+
+
+
 //============================================================================
 //    USB::Callbacks class
 //============================================================================
@@ -114,21 +129,58 @@ protected:
 		be multiple descriptors. Examples are HID descriptors and functional
 		descriptors.
 
-		If buffer is NULL, then obviously no data should be written. However,
-		this function should still return the correct descriptor length (which
-		will then be used to allocate a buffer of the appropriate size).
+		The descriptor is written straight to the control endpoint through
+		pWriter. If pWriter is NULL, then obviously no data should be written.
+		However, this function should still return the correct descriptor
+		length, which Device::Start() uses to find the total length of the
+		configuration.
 
 		\param interface  interface for which this message is intended
-		\param buffer     buffer to which to write the descriptor (may be NULL)
+		\param pWriter    writer to which to write the descriptor (may be NULL)
 		\result  size of descriptor
 	*/
-	virtual unsigned int const GetConfigurationDescriptor( uint8_t const interface, uint8_t* const buffer ) const = 0;
+	virtual unsigned int const GetConfigurationDescriptor( uint8_t const interface, ControlWriter* const pWriter ) const = 0;
+
+
+	/**
+		\brief Idle event handler, for an interface of known type
+
+		Called by USB::Dispatch instead of HandleIdle(). A derived class may
+		hide this function with its own version, which calls its handlers
+		directly instead of through the vtable. This default simply calls
+		HandleIdle().
+
+		\param pCallbacks  interface instance
+		\param interface   interface for which this message is intended
+	*/
+	template< typename t_Callbacks >
+	static inline void DispatchIdle( t_Callbacks* const pCallbacks, uint8_t const interface );
+
+	/**
+		\brief Request handler, for an interface of known type
+
+		Called by USB::Dispatch instead of HandleRequest(). As with
+		DispatchIdle(), this default simply calls HandleRequest().
+
+		\param pCallbacks  interface instance
+		\param bmRequestType
+		\param bRequest
+		\param wValue
+		\param wIndex
+		\param wLength
+		\result  true if the request was handled, false otherwise
+	*/
+	template< typename t_Callbacks >
+	static inline bool const DispatchRequest( t_Callbacks* const pCallbacks, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength );
 
 
 private:
 
 	friend struct Device;
 
+	template< uint8_t t_Index, typename... t_Interfaces >
+	friend struct _Private::DispatchImplementation;
+
 
 	inline Callbacks( Callbacks const& other );
 	inline Callbacks const& operator=( Callbacks const& other );
@@ -146,6 +198,20 @@ Callbacks::Callbacks() {
 }
 
 
+template< typename t_Callbacks >
+void Callbacks::DispatchIdle( t_Callbacks* const pCallbacks, uint8_t const interface ) {
+
+	static_cast< Callbacks* >( pCallbacks )->HandleIdle( interface );
+}
+
+
+template< typename t_Callbacks >
+bool const Callbacks::DispatchRequest( t_Callbacks* const pCallbacks, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength ) {
+
+	return static_cast< Callbacks* >( pCallbacks )->HandleRequest( bmRequestType, bRequest, wValue, wIndex, wLength );
+}
+
+
 
 
 }    // namespace USB
@@ -0,0 +1,421 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file usb_cdc_serial.cc
+	\brief USB::CDC::Serial implementation
+*/
+
+
+
+
+#include "usb.hh"
+#include "helpers.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+
+
+
+namespace USB {
+
+
+namespace CDC {
+
+
+
+
+namespace {
+
+
+
+
+//============================================================================
+//    Formatting helpers
+//============================================================================
+
+
+void PrintNumber( Serial* const pSerial, uint32_t value, uint8_t const base, bool const negative, uint8_t width, char const pad ) {
+
+	char digits[ 10 ];
+	uint8_t count = 0;
+	do {
+
+		uint8_t const digit = ( value % base );
+		digits[ count++ ] = ( ( digit < 10 ) ? ( '0' + digit ) : ( 'a' + digit - 10 ) );
+		value /= base;
+
+	} while ( value != 0 );
+
+	uint8_t const length = ( count + ( negative ? 1 : 0 ) );
+	if ( negative && ( pad == '0' ) )
+		pSerial->Write( '-' );
+	for ( ; width > length; --width )
+		pSerial->Write( pad );
+	if ( negative && ( pad != '0' ) )
+		pSerial->Write( '-' );
+	while ( count > 0 )
+		pSerial->Write( digits[ --count ] );
+}
+
+
+
+
+}    // anomymous namespace
+
+
+
+
+//============================================================================
+//    USB::CDC::Serial methods
+//============================================================================
+
+
+Serial::Serial( uint8_t const interfaceString ) :
+	m_notificationEndpoint( 0xff ),
+	m_inEndpoint( 0xff ),
+	m_outEndpoint( 0xff ),
+	m_lineState( 0 ),
+	m_zeroLength( false ),
+	m_dropped( 0 )
+{
+	// 115200 baud, 1 stop bit, no parity, 8 data bits
+	m_lineCoding[ 0 ] = 0x00;
+	m_lineCoding[ 1 ] = 0xc2;
+	m_lineCoding[ 2 ] = 0x01;
+	m_lineCoding[ 3 ] = 0x00;
+	m_lineCoding[ 4 ] = 0;
+	m_lineCoding[ 5 ] = 0;
+	m_lineCoding[ 6 ] = 8;
+
+	Device* const pDevice = Device::Instance();
+
+	m_controlInterface = pDevice->RegisterInterface(
+		this,
+		0x02,    // communication
+		0x02,    // abstract control model
+		0x01,    // AT commands (V.250)
+		interfaceString
+	);
+	m_dataInterface = 0xff;
+	if ( m_controlInterface != 0xff ) {
+
+		m_dataInterface = pDevice->RegisterInterface(
+			this,
+			0x0a,    // data
+			0x00,
+			0x00,
+			interfaceString
+		);
+		if ( m_dataInterface != 0xff ) {
+
+			m_notificationEndpoint = pDevice->RegisterEndpoint(
+				m_controlInterface,
+				( Device::ENDPOINT_FLAG_INTERRUPT | Device::ENDPOINT_FLAG_IN | Device::ENDPOINT_FLAG_SINGLE_BUFFERED ),
+				16,
+				64
+			);
+			m_inEndpoint = pDevice->RegisterEndpoint(
+				m_dataInterface,
+				( Device::ENDPOINT_FLAG_BULK | Device::ENDPOINT_FLAG_IN | Device::ENDPOINT_FLAG_DOUBLE_BUFFERED ),
+				ENDPOINT_SIZE,
+				0
+			);
+			m_outEndpoint = pDevice->RegisterEndpoint(
+				m_dataInterface,
+				( Device::ENDPOINT_FLAG_BULK | Device::ENDPOINT_FLAG_OUT | Device::ENDPOINT_FLAG_DOUBLE_BUFFERED ),
+				ENDPOINT_SIZE,
+				0
+			);
+
+			if (
+				( m_notificationEndpoint == 0xff ) ||
+				( m_inEndpoint == 0xff ) ||
+				( m_outEndpoint == 0xff ) ||
+				( ! pDevice->AssociateInterfaces( m_controlInterface, 2 ) )
+			)
+			{
+				// unregistering the interface also unregisters its endpoints
+				m_dataInterface = pDevice->UnregisterInterface( m_dataInterface );
+			}
+		}
+		if ( m_dataInterface == 0xff )
+			m_controlInterface = pDevice->UnregisterInterface( m_controlInterface );
+	}
+}
+
+
+Serial::~Serial() {
+}
+
+
+bool const Serial::Write( uint8_t const byte ) {
+
+	// nobody would read it, and it would come out stale once they did
+	bool success = false;
+	if ( IsConnected() )
+		success = m_transmit.Push( byte );
+
+	if ( ! success )
+		++m_dropped;
+	return success;
+}
+
+
+void Serial::Print( char const* const string ) {
+
+	for ( char const* pCharacter = string; *pCharacter != '\0'; ++pCharacter )
+		Write( *pCharacter );
+}
+
+
+void Serial::PrintProgmem( char const* const format, ... ) {
+
+	va_list arguments;
+	va_start( arguments, format );
+
+	for ( char const* pFormat = format; ; ) {
+
+		char character = pgm_read_byte( pFormat++ );
+		if ( character == '\0' )
+			break;
+		if ( character != '%' ) {
+
+			Write( character );
+			continue;
+		}
+
+		// flags, width and length modifier
+		char pad = ' ';
+		character = pgm_read_byte( pFormat++ );
+		if ( character == '0' ) {
+
+			pad = '0';
+			character = pgm_read_byte( pFormat++ );
+		}
+		uint8_t width = 0;
+		for ( ; ( character >= '0' ) && ( character <= '9' ); character = pgm_read_byte( pFormat++ ) )
+			width = width * 10 + ( character - '0' );
+		bool isLong = false;
+		if ( character == 'l' ) {
+
+			isLong = true;
+			character = pgm_read_byte( pFormat++ );
+		}
+
+		if ( character == '\0' )
+			break;
+		switch( character ) {
+
+			case 'c': Write( va_arg( arguments, int ) ); break;
+			case 's': Print( va_arg( arguments, char const* ) ); break;
+
+			case 'S': {
+
+				for ( char const* string = va_arg( arguments, char const* ); ( character = pgm_read_byte( string ) ) != '\0'; ++string )
+					Write( character );
+				break;
+			}
+
+			case 'd': {
+
+				int32_t const value = ( isLong ? va_arg( arguments, int32_t ) : va_arg( arguments, int ) );
+				uint32_t const magnitude = ( ( value < 0 ) ? ( 0u - static_cast< uint32_t >( value ) ) : value );
+				PrintNumber( this, magnitude, 10, ( value < 0 ), width, pad );
+				break;
+			}
+
+			case 'u':
+			case 'x': {
+
+				uint32_t const value = ( isLong ? va_arg( arguments, uint32_t ) : va_arg( arguments, unsigned int ) );
+				PrintNumber( this, value, ( ( character == 'x' ) ? 16 : 10 ), false, width, pad );
+				break;
+			}
+
+			default: Write( character ); break;
+		}
+	}
+
+	va_end( arguments );
+}
+
+
+void Serial::HandleIdle( uint8_t const interface ) {
+
+	// both interfaces are registered to us, but only the data interface has anything to do
+	if ( interface == m_dataInterface ) {
+
+		Transmit();
+		Receive();
+	}
+}
+
+
+bool const Serial::HandleRequest( uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength ) {
+
+	bool result = false;
+	if ( wIndex == m_controlInterface ) {
+
+		switch( bmRequestType ) {
+
+			case 0x21: {    // class host to interface
+
+				switch( bRequest ) {
+
+					case 0x20: {    // set line coding
+
+						WaitOut();
+						for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_lineCoding ); ++ii )
+							m_lineCoding[ ii ] = UEDATX;
+						ClearOut();
+						ClearIn();
+
+						result = true;
+						break;
+					}
+
+					case 0x22: {    // set control line state
+
+						m_lineState = wValue;
+						ClearIn();
+
+						result = true;
+						break;
+					}
+
+					case 0x23: {    // send break
+
+						ClearIn();
+
+						result = true;
+						break;
+					}
+				}
+				break;
+			}
+
+			case 0xa1: {    // class interface to host
+
+				if ( bRequest == 0x21 ) {    // get line coding
+
+					ControlWriter writer( ARRAYLENGTH( m_lineCoding ), wLength );
+					writer.Write( m_lineCoding, ARRAYLENGTH( m_lineCoding ) );
+					writer.Finish();
+
+					result = true;
+				}
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+
+unsigned int const Serial::GetConfigurationDescriptor( uint8_t const interface, ControlWriter* const pWriter ) const {
+
+	unsigned int length = 0;
+	if ( interface == m_controlInterface ) {
+
+		if ( pWriter != NULL ) {
+
+			// header functional descriptor
+			pWriter->Write( 5 );                     // bFunctionLength
+			pWriter->Write( 0x24 );                  // bDescriptorType = CS_INTERFACE
+			pWriter->Write( 0x00 );                  // bDescriptorSubtype = header
+			pWriter->Write( 0x10 );                  // bcdCDC
+			pWriter->Write( 0x01 );                  // bcdCDC
+
+			// call management functional descriptor
+			pWriter->Write( 5 );                     // bFunctionLength
+			pWriter->Write( 0x24 );                  // bDescriptorType = CS_INTERFACE
+			pWriter->Write( 0x01 );                  // bDescriptorSubtype = call management
+			pWriter->Write( 0x00 );                  // bmCapabilities
+			pWriter->Write( m_dataInterface );       // bDataInterface
+
+			// abstract control management functional descriptor
+			pWriter->Write( 4 );                     // bFunctionLength
+			pWriter->Write( 0x24 );                  // bDescriptorType = CS_INTERFACE
+			pWriter->Write( 0x02 );                  // bDescriptorSubtype = abstract control management
+			pWriter->Write( 0x02 );                  // bmCapabilities = line coding and serial state
+
+			// union functional descriptor
+			pWriter->Write( 5 );                     // bFunctionLength
+			pWriter->Write( 0x24 );                  // bDescriptorType = CS_INTERFACE
+			pWriter->Write( 0x06 );                  // bDescriptorSubtype = union
+			pWriter->Write( m_controlInterface );    // bMasterInterface
+			pWriter->Write( m_dataInterface );       // bSlaveInterface0
+		}
+		length = FUNCTIONAL_DESCRIPTORS_LENGTH;
+	}
+	return length;
+}
+
+
+void Serial::Transmit() {
+
+	UENUM = m_inEndpoint;
+
+	// fill both banks if there's enough queued, and end a transfer of full packets with a zero-length one
+	for ( unsigned int ii = 0; ( ii < 2 ) && ( ( ! m_transmit.IsEmpty() ) || m_zeroLength ); ++ii ) {
+
+		if ( ! ( UEINTX & ( 1 << RWAL ) ) )
+			break;
+
+		uint8_t length = 0;
+		for ( uint8_t byte; ( length < ENDPOINT_SIZE ) && m_transmit.Pop( &byte ); ++length )
+			UEDATX = byte;
+		m_zeroLength = ( length == ENDPOINT_SIZE );
+
+		UEINTX = ( ( 1 << RWAL ) | ( 1 << NAKOUTI ) | ( 1 << RXSTPI ) | ( 1 << STALLEDI ) );
+	}
+}
+
+
+void Serial::Receive() {
+
+	UENUM = m_outEndpoint;
+
+	for ( unsigned int ii = 0; ii < 2; ++ii ) {
+
+		if ( ! ( UEINTX & ( 1 << RXOUTI ) ) )
+			break;
+
+		// if the queue fills up, the rest of the packet stays in the bank, and the host is NAKed until there's room
+		while ( ( UEBCLX > 0 ) && ( ! m_receive.IsFull() ) )
+			m_receive.Push( UEDATX );
+		if ( UEBCLX > 0 )
+			break;
+
+		UEINTX = ( ( 1 << NAKINI ) | ( 1 << RWAL ) | ( 1 << RXSTPI ) | ( 1 << STALLEDI ) | ( 1 << TXINI ) );
+	}
+}
+
+
+
+
+}    // namespace CDC
+
+
+}    // namespace USB
@@ -0,0 +1,243 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file usb_cdc_serial.hh
+	\brief USB::CDC::Serial interface
+*/
+
+
+
+
+#ifndef __USB_CDC_SERIAL_HH__
+#define __USB_CDC_SERIAL_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include "usb_callbacks.hh"
+#include "usb_device.hh"
+#include "ring_buffer.hh"
+
+#include <inttypes.h>
+
+
+
+
+namespace USB {
+
+
+/**
+	\namespace USB::CDC
+	\brief USB::CDC namespace
+*/
+namespace CDC {
+
+
+
+
+//============================================================================
+//    USB::CDC::Serial class
+//============================================================================
+
+
+/**
+	\brief CDC-ACM virtual serial port
+
+	This class registers a pair of associated interfaces (a communication
+	interface with an interrupt IN notification endpoint, and a data interface
+	with double-buffered bulk IN and OUT endpoints), which the host presents
+	as a serial port.
+
+	Nothing here ever waits for the host. Output is queued in a ring buffer
+	and written to the bulk IN endpoint at start-of-frame, while input is
+	read from the bulk OUT endpoint into another ring buffer at
+	start-of-frame. If the transmit buffer is full, or nobody has opened the
+	port, then output is dropped (and counted), so that printing from the
+	main loop can't hold up scanning or the HID reports.
+*/
+struct Serial : public Callbacks {
+
+	enum { BUFFER_SIZE = 64 };
+	enum { ENDPOINT_SIZE = 64 };
+
+
+	/**
+		\brief Constructor
+
+		\param interfaceString  8-bit string number for the interfaces, 0 if none
+	*/
+	Serial( uint8_t const interfaceString = 0 );
+
+	/// \brief Destructor
+	virtual ~Serial();
+
+
+	/**
+		\brief Has the host opened the port?
+
+		\result  true if the host has asserted DTR, false otherwise
+	*/
+	inline bool const IsConnected() const;
+
+	/**
+		\brief Number of output bytes dropped so far
+
+		\result  dropped byte count (wraps around)
+	*/
+	inline uint16_t const GetDropped() const;
+
+
+	/**
+		\brief Reads a byte of input
+
+		\param pByte  receives the byte
+		\result  true if a byte was read, false if there was no input
+	*/
+	inline bool const Read( uint8_t* const pByte );
+
+	/**
+		\brief Queues a byte of output
+
+		\param byte  byte to send
+		\result  true if queued, false if dropped
+	*/
+	bool const Write( uint8_t const byte );
+
+	/**
+		\brief Queues a string of output
+
+		\param string  NULL-terminated string (in RAM)
+	*/
+	void Print( char const* const string );
+
+	/**
+		\brief Queues formatted output
+
+		A small subset of printf(): the conversions are %c, %s (a string in
+		RAM), %S (a string in program memory), %d, %u and %x (16-bit, or
+		32-bit with an "l" modifier) and %%, optionally with a field width,
+		which pads with zeros if it starts with "0".
+
+		\param format  format string (in program memory)
+	*/
+	void PrintProgmem( char const* const format, ... );
+
+
+private:
+
+	virtual void HandleIdle( uint8_t const interface );
+	virtual bool const HandleRequest( uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength );
+
+	virtual unsigned int const GetConfigurationDescriptor( uint8_t const interface, ControlWriter* const pWriter ) const;
+
+
+	/// \brief Calls HandleIdle() directly, instead of through the vtable
+	static inline void DispatchIdle( Serial* const pSerial, uint8_t const interface );
+
+	/// \brief Calls HandleRequest() directly, instead of through the vtable
+	static inline bool const DispatchRequest( Serial* const pSerial, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength );
+
+
+	/// \brief Writes queued output to the bulk IN endpoint
+	void Transmit();
+
+	/// \brief Reads input from the bulk OUT endpoint into the queue
+	void Receive();
+
+
+	enum { FUNCTIONAL_DESCRIPTORS_LENGTH = 19 };
+
+
+	RingBuffer< BUFFER_SIZE > m_transmit;
+	RingBuffer< BUFFER_SIZE > m_receive;
+
+	uint8_t m_controlInterface;
+	uint8_t m_dataInterface;
+
+	uint8_t m_notificationEndpoint;
+	uint8_t m_inEndpoint;
+	uint8_t m_outEndpoint;
+
+	uint8_t m_lineCoding[ 7 ];           ///< rate, stop bits, parity and data bits, as set by the host (and ignored)
+	uint8_t volatile m_lineState;        ///< bit 0 = DTR, bit 1 = RTS
+	bool m_zeroLength;                   ///< the last packet was full, so a zero-length packet must end the transfer
+	uint16_t m_dropped;
+
+
+	template< uint8_t t_Index, typename... t_Interfaces >
+	friend struct _Private::DispatchImplementation;
+
+
+	inline Serial( Serial const& other );
+	inline Serial const& operator=( Serial const& other );
+};
+
+
+
+
+//============================================================================
+//    USB::CDC::Serial inline methods
+//============================================================================
+
+
+bool const Serial::IsConnected() const {
+
+	return( ( m_lineState & 1 ) != 0 );
+}
+
+
+uint16_t const Serial::GetDropped() const {
+
+	return m_dropped;
+}
+
+
+bool const Serial::Read( uint8_t* const pByte ) {
+
+	return m_receive.Pop( pByte );
+}
+
+
+void Serial::DispatchIdle( Serial* const pSerial, uint8_t const interface ) {
+
+	pSerial->Serial::HandleIdle( interface );
+}
+
+
+bool const Serial::DispatchRequest( Serial* const pSerial, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength ) {
+
+	return pSerial->Serial::HandleRequest( bmRequestType, bRequest, wValue, wIndex, wLength );
+}
+
+
+
+
+}    // namespace CDC
+
+
+}    // namespace USB
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __USB_CDC_SERIAL_HH__ */
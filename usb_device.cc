@@ -52,6 +52,7 @@
 
 
 #include "usb.hh"
+#include "timer.hh"
 #include "helpers.h"
 
 #include <inttypes.h>
@@ -80,7 +81,7 @@ namespace {
 
 
 #if defined( __AVR_AT90USB162__ )
-inline void HWConfig()
+inline void HWConfig() {}
 inline void PLLConfig() { PLLCSR = ( ( 1 << PLLE ) | ( 1 << PLLP0 ) ); }
 inline void USBConfig() { USBCON = ( 1 << USBE ); }
 inline void USBFreeze() { USBCON = ( ( 1 << USBE ) | ( 1 << FRZCLK ) ); }
@@ -102,6 +103,24 @@ inline void USBFreeze() { USBCON = ( ( 1 << USBE ) | ( 1 << FRZCLK ) ); }
 #endif
 
 
+inline void USBSuspend() {
+
+	USBCON |= ( 1 << FRZCLK );
+	PLLCSR &= ~( 1 << PLLE );
+}
+
+
+inline void USBResume() {
+
+	if ( USBCON & ( 1 << FRZCLK ) ) {
+
+		PLLConfig();
+		while ( ! ( PLLCSR & ( 1 << PLOCK ) ) );
+		USBCON &= ~( 1 << FRZCLK );
+	}
+}
+
+
 uint8_t const GetCFG1Bits( uint16_t const endpointSize, uint8_t const endpointType ) {
 
 	// bits 6-4 = endpoint size bits
@@ -186,11 +205,25 @@ void Device::Start(
 		USBConfig();
 		UDCON = 0;
 
+		AllocateBanks();
+
+		// the configuration can't change after this, so its length is only found once
+		m_configurationLength = 9;
+		for ( unsigned int ii = 0; ii < m_nextInterface; ++ii ) {
+
+			if ( m_interfaces[ ii ].associatedInterfaces != 0 )
+				m_configurationLength += 8;
+			m_configurationLength += 9 + m_interfaces[ ii ].pCallbacks->GetConfigurationDescriptor( ii, NULL );
+		}
+		for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_endpoints ); ++ii )
+			if ( m_endpoints[ ii ].endpointType != 0 )
+				m_configurationLength += 7;
+
 		m_configuration = 0;
 		for ( unsigned int ii = 0; ii < m_nextInterface; ++ii )
 			m_interfaces[ ii ].pCallbacks->Configured( ii, m_configuration );
 
-		UDIEN = ( ( 1 << EORSTE ) | ( 1 << SOFE ) );
+		UDIEN = ( ( 1 << EORSTE ) | ( 1 << SOFE ) | ( 1 << SUSPE ) );
 		sei();
 
 		m_started = true;
@@ -215,6 +248,70 @@ uint8_t const Device::GetConfiguration() const {
 }
 
 
+bool const Device::GetFrameTicks( uint16_t* const pTicks ) const {
+
+	bool success = false;
+
+	// save and clear the interrupt flag
+	uint8_t const sreg = SREG;
+	cli();
+
+	uint8_t const frameLow  = UDFNUML;
+	uint8_t const frameHigh = UDFNUMH;
+	uint16_t const frameNumber = ( ( uint16_t )frameLow | ( ( uint16_t )frameHigh << 8 ) );
+	if ( m_suspended ) {
+
+		// there are no frames while the bus is suspended
+	}
+	else if ( frameNumber == m_frameNumber ) {
+
+		*pTicks = m_frameTicks;
+		success = true;
+	}
+	else if ( frameNumber == ( ( m_frameNumber + 1 ) & 0x07ff ) ) {    // start-of-frame interrupt is pending
+
+		*pTicks = Timer::Instance()->GetTicks();
+		success = true;
+	}
+
+	// restore the interrupt flag
+	SREG = sreg;
+
+	return success;
+}
+
+
+bool const Device::RemoteWakeup() {
+
+	bool success = false;
+
+	// save and clear the interrupt flag
+	uint8_t const sreg = SREG;
+	cli();
+
+	if ( m_suspended && m_remoteWakeup ) {
+
+		if ( ( ! m_resuming ) && ( static_cast< uint16_t >( Timer::Instance()->GetOverflows() - m_suspendOverflows ) >= REMOTE_WAKEUP_OVERFLOWS ) ) {
+
+			/*
+				The clock must be running to signal a resume, and is left
+				running until the host answers with its own resume
+				signalling, which ends the suspension in DeviceInterrupt().
+			*/
+			USBResume();
+			UDCON |= ( 1 << RMWKUP );
+			m_resuming = true;
+		}
+		success = true;
+	}
+
+	// restore the interrupt flag
+	SREG = sreg;
+
+	return success;
+}
+
+
 uint8_t const Device::RegisterStringProgmem(
 	wchar_t const* const string,
 	uint8_t const length
@@ -260,11 +357,12 @@ uint8_t const Device::RegisterInterface(
 	if ( ( ! m_started ) && ( m_nextInterface < MAXIMUM_INTERFACES ) ) {
 
 		result = m_nextInterface;
-		m_interfaces[ m_nextInterface ].pCallbacks        = pCallbacks;
-		m_interfaces[ m_nextInterface ].interfaceClass    = interfaceClass;
-		m_interfaces[ m_nextInterface ].interfaceSubclass = interfaceSubclass;
-		m_interfaces[ m_nextInterface ].interfaceProtocol = interfaceProtocol;
-		m_interfaces[ m_nextInterface ].interfaceString   = ( ( interfaceString <= m_nextString ) ? interfaceString : 0 );
+		m_interfaces[ m_nextInterface ].pCallbacks           = pCallbacks;
+		m_interfaces[ m_nextInterface ].interfaceClass       = interfaceClass;
+		m_interfaces[ m_nextInterface ].interfaceSubclass    = interfaceSubclass;
+		m_interfaces[ m_nextInterface ].interfaceProtocol    = interfaceProtocol;
+		m_interfaces[ m_nextInterface ].interfaceString      = ( ( interfaceString <= m_nextString ) ? interfaceString : 0 );
+		m_interfaces[ m_nextInterface ].associatedInterfaces = 0;
 		++m_nextInterface;
 	}
 	return result;
@@ -278,11 +376,17 @@ uint8_t const Device::UnregisterInterface( uint8_t const interface ) {
 
 		--m_nextInterface;
 
-		m_interfaces[ m_nextInterface ].pCallbacks        = NULL;
-		m_interfaces[ m_nextInterface ].interfaceClass    = 0;
-		m_interfaces[ m_nextInterface ].interfaceSubclass = 0;
-		m_interfaces[ m_nextInterface ].interfaceProtocol = 0;
-		m_interfaces[ m_nextInterface ].interfaceString   = 0;
+		m_interfaces[ m_nextInterface ].pCallbacks           = NULL;
+		m_interfaces[ m_nextInterface ].interfaceClass       = 0;
+		m_interfaces[ m_nextInterface ].interfaceSubclass    = 0;
+		m_interfaces[ m_nextInterface ].interfaceProtocol    = 0;
+		m_interfaces[ m_nextInterface ].interfaceString      = 0;
+		m_interfaces[ m_nextInterface ].associatedInterfaces = 0;
+
+		// an association which included this interface is dissolved
+		for ( unsigned int ii = 0; ii < m_nextInterface; ++ii )
+			if ( ii + m_interfaces[ ii ].associatedInterfaces > m_nextInterface )
+				m_interfaces[ ii ].associatedInterfaces = 0;
 
 		for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_endpoints ); ++ii ) {
 
@@ -292,6 +396,7 @@ uint8_t const Device::UnregisterInterface( uint8_t const interface ) {
 				m_endpoints[ ii ].endpointType     = 0;
 				m_endpoints[ ii ].endpointSize     = 0;
 				m_endpoints[ ii ].endpointInterval = 0;
+				m_endpoints[ ii ].endpointBanks    = 0;
 			}
 		}
 
@@ -301,6 +406,24 @@ uint8_t const Device::UnregisterInterface( uint8_t const interface ) {
 }
 
 
+bool const Device::AssociateInterfaces( uint8_t const firstInterface, uint8_t const interfaces ) {
+
+	bool success = ( ( ! m_started ) && ( interfaces > 1 ) && ( firstInterface + interfaces <= m_nextInterface ) );
+	for ( unsigned int ii = 0; success && ( ii < m_nextInterface ); ++ii ) {
+
+		// associations may not overlap
+		if ( m_interfaces[ ii ].associatedInterfaces != 0 )
+			success = ( ( ii + m_interfaces[ ii ].associatedInterfaces <= firstInterface ) || ( ii >= firstInterface + interfaces ) );
+	}
+	for ( unsigned int ii = firstInterface; success && ( ii < firstInterface + interfaces ); ++ii )
+		success = ( m_interfaces[ ii ].associatedInterfaces == 0 );
+
+	if ( success )
+		m_interfaces[ firstInterface ].associatedInterfaces = interfaces;
+	return success;
+}
+
+
 uint8_t const Device::RegisterEndpoint(
 	uint8_t const interface,
 	uint8_t const endpointType,
@@ -308,29 +431,52 @@ uint8_t const Device::RegisterEndpoint(
 	uint8_t const endpointInterval
 )
 {
-	static uint8_t const addresses[] = { 0, 1, 4, 5, 2, 3 };
-
 	uint8_t result = 0xff;
-	if ( ( ! m_started ) && ( interface < m_nextInterface ) ) {
+	if (
+		( ! m_started ) &&
+		( interface < m_nextInterface ) &&
+		( GetAllocatedBytes() + Hardware::GetBankSize( endpointSize ) <= Hardware::DPRAM_SIZE )    // every endpoint needs at least one bank
+	)
+	{
+		bool const doubleBuffered = ( ( endpointType & ENDPOINT_MASK_BUFFER ) == ENDPOINT_FLAG_DOUBLE_BUFFERED );
 
-		// **FIXME **TODO **HACK: only endpoints 3 and 4 support bulk transfers, but this is platform dependant!
-		uint8_t index = 0;
-		if ( ( endpointType & ENDPOINT_MASK_TYPE ) == ENDPOINT_FLAG_BULK )
-			index += 4;
-
-		for ( ; index < ARRAYLENGTH( addresses ); ++index ) {
+		/*
+			Take a free endpoint which can be double-buffered exactly when that
+			was asked for, if there is one, and out of those, the one with the
+			smallest maximum size, so that the larger ones are left for larger
+			requests. The control endpoint (0) is not stored in m_endpoints.
+		*/
+		uint8_t index = 0xff;
+		for ( uint8_t ii = 0; ii < ARRAYLENGTH( m_endpoints ); ++ii ) {
+
+			if ( ( m_endpoints[ ii ].endpointType == 0 ) && ( endpointSize <= Hardware::GetMaximumSize( ii + 1 ) ) ) {
+
+				if ( index == 0xff )
+					index = ii;
+				else {
+
+					bool const matches     = ( Hardware::IsDoubleBankable( ii    + 1 ) == doubleBuffered );
+					bool const bestMatches = ( Hardware::IsDoubleBankable( index + 1 ) == doubleBuffered );
+					if (
+						( matches && ( ! bestMatches ) ) ||
+						( ( matches == bestMatches ) && ( Hardware::GetMaximumSize( ii + 1 ) < Hardware::GetMaximumSize( index + 1 ) ) )
+					)
+					{
+						index = ii;
+					}
+				}
+			}
+		}
 
-			uint8_t const address = addresses[ index ];
-			if ( m_endpoints[ address ].endpointType == 0 ) {
+		if ( index != 0xff ) {
 
-				m_endpoints[ address ].interface        = interface;
-				m_endpoints[ address ].endpointType     = endpointType;
-				m_endpoints[ address ].endpointSize     = endpointSize;
-				m_endpoints[ address ].endpointInterval = endpointInterval;
+			m_endpoints[ index ].interface        = interface;
+			m_endpoints[ index ].endpointType     = endpointType;
+			m_endpoints[ index ].endpointSize     = endpointSize;
+			m_endpoints[ index ].endpointInterval = endpointInterval;
+			m_endpoints[ index ].endpointBanks    = 1;
 
-				result = address + 1;    // the control endpoint (0) is not stored in m_endpoints
-				break;
-			}
+			result = index + 1;
 		}
 	}
 	return result;
@@ -349,6 +495,7 @@ uint8_t const Device::UnregisterEndpoint( uint8_t const endpoint ) {
 			m_endpoints[ address ].endpointType     = 0;
 			m_endpoints[ address ].endpointSize     = 0;
 			m_endpoints[ address ].endpointInterval = 0;
+			m_endpoints[ address ].endpointBanks    = 0;
 
 			result = 0xff;
 		}
@@ -357,10 +504,108 @@ uint8_t const Device::UnregisterEndpoint( uint8_t const endpoint ) {
 }
 
 
+bool const Device::RegisterDispatch(
+	Callbacks* const* const ppCallbacks,
+	uint8_t const interfaces,
+	void* const pContext,
+	IdleHandler const idleHandler,
+	RequestHandler const requestHandler
+)
+{
+	bool success = ( ( ! m_started ) && ( interfaces == m_nextInterface ) );
+	for ( unsigned int ii = 0; success && ( ii < interfaces ); ++ii )
+		success = ( ppCallbacks[ ii ] == m_interfaces[ ii ].pCallbacks );
+
+	if ( success ) {
+
+		m_pDispatch       = pContext;
+		m_dispatchIdle    = idleHandler;
+		m_dispatchRequest = requestHandler;
+	}
+	return success;
+}
+
+
+uint16_t const Device::GetAllocatedBytes() const {
+
+	uint16_t bytes = Hardware::GetBankSize( CONTROL_ENDPOINT_SIZE );
+	for ( uint8_t ii = 0; ii < ARRAYLENGTH( m_endpoints ); ++ii )
+		if ( m_endpoints[ ii ].endpointType != 0 )
+			bytes += Hardware::GetBankSize( m_endpoints[ ii ].endpointSize ) * m_endpoints[ ii ].endpointBanks;
+	return bytes;
+}
+
+
+void Device::AllocateBanks() {
+
+	for ( uint8_t ii = 0; ii < ARRAYLENGTH( m_endpoints ); ++ii )
+		if ( m_endpoints[ ii ].endpointType != 0 )
+			m_endpoints[ ii ].endpointBanks = 1;
+	uint16_t available = Hardware::DPRAM_SIZE - GetAllocatedBytes();
+
+	/*
+		Second banks go first to the IN endpoints which asked for them, and then
+		to the OUT endpoints. Within each direction, the smallest bank which
+		still fits is always taken next, which double-buffers as many endpoints
+		as possible.
+	*/
+	for ( uint8_t direction = 0; direction < 2; ++direction ) {
+
+		uint8_t const inout = ( ( direction == 0 ) ? ENDPOINT_FLAG_IN : ENDPOINT_FLAG_OUT );
+		for ( ; ; ) {
+
+			uint8_t index = 0xff;
+			for ( uint8_t ii = 0; ii < ARRAYLENGTH( m_endpoints ); ++ii ) {
+
+				if (
+					( m_endpoints[ ii ].endpointType != 0 ) &&
+					( m_endpoints[ ii ].endpointBanks == 1 ) &&
+					( ( m_endpoints[ ii ].endpointType & ENDPOINT_MASK_INOUT ) == inout ) &&
+					( ( m_endpoints[ ii ].endpointType & ENDPOINT_MASK_BUFFER ) == ENDPOINT_FLAG_DOUBLE_BUFFERED ) &&
+					Hardware::IsDoubleBankable( ii + 1 ) &&
+					( Hardware::GetBankSize( m_endpoints[ ii ].endpointSize ) <= available ) &&
+					( ( index == 0xff ) || ( m_endpoints[ ii ].endpointSize < m_endpoints[ index ].endpointSize ) )
+				)
+				{
+					index = ii;
+				}
+			}
+			if ( index == 0xff )
+				break;
+
+			m_endpoints[ index ].endpointBanks = 2;
+			available -= Hardware::GetBankSize( m_endpoints[ index ].endpointSize );
+		}
+	}
+}
+
+
 void Device::DeviceInterrupt() {
 
+	uint16_t const ticks = Timer::Instance()->GetTicks();
+
 	uint8_t const udint = UDINT;
 	UDINT = 0;
+	if ( m_suspended ) {
+
+		if ( udint & ( ( 1 << WAKEUPI ) | ( 1 << EORSMI ) ) ) {    // bus activity, or the end of the resume we asked for
+
+			// the wakeup flag can only be cleared once the clock is running again
+			USBResume();
+			UDINT &= ~( 1 << WAKEUPI );
+			UDIEN = ( ( 1 << EORSTE ) | ( 1 << SOFE ) | ( 1 << SUSPE ) );
+			m_suspended = false;
+			m_resuming = false;
+		}
+	}
+	else if ( udint & ( 1 << SUSPI ) ) {    // no bus activity for 3ms
+
+		// only wake up on bus activity, and stop the USB clock and PLL until then
+		UDIEN = ( ( 1 << EORSTE ) | ( 1 << WAKEUPE ) | ( 1 << EORSME ) );
+		USBSuspend();
+		m_suspended = true;
+		m_suspendOverflows = Timer::Instance()->GetOverflows();
+	}
 	if ( udint & ( 1 << EORSTI ) ) {
 
 		UENUM = 0;
@@ -399,23 +644,37 @@ void Device::DeviceInterrupt() {
 		// bit 1 (STALLEDE) = stalled interrupt enable flag
 		// bit 0 (TXINE) = transmitter ready interrupt enable flag
 		UEIENX = ( 1 << RXSTPE );
+		m_controlState = CONTROL_STATE_IDLE;
 
+		m_remoteWakeup = false;
 		m_configuration = 0;
 		for ( unsigned int ii = 0; ii < m_nextInterface; ++ii )
 			m_interfaces[ ii ].pCallbacks->Configured( ii, m_configuration );
 	}
-	if ( m_configuration && ( udint & ( 1 << SOFI ) ) ) {    // start of frame
+	if ( udint & ( 1 << SOFI ) ) {    // start of frame
 
-		for ( unsigned int ii = 0; ii < m_nextInterface; ++ii )
-			m_interfaces[ ii ].pCallbacks->HandleIdle( ii );
+		// remember when this frame started, for Device::GetFrameTicks()
+		uint8_t const frameLow  = UDFNUML;
+		uint8_t const frameHigh = UDFNUMH;
+		m_frameNumber = ( ( uint16_t )frameLow | ( ( uint16_t )frameHigh << 8 ) );
+		m_frameTicks  = ticks;
+
+		if ( m_configuration ) {
+
+			if ( m_dispatchIdle != NULL )
+				m_dispatchIdle( m_pDispatch );
+			else {
+
+				for ( unsigned int ii = 0; ii < m_nextInterface; ++ii )
+					m_interfaces[ ii ].pCallbacks->HandleIdle( ii );
+			}
+		}
 	}
 }
 
 
 void Device::CommunicationInterrupt() {
 
-	bool success = false;
-
 	UENUM = 0;
 	uint8_t const ueintx = UEINTX;
 	if ( ueintx & ( 1 << RXSTPI ) ) {
@@ -438,294 +697,393 @@ void Device::CommunicationInterrupt() {
 
 		UEINTX = ~( ( 1 << RXSTPI ) | ( 1 << RXOUTI ) | ( 1 << TXINI ) );
 
-		/*
-			bit 7 = direction:
-				0 = host to device
-				1 = device to host
-			bits 6-5 = type:
-				0 = standard
-				1 = class
-				2 = vendor
-			bits 4-0 = recipient:
-				0 = device
-				1 = interface
-				2 = endpoint
-				3 = other
-		*/
-		switch( bmRequestType & 0x1f ) {
+		// a SETUP packet abandons whatever transfer was in progress
+		m_controlRequest.bmRequestType = bmRequestType;
+		m_controlRequest.bRequest      = bRequest;
+		m_controlRequest.wValue        = wValue;
+		m_controlRequest.wIndex        = wIndex;
+		m_controlRequest.wLength       = wLength;
+		m_controlOffset = 0;
 
-			case 0: {    // device
+		if ( ( ! ( bmRequestType & 0x80 ) ) && ( wLength > 0 ) ) {
 
-				if ( bmRequestType == 0x00 ) {    // standard host to device
+			// the request is handled once its data has arrived
+			m_controlState = CONTROL_STATE_DATA_OUT;
+			UEIENX = ( ( 1 << RXSTPE ) | ( 1 << RXOUTE ) );
+		}
+		else
+			HandleControlRequest();
+	}
+	else {
 
-					switch( bRequest ) {
+		switch( m_controlState ) {
 
-						case 5: {    // set address
+			case CONTROL_STATE_DATA_IN: {
 
-							ClearIn();
-							WaitIn();
-							UDADDR = ( wValue | ( 1 << ADDEN ) );
+				if ( ueintx & ( 1 << RXOUTI ) ) {    // host started the status stage early
 
-							success = true;
-							break;
-						}
+					m_controlState = CONTROL_STATE_IDLE;
+					UEIENX = ( 1 << RXSTPE );
+				}
+				else if ( ueintx & ( 1 << TXINI ) )    // host took the last packet, so send the next one
+					HandleControlRequest();
+				break;
+			}
 
-						case 9: {    // set configuration
+			case CONTROL_STATE_DATA_OUT: {
 
-							m_configuration = wValue;
-							for ( unsigned int ii = 0; ii < m_nextInterface; ++ii )
-								m_interfaces[ ii ].pCallbacks->Configured( ii, m_configuration );
-							ClearIn();
-							for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_endpoints ); ++ii ) {
+				if ( ueintx & ( 1 << RXOUTI ) )
+					HandleControlRequest();
+				break;
+			}
 
-								UENUM = ii + 1;
-								if ( m_endpoints[ ii ].endpointType == 0 ) {
+			case CONTROL_STATE_ADDRESS: {
 
-									// bit 5 = stall request handshake bit
-									// bit 4 = stall equest clear handshake bit
-									// bit 3 = reset data toggle bit
-									// bit 0 = endpoint enable bit
-									UECONX = 0;
-								}
-								else {
-
-									// bit 5 = stall request handshake bit
-									// bit 4 = stall equest clear handshake bit
-									// bit 3 = reset data toggle bit
-									// bit 0 = endpoint enable bit
-									UECONX = 1;
-
-									// bits 7-6 = endpoint type bits
-									//     00 = bulk
-									//     01 = isochronous
-									//     11 = interrupt
-									// bit 0 = endpoint direction bit
-									//     0 = out
-									//     1 = in
-									UECFG0X = ( m_endpoints[ ii ].endpointType & ENDPOINT_MASK_INOUT_TYPE );
-
-									// bits 6-4 = endpoint size bits
-									//     000 = 8 bytes
-									//     001 = 16 bytes
-									//     ...
-									//     110 = 512 bytes
-									//     111 = reserved
-									// bits 3-2 = endpoint bank bits
-									//     00 = one bank
-									//     01 = two banks
-									//     1? = reserved
-									//  bit 1 = endpoint allocation bit
-									UECFG1X = GetCFG1Bits( m_endpoints[ ii ].endpointSize, m_endpoints[ ii ].endpointType );
-								}
-							}
-							UERST = 0x1e;
-							UERST = 0;
+				if ( ueintx & ( 1 << TXINI ) ) {    // status stage is complete, so the new address takes effect
 
-							success = true;
-							break;
-						}
-					}
+					UDADDR = ( m_controlRequest.wValue | ( 1 << ADDEN ) );
+					m_controlState = CONTROL_STATE_IDLE;
+					UEIENX = ( 1 << RXSTPE );
 				}
-				else if ( bmRequestType == 0x80 ) {    // standard device to host
+				break;
+			}
+		}
+	}
+}
+
+
+void Device::HandleControlRequest() {
+
+	bool success = false;
+
+	uint8_t const bmRequestType = m_controlRequest.bmRequestType;
+	uint8_t const bRequest      = m_controlRequest.bRequest;
+	uint16_t const wValue       = m_controlRequest.wValue;
+	uint16_t const wIndex       = m_controlRequest.wIndex;
+	uint16_t const wLength      = m_controlRequest.wLength;
+
+	uint8_t const wValueLow  = LSB( wValue );
+	uint8_t const wValueHigh = MSB( wValue );
+
+	m_controlState = CONTROL_STATE_IDLE;
+	m_controlMore = false;
+
+	/*
+		bit 7 = direction:
+			0 = host to device
+			1 = device to host
+		bits 6-5 = type:
+			0 = standard
+			1 = class
+			2 = vendor
+		bits 4-0 = recipient:
+			0 = device
+			1 = interface
+			2 = endpoint
+			3 = other
+	*/
+	switch( bmRequestType & 0x1f ) {
+
+		case 0: {    // device
+
+			if ( bmRequestType == 0x00 ) {    // standard host to device
+
+				switch( bRequest ) {
 
-					switch( bRequest ) {
+					case 1:      // clear feature
+					case 3: {    // set feature
 
-						case 0: {    // get status
+						if ( wValue == 1 ) {    // device remote wakeup
 
-							WaitIn();
-							UEDATX = 0;
-							UEDATX = 0;
+							m_remoteWakeup = ( bRequest == 3 );
 							ClearIn();
 
 							success = true;
-							break;
 						}
+						break;
+					}
 
-						case 6: {    // get descriptor
-
-							uint8_t* buffer = NULL;
-							unsigned int length = 0;
-
-							switch( wValueHigh ) {
-
-								case 0x01: {    // device descriptor
-
-									if ( wValueLow == 0 ) {
-
-										length = 18;
-										uint8_t* pBuffer = static_cast< uint8_t* >( malloc( length ) );
-										buffer = pBuffer;
-
-										*( pBuffer++ ) = 18;                        // bLength
-										*( pBuffer++ ) = 1;                         // bDescriptorType
-										*( pBuffer++ ) = 0x00;                      // bcdUSB
-										*( pBuffer++ ) = 0x02;                      // bcdUSB
-										*( pBuffer++ ) = 0;                         // bDeviceClass    // **TODO **FIXME **HACK: 0=composite, 2=communication. If we don't choose "communication", then USB Serial doesn't work on Mac or Windows, and if we do choose "communication", then the HID interfaces won't work on Windows!
-										*( pBuffer++ ) = 0;                         // bDeviceSubClass
-										*( pBuffer++ ) = 0;                         // bDeviceProtocol
-										*( pBuffer++ ) = CONTROL_ENDPOINT_SIZE;     // bMaxPacketSize0
-										*( pBuffer++ ) = LSB( m_vendorID );         // idVendor
-										*( pBuffer++ ) = MSB( m_vendorID );         // idVendor
-										*( pBuffer++ ) = LSB( m_productID );        // idProduct
-										*( pBuffer++ ) = MSB( m_productID );        // idProduct
-										*( pBuffer++ ) = LSB( m_releaseNumber );    // bcdDevice
-										*( pBuffer++ ) = MSB( m_releaseNumber );    // bcdDevice
-										*( pBuffer++ ) = m_manufacturerString;      // iManufacturer
-										*( pBuffer++ ) = m_productString;           // iProduct
-										*( pBuffer++ ) = m_serialString;            // iSerialNumber
-										*( pBuffer++ ) = 1;                         // bNumConfigurations
-									}
-									break;
-								}
+					case 5: {    // set address
 
-								case 0x02: {    // configuration descriptor
-
-									if ( wValueLow == 0 ) {
-
-										length = 9;
-										for ( unsigned int ii = 0; ii < m_nextInterface; ++ii )
-											length += 9 + m_interfaces[ ii ].pCallbacks->GetConfigurationDescriptor( ii, NULL );
-										for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_endpoints ); ++ii )
-											if ( m_endpoints[ ii ].endpointType != 0 )
-												length += 7;
-
-										uint8_t* pBuffer = static_cast< uint8_t* >( malloc( length ) );
-										buffer = pBuffer;
-
-										// configuration descriptor
-										*( pBuffer++ ) = 9;                        // bLength
-										*( pBuffer++ ) = 2;                        // bDescriptorType
-										*( pBuffer++ ) = LSB( length );            // wTotalLength
-										*( pBuffer++ ) = MSB( length );            // wTotalLength
-										*( pBuffer++ ) = m_nextInterface;          // bNumInterfaces
-										*( pBuffer++ ) = 1;                        // bConfigurationValue
-										*( pBuffer++ ) = m_configurationString;    // iConfiguration
-										*( pBuffer++ ) = 0xc0;                     // bmAttributes
-										*( pBuffer++ ) = 50;                       // bMaxPower
-
-										for ( unsigned int ii = 0; ii < m_nextInterface; ++ii ) {
-
-											uint8_t endpoints = 0;
-											for ( unsigned int jj = 0; jj < ARRAYLENGTH( m_endpoints ); ++jj )
-												if ( ( m_endpoints[ jj ].endpointType != 0 ) && ( m_endpoints[ jj ].interface == ii ) )
-													++endpoints;
-
-											// interface descriptor
-											*( pBuffer++ ) = 9;                                       // bLength
-											*( pBuffer++ ) = 4;                                       // bDescriptorType
-											*( pBuffer++ ) = ii;                                      // bInterfaceNumber
-											*( pBuffer++ ) = 0;                                       // bAlternateSetting
-											*( pBuffer++ ) = endpoints;                               // bNumEndpoints
-											*( pBuffer++ ) = m_interfaces[ ii ].interfaceClass;       // bInterfaceClass
-											*( pBuffer++ ) = m_interfaces[ ii ].interfaceSubclass;    // bInterfaceSubClass
-											*( pBuffer++ ) = m_interfaces[ ii ].interfaceProtocol;    // bInterfaceProtocol
-											*( pBuffer++ ) = m_interfaces[ ii ].interfaceString;      // iInterface
-
-											pBuffer += m_interfaces[ ii ].pCallbacks->GetConfigurationDescriptor( ii, pBuffer );
-
-											for ( unsigned int jj = 0; jj < ARRAYLENGTH( m_endpoints ); ++jj ) {
-
-												if ( ( m_endpoints[ jj ].endpointType != 0 ) && ( m_endpoints[ jj ].interface == ii ) ) {
-
-													uint8_t const index = ( ( m_endpoints[ jj ].endpointType & ENDPOINT_FLAG_IN ) ? ( jj + 0x81 ) : ( jj + 0x01 ) );
-													uint8_t const attributes = ( ( m_endpoints[ jj ].endpointType & ENDPOINT_MASK_TYPE ) >> ENDPOINT_SHIFT_TYPE );
-
-													// endpoint descriptor
-													*( pBuffer++ ) = 7;                                        // bLength
-													*( pBuffer++ ) = 5;                                        // bDescriptorType
-													*( pBuffer++ ) = index;                                    // bEndpointAddress
-													*( pBuffer++ ) = attributes;                               // bmAttributes
-													*( pBuffer++ ) = LSB( m_endpoints[ jj ].endpointSize );    // wMaxPacketSize
-													*( pBuffer++ ) = MSB( m_endpoints[ jj ].endpointSize );    // wMaxPacketSize
-													*( pBuffer++ ) = m_endpoints[ jj ].endpointInterval;       // bInterval
-												}
-											}
-										}
-									}
-									break;
-								}
+						// the address only takes effect after the status stage, in CommunicationInterrupt()
+						ClearIn();
+						m_controlState = CONTROL_STATE_ADDRESS;
 
-								case 0x03: {    // string descriptor
+						success = true;
+						break;
+					}
 
-									if ( wValueLow == 0 ) {
+					case 9: {    // set configuration
 
-										length = 4;
-										uint8_t* pBuffer = static_cast< uint8_t* >( malloc( length ) );
-										buffer = pBuffer;
+						m_configuration = wValue;
+						for ( unsigned int ii = 0; ii < m_nextInterface; ++ii )
+							m_interfaces[ ii ].pCallbacks->Configured( ii, m_configuration );
+						ClearIn();
+						for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_endpoints ); ++ii ) {
 
-										*( pBuffer++ ) = 4;       // bLength
-										*( pBuffer++ ) = 3;       // bDescriptorType
-										*( pBuffer++ ) = 0x09;    // wLANGID
-										*( pBuffer++ ) = 0x04;    // wLANGID
-									}
-									else if ( wValueLow <= m_nextString ) {
+							UENUM = ii + 1;
+							if ( m_endpoints[ ii ].endpointType == 0 ) {
+
+								// bit 5 = stall request handshake bit
+								// bit 4 = stall equest clear handshake bit
+								// bit 3 = reset data toggle bit
+								// bit 0 = endpoint enable bit
+								UECONX = 0;
+							}
+							else {
+
+								// bit 5 = stall request handshake bit
+								// bit 4 = stall equest clear handshake bit
+								// bit 3 = reset data toggle bit
+								// bit 0 = endpoint enable bit
+								UECONX = 1;
+
+								// bits 7-6 = endpoint type bits
+								//     00 = bulk
+								//     01 = isochronous
+								//     11 = interrupt
+								// bit 0 = endpoint direction bit
+								//     0 = out
+								//     1 = in
+								UECFG0X = ( m_endpoints[ ii ].endpointType & ENDPOINT_MASK_INOUT_TYPE );
+
+								// bits 6-4 = endpoint size bits
+								//     000 = 8 bytes
+								//     001 = 16 bytes
+								//     ...
+								//     110 = 512 bytes
+								//     111 = reserved
+								// bits 3-2 = endpoint bank bits
+								//     00 = one bank
+								//     01 = two banks
+								//     1? = reserved
+								//  bit 1 = endpoint allocation bit
+								UECFG1X = GetCFG1Bits(
+									m_endpoints[ ii ].endpointSize,
+									( ( m_endpoints[ ii ].endpointBanks > 1 ) ? ENDPOINT_FLAG_DOUBLE_BUFFERED : ENDPOINT_FLAG_SINGLE_BUFFERED )
+								);
+							}
+						}
+						UERST = 0x1e;
+						UERST = 0;
+
+						success = true;
+						break;
+					}
+				}
+			}
+			else if ( bmRequestType == 0x80 ) {    // standard device to host
+
+				switch( bRequest ) {
 
-										wchar_t const* const string = m_strings[ wValueLow - 1 ].string;
-										unsigned int const stringLength = Min( m_strings[ wValueLow - 1 ].length, ( uint8_t )126 );
+					case 0: {    // get status
 
-										length = 2 + stringLength * 2;
-										uint8_t* pBuffer = static_cast< uint8_t* >( malloc( length ) );
-										buffer = pBuffer;
+						// bit 1 = remote wakeup enabled
+						// bit 0 = self powered
+						WaitIn();
+						UEDATX = ( m_remoteWakeup ? 2 : 0 );
+						UEDATX = 0;
+						ClearIn();
 
-										*( pBuffer++ ) = length;    // bLength
-										*( pBuffer++ ) = 3;         // bDescriptorType
-										for ( unsigned int ii = 0; ii < stringLength; ++ii ) {
+						success = true;
+						break;
+					}
+
+					case 6: {    // get descriptor
+
+						switch( wValueHigh ) {
+
+							case 0x01: {    // device descriptor
+
+								if ( wValueLow == 0 ) {
+
+									// functions spanning several interfaces are described by interface association descriptors
+									bool associated = false;
+									for ( unsigned int ii = 0; ii < m_nextInterface; ++ii )
+										associated |= ( m_interfaces[ ii ].associatedInterfaces != 0 );
+
+									ControlWriter writer( 18, wLength );
+									writer.Write( 18 );                           // bLength
+									writer.Write( 1 );                            // bDescriptorType
+									writer.Write( 0x00 );                         // bcdUSB
+									writer.Write( 0x02 );                         // bcdUSB
+									writer.Write( associated ? 0xef : 0 );        // bDeviceClass (0xef = miscellaneous, 0 = per interface)
+									writer.Write( associated ? 0x02 : 0 );        // bDeviceSubClass (0x02 = common class)
+									writer.Write( associated ? 0x01 : 0 );        // bDeviceProtocol (0x01 = interface association descriptors)
+									writer.Write( CONTROL_ENDPOINT_SIZE );        // bMaxPacketSize0
+									writer.Write( LSB( m_vendorID ) );            // idVendor
+									writer.Write( MSB( m_vendorID ) );            // idVendor
+									writer.Write( LSB( m_productID ) );           // idProduct
+									writer.Write( MSB( m_productID ) );           // idProduct
+									writer.Write( LSB( m_releaseNumber ) );       // bcdDevice
+									writer.Write( MSB( m_releaseNumber ) );       // bcdDevice
+									writer.Write( m_manufacturerString );         // iManufacturer
+									writer.Write( m_productString );              // iProduct
+									writer.Write( m_serialString );               // iSerialNumber
+									writer.Write( 1 );                            // bNumConfigurations
+									writer.Finish();
+
+									success = true;
+								}
+								break;
+							}
+
+							case 0x02: {    // configuration descriptor
+
+								if ( wValueLow == 0 ) {
+
+									ControlWriter writer( m_configurationLength, wLength );
+
+									// configuration descriptor
+									writer.Write( 9 );                            // bLength
+									writer.Write( 2 );                            // bDescriptorType
+									writer.Write( LSB( m_configurationLength ) ); // wTotalLength
+									writer.Write( MSB( m_configurationLength ) ); // wTotalLength
+									writer.Write( m_nextInterface );              // bNumInterfaces
+									writer.Write( 1 );                            // bConfigurationValue
+									writer.Write( m_configurationString );        // iConfiguration
+									writer.Write( 0xe0 );                         // bmAttributes (remote wakeup)
+									writer.Write( 50 );                           // bMaxPower
+
+									for ( unsigned int ii = 0; ii < m_nextInterface; ++ii ) {
+
+										uint8_t endpoints = 0;
+										for ( unsigned int jj = 0; jj < ARRAYLENGTH( m_endpoints ); ++jj )
+											if ( ( m_endpoints[ jj ].endpointType != 0 ) && ( m_endpoints[ jj ].interface == ii ) )
+												++endpoints;
+
+										if ( m_interfaces[ ii ].associatedInterfaces != 0 ) {
+
+											// interface association descriptor
+											writer.Write( 8 );                                       // bLength
+											writer.Write( 11 );                                      // bDescriptorType
+											writer.Write( ii );                                      // bFirstInterface
+											writer.Write( m_interfaces[ ii ].associatedInterfaces ); // bInterfaceCount
+											writer.Write( m_interfaces[ ii ].interfaceClass );       // bFunctionClass
+											writer.Write( m_interfaces[ ii ].interfaceSubclass );    // bFunctionSubClass
+											writer.Write( m_interfaces[ ii ].interfaceProtocol );    // bFunctionProtocol
+											writer.Write( m_interfaces[ ii ].interfaceString );      // iFunction
+										}
 
-											uint16_t const character = pgm_read_word( string + ii );
-											*( pBuffer++ ) = LSB( character );
-											*( pBuffer++ ) = MSB( character );
+										// interface descriptor
+										writer.Write( 9 );                                       // bLength
+										writer.Write( 4 );                                       // bDescriptorType
+										writer.Write( ii );                                      // bInterfaceNumber
+										writer.Write( 0 );                                       // bAlternateSetting
+										writer.Write( endpoints );                               // bNumEndpoints
+										writer.Write( m_interfaces[ ii ].interfaceClass );       // bInterfaceClass
+										writer.Write( m_interfaces[ ii ].interfaceSubclass );    // bInterfaceSubClass
+										writer.Write( m_interfaces[ ii ].interfaceProtocol );    // bInterfaceProtocol
+										writer.Write( m_interfaces[ ii ].interfaceString );      // iInterface
+
+										m_interfaces[ ii ].pCallbacks->GetConfigurationDescriptor( ii, &writer );
+
+										for ( unsigned int jj = 0; jj < ARRAYLENGTH( m_endpoints ); ++jj ) {
+
+											if ( ( m_endpoints[ jj ].endpointType != 0 ) && ( m_endpoints[ jj ].interface == ii ) ) {
+
+												uint8_t const index = ( ( m_endpoints[ jj ].endpointType & ENDPOINT_FLAG_IN ) ? ( jj + 0x81 ) : ( jj + 0x01 ) );
+												uint8_t const attributes = ( ( m_endpoints[ jj ].endpointType & ENDPOINT_MASK_TYPE ) >> ENDPOINT_SHIFT_TYPE );
+
+												// endpoint descriptor
+												writer.Write( 7 );                                        // bLength
+												writer.Write( 5 );                                        // bDescriptorType
+												writer.Write( index );                                    // bEndpointAddress
+												writer.Write( attributes );                               // bmAttributes
+												writer.Write( LSB( m_endpoints[ jj ].endpointSize ) );    // wMaxPacketSize
+												writer.Write( MSB( m_endpoints[ jj ].endpointSize ) );    // wMaxPacketSize
+												writer.Write( m_endpoints[ jj ].endpointInterval );       // bInterval
+											}
 										}
 									}
-									break;
+									writer.Finish();
+
+									success = true;
 								}
+								break;
 							}
 
-							if ( buffer != NULL ) {
+							case 0x03: {    // string descriptor
+
+								if ( wValueLow == 0 ) {
+
+									ControlWriter writer( 4, wLength );
+									writer.Write( 4 );       // bLength
+									writer.Write( 3 );       // bDescriptorType
+									writer.Write( 0x09 );    // wLANGID
+									writer.Write( 0x04 );    // wLANGID
+									writer.Finish();
+
+									success = true;
+								}
+								else if ( wValueLow <= m_nextString ) {
+
+									// the string is already little-endian UTF-16 in program memory
+									unsigned int const stringLength = Min( m_strings[ wValueLow - 1 ].length, ( uint8_t )126 );
+									unsigned int const length = 2 + stringLength * 2;
 
-								SendBuffer( buffer, Min( length, wLength, 255u ) );
-								free( buffer );
+									ControlWriter writer( length, wLength );
+									writer.Write( length );    // bLength
+									writer.Write( 3 );         // bDescriptorType
+									writer.WriteProgmem( reinterpret_cast< uint8_t const* >( m_strings[ wValueLow - 1 ].string ), stringLength * 2 );
+									writer.Finish();
 
-								success = true;
+									success = true;
+								}
+								break;
 							}
-							break;
 						}
+						break;
+					}
 
-						case 8: {    // get configuration
+					case 8: {    // get configuration
 
-							WaitIn();
-							UEDATX = m_configuration;
-							ClearIn();
+						WaitIn();
+						UEDATX = m_configuration;
+						ClearIn();
 
-							success = true;
-							break;
-						}
+						success = true;
+						break;
 					}
 				}
-				break;
 			}
+			break;
+		}
 
-			case 1: {    // interface
+		case 1: {    // interface
 
-				if ( wIndex < m_nextInterface )
-					success = m_interfaces[ wIndex ].pCallbacks->HandleRequest( bmRequestType, bRequest, wValue, wIndex, wLength );
-				break;
-			}
+			if ( wIndex < m_nextInterface )
+				success = HandleInterfaceRequest( wIndex, bmRequestType, bRequest, wValue, wIndex, wLength );
+			break;
+		}
 
-			case 2: {    // endpoint
+		case 2: {    // endpoint
 
-				if ( wIndex > 0 ) {
+			if ( wIndex > 0 ) {
 
-					uint16_t index = wIndex - 1;
-					if ( ( index < ARRAYLENGTH( m_endpoints ) ) && ( m_endpoints[ index ].endpointType != 0 ) )
-						success = m_interfaces[ m_endpoints[ index ].interface ].pCallbacks->HandleRequest( bmRequestType, bRequest, wValue, wIndex, wLength );
-				}
-				break;
+				uint16_t index = wIndex - 1;
+				if ( ( index < ARRAYLENGTH( m_endpoints ) ) && ( m_endpoints[ index ].endpointType != 0 ) )
+					success = HandleInterfaceRequest( m_endpoints[ index ].interface, bmRequestType, bRequest, wValue, wIndex, wLength );
 			}
+			break;
 		}
 	}
 
-	if ( ! success )
+	if ( success ) {
+
+		// a ControlWriter which has more to send leaves m_controlMore set
+		if ( m_controlMore )
+			m_controlState = CONTROL_STATE_DATA_IN;
+	}
+	else
 		Stall();
+
+	switch( m_controlState ) {
+
+		case CONTROL_STATE_DATA_IN: UEIENX = ( ( 1 << RXSTPE ) | ( 1 << TXINE ) | ( 1 << RXOUTE ) ); break;
+		case CONTROL_STATE_ADDRESS: UEIENX = ( ( 1 << RXSTPE ) | ( 1 << TXINE ) ); break;
+		default: UEIENX = ( 1 << RXSTPE ); break;
+	}
 }
 
 
@@ -60,6 +60,7 @@
 
 
 #include "usb_callbacks.hh"
+#include "usb_hardware.hh"
 
 #include <inttypes.h>
 #include <string.h>
@@ -135,8 +136,12 @@ struct Device {
 
 	enum { MAXIMUM_STRINGS = 8 };
 	enum { MAXIMUM_INTERFACES = 6 };
+	enum { MAXIMUM_ENDPOINTS = Hardware::ENDPOINTS - 1 };    ///< not counting the control endpoint
 	enum { CONTROL_ENDPOINT_SIZE = 32 };
 
+	static_assert( ( static_cast< unsigned int >( CONTROL_ENDPOINT_SIZE ) <= Hardware::MAXIMUM_SIZE ), "control endpoint is too large" );
+	static_assert( ( static_cast< unsigned int >( CONTROL_ENDPOINT_SIZE ) + MAXIMUM_ENDPOINTS * 8 <= Hardware::DPRAM_SIZE ), "control endpoint leaves no room for the others" );
+
 	enum {
 
 		// bits 7-6 = endpoint type
@@ -219,6 +224,54 @@ struct Device {
 	uint8_t const GetConfiguration() const;
 
 
+	/**
+		\brief Gets the time of the most recent start-of-frame
+
+		The start-of-frame interrupt records the Timer ticks at which it ran,
+		along with the frame number from UDFNUM. If the frame number hasn't
+		moved on since then, the recorded time is returned. If it has moved on
+		by one, the interrupt is still pending (interrupts are disabled), and
+		the current time is returned instead. Otherwise, we've lost track of
+		the frames (e.g. no start-of-frame has been seen yet), and false is
+		returned.
+
+		\param pTicks  receives the Timer ticks at the start of the frame
+		\result  true if the start-of-frame time is known, false otherwise
+	*/
+	bool const GetFrameTicks( uint16_t* const pTicks ) const;
+
+
+	/**
+		\brief Checks whether the bus is suspended
+
+		While the bus is suspended, the USB clock is frozen and the PLL is
+		stopped, so nothing will be sent to the host. The caller should keep
+		its own power consumption down (e.g. by turning off LEDs and sleeping
+		with Power::Standby()) until it returns false again.
+
+		\result  true if suspended, false otherwise
+	*/
+	inline bool const IsSuspended() const;
+
+	/**
+		\brief Wakes up the host
+
+		If the bus is suspended, and the host has enabled remote wakeup, then
+		resume signalling is started upstream, and this function returns
+		without waiting for it to finish. The suspension ends, in
+		DeviceInterrupt(), once the host has resumed the bus in response.
+
+		The bus must have been idle for at least 5ms before we may signal a
+		resume, so if the suspension has only just started, nothing is sent
+		yet. The caller should keep calling this function (without sleeping
+		in standby, which stops the timer) until it returns false, or the bus
+		is no longer suspended.
+
+		\result  true if resume signalling has been, or will be, started, false otherwise
+	*/
+	bool const RemoteWakeup();
+
+
 	/**
 		\brief Registers a new string
 
@@ -295,6 +348,24 @@ struct Device {
 	*/
 	uint8_t const UnregisterInterface( uint8_t const interface );
 
+	/**
+		\brief Groups consecutive interfaces into a single function
+
+		An interface association descriptor is written before the first
+		interface of the group, using its class, subclass, protocol and string
+		as those of the function. Functions spanning several interfaces (e.g.
+		CDC-ACM) need this to be recognized as part of a composite device. If
+		any interfaces are associated, then the device descriptor marks the
+		device as using interface associations.
+
+		This function cannot be called after a call to Start().
+
+		\param firstInterface  first interface number of the group
+		\param interfaces      number of interfaces in the group
+		\result  true on success, false on failure
+	*/
+	bool const AssociateInterfaces( uint8_t const firstInterface, uint8_t const interfaces );
+
 
 	/**
 		\brief Registers a new endpoint
@@ -305,6 +376,14 @@ struct Device {
 		and the endpoint direction flags ENDPOINT_FLAG_OUT and
 		ENDPOINT_FLAG_IN. Isochronous endpoints are not supported.
 
+		The endpoint number is chosen from those the MCU can give the
+		requested size, preferring ones which can be double-buffered if
+		ENDPOINT_FLAG_DOUBLE_BUFFERED is set, and ones which can't otherwise.
+		Double buffering is only a request: Start() gives second banks to as
+		many of the endpoints asking for them as DPRAM allows, IN endpoints
+		first. Registration fails if the endpoint couldn't be given even a
+		single bank.
+
 		The passed Callbacks instance associated with the interface owning this
 		endpoint will receive control interrupts for this endpoint via
 		Callbacks::HandleRequest(), after Start() has been called.
@@ -338,13 +417,78 @@ struct Device {
 	uint8_t const UnregisterEndpoint( uint8_t const endpoint );
 
 
+	/// \brief Start-of-frame handler registered by RegisterDispatch()
+	typedef void ( *IdleHandler )( void* const pContext );
+
+	/// \brief Interface and endpoint request handler registered by RegisterDispatch()
+	typedef bool const ( *RequestHandler )( void* const pContext, uint8_t const interface, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength );
+
+	/**
+		\brief Registers handlers which replace the interfaces' callbacks
+
+		Normally, start-of-frame and control interrupts reach the interfaces
+		through the virtual Callbacks::HandleIdle() and
+		Callbacks::HandleRequest(). USB::Dispatch registers a pair of handlers
+		which know the type of every interface at compile time instead, so
+		that the calls to the interfaces are direct, and may be inlined. The
+		interfaces handled must be exactly those which have been registered,
+		in order.
+
+		This function cannot be called after a call to Start().
+
+		\param ppCallbacks     interfaces handled, in order of interface number
+		\param interfaces      number of interfaces handled
+		\param pContext        passed through to the handlers
+		\param idleHandler     start-of-frame handler
+		\param requestHandler  interface and endpoint request handler
+		\result  true on success, false on failure
+	*/
+	bool const RegisterDispatch(
+		Callbacks* const* const ppCallbacks,
+		uint8_t const interfaces,
+		void* const pContext,
+		IdleHandler const idleHandler,
+		RequestHandler const requestHandler
+	);
+
+
 private:
 
+	/**
+		The suspend interrupt is raised after 3ms of bus idle, and 5ms are
+		needed before signalling a resume, so we wait for two more timer
+		overflows (each at least 4ms at 16MHz) after it.
+	*/
+	enum { REMOTE_WAKEUP_OVERFLOWS = 2 };
+
 	inline Device();
 
 	void DeviceInterrupt();
 	void CommunicationInterrupt();
 
+	void HandleControlRequest();
+
+	inline bool const HandleInterfaceRequest( uint8_t const interface, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength );
+
+	uint16_t const GetAllocatedBytes() const;
+	void AllocateBanks();
+
+
+	/*
+		Control transfers are advanced one packet per interrupt: SETUP
+		(RXSTPI) starts a transfer, each TXINI sends the next packet of an IN
+		data stage, and RXOUTI delivers the data of an OUT data stage, so we
+		never wait in the interrupt for the host.
+	*/
+	enum {
+
+		CONTROL_STATE_IDLE,
+		CONTROL_STATE_DATA_IN,     // waiting to send the next packet
+		CONTROL_STATE_DATA_OUT,    // waiting for the data
+		CONTROL_STATE_ADDRESS      // waiting for the status stage of a set address request
+
+	};
+
 
 	struct StringData {
 		wchar_t const* string;
@@ -357,6 +501,15 @@ private:
 		uint8_t interfaceSubclass;
 		uint8_t interfaceProtocol;
 		uint8_t interfaceString;
+		uint8_t associatedInterfaces;    ///< nonzero if this is the first interface of an association
+	};
+
+	struct ControlRequest {
+		uint8_t bmRequestType;
+		uint8_t bRequest;
+		uint16_t wValue;
+		uint16_t wIndex;
+		uint16_t wLength;
 	};
 
 	struct EndpointData {
@@ -364,6 +517,7 @@ private:
 		uint8_t endpointType;
 		uint16_t endpointSize;
 		uint8_t endpointInterval;
+		uint8_t endpointBanks;    ///< chosen by AllocateBanks()
 	};
 
 
@@ -373,7 +527,11 @@ private:
 	InterfaceData m_interfaces[ MAXIMUM_INTERFACES ];
 	uint8_t m_nextInterface;
 
-	EndpointData m_endpoints[ 6 ];
+	EndpointData m_endpoints[ MAXIMUM_ENDPOINTS ];
+
+	void* m_pDispatch;
+	IdleHandler m_dispatchIdle;
+	RequestHandler m_dispatchRequest;
 
 	uint16_t m_vendorID;
 	uint16_t m_productID;
@@ -384,9 +542,27 @@ private:
 	uint8_t m_serialString;
 	uint8_t m_configurationString;
 
+	uint16_t m_configurationLength;
+
 	bool m_started;
 	uint8_t m_configuration;
 
+	bool volatile m_suspended;
+	bool m_remoteWakeup;    ///< set by the host with a set feature request
+	bool volatile m_resuming;    ///< resume signalling has been started, and the host hasn't answered yet
+	uint16_t m_suspendOverflows;    ///< timer overflow count when the bus was suspended
+
+	uint16_t volatile m_frameNumber;
+	uint16_t volatile m_frameTicks;
+
+	ControlRequest m_controlRequest;
+	uint16_t m_controlOffset;    ///< bytes of the IN data stage already sent
+	uint8_t m_controlState;
+	bool m_controlMore;          ///< set by ControlWriter::Finish() if there are more packets to send
+
+
+	friend struct ControlWriter;
+
 
 	friend void _Private::DeviceInterrupt();
 	friend void _Private::CommunicationInterrupt();
@@ -417,9 +593,29 @@ bool const Device::IsStarted() const {
 }
 
 
+bool const Device::IsSuspended() const {
+
+	return m_suspended;
+}
+
+
+bool const Device::HandleInterfaceRequest( uint8_t const interface, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength ) {
+
+	bool result = false;
+	if ( m_dispatchRequest != NULL )
+		result = m_dispatchRequest( m_pDispatch, interface, bmRequestType, bRequest, wValue, wIndex, wLength );
+	else
+		result = m_interfaces[ interface ].pCallbacks->HandleRequest( bmRequestType, bRequest, wValue, wIndex, wLength );
+	return result;
+}
+
+
 Device::Device() :
 	m_nextString( 0 ),
 	m_nextInterface( 0 ),
+	m_pDispatch( NULL ),
+	m_dispatchIdle( NULL ),
+	m_dispatchRequest( NULL ),
 	m_vendorID( 0 ),
 	m_productID( 0 ),
 	m_releaseNumber( 0 ),
@@ -427,12 +623,23 @@ Device::Device() :
 	m_productString( 0 ),
 	m_serialString( 0 ),
 	m_configurationString( 0 ),
+	m_configurationLength( 0 ),
 	m_started( false ),
-	m_configuration( 0 )
+	m_configuration( 0 ),
+	m_suspended( false ),
+	m_remoteWakeup( false ),
+	m_resuming( false ),
+	m_suspendOverflows( 0 ),
+	m_frameNumber( 0xffff ),
+	m_frameTicks( 0 ),
+	m_controlOffset( 0 ),
+	m_controlState( CONTROL_STATE_IDLE ),
+	m_controlMore( false )
 {
-	memset( m_strings,    0, sizeof( m_strings    ) );
-	memset( m_interfaces, 0, sizeof( m_interfaces ) );
-	memset( m_endpoints,  0, sizeof( m_endpoints  ) );
+	memset(  m_strings,        0, sizeof( m_strings        ) );
+	memset(  m_interfaces,     0, sizeof( m_interfaces     ) );
+	memset(  m_endpoints,      0, sizeof( m_endpoints      ) );
+	memset( &m_controlRequest, 0, sizeof( m_controlRequest ) );
 }
 
 
@@ -0,0 +1,239 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file usb_dispatch.hh
+	\brief USB::Dispatch implementation
+*/
+
+
+
+
+#ifndef __USB_DISPATCH_HH__
+#define __USB_DISPATCH_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include "usb_callbacks.hh"
+#include "usb_device.hh"
+
+#include <inttypes.h>
+
+
+
+
+namespace USB {
+
+
+
+
+namespace _Private {
+
+
+
+
+//============================================================================
+//    USB::_Private::DispatchImplementation class
+//============================================================================
+
+
+template< uint8_t t_Index, typename... t_Interfaces >
+struct DispatchImplementation {
+
+	enum { SIZE = 0 };
+
+
+	inline DispatchImplementation() { }
+
+
+	inline void GetCallbacks( Callbacks** const ppCallbacks ) const { }
+
+	inline void HandleIdle() { }
+
+	inline bool const HandleRequest( uint8_t const interface, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength ) { return false; }
+};
+
+
+template< uint8_t t_Index, typename t_Interface, typename... t_Interfaces >
+struct DispatchImplementation< t_Index, t_Interface, t_Interfaces... > {
+
+	typedef DispatchImplementation< t_Index + 1, t_Interfaces... > Next;
+
+	enum { SIZE = 1 + Next::SIZE };
+
+
+	inline DispatchImplementation( t_Interface* const pInterface, t_Interfaces* const... pInterfaces ) :
+		m_pInterface( pInterface ),
+		m_next( pInterfaces... )
+	{
+	}
+
+
+	inline void GetCallbacks( Callbacks** const ppCallbacks ) const {
+
+		ppCallbacks[ t_Index ] = m_pInterface;
+		m_next.GetCallbacks( ppCallbacks );
+	}
+
+	inline void HandleIdle() {
+
+		t_Interface::DispatchIdle( m_pInterface, t_Index );
+		m_next.HandleIdle();
+	}
+
+	inline bool const HandleRequest( uint8_t const interface, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength ) {
+
+		bool result = false;
+		if ( interface == t_Index )
+			result = t_Interface::DispatchRequest( m_pInterface, bmRequestType, bRequest, wValue, wIndex, wLength );
+		else
+			result = m_next.HandleRequest( interface, bmRequestType, bRequest, wValue, wIndex, wLength );
+		return result;
+	}
+
+
+private:
+
+	t_Interface* const m_pInterface;
+	Next m_next;
+};
+
+
+
+
+}    // namespace _Private
+
+
+
+
+//============================================================================
+//    USB::Dispatch class
+//============================================================================
+
+
+/**
+	\brief Compile-time list of the USB interfaces
+
+	Start-of-frame and control interrupts normally reach each interface
+	through the virtual Callbacks::HandleIdle() and Callbacks::HandleRequest()
+	methods, and the HID interfaces then make further virtual calls for every
+	report. On the AVR, each of these is an indirect call, which must save
+	every call-clobbered register. If an instance of this class is created
+	before Device::Start(), listing the types of all of the interfaces in
+	order of registration, then the device instead makes a single call to
+	a handler which has been generated for exactly these types, and in which
+	the calls to the interfaces (and, for HID interfaces, to the report
+	methods) are direct, and may be inlined.
+
+	Interface types which don't provide their own Callbacks::DispatchIdle()
+	and Callbacks::DispatchRequest() fall back to the virtual calls. If the
+	list doesn't match the registered interfaces, then the device ignores it,
+	and uses the virtual calls for everything.
+
+	The instance must outlive the device, e.g. by being created in main()
+	alongside the interfaces.
+*/
+template< typename... t_Interfaces >
+struct Dispatch {
+
+	/**
+		\brief Constructor
+
+		\param pInterfaces  interface instances, in order of registration
+	*/
+	inline Dispatch( t_Interfaces* const... pInterfaces );
+
+
+	/**
+		\brief Checks whether the device accepted the list
+
+		\result  true if registered, false otherwise
+	*/
+	inline bool const IsRegistered() const;
+
+
+private:
+
+	typedef _Private::DispatchImplementation< 0, t_Interfaces... > Implementation;
+
+
+	static void HandleIdle( void* const pContext );
+	static bool const HandleRequest( void* const pContext, uint8_t const interface, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength );
+
+
+	Implementation m_implementation;
+	bool m_registered;
+
+
+	inline Dispatch( Dispatch const& other );
+	inline Dispatch const& operator=( Dispatch const& other );
+};
+
+
+
+
+//============================================================================
+//    USB::Dispatch methods
+//============================================================================
+
+
+template< typename... t_Interfaces >
+Dispatch< t_Interfaces... >::Dispatch( t_Interfaces* const... pInterfaces ) :
+	m_implementation( pInterfaces... ),
+	m_registered( false )
+{
+	Callbacks* callbacks[ Implementation::SIZE ];
+	m_implementation.GetCallbacks( callbacks );
+	m_registered = Device::Instance()->RegisterDispatch( callbacks, Implementation::SIZE, this, &HandleIdle, &HandleRequest );
+}
+
+
+template< typename... t_Interfaces >
+bool const Dispatch< t_Interfaces... >::IsRegistered() const {
+
+	return m_registered;
+}
+
+
+template< typename... t_Interfaces >
+void Dispatch< t_Interfaces... >::HandleIdle( void* const pContext ) {
+
+	static_cast< Dispatch* >( pContext )->m_implementation.HandleIdle();
+}
+
+
+template< typename... t_Interfaces >
+bool const Dispatch< t_Interfaces... >::HandleRequest( void* const pContext, uint8_t const interface, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength ) {
+
+	return static_cast< Dispatch* >( pContext )->m_implementation.HandleRequest( interface, bmRequestType, bRequest, wValue, wIndex, wLength );
+}
+
+
+
+
+}    // namespace USB
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __USB_DISPATCH_HH__ */
@@ -0,0 +1,148 @@
+/*
+	Copyright (C) 2011  Andrew Cotter
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the Free
+	Software Foundation, either version 3 of the License, or (at your option)
+	any later version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+	\file usb_hardware.hh
+	\brief USB::Hardware implementation
+*/
+
+
+
+
+#ifndef __USB_HARDWARE_HH__
+#define __USB_HARDWARE_HH__
+
+#ifdef __cplusplus
+
+
+
+
+#include <inttypes.h>
+
+
+
+
+namespace USB {
+
+
+
+
+//============================================================================
+//    USB::Hardware struct
+//============================================================================
+
+
+/**
+	\brief Endpoint capabilities of the USB controller
+
+	Describes the endpoints of the selected MCU, and how much dual-port RAM
+	(DPRAM) they share. The controller allocates DPRAM to the endpoints in
+	order of endpoint number, so a configuration fits if the banks of all
+	enabled endpoints, including the control endpoint, add up to no more than
+	DPRAM_SIZE bytes. Bank sizes are powers of two, from 8 bytes up to the
+	endpoint's maximum.
+
+	Endpoints are numbered as on the bus: endpoint 0 is the control endpoint.
+*/
+struct Hardware {
+
+#if defined( __AVR_AT90USB162__ )
+	enum { ENDPOINTS = 5 };
+	enum { DPRAM_SIZE = 176 };
+	enum { DOUBLE_BANK_ENDPOINTS = 0x18 };    ///< endpoints 3 and 4
+	enum { LARGE_ENDPOINTS = 0x00 };
+#elif defined( __AVR_ATmega32U4__ ) || defined( __AVR_AT90USB646__ ) || defined( __AVR_AT90USB1286__ )
+	enum { ENDPOINTS = 7 };
+	enum { DPRAM_SIZE = 832 };
+	enum { DOUBLE_BANK_ENDPOINTS = 0x7e };    ///< endpoints 1 through 6
+	enum { LARGE_ENDPOINTS = 0x02 };          ///< endpoint 1
+#else
+#error "USB::Hardware does not know the endpoints of this MCU"
+#endif
+
+	enum {
+		MAXIMUM_SIZE       = 64,     ///< of any endpoint not in LARGE_ENDPOINTS
+		MAXIMUM_LARGE_SIZE = 256
+	};
+
+	static_assert( ( ( ( DOUBLE_BANK_ENDPOINTS | LARGE_ENDPOINTS ) >> ENDPOINTS ) == 0 ), "endpoint masks must only contain existing endpoints" );
+
+
+	/**
+		\brief Finds the largest bank size supported by an endpoint
+		\param endpoint  endpoint number
+		\result  maximum size in bytes
+	*/
+	static inline uint16_t const GetMaximumSize( uint8_t const endpoint );
+
+
+	/**
+		\brief Finds whether an endpoint can have two banks
+		\param endpoint  endpoint number
+		\result  whether it can be double-buffered
+	*/
+	static inline bool const IsDoubleBankable( uint8_t const endpoint );
+
+
+	/**
+		\brief Finds how much DPRAM one bank of an endpoint takes
+		\param endpointSize  16-bit endpoint size
+		\result  bank size in bytes
+	*/
+	static inline uint16_t const GetBankSize( uint16_t const endpointSize );
+};
+
+
+
+
+//============================================================================
+//    USB::Hardware methods
+//============================================================================
+
+
+uint16_t const Hardware::GetMaximumSize( uint8_t const endpoint ) {
+
+	return( ( LARGE_ENDPOINTS & ( 1 << endpoint ) ) ? MAXIMUM_LARGE_SIZE : MAXIMUM_SIZE );
+}
+
+
+bool const Hardware::IsDoubleBankable( uint8_t const endpoint ) {
+
+	return( ( DOUBLE_BANK_ENDPOINTS & ( 1 << endpoint ) ) != 0 );
+}
+
+
+uint16_t const Hardware::GetBankSize( uint16_t const endpointSize ) {
+
+	uint16_t size = 8;
+	while ( size < endpointSize )
+		size <<= 1;
+	return size;
+}
+
+
+
+
+}    // namespace USB
+
+
+
+
+#endif    /* __cplusplus */
+
+#endif    /* __USB_HARDWARE_HH__ */
@@ -69,73 +69,67 @@ namespace USB {
 
 
 //============================================================================
-//    USB memory transfer helper
+//    USB::ControlWriter methods
 //============================================================================
 
 
-unsigned int const SendBuffer( uint8_t const* const buffer, unsigned int const length, unsigned int const endpointSize ) {
+void ControlWriter::Write( uint8_t const byte ) {
 
-	uint8_t const* pBuffer = buffer;
-	uint8_t const* const pBufferEnd = pBuffer + length;
-	if ( endpointSize > 0 ) {
+	if ( m_skip > 0 ) {
 
-		for ( ; ; ) {
+		if ( m_remaining > 0 ) {
 
-			if ( WaitInOut() & ( 1 << RXOUTI ) )
-				break;
+			--m_skip;
+			--m_remaining;
+		}
+	}
+	else if ( ! IsFull() ) {
 
-			uint8_t const* pBufferNext = pBuffer + endpointSize;
-			if ( pBufferEnd < pBufferNext ) {    // **NOTE: if we're exactly filling the endpoint, then we need to send a 0-length block
+		if ( m_packetLength == 0 )
+			WaitIn();    // already set when we're called from SETUP or TXINI, so this doesn't spin
 
-				for ( ; pBuffer < pBufferEnd; ++pBuffer )
-					UEDATX = *pBuffer;
-				ClearIn();
+		UEDATX = byte;
+		++m_packetLength;
+		--m_remaining;
+	}
+}
 
-				break;
-			}
-			else {
 
-				for ( ; pBuffer < pBufferNext; ++pBuffer )
-					UEDATX = *pBuffer;
-				ClearIn();
-			}
-		}
-	}
+void ControlWriter::Write( uint8_t const* const buffer, uint16_t const length ) {
 
-	return( pBuffer - buffer );
+	for ( uint16_t ii = 0; ( ii < length ) && ( ( m_skip > 0 ) || ! IsFull() ); ++ii )
+		Write( buffer[ ii ] );
 }
 
 
-unsigned int const SendBufferProgmem( uint8_t const* const buffer, unsigned int const length, unsigned int const endpointSize ) {
+void ControlWriter::WriteProgmem( uint8_t const* const buffer, uint16_t const length ) {
 
-	uint8_t const* pBuffer = buffer;
-	uint8_t const* const pBufferEnd = pBuffer + length;
-	if ( endpointSize > 0 ) {
+	uint16_t ii = 0;
 
-		for ( ; ; ) {
+	// skip over what was sent in earlier packets without reading it
+	uint16_t const skip = ( ( m_skip < length ) ? m_skip : length );
+	if ( skip > 0 ) {
 
-			if ( WaitInOut() & ( 1 << RXOUTI ) )
-				break;
+		uint16_t const skipped = ( ( skip < m_remaining ) ? skip : m_remaining );
+		m_skip      -= skipped;
+		m_remaining -= skipped;
+		ii = skip;
+	}
 
-			uint8_t const* pBufferNext = pBuffer + endpointSize;
-			if ( pBufferEnd < pBufferNext ) {    // **NOTE: if we're exactly filling the endpoint, then we need to send a 0-length block
+	for ( ; ( ii < length ) && ! IsFull(); ++ii )
+		Write( pgm_read_byte( buffer + ii ) );
+}
 
-				for ( ; pBuffer < pBufferEnd; ++pBuffer )
-					UEDATX = pgm_read_byte( pBuffer );
-				ClearIn();
 
-				break;
-			}
-			else {
+void ControlWriter::Finish() {
 
-				for ( ; pBuffer < pBufferNext; ++pBuffer )
-					UEDATX = pgm_read_byte( pBuffer );
-				ClearIn();
-			}
-		}
-	}
+	if ( m_packetLength == 0 )
+		WaitIn();    // zero-length packet
+	ClearIn();
 
-	return( pBuffer - buffer );
+	Device* const pDevice = Device::Instance();
+	pDevice->m_controlOffset += m_packetLength;
+	pDevice->m_controlMore = ( ( m_packetLength == Device::CONTROL_ENDPOINT_SIZE ) && ( ( m_remaining > 0 ) || m_short ) );
 }
 
 
@@ -116,14 +116,88 @@ inline void Stall() {
 
 
 //============================================================================
-//    USB memory transfer helpers
+//    USB::ControlWriter class
 //============================================================================
 
 
-unsigned int const SendBuffer( uint8_t const* const buffer, unsigned int const length, unsigned int const endpointSize = Device::CONTROL_ENDPOINT_SIZE );
+/**
+	\brief Writes one packet of the data stage of a control IN transfer
+
+	Bytes are written to the control endpoint as they're produced, so that
+	descriptors can be streamed straight from their sources (mostly program
+	memory) instead of being assembled in a buffer first.
+
+	Device only sends one packet per interrupt, and calls the request handler
+	again for each packet, so a handler should simply write the whole reply
+	every time: the bytes which went out in earlier packets are skipped, and
+	those which don't fit in this one are dropped. Finish() sends the packet,
+	and tells Device whether there's more to come.
+
+	The reply is truncated to the wLength requested by the host, and is
+	terminated with a zero-length packet only if it's shorter than wLength
+	and ends on a packet boundary.
+*/
+struct ControlWriter {
+
+	/**
+		\brief Constructor
+
+		\param length   full length of the reply (bytes)
+		\param wLength  number of bytes requested by the host
+	*/
+	inline ControlWriter( uint16_t const length, uint16_t const wLength );
+
+
+	/// \brief Writes a single byte
+	void Write( uint8_t const byte );
+
+	/// \brief Writes a buffer
+	void Write( uint8_t const* const buffer, uint16_t const length );
+
+	/// \brief Writes a buffer in program memory
+	void WriteProgmem( uint8_t const* const buffer, uint16_t const length );
+
+
+	/// \brief Sends the packet
+	void Finish();
+
+
+private:
+
+	inline bool const IsFull() const;
 
 
-unsigned int const SendBufferProgmem( uint8_t const* const buffer, unsigned int const length, unsigned int const endpointSize = Device::CONTROL_ENDPOINT_SIZE );
+	uint16_t m_skip;         ///< bytes still to be skipped, because they were sent in earlier packets
+	uint16_t m_remaining;    ///< bytes of the reply not yet skipped or written
+	uint8_t m_packetLength;
+	bool m_short;
+
+
+	inline ControlWriter( ControlWriter const& other );
+	inline ControlWriter const& operator=( ControlWriter const& other );
+};
+
+
+
+
+//============================================================================
+//    USB::ControlWriter inline methods
+//============================================================================
+
+
+ControlWriter::ControlWriter( uint16_t const length, uint16_t const wLength ) :
+	m_skip( Device::Instance()->m_controlOffset ),
+	m_remaining( ( length < wLength ) ? length : wLength ),
+	m_packetLength( 0 ),
+	m_short( length < wLength )
+{
+}
+
+
+bool const ControlWriter::IsFull() const {
+
+	return( ( m_remaining == 0 ) || ( m_packetLength == Device::CONTROL_ENDPOINT_SIZE ) );
+}
 
 
 
@@ -52,6 +52,7 @@
 
 
 #include "usb.hh"
+#include "latency_trace.hh"
 #include "helpers.h"
 
 #include <inttypes.h>
@@ -83,13 +84,81 @@ Interface::~Interface() {
 
 bool const Interface::IsChanged() {
 
+	return( ( m_changed != 0 ) || ( ! m_queue.IsEmpty() ) );
+}
+
+
+bool const Interface::Snapshot() {
+
+	bool success = true;
+
+	// save and clear the interrupt flag
+	uint8_t const sreg = SREG;
+	cli();
+
+	for ( unsigned int ii = 0; ii < m_nextReport; ++ii ) {
+
+		if ( IsIdleReport( ii ) && IsChangedReport( ii ) ) {
+
+			// GetReport() may consume state, so only call it if there's room for a whole packet
+			if ( REPORT_QUEUE_SIZE - m_queue.GetCount() >= 2 + m_maximumReportSize ) {
+
+				uint8_t buffer[ MAXIMUM_REPORT_SIZE ];
+				m_changed &= ~( 1 << ii );
+				uint8_t const length = this->GetReport( ii, buffer );
+
+				m_queue.Push( ii );
+				m_queue.Push( length );
+				for ( uint8_t jj = 0; jj < length; ++jj )
+					m_queue.Push( buffer[ jj ] );
+			}
+			else
+				success = false;
+		}
+	}
+
+	// restore the interrupt flag
+	SREG = sreg;
+
+	return success;
+}
+
+
+bool const Interface::Flush() {
+
 	bool changed = false;
-	for ( unsigned int ii = 0; ( ! changed ) && ( ii < m_nextReport ); ++ii ) {
 
-		if ( m_reports[ ii ].reportType & REPORT_FLAG_SEND )
-			changed |= this->IsChangedReport( ii );
+	// save and clear the interrupt flag
+	uint8_t const sreg = SREG;
+	cli();
+
+	bool const configured = ( Device::Instance()->GetConfiguration() != 0 );
+	if ( configured )
+		WriteQueuedReports();
+	changed = ( ! m_queue.IsEmpty() );
+
+	if ( configured )
+		UENUM = m_endpoint;
+	for ( unsigned int ii = 0; ii < m_nextReport; ++ii ) {
+
+		if ( IsIdleReport( ii ) && IsChangedReport( ii ) ) {
+
+			if ( configured && m_queue.IsEmpty() && ( UEINTX & ( 1 << RWAL ) ) ) {
+
+				uint8_t buffer[ MAXIMUM_REPORT_SIZE ];
+				m_changed &= ~( 1 << ii );
+				uint8_t const length = this->GetReport( ii, buffer );
+				WriteReport( ii, buffer, length );
+			}
+			else
+				changed = true;
+		}
 	}
-	return changed;
+
+	// restore the interrupt flag
+	SREG = sreg;
+
+	return( ! changed );
 }
 
 
@@ -102,7 +171,10 @@ Interface::Interface(
 	uint8_t const endpointInterval
 ) :
 	m_nextReport( 0 ),
-	m_protocol( 1 )
+	m_changed( 0 ),
+	m_maximumReportSize( ( endpointSize < MAXIMUM_REPORT_SIZE ) ? endpointSize : MAXIMUM_REPORT_SIZE ),    // no report can be longer than a packet
+	m_protocol( 1 ),
+	m_immediate( false )
 {
 	memset( m_reports, 0, sizeof( m_reports ) );
 
@@ -131,7 +203,7 @@ uint8_t const Interface::RegisterReportProgmem(
 	uint8_t const* const descriptor,
 	uint8_t const descriptorSize,
 	uint8_t const reportType,
-	uint8_t const usagePage,
+	uint16_t const usagePage,
 	uint8_t const usage,
 	uint8_t const idle
 )
@@ -183,9 +255,10 @@ bool const Interface::ForceSendReport( uint8_t const report, uint16_t const time
 		uint8_t sreg = SREG;
 		cli();
 
+		WriteQueuedReports();
 		UENUM = m_endpoint;
-		uint8_t ueintx = UEINTX;
-		if ( ! ( ueintx & ( 1 << RWAL ) ) ) {
+		bool ready = ( m_queue.IsEmpty() && ( UEINTX & ( 1 << RWAL ) ) );
+		if ( ! ready ) {
 
 			if ( timeout > 0 ) {
 
@@ -212,21 +285,20 @@ bool const Interface::ForceSendReport( uint8_t const report, uint16_t const time
 					sreg = SREG;
 					cli();
 
+					WriteQueuedReports();
 					UENUM = m_endpoint;
-					ueintx = UEINTX;
+					ready = ( m_queue.IsEmpty() && ( UEINTX & ( 1 << RWAL ) ) );
 
-				} while ( ! ( ueintx & ( 1 << RWAL ) ) );
+				} while ( ! ready );
 			}
 		}
 
-		if ( ueintx & ( 1 << RWAL ) ) {
+		if ( ready ) {
 
-			if ( m_nextReport > 1 )
-				UEDATX = report + 1;
-			this->SendReport( report );
-			m_reports[ report ].idleCount = 0;
-
-			UEINTX = ( ( 1 << RWAL ) | ( 1 << NAKOUTI ) | ( 1 << RXSTPI ) | ( 1 << STALLEDI ) );
+			uint8_t buffer[ MAXIMUM_REPORT_SIZE ];
+			m_changed &= ~( 1 << report );
+			uint8_t const length = this->GetReport( report, buffer );
+			WriteReport( report, buffer, length );
 
 			success = true;
 		}
@@ -240,26 +312,22 @@ bool const Interface::ForceSendReport( uint8_t const report, uint16_t const time
 
 void Interface::HandleIdle( uint8_t const interface ) {
 
+	// DispatchIdle() does the same, without the virtual calls
+	WriteQueuedReports();
 	for ( unsigned int ii = 0; ii < m_nextReport; ++ii ) {
 
-		if ( ( m_reports[ ii ].reportType & REPORT_FLAG_SEND ) && ( m_reports[ ii ].reportType & REPORT_FLAG_IDLE ) ) {
-
-			uint8_t const idle = m_reports[ ii ].idle;
-
-			if ( m_reports[ ii ].idleCount < idle * 4u )
-				++m_reports[ ii ].idleCount;
+		if ( IsIdleReport( ii ) ) {
 
-			if ( this->IsChangedReport( ii ) || ( ( idle > 0 ) && ( m_reports[ ii ].idleCount >= idle * 4u ) ) ) {
+			bool const expired = UpdateIdle( ii );
+			if ( IsChangedReport( ii ) || expired ) {
 
 				UENUM = m_endpoint;
-				if ( UEINTX & ( 1 << RWAL ) ) {
+				if ( m_queue.IsEmpty() && ( UEINTX & ( 1 << RWAL ) ) ) {
 
-					if ( m_nextReport > 1 )
-						UEDATX = ii + 1;
-					this->SendReport( ii );
-					m_reports[ ii ].idleCount = 0;
-
-					UEINTX = ( ( 1 << RWAL ) | ( 1 << NAKOUTI ) | ( 1 << RXSTPI ) | ( 1 << STALLEDI ) );
+					uint8_t buffer[ MAXIMUM_REPORT_SIZE ];
+					m_changed &= ~( 1 << ii );
+					uint8_t const length = this->GetReport( ii, buffer );
+					WriteReport( ii, buffer, length );
 				}
 			}
 		}
@@ -272,19 +340,6 @@ bool const Interface::HandleRequest( uint8_t const bmRequestType, uint8_t const
 	bool result = false;
 	switch( bmRequestType ) {
 
-		case 0x01: {    // standard host to interface
-
-			if ( bRequest == 5 ) {    // set address
-
-				ClearIn();
-				WaitIn();
-				UDADDR = ( wValue | ( 1 << ADDEN ) );
-
-				result = true;
-			}
-			break;
-		}
-
 		case 0x81: {    // standard interface to host
 
 			if ( bRequest == 0 ) {    // get status
@@ -298,71 +353,40 @@ bool const Interface::HandleRequest( uint8_t const bmRequestType, uint8_t const
 			}
 			else if ( bRequest == 6 ) {    // get descriptor
 
-				uint8_t* buffer = NULL;
-				unsigned int length = 0;
-
 				if ( ( wValue >> 8 ) == 0x21 ) {    // HID configuration descriptor
 
-					length = this->GetConfigurationDescriptor( m_interface, NULL );
-					if ( length > 0 ) {
+					ControlWriter writer( HID_DESCRIPTOR_LENGTH, wLength );
+					this->GetConfigurationDescriptor( m_interface, &writer );
+					writer.Finish();
 
-						buffer = static_cast< uint8_t* >( malloc( length ) );
-						this->GetConfigurationDescriptor( m_interface, buffer );
-					}
+					result = true;
 				}
-				else if ( ( wValue >> 8 ) == 0x22 ) {    // HID report descriptor
-
-					length = 0;
-					if ( m_nextReport == 1 )
-						length += 6 + m_reports[ 0 ].descriptorSize + 1;
-					else if ( m_nextReport > 1 ) {
-
-						for ( unsigned int ii = 0; ii < m_nextReport; ++ii )
-							length += 8 + m_reports[ ii ].descriptorSize + 1;
-					}
-
-					if ( length > 0 ) {
-
-						uint8_t* pBuffer = static_cast< uint8_t* >( malloc( length ) );
-						buffer = pBuffer;
+				else if ( ( ( wValue >> 8 ) == 0x22 ) && ( m_nextReport > 0 ) ) {    // HID report descriptor
 
-						if ( m_nextReport == 1 ) {
+					// the report descriptors are wrapped in collections as they're streamed from program memory
+					ControlWriter writer( GetReportDescriptorLength(), wLength );
+					for ( unsigned int ii = 0; ii < m_nextReport; ++ii ) {
 
-							*( pBuffer++ ) = 0x05; *( pBuffer++ ) = m_reports[ 0 ].usagePage;    // usage page
-							*( pBuffer++ ) = 0x09; *( pBuffer++ ) = m_reports[ 0 ].usage;        // usage
-							*( pBuffer++ ) = 0xa1; *( pBuffer++ ) = 0x01;                        // collection = application
+						if ( m_reports[ ii ].usagePage > 0xff ) {
 
-							uint8_t const* const descriptor = m_reports[ 0 ].descriptor;
-							unsigned int const descriptorSize = m_reports[ 0 ].descriptorSize;
-							for ( unsigned int ii = 0; ii < descriptorSize; ++ii )
-								*( pBuffer++ ) = pgm_read_byte( descriptor + ii );
-
-							*( pBuffer++ ) = 0xc0;    // end collection
+							writer.Write( 0x06 ); writer.Write( LSB( m_reports[ ii ].usagePage ) ); writer.Write( MSB( m_reports[ ii ].usagePage ) );    // usage page
 						}
-						else if ( m_nextReport > 1 ) {
-
-							for ( unsigned int ii = 0; ii < m_nextReport; ++ii ) {
-
-								*( pBuffer++ ) = 0x05; *( pBuffer++ ) = m_reports[ ii ].usagePage;    // usage page
-								*( pBuffer++ ) = 0x09; *( pBuffer++ ) = m_reports[ ii ].usage;        // usage
-								*( pBuffer++ ) = 0xa1; *( pBuffer++ ) = 0x01;                         // collection = application
-								*( pBuffer++ ) = 0x85; *( pBuffer++ ) = ii + 1;                       // report ID
+						else {
 
-								uint8_t const* const descriptor = m_reports[ ii ].descriptor;
-								unsigned int const descriptorSize = m_reports[ ii ].descriptorSize;
-								for ( unsigned int jj = 0; jj < descriptorSize; ++jj )
-									*( pBuffer++ ) = pgm_read_byte( descriptor + jj );
+							writer.Write( 0x05 ); writer.Write( m_reports[ ii ].usagePage );    // usage page
+						}
+						writer.Write( 0x09 ); writer.Write( m_reports[ ii ].usage );        // usage
+						writer.Write( 0xa1 ); writer.Write( 0x01 );                         // collection = application
+						if ( m_nextReport > 1 ) {
 
-								*( pBuffer++ ) = 0xc0;    // end collection
-							}
+							writer.Write( 0x85 ); writer.Write( ii + 1 );                   // report ID
 						}
-					}
-				}
 
-				if ( buffer != NULL ) {
+						writer.WriteProgmem( m_reports[ ii ].descriptor, m_reports[ ii ].descriptorSize );
 
-					SendBuffer( buffer, Min( length, wLength, 255u ) );
-					free( buffer );
+						writer.Write( 0xc0 );    // end collection
+					}
+					writer.Finish();
 
 					result = true;
 				}
@@ -460,9 +484,14 @@ bool const Interface::HandleRequest( uint8_t const bmRequestType, uint8_t const
 
 						if ( ( report == 0 ) && ( m_reports[ 0 ].reportType & REPORT_FLAG_SEND ) ) {
 
-							WaitIn();
-							this->SendReport( 0 );
+							uint8_t buffer[ MAXIMUM_REPORT_SIZE ];
+							m_changed &= ~1;
+							uint8_t const length = this->GetReport( 0, buffer );
 							m_reports[ 0 ].idleCount = 0;
+
+							WaitIn();
+							for ( uint8_t ii = 0; ii < length; ++ii )
+								UEDATX = buffer[ ii ];
 							ClearIn();
 
 							result = true;
@@ -472,10 +501,15 @@ bool const Interface::HandleRequest( uint8_t const bmRequestType, uint8_t const
 
 						if ( ( report > 0 ) && ( report <= m_nextReport ) && ( m_reports[ report - 1 ].reportType & REPORT_FLAG_SEND ) ) {
 
+							uint8_t buffer[ MAXIMUM_REPORT_SIZE ];
+							m_changed &= ~( 1 << ( report - 1 ) );
+							uint8_t const length = this->GetReport( report - 1, buffer );
+							m_reports[ report - 1 ].idleCount = 0;
+
 							WaitIn();
 							UEDATX = report;
-							this->SendReport( report - 1 );
-							m_reports[ report - 1 ].idleCount = 0;
+							for ( uint8_t ii = 0; ii < length; ++ii )
+								UEDATX = buffer[ ii ];
 							ClearIn();
 
 							result = true;
@@ -531,32 +565,67 @@ bool const Interface::HandleRequest( uint8_t const bmRequestType, uint8_t const
 }
 
 
-unsigned int const Interface::GetConfigurationDescriptor( uint8_t const interface, uint8_t* const buffer ) const {
+void Interface::WriteReport( uint8_t const report, uint8_t const* const buffer, uint8_t const length ) {
+
+	if ( m_nextReport > 1 )
+		UEDATX = report + 1;
+	for ( uint8_t ii = 0; ii < length; ++ii )
+		UEDATX = buffer[ ii ];
+
+	m_reports[ report ].idleCount = 0;
+	LatencyTrace::Send();
+
+	UEINTX = ( ( 1 << RWAL ) | ( 1 << NAKOUTI ) | ( 1 << RXSTPI ) | ( 1 << STALLEDI ) );
+}
+
+
+void Interface::WriteQueuedReports() {
+
+	if ( ! m_queue.IsEmpty() ) {
 
-	if ( buffer != NULL ) {
+		UENUM = m_endpoint;
+		while ( ( ! m_queue.IsEmpty() ) && ( UEINTX & ( 1 << RWAL ) ) ) {
 
-		uint8_t* pBuffer = buffer;
+			uint8_t report = 0;
+			uint8_t length = 0;
+			m_queue.Pop( &report );
+			m_queue.Pop( &length );
 
-		uint16_t reportLength = 0;
-		if ( m_nextReport == 1 )
-			reportLength += 6 + m_reports[ 0 ].descriptorSize + 1;
-		else if ( m_nextReport > 1 ) {
+			if ( m_nextReport > 1 )
+				UEDATX = report + 1;
+			for ( ; length > 0; --length ) {
 
-			for ( unsigned int ii = 0; ii < m_nextReport; ++ii )
-				reportLength += 8 + m_reports[ ii ].descriptorSize + 1;
+				uint8_t byte = 0;
+				m_queue.Pop( &byte );
+				UEDATX = byte;
+			}
+
+			m_reports[ report ].idleCount = 0;
+			LatencyTrace::Send();
+
+			UEINTX = ( ( 1 << RWAL ) | ( 1 << NAKOUTI ) | ( 1 << RXSTPI ) | ( 1 << STALLEDI ) );
 		}
+	}
+}
+
+
+unsigned int const Interface::GetConfigurationDescriptor( uint8_t const interface, ControlWriter* const pWriter ) const {
+
+	if ( pWriter != NULL ) {
+
+		uint16_t const reportLength = GetReportDescriptorLength();
 
-		*( pBuffer++ ) = 9;                      // bLength
-		*( pBuffer++ ) = 0x21;                   // bDescriptorType
-		*( pBuffer++ ) = 0x11;                   // bcdHID
-		*( pBuffer++ ) = 0x01;                   // bcdHID
-		*( pBuffer++ ) = 0;                      // bCountryCode
-		*( pBuffer++ ) = 1;                      // bNumDescriptors
-		*( pBuffer++ ) = 0x22;                   // bDescriptorType
-		*( pBuffer++ ) = LSB( reportLength );    // wDescriptorLength
-		*( pBuffer++ ) = MSB( reportLength );    // wDescriptorLength
+		pWriter->Write( HID_DESCRIPTOR_LENGTH );    // bLength
+		pWriter->Write( 0x21 );                     // bDescriptorType
+		pWriter->Write( 0x11 );                     // bcdHID
+		pWriter->Write( 0x01 );                     // bcdHID
+		pWriter->Write( 0 );                        // bCountryCode
+		pWriter->Write( 1 );                        // bNumDescriptors
+		pWriter->Write( 0x22 );                     // bDescriptorType
+		pWriter->Write( LSB( reportLength ) );      // wDescriptorLength
+		pWriter->Write( MSB( reportLength ) );      // wDescriptorLength
 	}
-	return 9;
+	return HID_DESCRIPTOR_LENGTH;
 }
 
 
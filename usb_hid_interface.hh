@@ -61,9 +61,12 @@
 
 #include "usb_callbacks.hh"
 #include "usb_device.hh"
+#include "ring_buffer.hh"
 
 #include <inttypes.h>
 
+#include <avr/io.h>
+
 
 
 
@@ -86,8 +89,18 @@ namespace HID {
 	This class represents a single basic HID device, with a single interface, a
 	single HID report descriptor, and a single double-buffered interrupt IN
 	endpoint. All HID requests are handled by this class, often by passing
-	through to the virtual IsChangedReport(), SendReport() and ReceiveReport()
-	methods.
+	through to the virtual GetReport() and ReceiveReport() methods.
+
+	Derived classes call SetChanged() whenever they modify the state behind
+	an input report. This marks the report as needing to be sent, so that
+	deciding whether to send it, at start-of-frame, is a single bit test.
+
+	Input reports only describe the current state, so two changes between
+	start-of-frames (e.g. a key pressed and released again) would be merged
+	into one, or lost altogether. Snapshot() prevents this, by copying the
+	changed reports into a small queue, which is drained, oldest first, into
+	the endpoint banks as they become free. Changes which haven't been
+	queued are sent once the queue is empty.
 */
 struct Interface : public Callbacks {
 
@@ -96,15 +109,65 @@ struct Interface : public Callbacks {
 
 
 	/**
-		\brief Have any HID input reports changed?
+		\brief Have any HID input reports changed, or are any queued?
 		\result  true if changed, false otherwise
 	*/
 	bool const IsChanged();
 
+	/**
+		\brief Queues copies of the changed HID input reports
+
+		Call this once the reports are in a state which the host should see,
+		e.g. at the end of HIDKeymap::Update(). Each changed input report is
+		copied into the queue, and marked unchanged, so later changes can't
+		overwrite it before it's sent. If there isn't room, the report stays
+		changed, and it's the state at the time it's finally sent (or queued,
+		by a later call) which the host sees.
+
+		\result  true if every changed report was queued, false if the queue is full
+	*/
+	bool const Snapshot();
+
+	/**
+		\brief Sends queued and changed HID input reports without waiting for SOF
+
+		Queued reports, and then changed input reports, are written to the
+		endpoint immediately while banks are free, instead of at the next
+		start-of-frame. This never waits, so with a double-buffered endpoint,
+		up to two reports can be queued ahead of the host.
+
+		\result  true if no queued or changed reports remain unsent, false otherwise
+	*/
+	bool const Flush();
+
+
+	/**
+		\brief Are reports submitted immediately?
+
+		By default, changed input reports are written to the endpoint at the
+		next start-of-frame. In immediate mode, whoever changes the reports
+		(e.g. HIDKeymap::Update()) is expected to call Flush() once it's done,
+		so that they reach the endpoint bank up to a frame earlier. Reports
+		which can't be written because both banks are full still go out at
+		start-of-frame, as usual.
+
+		\result  true if in immediate mode, false otherwise
+	*/
+	inline bool const GetImmediate() const;
+
+	/**
+		\brief Enables or disables immediate report submission
+		\param immediate  true to enable immediate mode, false to disable it
+		\sa GetImmediate()
+	*/
+	inline void SetImmediate( bool const immediate );
+
 
 protected:
 
 	enum { MAXIMUM_REPORTS = 4 };
+	enum { MAXIMUM_REPORT_SIZE = 32 };    ///< bytes, not counting the report number
+	enum { REPORT_QUEUE_SIZE = 64 };      ///< bytes, each queued report taking two more than its length
 
 	enum {
 		REPORT_FLAG_SEND    = 1,
@@ -116,7 +179,8 @@ protected:
 	/**
 		\brief Constructor
 
-		We only support a single double-buffered interrupt IN endpoint, so the
+		We only support a single interrupt IN endpoint, which asks to be
+		double-buffered (it will be wherever the MCU allows), so the
 		endpointType parameter is absent, but otherwise the parameters to this
 		function are simply passed through to Device::RegisterInterface and
 		Device::RegisterEndpoint.
@@ -150,7 +214,7 @@ protected:
 		\param descriptor      buffer containing the report descriptor (in program memory)
 		\param descriptorSize  size of the report descriptor (bytes)
 		\param reportType      flags indicating which functions are supported
-		\param usagePage       8-bit usage page of the report
+		\param usagePage       usage page of the report (e.g. 0xff00 for vendor defined)
 		\param usage           8-bit usage of the report
 		\param idle            idle duration (4 USB frames)
 		\result  Report number, or 255 on error
@@ -159,7 +223,7 @@ protected:
 		uint8_t const* const descriptor,
 		uint8_t const descriptorSize,
 		uint8_t const reportType,
-		uint8_t const usagePage,
+		uint16_t const usagePage,
 		uint8_t const usage,
 		uint8_t const idle = 0
 	);
@@ -186,8 +250,8 @@ protected:
 		when the report changes, or when the idle interval has elapsed, and
 		also in response to control interrupts. In certain circumstances,
 		however, the user may wish to send a report <em>immediately</em>. This
-		function waits until the USB host is ready to receive a report, and
-		then sends it.
+		function waits until the USB host has taken every queued report, and
+		is ready to receive another, and then sends it.
 
 		\param report   report number
 		\param timeout  how long to wait before giving up (USB frames)
@@ -197,27 +261,33 @@ protected:
 
 
 	/**
-		\brief Has the HID input report changed?
+		\brief Marks a HID input report as changed
 
-		This function is used to determine whether a report should be sent,
-		inside the idle interrupt. It should return true only if the report has
-		changed since the last call to SendReport().
+		The report will be sent at the next start-of-frame (or Flush()), or
+		queued by the next Snapshot(). Call this, with interrupts disabled,
+		whenever the state reported by the report changes. It's cleared just
+		before GetReport() is called, so GetReport() may call it again if some
+		of the state couldn't be reported (e.g. a mouse movement too large for
+		one report).
 
 		\param report  report number
-		\result  true if changed, false otherwise
 	*/
-	virtual bool const IsChangedReport( uint8_t const report ) const = 0;
+	inline void SetChanged( uint8_t const report );
 
 	/**
-		\brief Sends the HID input report
+		\brief Gets the HID input report
 
-		This function should do nothing but write its report to UEDATX. No
-		other handling is necessary, and no other USB registers should be
+		This function should do nothing but copy its report into the buffer,
+		and perhaps call SetChanged(). The copy may be sent straight away, or
+		queued to be sent later, so anything which the report consumes (e.g.
+		mouse movement) should be consumed here. No USB registers should be
 		accessed.
 
 		\param report  report number
+		\param buffer  receives the report (at most MAXIMUM_REPORT_SIZE bytes)
+		\result  length of the report (bytes)
 	*/
-	virtual void SendReport( uint8_t const report ) = 0;
+	virtual uint8_t const GetReport( uint8_t const report, uint8_t* const buffer ) = 0;
 
 	/**
 		\brief Receives the HID output report
@@ -248,7 +318,7 @@ protected:
 		\brief Accessor for HID protocol
 
 		If the protocol is 0, then the device is in boot mode, which should be
-		handled appropriately by IsChanged, SendReport and ReceiveReport.
+		handled appropriately by GetReport and ReceiveReport.
 		Otherwise, we're in report mode.
 
 		\result HID protocol
@@ -269,14 +339,65 @@ private:
 	virtual void HandleIdle( uint8_t const interface );
 	virtual bool const HandleRequest( uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength );
 
-	virtual unsigned int const GetConfigurationDescriptor( uint8_t const interface, uint8_t* const buffer ) const;
+	virtual unsigned int const GetConfigurationDescriptor( uint8_t const interface, ControlWriter* const pWriter ) const;
+
+
+	/**
+		\brief Idle event handler, for an interface of known type
+
+		Does the same as HandleIdle(), but calls the GetReport() method of
+		t_Interface directly, instead of through the vtable, so it must be a
+		friend of t_Interface. Called by USB::Dispatch.
+	*/
+	template< typename t_Interface >
+	static inline void DispatchIdle( t_Interface* const pInterface, uint8_t const interface );
+
+	/// \brief Calls HandleRequest() directly, instead of through the vtable
+	template< typename t_Interface >
+	static inline bool const DispatchRequest( t_Interface* const pInterface, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength );
+
+
+	/// \brief Is the report sent at start-of-frame?
+	inline bool const IsIdleReport( uint8_t const report ) const;
+
+	/// \brief Has SetChanged() been called since the report was last sent?
+	inline bool const IsChangedReport( uint8_t const report ) const;
+
+	/**
+		\brief Counts a start-of-frame towards the idle duration of a report
+
+		\param report  report number
+		\result  true if the idle duration has elapsed, false otherwise
+	*/
+	inline bool const UpdateIdle( uint8_t const report );
+
+	/**
+		\brief Writes a report to the selected endpoint bank
+
+		The report number (if there's more than one report) is written first,
+		and the bank is then handed to the USB controller.
+
+		\param report  report number
+		\param buffer  report, from GetReport()
+		\param length  length of the report (bytes)
+	*/
+	void WriteReport( uint8_t const report, uint8_t const* const buffer, uint8_t const length );
+
+	/// \brief Writes queued reports to the endpoint, for as long as there are free banks
+	void WriteQueuedReports();
+
+
+	enum { HID_DESCRIPTOR_LENGTH = 9 };
+
+	/// \brief Length of the HID report descriptor, with every report wrapped in a collection
+	inline uint16_t const GetReportDescriptorLength() const;
 
 
 	struct ReportData {
 		uint8_t const* descriptor;
 		uint16_t descriptorSize;
 		uint8_t reportType;
-		uint8_t usagePage;
+		uint16_t usagePage;
 		uint8_t usage;
 		uint8_t idle;
 		uint16_t idleCount;
@@ -286,11 +407,25 @@ private:
 	ReportData m_reports[ MAXIMUM_REPORTS ];
 	uint8_t m_nextReport;
 
+	uint8_t volatile m_changed;    ///< bit n is set if report n has changed since it was last sent
+	static_assert( ( MAXIMUM_REPORTS <= 8 ), "m_changed must have a bit for every report" );
+
+	/// \brief Queued reports, each stored as its number, its length, and then its contents
+	RingBuffer< REPORT_QUEUE_SIZE > m_queue;
+	uint8_t m_maximumReportSize;    ///< room left in the queue for a report of this length guarantees room for any
+	static_assert( ( MAXIMUM_REPORT_SIZE + 2 <= REPORT_QUEUE_SIZE ), "the report queue must hold at least one report" );
+
 	uint8_t m_interface;
 	uint8_t m_endpoint;
 
 	uint8_t m_protocol;
 
+	bool m_immediate;
+
+
+	template< uint8_t t_Index, typename... t_Interfaces >
+	friend struct _Private::DispatchImplementation;
+
 
 	inline Interface( Interface const& other );
 	inline Interface const& operator=( Interface const& other );
@@ -304,6 +439,18 @@ private:
 //============================================================================
 
 
+bool const Interface::GetImmediate() const {
+
+	return m_immediate;
+}
+
+
+void Interface::SetImmediate( bool const immediate ) {
+
+	m_immediate = immediate;
+}
+
+
 uint8_t const Interface::GetInterface() const {
 
 	return m_interface;
@@ -322,6 +469,76 @@ uint8_t const Interface::GetProtocol() const {
 }
 
 
+void Interface::SetChanged( uint8_t const report ) {
+
+	m_changed |= ( 1 << report );
+}
+
+
+uint16_t const Interface::GetReportDescriptorLength() const {
+
+	uint16_t length = 0;
+	for ( unsigned int ii = 0; ii < m_nextReport; ++ii )
+		length += ( ( m_nextReport > 1 ) ? 8 : 6 ) + ( ( m_reports[ ii ].usagePage > 0xff ) ? 1 : 0 ) + m_reports[ ii ].descriptorSize + 1;
+	return length;
+}
+
+
+template< typename t_Interface >
+void Interface::DispatchIdle( t_Interface* const pInterface, uint8_t const interface ) {
+
+	Interface* const pBase = pInterface;
+	pBase->WriteQueuedReports();
+	for ( uint8_t ii = 0; ii < pBase->m_nextReport; ++ii ) {
+
+		if ( pBase->IsIdleReport( ii ) ) {
+
+			bool const expired = pBase->UpdateIdle( ii );
+			if ( pBase->IsChangedReport( ii ) || expired ) {
+
+				// the current state is only sent once everything queued before it has been
+				UENUM = pBase->m_endpoint;
+				if ( pBase->m_queue.IsEmpty() && ( UEINTX & ( 1 << RWAL ) ) ) {
+
+					uint8_t buffer[ MAXIMUM_REPORT_SIZE ];
+					pBase->m_changed &= ~( 1 << ii );
+					uint8_t const length = pInterface->t_Interface::GetReport( ii, buffer );
+					pBase->WriteReport( ii, buffer, length );
+				}
+			}
+		}
+	}
+}
+
+
+template< typename t_Interface >
+bool const Interface::DispatchRequest( t_Interface* const pInterface, uint8_t const bmRequestType, uint8_t const bRequest, uint16_t const wValue, uint16_t const wIndex, uint16_t const wLength ) {
+
+	return pInterface->Interface::HandleRequest( bmRequestType, bRequest, wValue, wIndex, wLength );
+}
+
+
+bool const Interface::IsIdleReport( uint8_t const report ) const {
+
+	return( ( m_reports[ report ].reportType & REPORT_FLAG_SEND ) && ( m_reports[ report ].reportType & REPORT_FLAG_IDLE ) );
+}
+
+
+bool const Interface::IsChangedReport( uint8_t const report ) const {
+
+	return( ( m_changed & ( 1 << report ) ) != 0 );
+}
+
+
+bool const Interface::UpdateIdle( uint8_t const report ) {
+
+	uint8_t const idle = m_reports[ report ].idle;
+	if ( m_reports[ report ].idleCount < idle * 4u )
+		++m_reports[ report ].idleCount;
+	return( ( idle > 0 ) && ( m_reports[ report ].idleCount >= idle * 4u ) );
+}
+
+
 uint8_t const Interface::GetIdle( uint8_t const report ) const {
 
 	uint8_t idle = 0;
@@ -146,10 +146,10 @@ Keyboard::Keyboard( uint8_t const interfaceString ) :
 	),
 	m_modifiers( 0 ),
 	m_leds( 0 ),
-	m_oldModifiers( 0 )
+	m_keyCount( 0 )
 {
 	memset( m_keys,    0, ARRAYLENGTH( m_keys    ) );
-	memset( m_oldKeys, 0, ARRAYLENGTH( m_oldKeys ) );
+	memset( m_pressed, 0, ARRAYLENGTH( m_pressed ) );
 
 	m_report = RegisterReportProgmem(
 		g_HIDReportDescriptor,
@@ -189,11 +189,8 @@ bool const Keyboard::GetKey( Key const key ) const {
 	bool found = false;
 	if ( ( key >= 0xe0 ) && ( key <= 0xe7 ) )
 		found = ( ( m_modifiers & ( 1 << ( key - 0xe0 ) ) ) != 0 );
-	else if ( ( key >= 0x00 ) && ( key <= 0xff ) ) {
-
-		for ( unsigned int ii = 0; ( ! found ) && ( ii < ARRAYLENGTH( m_keys ) ); ++ii )
-			found = ( m_keys[ ii ] == key );
-	}
+	else
+		found = ( ( m_pressed[ key >> 3 ] & ( 1 << ( key & 7 ) ) ) != 0 );
 	return found;
 }
 
@@ -208,33 +205,33 @@ bool const Keyboard::PressKey( Key const key ) {
 
 	if ( ( key >= 0xe0 ) && ( key <= 0xe7 ) ) {
 
-		m_modifiers |= ( 1 << ( key - 0xe0 ) );
+		uint8_t const mask = ( 1 << ( key - 0xe0 ) );
+		if ( ! ( m_modifiers & mask ) ) {
+
+			m_modifiers |= mask;
+			SetChanged( m_report );
+		}
 		found = true;
 	}
-	else if ( ( key >= 0x00 ) && ( key <= 0xff ) ) {
+	else if ( key != 0 ) {
 
-		for ( unsigned int ii = 0; ( ! found ) && ( ii < ARRAYLENGTH( m_keys ) ); ++ii )
-			found = ( m_keys[ ii ] == key );
+		uint8_t const mask = ( 1 << ( key & 7 ) );
+		found = ( ( m_pressed[ key >> 3 ] & mask ) != 0 );
 
-		if ( ! found ) {
+		if ( ( ! found ) && ( m_keyCount < ARRAYLENGTH( m_keys ) ) ) {
 
-			for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_keys ); ++ii ) {
-
-				if ( m_keys[ ii ] == 0 ) {
-
-					m_keys[ ii ] = key;
-					found = true;
-					break;
-				}
-			}
-
-			/*
-				The spec says that we should handle more than 6 keypresses by
-				doing something involving KEY_ERROR_ROLLOVER. Since we want to
-				be able to fall back to KeyboardExtension, we don't do this,
-				and instead return false.
-			*/
+			m_keys[ m_keyCount++ ] = key;
+			m_pressed[ key >> 3 ] |= mask;
+			SetChanged( m_report );
+			found = true;
 		}
+
+		/*
+			The spec says that we should handle more than 6 keypresses by
+			doing something involving KEY_ERROR_ROLLOVER. Since we want to
+			be able to fall back to KeyboardExtension, we don't do this,
+			and instead return false.
+		*/
 	}
 
 	// restore the interrupt flag
@@ -250,48 +247,51 @@ void Keyboard::ReleaseKey( Key const key ) {
 	uint8_t const sreg = SREG;
 	cli();
 
-	if ( ( key >= 0xe0 ) && ( key <= 0xe7 ) )
-		m_modifiers &= ~( 1 << ( key - 0xe0 ) );
-	else if ( ( key >= 0x00 ) && ( key <= 0xff ) ) {
+	if ( ( key >= 0xe0 ) && ( key <= 0xe7 ) ) {
 
-		for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_keys ); ++ii )
-			if ( m_keys[ ii ] == key )
-				m_keys[ ii ] = 0;
-	}
+		uint8_t const mask = ( 1 << ( key - 0xe0 ) );
+		if ( m_modifiers & mask ) {
 
-	// restore the interrupt flag
-	SREG = sreg;
-}
+			m_modifiers &= ~mask;
+			SetChanged( m_report );
+		}
+	}
+	else {
 
+		uint8_t const mask = ( 1 << ( key & 7 ) );
+		if ( m_pressed[ key >> 3 ] & mask ) {
 
-bool const Keyboard::IsChangedReport( uint8_t const report ) const {
+			m_pressed[ key >> 3 ] &= ~mask;
 
-	bool result = false;
-	if ( report == m_report ) {
+			// the slots are kept packed (the report doesn't care about order), so the last key fills the hole
+			uint8_t slot = 0;
+			while ( m_keys[ slot ] != key )
+				++slot;
+			m_keys[ slot ] = m_keys[ --m_keyCount ];
+			m_keys[ m_keyCount ] = 0;
 
-		result = ( m_modifiers != m_oldModifiers );
-		for ( unsigned int ii = 0; ( ! result ) && ( ii < ARRAYLENGTH( m_keys ) ); ++ii )
-			result = ( m_keys[ ii ] != m_oldKeys[ ii ] );
+			SetChanged( m_report );
+		}
 	}
-	return result;
-}
-
 
-void Keyboard::SendReport( uint8_t const report ) {
+	// restore the interrupt flag
+	SREG = sreg;
+}
 
-	if ( report == m_report ) {
 
-		UEDATX = m_modifiers;
-		m_oldModifiers = m_modifiers;
+uint8_t const Keyboard::GetReport( uint8_t const report, uint8_t* const buffer ) {
 
-		UEDATX = 0;
+	uint8_t length = 0;
 
-		for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_keys ); ++ii ) {
+	if ( report == m_report ) {
 
-			UEDATX = m_keys[ ii ];
-			m_oldKeys[ ii ] = m_keys[ ii ];
-		}
+		buffer[ length++ ] = m_modifiers;
+		buffer[ length++ ] = 0;
+		for ( unsigned int ii = 0; ii < ARRAYLENGTH( m_keys ); ++ii )
+			buffer[ length++ ] = m_keys[ ii ];
 	}
+
+	return( length );
 }
 
 
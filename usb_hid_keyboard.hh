@@ -107,9 +107,7 @@ struct Keyboard : public Interface {
 
 private:
 
-	virtual bool const IsChangedReport( uint8_t const report ) const;
-
-	virtual void SendReport( uint8_t const report );
+	virtual uint8_t const GetReport( uint8_t const report, uint8_t* const buffer );
 	virtual void ReceiveReport( uint8_t const report );
 
 
@@ -117,10 +115,15 @@ private:
 
 	uint8_t m_modifiers;
 	uint8_t m_leds;
+
+	// the first m_keyCount slots of m_keys are in use, and m_pressed has a bit set for each of their keys
+	uint8_t m_keyCount;
 	uint8_t m_keys[ 6 ];
+	uint8_t m_pressed[ 32 ];
+
 
-	uint8_t m_oldModifiers;
-	uint8_t m_oldKeys[ 6 ];
+	// Interface::DispatchIdle() calls the report methods directly
+	friend struct Interface;
 
 
 	inline Keyboard( Keyboard const& other );
@@ -25,6 +25,7 @@
 
 
 #include "usb.hh"
+#include "latency_trace.hh"
 #include "helpers.h"
 
 #include <inttypes.h>
@@ -47,6 +48,37 @@ namespace {
 //============================================================================
 
 
+#ifdef NKRO_BITMAP
+
+extern uint8_t const g_HIDKeyboardReportDescriptor[] __attribute__(( __progmem__ ));
+uint8_t const g_HIDKeyboardReportDescriptor[] = {
+
+// ----  modifiers  -----------------------------------------------------------
+	0x05, 0x07,          // usage page = keyboard
+	0x19, 0xe0,          // usage minimum = 224 (left control)
+	0x29, 0xe7,          // usage maximum = 231 (right GUI)
+	0x15, 0x00,          // logical minimum = 0
+	0x25, 0x01,          // logical maximum = 1
+	0x75, 0x01,          // report size = 1
+	0x95, 0x08,          // report count = 8
+	0x81, 0x02,          // input (data, variable, absolute, no wrap, linear, preferred state, no null position, non volatile, bitfield)
+// ----------------------------------------------------------------------------
+
+// ----  keys  ----------------------------------------------------------------
+	//0x05, 0x07,          // usage page = keyboard
+	0x19, 0x00,          // usage minimum = 0
+	0x29, 0xdf,          // usage maximum = 223
+	//0x15, 0x00,          // logical minimum = 0
+	//0x25, 0x01,          // logical maximum = 1
+	//0x75, 0x01,          // report size = 1
+	0x95, 0xe0,          // report count = 224
+	0x81, 0x02,          // input (data, variable, absolute, no wrap, linear, preferred state, no null position, non volatile, bitfield)
+// ----------------------------------------------------------------------------
+
+};
+
+#else    /* NKRO_BITMAP */
+
 extern uint8_t const g_HIDKeyboard1ReportDescriptor[] __attribute__(( __progmem__ ));
 uint8_t const g_HIDKeyboard1ReportDescriptor[] = {
 
@@ -80,6 +112,8 @@ uint8_t const g_HIDKeyboard2ReportDescriptor[] = {
 
 };
 
+#endif    /* NKRO_BITMAP */
+
 
 extern uint8_t const g_HIDConsumerReportDescriptor[] __attribute__(( __progmem__ ));
 uint8_t const g_HIDConsumerReportDescriptor[] = {
@@ -98,6 +132,46 @@ uint8_t const g_HIDConsumerReportDescriptor[] = {
 };
 
 
+#ifdef LATENCY_TRACE
+
+extern uint8_t const g_HIDLatencyReportDescriptor[] __attribute__(( __progmem__ ));
+uint8_t const g_HIDLatencyReportDescriptor[] = {
+
+// ----  latency histograms  --------------------------------------------------
+	0x06, 0x00, 0xff,    // usage page = vendor defined
+	0x09, 0x01,          // usage = 1
+	0x15, 0x00,          // logical minimum = 0
+	0x26, 0xff, 0x00,    // logical maximum = 255
+	0x75, 0x08,          // report size = 8
+	0x95, 0x1d,          // report count = 29 (stage, then 14 16-bit bucket counts)
+	0xb1, 0x02,          // feature (data, variable, absolute, no wrap, linear, preferred state, no null position, non volatile, bitfield)
+// ----------------------------------------------------------------------------
+
+};
+static_assert( 1 + 2 * LatencyTrace::BUCKETS == 0x1d, "latency report size doesn't match the number of buckets" );
+
+#endif    /* LATENCY_TRACE */
+
+
+
+
+//============================================================================
+//    Endpoint size
+//============================================================================
+
+
+#ifdef NKRO_BITMAP
+
+// large enough for the whole keyboard report, so that it goes out in one packet
+enum { ENDPOINT_SIZE = 32 };
+
+#else    /* NKRO_BITMAP */
+
+enum { ENDPOINT_SIZE = 8 };
+
+#endif    /* NKRO_BITMAP */
+
+
 
 
 }    // anomymous namespace
@@ -124,15 +198,30 @@ KeyboardExtension::KeyboardExtension( uint8_t const interfaceString ) :
 		0x00,    // none
 		0x00,    // none
 		interfaceString,
-		8,
+		ENDPOINT_SIZE,
 		1
 	),
-	m_consumer( 0 ),
-	m_oldConsumer( 0 )
+#ifdef NKRO_BITMAP
+	m_modifiers( 0 ),
+#endif    /* NKRO_BITMAP */
+	m_consumer( 0 )
 {
-	memset( m_keys,    0, ARRAYLENGTH( m_keys    ) );
-	memset( m_oldKeys, 0, ARRAYLENGTH( m_oldKeys ) );
+#ifdef NKRO_BITMAP
+	static_assert( ( 1 + 1 + KEY_BYTES <= ENDPOINT_SIZE ), "keyboard report, with its report number, doesn't fit in the endpoint" );
+#endif    /* NKRO_BITMAP */
 
+	memset( m_keys, 0, ARRAYLENGTH( m_keys ) );
+
+#ifdef NKRO_BITMAP
+	m_keyboardReport = RegisterReportProgmem(
+		g_HIDKeyboardReportDescriptor,
+		ARRAYLENGTH( g_HIDKeyboardReportDescriptor ),
+		( REPORT_FLAG_SEND | REPORT_FLAG_IDLE ),
+		0x01,    // usage page = generic desktop controls
+		0x06,    // usage = keyboard
+		125
+	);
+#else    /* NKRO_BITMAP */
 	m_keyboard1Report = RegisterReportProgmem(
 		g_HIDKeyboard1ReportDescriptor,
 		ARRAYLENGTH( g_HIDKeyboard1ReportDescriptor ),
@@ -150,6 +239,7 @@ KeyboardExtension::KeyboardExtension( uint8_t const interfaceString ) :
 		0x06,    // usage = keyboard
 		125
 	);
+#endif    /* NKRO_BITMAP */
 
 	m_consumerReport = RegisterReportProgmem(
 		g_HIDConsumerReportDescriptor,
@@ -159,6 +249,17 @@ KeyboardExtension::KeyboardExtension( uint8_t const interfaceString ) :
 		0x01,    // usage = consumer control
 		125
 	);
+
+#ifdef LATENCY_TRACE
+	m_latencyReport = RegisterReportProgmem(
+		g_HIDLatencyReportDescriptor,
+		ARRAYLENGTH( g_HIDLatencyReportDescriptor ),
+		( REPORT_FLAG_SEND | REPORT_FLAG_RECEIVE ),    // feature report, so never sent on idle
+		0xff00,    // usage page = vendor defined
+		0x01     // usage = 1
+	);
+	m_latencyStage = 0;
+#endif    /* LATENCY_TRACE */
 }
 
 
@@ -169,9 +270,14 @@ KeyboardExtension::~KeyboardExtension() {
 bool const KeyboardExtension::GetKey( Key const key ) const {
 
 	bool found = false;
-	if ( ( key >= 0x04 ) && ( key <= 0x73 ) ) {
-
-		uint8_t const index = ( key - 0x04 );
+#ifdef NKRO_BITMAP
+	if ( ( key >= 0xe0 ) && ( key <= 0xe7 ) )
+		found = ( ( m_modifiers & ( 1 << ( key - 0xe0 ) ) ) != 0 );
+	else
+#endif    /* NKRO_BITMAP */
+	if ( ( key >= 0x04 ) && ( static_cast< unsigned int >( key ) <= LAST_KEY ) ) {
+
+		uint8_t const index = ( key - FIRST_KEY );
 		found = ( ( m_keys[ index >> 3 ] & ( 1 << ( index & 7 ) ) ) != 0 );
 	}
 	return found;
@@ -186,12 +292,30 @@ bool const KeyboardExtension::PressKey( Key const key ) {
 	uint8_t const sreg = SREG;
 	cli();
 
-	if ( ( key >= 0x04 ) && ( key <= 0x73 ) ) {
+#ifdef NKRO_BITMAP
+	if ( ( key >= 0xe0 ) && ( key <= 0xe7 ) ) {
+
+		uint8_t const mask = ( 1 << ( key - 0xe0 ) );
+		if ( ! ( m_modifiers & mask ) ) {
+
+			m_modifiers |= mask;
+			SetChanged( m_keyboardReport );
+		}
+		found = true;
+	}
+	else
+#endif    /* NKRO_BITMAP */
+	if ( ( key >= 0x04 ) && ( static_cast< unsigned int >( key ) <= LAST_KEY ) ) {
 
 		if ( ( key != KEY_CAPS_LOCK ) && ( key != KEY_SCROLL_LOCK ) && ( key != KEY_NUM_LOCK ) ) {    // **NOTE: workaround for linux bug which prevents LED state from being updated when locking keys are pressed from this interface
 
-			uint8_t const index = ( key - 0x04 );
-			m_keys[ index >> 3 ] |= ( 1 << ( index & 7 ) );
+			uint8_t const index = ( key - FIRST_KEY );
+			uint8_t const mask = ( 1 << ( index & 7 ) );
+			if ( ! ( m_keys[ index >> 3 ] & mask ) ) {
+
+				m_keys[ index >> 3 ] |= mask;
+				SetChanged( GetKeyReport( index ) );
+			}
 			found = true;
 		}
 	}
@@ -209,10 +333,27 @@ void KeyboardExtension::ReleaseKey( Key const key ) {
 	uint8_t const sreg = SREG;
 	cli();
 
-	if ( ( key >= 0x04 ) && ( key <= 0x73 ) ) {
+#ifdef NKRO_BITMAP
+	if ( ( key >= 0xe0 ) && ( key <= 0xe7 ) ) {
+
+		uint8_t const mask = ( 1 << ( key - 0xe0 ) );
+		if ( m_modifiers & mask ) {
+
+			m_modifiers &= ~mask;
+			SetChanged( m_keyboardReport );
+		}
+	}
+	else
+#endif    /* NKRO_BITMAP */
+	if ( ( key >= 0x04 ) && ( static_cast< unsigned int >( key ) <= LAST_KEY ) ) {
+
+		uint8_t const index = ( key - FIRST_KEY );
+		uint8_t const mask = ( 1 << ( index & 7 ) );
+		if ( m_keys[ index >> 3 ] & mask ) {
 
-		uint8_t const index = ( key - 0x04 );
-		m_keys[ index >> 3 ] &= ~( 1 << ( index & 7 ) );
+			m_keys[ index >> 3 ] &= ~mask;
+			SetChanged( GetKeyReport( index ) );
+		}
 	}
 
 	// restore the interrupt flag
@@ -236,8 +377,11 @@ bool const KeyboardExtension::PressConsumer( Consumer const consumer ) {
 
 	if ( ( consumer >= 0x00 ) && ( consumer <= 0x0fff ) ) {
 
-		if ( m_consumer == 0 )
+		if ( m_consumer == 0 ) {
+
 			m_consumer = consumer;
+			SetChanged( m_consumerReport );
+		}
 
 		found = ( m_consumer == static_cast< uint16_t >( consumer ) );
 	}
@@ -255,61 +399,85 @@ void KeyboardExtension::ReleaseConsumer( Consumer const consumer ) {
 	uint8_t const sreg = SREG;
 	cli();
 
-	if ( m_consumer == static_cast< uint16_t >( consumer ) )
+	if ( ( m_consumer != 0 ) && ( m_consumer == static_cast< uint16_t >( consumer ) ) ) {
+
 		m_consumer = 0;
+		SetChanged( m_consumerReport );
+	}
 
 	// restore the interrupt flag
 	SREG = sreg;
 }
 
 
-bool const KeyboardExtension::IsChangedReport( uint8_t const report ) const {
+uint8_t const KeyboardExtension::GetKeyReport( uint8_t const index ) const {
 
-	bool result = false;
-	if ( report == m_keyboard1Report ) {
+#ifdef NKRO_BITMAP
+	return m_keyboardReport;
+#else    /* NKRO_BITMAP */
+	return( ( index < 56 ) ? m_keyboard1Report : m_keyboard2Report );
+#endif    /* NKRO_BITMAP */
+}
 
-		for ( unsigned int ii = 0; ( ! result ) && ( ii < 7 ); ++ii )
-			result = ( m_keys[ ii ] != m_oldKeys[ ii ] );
-	}
-	if ( report == m_keyboard2Report ) {
 
-		for ( unsigned int ii = 7; ( ! result ) && ( ii < 14 ); ++ii )
-			result = ( m_keys[ ii ] != m_oldKeys[ ii ] );
-	}
-	else if ( report == m_consumerReport )
-		result = ( m_consumer != m_oldConsumer );
-	return result;
-}
+uint8_t const KeyboardExtension::GetReport( uint8_t const report, uint8_t* const buffer ) {
 
+	uint8_t length = 0;
 
-void KeyboardExtension::SendReport( uint8_t const report ) {
+#ifdef NKRO_BITMAP
+	if ( report == m_keyboardReport ) {
 
+		buffer[ length++ ] = m_modifiers;
+		for ( unsigned int ii = 0; ii < KEY_BYTES; ++ii )
+			buffer[ length++ ] = m_keys[ ii ];
+	}
+#else    /* NKRO_BITMAP */
 	if ( report == m_keyboard1Report ) {
 
-		for ( unsigned int ii = 0; ii < 7; ++ii ) {
-
-			UEDATX = m_keys[ ii ];
-			m_oldKeys[ ii ] = m_keys[ ii ];
-		}
+		for ( unsigned int ii = 0; ii < 7; ++ii )
+			buffer[ length++ ] = m_keys[ ii ];
 	}
 	if ( report == m_keyboard2Report ) {
 
-		for ( unsigned int ii = 7; ii < 14; ++ii ) {
-
-			UEDATX = m_keys[ ii ];
-			m_oldKeys[ ii ] = m_keys[ ii ];
-		}
+		for ( unsigned int ii = 7; ii < 14; ++ii )
+			buffer[ length++ ] = m_keys[ ii ];
 	}
+#endif    /* NKRO_BITMAP */
 	else if ( report == m_consumerReport ) {
 
-		UEDATX = LSB( m_consumer );
-		UEDATX = MSB( m_consumer );
-		m_oldConsumer = m_consumer;
+		buffer[ length++ ] = LSB( m_consumer );
+		buffer[ length++ ] = MSB( m_consumer );
+	}
+#ifdef LATENCY_TRACE
+	else if ( report == m_latencyReport ) {
+
+		// each request returns the histogram of the next stage
+		buffer[ length++ ] = m_latencyStage;
+		for ( unsigned int ii = 0; ii < LatencyTrace::BUCKETS; ++ii ) {
+
+			uint16_t const count = LatencyTrace::GetCount( m_latencyStage, ii );
+			buffer[ length++ ] = LSB( count );
+			buffer[ length++ ] = MSB( count );
+		}
+		if ( ++m_latencyStage >= LatencyTrace::STAGES )
+			m_latencyStage = 0;
 	}
+#endif    /* LATENCY_TRACE */
+
+	return( length );
 }
 
 
 void KeyboardExtension::ReceiveReport( uint8_t const report ) {
+
+#ifdef LATENCY_TRACE
+	// any write to the latency report clears the histograms
+	if ( report == m_latencyReport ) {
+
+		LatencyTrace::Clear();
+		m_latencyStage = 0;
+	}
+#endif    /* LATENCY_TRACE */
 }
 
 
@@ -72,6 +72,12 @@ namespace HID {
 	bytes are used, as a one-key-rollover element storing 16-bit consumer
 	controls.
 
+	If NKRO_BITMAP is defined, the keys are instead sent as a single 29-byte
+	bitmap report: the 8 modifiers, followed by one bit for every usage from
+	0x00 to 0xdf. Any change to the keyboard state then goes out in one IN
+	transaction, on a 32-byte endpoint, and this class can stand in for the
+	Keyboard class entirely, when the boot protocol isn't needed.
+
 	\note Under Linux, if a caps lock keypress goes through the Keyboard class,
 	then the caps lock LED will state will only be sent to the Keyboard class,
 	<em>not</em> the KeyboardExtension class. This also applies to other locking
@@ -136,21 +142,45 @@ struct KeyboardExtension : public Interface {
 
 private:
 
-	virtual bool const IsChangedReport( uint8_t const report ) const;
-
-	virtual void SendReport( uint8_t const report );
+	virtual uint8_t const GetReport( uint8_t const report, uint8_t* const buffer );
 	virtual void ReceiveReport( uint8_t const report );
 
+	/// \brief Finds the report containing a bit of m_keys
+	inline uint8_t const GetKeyReport( uint8_t const index ) const;
+
+
+	// the bitfield holds the usages from FIRST_KEY to LAST_KEY, of which those from 0x04 ("A") up are keys
+#ifdef NKRO_BITMAP
+	enum { FIRST_KEY = 0x00 };
+	enum { KEY_BYTES = 28 };
+#else    /* NKRO_BITMAP */
+	enum { FIRST_KEY = 0x04 };
+	enum { KEY_BYTES = 14 };
+#endif    /* NKRO_BITMAP */
+	enum { LAST_KEY = ( FIRST_KEY + 8 * KEY_BYTES - 1 ) };
 
+
+#ifdef NKRO_BITMAP
+	uint8_t m_keyboardReport;
+#else    /* NKRO_BITMAP */
 	uint8_t m_keyboard1Report;
 	uint8_t m_keyboard2Report;
+#endif    /* NKRO_BITMAP */
 	uint8_t m_consumerReport;
-
-	uint8_t m_keys[ 14 ];
+#ifdef LATENCY_TRACE
+	uint8_t m_latencyReport;
+	uint8_t m_latencyStage;
+#endif    /* LATENCY_TRACE */
+
+#ifdef NKRO_BITMAP
+	uint8_t m_modifiers;
+#endif    /* NKRO_BITMAP */
+	uint8_t m_keys[ KEY_BYTES ];
 	uint16_t m_consumer;
 
-	uint8_t m_oldKeys[ 14 ];
-	uint16_t m_oldConsumer;
+
+	// Interface::DispatchIdle() calls the report methods directly
+	friend struct Interface;
 
 
 	inline KeyboardExtension( KeyboardExtension const& other );
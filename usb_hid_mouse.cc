@@ -180,8 +180,7 @@ Mouse::Mouse( uint8_t const interfaceString ) :
 	m_buttons( 0 ),
 	m_xx( 0 ),
 	m_yy( 0 ),
-	m_wheel( 0 ),
-	m_oldButtons( 0 )
+	m_wheel( 0 )
 {
 	m_report = RegisterReportProgmem(
 		g_HIDReportDescriptor,
@@ -216,7 +215,12 @@ bool const Mouse::PressButton( Button const button ) {
 	bool found = false;
 	if ( ( button >= 1 ) && ( button <= BUTTONS ) ) {
 
-		m_buttons |= ( 1 << ( button - 1 ) );
+		uint8_t const mask = ( 1 << ( button - 1 ) );
+		if ( ! ( m_buttons & mask ) ) {
+
+			m_buttons |= mask;
+			SetChanged( m_report );
+		}
 		found = true;
 	}
 
@@ -233,8 +237,15 @@ void Mouse::ReleaseButton( Button const button ) {
 	uint8_t sreg = SREG;
 	cli();
 
-	if ( ( button >= 1 ) && ( button <= BUTTONS ) )
-		m_buttons &= ~( 1 << ( button - 1 ) );
+	if ( ( button >= 1 ) && ( button <= BUTTONS ) ) {
+
+		uint8_t const mask = ( 1 << ( button - 1 ) );
+		if ( m_buttons & mask ) {
+
+			m_buttons &= ~mask;
+			SetChanged( m_report );
+		}
+	}
 
 	// restore the interrupt flag
 	SREG = sreg;
@@ -250,77 +261,74 @@ void Mouse::Move( int const xx, int const yy, int const wheel ) {
 	m_xx    += xx;
 	m_yy    += yy;
 	m_wheel += wheel;
+	if ( ( xx != 0 ) || ( yy != 0 ) || ( wheel != 0 ) )
+		SetChanged( m_report );
 
 	// restore the interrupt flag
 	SREG = sreg;
 }
 
 
-bool const Mouse::IsChangedReport( uint8_t const report ) const {
+uint8_t const Mouse::GetReport( uint8_t const report, uint8_t* const buffer ) {
 
-	bool result = false;
-	if ( report == m_report ) {
-
-		if ( GetProtocol() == 0 )
-			result = ( ( ( m_buttons & 0x07 ) != ( m_oldButtons & 0x07 ) ) || ( m_xx != 0 ) || ( m_yy != 0 ) );
-		else
-			result = ( ( m_buttons != m_oldButtons ) || ( m_xx != 0 ) || ( m_yy != 0 ) || ( m_wheel != 0 ) );
-	}
-	return result;
-}
-
-
-void Mouse::SendReport( uint8_t const report ) {
+	uint8_t length = 0;
 
 	if ( report == m_report ) {
 
 		if ( GetProtocol() == 0 ) {
 
-			uint8_t const buttons = ( m_buttons & 0x07 );
-			UEDATX = buttons;
-			m_oldButtons = buttons;
+			buffer[ length++ ] = ( m_buttons & 0x07 );
 
 			int8_t const xx = ( ( m_xx < -127 ) ? -127 : ( ( m_xx > 127 ) ? 127 : m_xx ) );
 			int8_t const yy = ( ( m_yy < -127 ) ? -127 : ( ( m_yy > 127 ) ? 127 : m_yy ) );
-			UEDATX = xx;
-			UEDATX = yy;
+			buffer[ length++ ] = xx;
+			buffer[ length++ ] = yy;
 			m_xx -= xx;
 			m_yy -= yy;
 
+			// movements too large for one report are sent over several
+			if ( ( m_xx != 0 ) || ( m_yy != 0 ) )
+				SetChanged( m_report );
+
 			// **TODO: according to the spec, we're allowed to send more bytes, but should expect them to be ignored. Would there be any point in sticking the wheel in?
 		}
 		else {
 
-			UEDATX = m_buttons;
-			m_oldButtons = m_buttons;
+			buffer[ length++ ] = m_buttons;
 
 #ifdef LONG_AXES
 			int16_t const xx = ( ( m_xx < -32767 ) ? -32767 : ( ( m_xx > 32767 ) ? 32767 : m_xx ) );
 			int16_t const yy = ( ( m_yy < -32767 ) ? -32767 : ( ( m_yy > 32767 ) ? 32767 : m_yy ) );
-			UEDATX = LSB( xx );
-			UEDATX = MSB( xx );
-			UEDATX = LSB( yy );
-			UEDATX = MSB( yy );
+			buffer[ length++ ] = LSB( xx );
+			buffer[ length++ ] = MSB( xx );
+			buffer[ length++ ] = LSB( yy );
+			buffer[ length++ ] = MSB( yy );
 #else    // LONG_AXES
 			int8_t const xx = ( ( m_xx < -127 ) ? -127 : ( ( m_xx > 127 ) ? 127 : m_xx ) );
 			int8_t const yy = ( ( m_yy < -127 ) ? -127 : ( ( m_yy > 127 ) ? 127 : m_yy ) );
-			UEDATX = xx;
-			UEDATX = yy;
+			buffer[ length++ ] = xx;
+			buffer[ length++ ] = yy;
 #endif    // LONG_AXES
 			m_xx -= xx;
 			m_yy -= yy;
 
 #ifdef LONG_WHEEL
 			int16_t const wheel = ( ( m_wheel < -32767 ) ? -32767 : ( ( m_wheel > 32767 ) ? 32767 : m_wheel ) );
-			UEDATX = LSB( wheel );
-			UEDATX = MSB( wheel );
+			buffer[ length++ ] = LSB( wheel );
+			buffer[ length++ ] = MSB( wheel );
 #else    // LONG_WHEEL
 			int8_t const wheel = ( ( m_wheel < -127 ) ? -127 : ( ( m_wheel > 127 ) ? 127 : m_wheel ) );
-			UEDATX = wheel;
+			buffer[ length++ ] = wheel;
 #endif    // LONG_WHEEL
 			m_wheel -= wheel;
+
+			// movements too large for one report are sent over several
+			if ( ( m_xx != 0 ) || ( m_yy != 0 ) || ( m_wheel != 0 ) )
+				SetChanged( m_report );
 		}
 	}
+
+	return( length );
 }
 
 
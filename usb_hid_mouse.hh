@@ -105,9 +105,7 @@ struct Mouse : public Interface {
 
 private:
 
-	virtual bool const IsChangedReport( uint8_t const report ) const;
-
-	virtual void SendReport( uint8_t const report );
+	virtual uint8_t const GetReport( uint8_t const report, uint8_t* const buffer );
 	virtual void ReceiveReport( uint8_t const report );
 
 
@@ -118,7 +116,9 @@ private:
 	int m_yy;
 	int m_wheel;
 
-	uint8_t volatile m_oldButtons;
+
+	// Interface::DispatchIdle() calls the report methods directly
+	friend struct Interface;
 
 
 	inline Mouse( Mouse const& other );